@@ -0,0 +1,722 @@
+#define _GNU_SOURCE
+#include "../include/lz77.h"
+#include "../include/hash.h"
+#include "../include/buffer.h"
+#include "../include/cpu.h"
+#include "../include/constants.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#else
+#define HAVE_RDTSC 0
+#endif
+
+#define BENCH_DEFAULT_SIZE (4 * 1024 * 1024)
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_MAX_RESULTS 256
+#define BENCH_NAME_SIZE 32
+// Positions find_best_match() runs on between two updates of the chains
+#define BENCH_FIND_BLOCK 4096
+// Bytes per kernel call of the match length and wild copy benchmarks (a long token)
+#define BENCH_PIECE_SIZE 64
+// Longest run one run_length() call scans
+#define BENCH_RUN_LIMIT 4096
+#define BENCH_FILE_VERSION 1
+
+#define OPT_SAVE 256
+#define OPT_COMPARE 257
+
+// Hardware counters of the process, user space only (fd -1: not available)
+enum { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_CACHE_MISSES, COUNTER_BRANCH_MISSES, COUNTERS };
+
+static const uint64_t counter_configs[COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/*
+* Time stamp counter ticks, wall clock and counter totals of the timed
+* sections of one run. A benchmark may time several sections, their setup in
+* between is not counted.
+*/
+typedef struct {
+    int fds[COUNTERS];
+    uint64_t ticks;
+    uint64_t ns;
+    uint64_t counts[COUNTERS];
+    uint64_t start_ticks;
+    uint64_t start_ns;
+    uint64_t start_counts[COUNTERS];
+} Meter;
+
+typedef struct {
+    char name[BENCH_NAME_SIZE];
+    unsigned char* data;    // WILD_COPY_SLACK readable bytes after the end
+    size_t size;
+} Input;
+
+typedef struct {
+    int min_match;
+    size_t window_size;
+} Config;
+
+typedef struct {
+    const char* name;
+    // One run on input (kernels: the set a kernel benchmark runs). returns: If failed (0), On success (1)
+    int (*run)(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels);
+    int kernel;             // Run once per supported kernel set
+} Bench;
+
+typedef struct {
+    char bench[BENCH_NAME_SIZE];
+    char input[BENCH_NAME_SIZE];
+    double ticks;           // Per byte (nanoseconds without a time stamp counter)
+    double ns;              // Per byte
+    double ipc;             // Instructions per cycle (-1: not counted)
+    double cache_misses;    // Per KB (-1: not counted)
+    double branch_misses;   // Per KB (-1: not counted)
+} Result;
+
+// Results end up here, so the compiler can't drop the work
+static volatile size_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static uint64_t now_ticks(void) {
+#if HAVE_RDTSC
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+// Returns the errno of the first counter that couldn't be opened (0: all open)
+static int open_counters(Meter* meter) {
+    int error = 0;
+    for (int i = 0; i < COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counter_configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        meter->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (meter->fds[i] < 0 && error == 0) {
+            error = errno;
+        }
+    }
+    return error;
+}
+
+static void close_counters(Meter* meter) {
+    for (int i = 0; i < COUNTERS; i++) {
+        if (meter->fds[i] >= 0) {
+            close(meter->fds[i]);
+        }
+    }
+}
+
+static void read_counters(const Meter* meter, uint64_t* counts) {
+    for (int i = 0; i < COUNTERS; i++) {
+        counts[i] = 0;
+        if (meter->fds[i] >= 0 && read(meter->fds[i], &counts[i], sizeof(counts[i])) != sizeof(counts[i])) {
+            counts[i] = 0;
+        }
+    }
+}
+
+static void reset_meter(Meter* meter) {
+    meter->ticks = 0;
+    meter->ns = 0;
+    memset(meter->counts, 0, sizeof(meter->counts));
+}
+
+// The counters are read outside of the ticks, the system calls aren't timed
+static void meter_start(Meter* meter) {
+    read_counters(meter, meter->start_counts);
+    meter->start_ns = now_ns();
+    meter->start_ticks = now_ticks();
+}
+
+static void meter_stop(Meter* meter) {
+    uint64_t ticks = now_ticks();
+    uint64_t ns = now_ns();
+    uint64_t counts[COUNTERS];
+    read_counters(meter, counts);
+    meter->ticks += ticks - meter->start_ticks;
+    meter->ns += ns - meter->start_ns;
+    for (int i = 0; i < COUNTERS; i++) {
+        meter->counts[i] += counts[i] - meter->start_counts[i];
+    }
+}
+
+/*
+* A fresh table of the input size, its pages touched: page faults of the
+* first bucket accesses are setup, not work of the timed functions
+*/
+static int new_hash_table(HashTable* hash_table, const Config* config, size_t size) {
+    hash_table->items = NULL;
+    if (!init_hash_table(hash_table, config->min_match, size)) {
+        return 0;
+    }
+    memset(hash_table->items, 0, (hash_table->mask + 1) * sizeof(HashItem));
+    return 1;
+}
+
+static Buffer whole_buffer(const Input* input) {
+    return (Buffer) { .data = input->data, .pos = 0, .size = input->size, .max_size = input->size };
+}
+
+static int bench_hash(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) kernels;
+    size_t sum = 0;
+    size_t end = input->size > MAX_HASH_LENGTH ? input->size - MAX_HASH_LENGTH : 0;
+    meter_start(meter);
+    for (size_t pos = 0; pos < end; pos++) {
+        sum += hash(input->data + pos, config->min_match);
+    }
+    meter_stop(meter);
+    sink = sum;
+    return 1;
+}
+
+static int bench_update_hash_table(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) kernels;
+    HashTable hash_table;
+    if (!new_hash_table(&hash_table, config, input->size)) {
+        return 0;
+    }
+    Buffer buffer = whole_buffer(input);
+    meter_start(meter);
+    for (buffer.pos = 0; buffer.pos < buffer.size; buffer.pos++) {
+        update_hash_table(&hash_table, &buffer, config->window_size);
+    }
+    meter_stop(meter);
+    free_hash_table(&hash_table);
+    return 1;
+}
+
+/*
+* Only the searches are timed: a block of positions is searched, then added
+* to the chains, so every search sees the chains as they were at the start
+* of its block
+*/
+static int bench_find_best_match(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) kernels;
+    HashTable hash_table;
+    if (!new_hash_table(&hash_table, config, input->size)) {
+        return 0;
+    }
+    Buffer buffer = whole_buffer(input);
+    size_t sum = 0;
+    for (size_t start = 0; start < input->size; start += BENCH_FIND_BLOCK) {
+        size_t end = input->size - start < BENCH_FIND_BLOCK ? input->size : start + BENCH_FIND_BLOCK;
+        meter_start(meter);
+        for (buffer.pos = start; buffer.pos < end; buffer.pos++) {
+            size_t length = 0;
+            sum += find_best_match(&hash_table, &buffer, config->window_size, &length) + length;
+        }
+        meter_stop(meter);
+        for (buffer.pos = start; buffer.pos < end; buffer.pos++) {
+            update_hash_table(&hash_table, &buffer, config->window_size);
+        }
+    }
+    sink = sum;
+    free_hash_table(&hash_table);
+    return 1;
+}
+
+/*
+* The streaming encoder: chunks of DECOMPRESSED_BUFFER_SIZE, each one with its
+* own window, the tokens written to file
+*/
+static int encode_chunks(const Input* input, const Config* config, FILE* file, int lazy, Meter* meter) {
+    LZWriter lz_writer;
+    HashTable hash_table;
+    if (!init_writer(&lz_writer, file, COMPRESSED_BUFFER_SIZE, config->window_size, LEVEL_FAST, config->min_match)) {
+        return 0;
+    }
+    if (!new_hash_table(&hash_table, config, input->size)) {
+        free(lz_writer.buffer);
+        return 0;
+    }
+    lz_writer.lazy = lazy;
+
+    int result = 1;
+    if (meter != NULL) {
+        meter_start(meter);
+    }
+    for (size_t start = 0; start < input->size && result; start += DECOMPRESSED_BUFFER_SIZE) {
+        size_t size = input->size - start < DECOMPRESSED_BUFFER_SIZE ? input->size - start : DECOMPRESSED_BUFFER_SIZE;
+        Buffer buffer = { .data = input->data + start, .pos = 0, .size = size, .max_size = size };
+        while (buffer.pos < size) {
+            ssize_t length = write_lz(&lz_writer, &hash_table, &buffer);
+            if (length < 1) {
+                result = 0;
+                break;
+            }
+            buffer.pos += length;
+        }
+        shift_hash_table(&hash_table, size);
+    }
+    result = result && flush_writer(&lz_writer) >= 0;
+    if (meter != NULL) {
+        meter_stop(meter);
+    }
+    free_hash_table(&hash_table);
+    free(lz_writer.buffer);
+    free(lz_writer.block);
+    return result;
+}
+
+static int encode_discarded(Meter* meter, const Input* input, const Config* config, int lazy) {
+    FILE* file = fopen("/dev/null", "wb");
+    int result = file != NULL && encode_chunks(input, config, file, lazy, meter);
+    if (file != NULL) {
+        fclose(file);
+    }
+    return result;
+}
+
+static int bench_write_lz(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) kernels;
+    return encode_discarded(meter, input, config, 0);
+}
+
+static int bench_write_lz_lazy(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) kernels;
+    return encode_discarded(meter, input, config, 1);
+}
+
+// Decodes the tokens of the input (encoded untimed) and checks the checksum of the output
+static int bench_read_lz(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) kernels;
+    char* tokens = NULL;
+    size_t tokens_size = 0;
+    FILE* file = open_memstream(&tokens, &tokens_size);
+    int result = file != NULL && encode_chunks(input, config, file, 0, NULL);
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    LZReader lz_reader;
+    result = result && init_reader(&lz_reader, NULL, COMPRESSED_BUFFER_SIZE, config->window_size);
+    if (result) {
+        lz_reader.content_size = input->size;
+        Buffer buffer = { .data = (unsigned char*) tokens, .pos = 0, .size = tokens_size, .max_size = tokens_size };
+        meter_start(meter);
+        while (result && end_of_buffer(&buffer) >= TOKEN_SIZE) {
+            result = read_lz(&buffer, &lz_reader) > 0;
+        }
+        result = result && flush_reader(&lz_reader) >= 0;
+        meter_stop(meter);
+        result = result && lz_reader.produced == input->size
+            && lz_reader.checksum == cpu_kernels()->crc32c(0, input->data, input->size);
+        free(lz_reader.buffer);
+        free(lz_reader.dictionary);
+    }
+    free(tokens);
+    return result;
+}
+
+static int bench_dictionary_push(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) kernels;
+    LZReader lz_reader;
+    if (!init_reader(&lz_reader, NULL, COMPRESSED_BUFFER_SIZE, config->window_size)) {
+        return 0;
+    }
+    size_t sum = 0;
+    meter_start(meter);
+    for (size_t pos = 0; pos < input->size; pos++) {
+        sum += dictionary_push(&lz_reader, input->data + pos);
+    }
+    meter_stop(meter);
+    sink = sum + lz_reader.dictionary[sum & lz_reader.dict_mask];
+    free(lz_reader.buffer);
+    free(lz_reader.dictionary);
+    return 1;
+}
+
+// Compares the input with a copy of itself, BENCH_PIECE_SIZE bytes per call (every byte matches)
+static int bench_match_length(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) config;
+    unsigned char* copy = malloc(input->size + WILD_COPY_SLACK);
+    if (copy == NULL) {
+        return 0;
+    }
+    memcpy(copy, input->data, input->size + WILD_COPY_SLACK);
+    size_t sum = 0;
+    meter_start(meter);
+    for (size_t pos = 0; pos < input->size; pos += BENCH_PIECE_SIZE) {
+        size_t limit = input->size - pos < BENCH_PIECE_SIZE ? input->size - pos : BENCH_PIECE_SIZE;
+        sum += kernels->match_length(input->data + pos, copy + pos, limit);
+    }
+    meter_stop(meter);
+    sink = sum;
+    free(copy);
+    return sum == input->size;
+}
+
+// Steps over the input a run at a time (one byte at a time on data without runs)
+static int bench_run_length(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) config;
+    size_t calls = 0;
+    meter_start(meter);
+    for (size_t pos = 0; pos < input->size; calls++) {
+        size_t limit = input->size - pos < BENCH_RUN_LIMIT ? input->size - pos : BENCH_RUN_LIMIT;
+        pos += kernels->run_length(input->data + pos, limit);
+    }
+    meter_stop(meter);
+    sink = calls;
+    return 1;
+}
+
+static int bench_wild_copy(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) config;
+    unsigned char* copy = malloc(input->size + WILD_COPY_SLACK);
+    if (copy == NULL) {
+        return 0;
+    }
+    meter_start(meter);
+    for (size_t pos = 0; pos < input->size; pos += BENCH_PIECE_SIZE) {
+        size_t length = input->size - pos < BENCH_PIECE_SIZE ? input->size - pos : BENCH_PIECE_SIZE;
+        kernels->wild_copy(copy + pos, input->data + pos, length);
+    }
+    meter_stop(meter);
+    int result = memcmp(copy, input->data, input->size) == 0;
+    free(copy);
+    return result;
+}
+
+static int bench_crc32c(Meter* meter, const Input* input, const Config* config, const CpuKernels* kernels) {
+    (void) config;
+    meter_start(meter);
+    uint32_t crc = kernels->crc32c(0, input->data, input->size);
+    meter_stop(meter);
+    sink = crc;
+    return crc == cpu_kernels_for(CPU_SCALAR)->crc32c(0, input->data, input->size);
+}
+
+static const Bench benches[] = {
+    { "hash", bench_hash, 0 },
+    { "update_hash_table", bench_update_hash_table, 0 },
+    { "find_best_match", bench_find_best_match, 0 },
+    { "write_lz", bench_write_lz, 0 },
+    { "write_lz/lazy", bench_write_lz_lazy, 0 },
+    { "read_lz", bench_read_lz, 0 },
+    { "dictionary_push", bench_dictionary_push, 0 },
+    { "match_length", bench_match_length, 1 },
+    { "run_length", bench_run_length, 1 },
+    { "wild_copy", bench_wild_copy, 1 },
+    { "crc32c", bench_crc32c, 1 },
+};
+#define BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+// xorshift64, the inputs are the same on every machine
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*
+* Generated inputs: zeros (runs), random bytes (no matches) and text records
+* (short matches at a few recurring offsets)
+*/
+static int generate_input(Input* input, const char* name, size_t size) {
+    input->data = calloc(size + WILD_COPY_SLACK, 1);
+    input->size = size;
+    snprintf(input->name, sizeof(input->name), "%s", name);
+    if (input->data == NULL) {
+        return 0;
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    if (strcmp(name, "random") == 0) {
+        for (size_t i = 0; i < size; i++) {
+            input->data[i] = next_random(&state) >> 56;
+        }
+    } else if (strcmp(name, "text") == 0) {
+        static const char* names[] = { "alpha", "bravo", "charlie", "delta", "echo", "foxtrot" };
+        size_t pos = 0;
+        for (size_t record = 0; pos < size; record++) {
+            char line[128];
+            uint64_t value = next_random(&state);
+            int length = snprintf(line, sizeof(line), "%08zu,%s,%c,%u,%s\n", record, names[value % 6],
+                                  (char) ('A' + (value >> 8) % 3), (unsigned) ((value >> 16) % 100000),
+                                  (value >> 40) % 4 ? "ok" : "retry");
+            size_t part = size - pos < (size_t) length ? size - pos : (size_t) length;
+            memcpy(input->data + pos, line, part);
+            pos += part;
+        }
+    }
+    return 1;
+}
+
+static int load_input(Input* input, const char* path, size_t size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open '%s'!\n", path);
+        return 0;
+    }
+    input->data = calloc(size + WILD_COPY_SLACK, 1);
+    input->size = input->data != NULL ? fread(input->data, 1, size, file) : 0;
+    fclose(file);
+    const char* name = strrchr(path, '/');
+    snprintf(input->name, sizeof(input->name), "%s", name != NULL ? name + 1 : path);
+    return input->size > 0;
+}
+
+// Baseline file: a version line, then "bench input ticks ns ipc cache_misses branch_misses" per result
+static int save_results(const char* path, const Result* results, size_t count) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to write '%s'!\n", path);
+        return 0;
+    }
+    fprintf(file, "lz7-bench %d\n", BENCH_FILE_VERSION);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(file, "%s %s %.6f %.6f %.4f %.4f %.4f\n", results[i].bench, results[i].input, results[i].ticks,
+                results[i].ns, results[i].ipc, results[i].cache_misses, results[i].branch_misses);
+    }
+    return fclose(file) == 0;
+}
+
+static size_t load_results(const char* path, Result* results, size_t capacity) {
+    FILE* file = fopen(path, "r");
+    int version = 0;
+    if (file == NULL || fscanf(file, "lz7-bench %d", &version) != 1 || version != BENCH_FILE_VERSION) {
+        fprintf(stderr, "'%s' is not a baseline of this benchmark!\n", path);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return 0;
+    }
+    size_t count = 0;
+    while (count < capacity) {
+        Result* result = &results[count];
+        if (fscanf(file, "%31s %31s %lf %lf %lf %lf %lf", result->bench, result->input, &result->ticks, &result->ns,
+                   &result->ipc, &result->cache_misses, &result->branch_misses) != 7) {
+            break;
+        }
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+static const Result* find_result(const Result* results, size_t count, const Result* result) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(results[i].bench, result->bench) == 0 && strcmp(results[i].input, result->input) == 0) {
+            return &results[i];
+        }
+    }
+    return NULL;
+}
+
+static void print_value(double value, const char* format) {
+    if (value < 0) {
+        printf("%14s", "-");
+    } else {
+        printf(format, value);
+    }
+}
+
+static void print_result(const Result* result, const Result* baseline, int comparing) {
+    printf("%-22s %-10s %10.3f %9.3f", result->bench, result->input, result->ticks, result->ns);
+    print_value(result->ipc, "%14.2f");
+    print_value(result->cache_misses, "%14.2f");
+    print_value(result->branch_misses, "%14.2f");
+    if (baseline != NULL) {
+        printf(" %+9.1f%%", (result->ticks / baseline->ticks - 1) * 100);
+    } else if (comparing) {
+        printf(" %10s", "new");
+    }
+    printf("\n");
+}
+
+// Best run (fewest ticks) of a benchmark on an input
+static int measure(Meter* meter, const Bench* bench, const CpuKernels* kernels, const Input* input,
+                   const Config* config, int runs, Result* result) {
+    Meter best = { .ticks = UINT64_MAX };
+    for (int run = 0; run < runs; run++) {
+        reset_meter(meter);
+        if (!bench->run(meter, input, config, kernels)) {
+            return 0;
+        }
+        if (meter->ticks < best.ticks) {
+            best = *meter;
+        }
+    }
+    double bytes = input->size;
+    result->ticks = best.ticks / bytes;
+    result->ns = best.ns / bytes;
+    result->ipc = meter->fds[COUNTER_INSTRUCTIONS] >= 0 && meter->fds[COUNTER_CYCLES] >= 0 && best.counts[COUNTER_CYCLES] > 0
+        ? (double) best.counts[COUNTER_INSTRUCTIONS] / best.counts[COUNTER_CYCLES] : -1;
+    result->cache_misses = meter->fds[COUNTER_CACHE_MISSES] >= 0 ? best.counts[COUNTER_CACHE_MISSES] * KB / bytes : -1;
+    result->branch_misses = meter->fds[COUNTER_BRANCH_MISSES] >= 0 ? best.counts[COUNTER_BRANCH_MISSES] * KB / bytes : -1;
+    return 1;
+}
+
+// A benchmark runs if it starts with one of the patterns (no patterns: all of them)
+static int selected(const char* name, char** patterns, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strncmp(name, patterns[i], strlen(patterns[i])) == 0) {
+            return 1;
+        }
+    }
+    return count == 0;
+}
+
+static void usage(const char* program) {
+    printf("[USAGE]: %s [-n bytes] [-r runs] [-m min_match] [-w window] [-f file] [--save baseline] "
+           "[--compare baseline] [benchmark...]\n", program);
+    printf("\t-n: bytes per input (default: %d)\n", BENCH_DEFAULT_SIZE);
+    printf("\t-r: runs per benchmark, the fastest one counts (default: %d)\n", BENCH_DEFAULT_RUNS);
+    printf("\t-m: minimum match length of the match finder, 2 to 4 (default: 2)\n");
+    printf("\t-w: window size (default: %d bytes)\n", WINDOW_SIZE);
+    printf("\t-f: run on the start of a file instead of the generated inputs (zeros, random, text)\n");
+    printf("\t--save: write the results to a baseline file\n");
+    printf("\t--compare: print the change of ticks/B against a baseline file\n");
+    printf("\tbenchmark: run only the benchmarks starting with it (i.e. hash, write_lz, crc32c/avx2)\n");
+    printf("\tBenchmarks:");
+    for (size_t i = 0; i < BENCHES; i++) {
+        printf(" %s%s", benches[i].name, benches[i].kernel ? "/<kernel set>" : "");
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    size_t size = BENCH_DEFAULT_SIZE;
+    int runs = BENCH_DEFAULT_RUNS;
+    Config config = { .min_match = MIN_HASH_LENGTH, .window_size = WINDOW_SIZE };
+    const char* file_path = NULL;
+    const char* save_path = NULL;
+    const char* compare_path = NULL;
+
+    static const struct option long_options[] = {
+        { "save", required_argument, NULL, OPT_SAVE },
+        { "compare", required_argument, NULL, OPT_COMPARE },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:r:m:w:f:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                size = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'm':
+                config.min_match = atoi(optarg);
+                break;
+            case 'w':
+                config.window_size = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                file_path = optarg;
+                break;
+            case OPT_SAVE:
+                save_path = optarg;
+                break;
+            case OPT_COMPARE:
+                compare_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (size == 0 || runs < 1 || config.min_match < MIN_HASH_LENGTH || config.min_match > MAX_HASH_LENGTH
+        || config.window_size == 0 || config.window_size > MAX_OFFSET) {
+        fprintf(stderr, "Invalid size, runs, minimum match or window!\n");
+        return EXIT_FAILURE;
+    }
+
+    static const char* generated[] = { "zeros", "random", "text" };
+    Input inputs[3];
+    size_t input_count = file_path != NULL ? 1 : 3;
+    for (size_t i = 0; i < input_count; i++) {
+        int loaded = file_path != NULL ? load_input(&inputs[i], file_path, size) : generate_input(&inputs[i], generated[i], size);
+        if (!loaded) {
+            fprintf(stderr, "Unable to prepare the inputs!\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    static Result baseline[BENCH_MAX_RESULTS];
+    size_t baseline_count = 0;
+    if (compare_path != NULL && (baseline_count = load_results(compare_path, baseline, BENCH_MAX_RESULTS)) == 0) {
+        return EXIT_FAILURE;
+    }
+
+    Meter meter;
+    int error = open_counters(&meter);
+    printf("lz7-bench: %zu bytes per input, best of %d runs, min match %d, window %zu, kernels: %s\n",
+           inputs[0].size, runs, config.min_match, config.window_size, cpu_kernels()->name);
+    printf("%s, hardware counters: %s\n\n", HAVE_RDTSC ? "ticks: time stamp counter" : "ticks: nanoseconds",
+           error == 0 ? "user space" : strerror(error));
+    printf("%-22s %-10s %10s %9s %14s %14s %14s%s\n", "benchmark", "input", "ticks/B", "ns/B", "IPC",
+           "cache-miss/KB", "branch-miss/KB", compare_path != NULL ? "   vs base" : "");
+
+    static Result results[BENCH_MAX_RESULTS];
+    size_t count = 0;
+    int failed = 0;
+    for (size_t b = 0; b < BENCHES; b++) {
+        // Kernel benchmarks run once per supported set, the others on the running one
+        int levels = benches[b].kernel ? CPU_LEVEL_COUNT : 1;
+        for (int level = 0; level < levels; level++) {
+            const CpuKernels* kernels = benches[b].kernel ? cpu_kernels_for(level) : cpu_kernels();
+            if (benches[b].kernel && kernels->level != level) {
+                continue;
+            }
+            char name[BENCH_NAME_SIZE];
+            snprintf(name, sizeof(name), benches[b].kernel ? "%s/%s" : "%s", benches[b].name, kernels->name);
+            if (!selected(name, argv + optind, argc - optind)) {
+                continue;
+            }
+            for (size_t i = 0; i < input_count && count < BENCH_MAX_RESULTS; i++) {
+                Result* result = &results[count];
+                memcpy(result->bench, name, BENCH_NAME_SIZE);
+                memcpy(result->input, inputs[i].name, BENCH_NAME_SIZE);
+                if (!measure(&meter, &benches[b], kernels, &inputs[i], &config, runs, result)) {
+                    fprintf(stderr, "%s failed on %s!\n", name, inputs[i].name);
+                    failed++;
+                    continue;
+                }
+                print_result(result, find_result(baseline, baseline_count, result), compare_path != NULL);
+                count++;
+            }
+        }
+    }
+    close_counters(&meter);
+
+    if (save_path != NULL && !save_results(save_path, results, count)) {
+        failed++;
+    }
+    for (size_t i = 0; i < input_count; i++) {
+        free(inputs[i].data);
+    }
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,42 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+#include "lz77.h"
+
+#include <stdio.h>
+
+// Input bytes encoded with one setting before the next one is picked
+#define ADAPTIVE_BLOCK_SIZE (256 * KB)
+#define ADAPTIVE_STEPS 5
+// Step the greedy levels start at (the optimal parse starts at the last one)
+#define ADAPTIVE_GREEDY_STEP 2
+// The fastest step skips a byte more after every run of this many literals
+#define ADAPTIVE_SKIP_RUN 16
+// A step not measured yet is assumed this many times slower than the one below it
+#define ADAPTIVE_STEP_COST 2
+// A harder step has to fit this share of the time budget (percent)
+#define ADAPTIVE_HEADROOM 80
+// ... and to have saved this share of the output when it last ran (percent)
+#define ADAPTIVE_MIN_GAIN 1
+// The ratios of the other steps are dropped this often (blocks), so they are tried again
+#define ADAPTIVE_PROBE_BLOCKS 64
+
+/*
+* Function: encode_adaptive
+* -------------------------
+*  Encodes the input file in blocks of ADAPTIVE_BLOCK_SIZE and picks the effort
+*  of every block from the ones before it. The steps go from a shallow greedy
+*  hash chain through the full chain and lazy matching to the optimal parse.
+*  Each block measures the speed and the ratio of its step. The next block
+*  gets the hardest step whose predicted parse time fits what is left of its
+*  time budget (block size / lz_writer->target) after reading it. When reading
+*  alone takes the budget, the fastest step is used, and a step that stops
+*  fitting (the CPU got busy) gives way to a cheaper one. The output is a
+*  normal token stream.
+*
+*  lz_writer: Pointer to the writer (target: bytes per second, level: the first step)
+*  input_file: Pointer to the input file
+*
+*  returns: Number of processed bytes. If failed (-1)
+*/
+ssize_t encode_adaptive(LZWriter* lz_writer, FILE* input_file);
+#endif
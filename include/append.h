@@ -0,0 +1,35 @@
+#ifndef APPEND_H
+#define APPEND_H
+#include "error.h"
+#include "lz7.h"
+
+#include <stdio.h>
+
+// Read/write copy of the existing frames when the file system can neither
+// share their blocks nor copy them in the kernel
+#define APPEND_COPY_SIZE (256 * 1024)
+
+/*
+* Function: append_file
+* ---------------------
+*  Compresses the input into a new frame at the end of a compressed file and
+*  rewrites the frame index after it (see frame.h), so the existing frames are
+*  never decoded or encoded again. The result is written to a temporary file
+*  next to the target and renamed over it: a failure leaves the target as it
+*  was. The existing frames are shared with the old file (FICLONE) where the
+*  file system allows it and copied in the kernel otherwise. A missing target
+*  is created with a single frame.
+*
+*  With options->prime, the window of the new frame starts with the end of
+*  the existing content. The index keeps the last window of content for the
+*  next append; a file without it (a plain frame) is decoded once to get it.
+*
+*  input_file: New content
+*  path: Target file (a frame or a multi-frame file)
+*  options: Compression options of the new frame, prime
+*  progress: Input bytes encoded so far (NULL: no progress)
+*
+*  returns: If failed (0), On success (1)
+*/
+int append_file(FILE* input_file, const char* path, const Lz7Options* options, const Progress* progress);
+#endif
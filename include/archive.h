@@ -0,0 +1,71 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+#include "constants.h"
+#include "lz7.h"
+
+#include <stdio.h>
+
+// Archive layout: [header][chunk data...][index][footer]
+//   header: "LZ7A", version, flags, reserved (2), window size (4)
+//   index:  chunk count (4), chunk records, file count (4), file records
+//   footer: index position (8), "LZ7A"
+#define ARCHIVE_MAGIC "LZ7A"
+#define ARCHIVE_MAGIC_SIZE 4
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 12
+#define ARCHIVE_FOOTER_SIZE 12
+// Chunk record: SHA-256 (32), position (8), stored size (4), size (4), CRC-32C (4), method (1)
+#define ARCHIVE_CHUNK_RECORD_SIZE 53
+
+// Chunk storage methods
+#define CHUNK_STORED 0
+#define CHUNK_LZ 1
+
+// Content-defined chunking (FastCDC): no cut before CHUNK_MIN_SIZE, a harder
+// cut condition up to the average size and an easier one after it
+#define CHUNK_MIN_SIZE (4 * KB)
+#define CHUNK_AVERAGE_BITS 14
+#define CHUNK_MAX_SIZE (64 * KB)
+#define ARCHIVE_READ_SIZE (1024 * KB)
+// Chunks waiting for a worker
+#define ARCHIVE_QUEUE_SIZE 64
+
+/*
+* Function: create_archive
+* ------------------------
+*  Writes a deduplicating archive of the given files. Every file is split
+*  into content-defined chunks (a Gear rolling hash picks the cut points, so
+*  an insertion only changes the chunks around it). A pool of workers hashes
+*  each chunk with SHA-256, and only chunks with an unseen hash are compressed
+*  (greedy hash chain, every chunk on its own) and stored. The index at the
+*  end lists the chunks and, for every file, the chunks it is made of.
+*
+*  archive_path: Output archive path
+*  paths: Input file paths (stored without a leading '/')
+*  count: Number of paths
+*  options: Number of workers (threads, 0: one per online CPU), window size and
+*           shortest match (min_match) of the chunk encoder
+*  summary: Sizes and chunk counts of the archive (NULL: not needed)
+*
+*  returns: If failed (0), On success (1)
+*/
+int create_archive(const char* archive_path, char** paths, int count, const Lz7Options* options,
+                   Lz7ArchiveSummary* summary);
+
+/*
+* Function: extract_archive
+* -------------------------
+*  Rebuilds every file of an archive below output_dir. Files are spread over
+*  a pool of threads, every chunk is validated while it is decoded and its
+*  CRC-32C is checked. Paths with ".." components are rejected.
+*
+*  archive_path: Archive path
+*  output_dir: Directory the stored paths are relative to (NULL: current directory)
+*  options: Number of threads (0: one per online CPU) and the reader buffer size
+*  summary: Number of extracted files (NULL: not needed)
+*
+*  returns: If failed (0), On success (1)
+*/
+int extract_archive(const char* archive_path, const char* output_dir, const Lz7Options* options,
+                    Lz7ArchiveSummary* summary);
+#endif
@@ -12,6 +12,7 @@ typedef struct {
 int init_buffer_from_file(Buffer* buffer, FILE* file, size_t read_size);
 void free_buffer(Buffer* buffer);
 size_t read_chunk(Buffer* buffer, FILE* file);
+size_t refill_buffer(Buffer* buffer, FILE* file, size_t limit);
 ssize_t end_of_buffer(Buffer* buffer);
 void print_buffer(const unsigned char* buffer, size_t size, int cols);
 #endif
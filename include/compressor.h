@@ -1,7 +1,12 @@
 #ifndef COMPRESSOR_H
 #define COMPRESSOR_H
+#include "error.h"
+#include "lz7.h"
+
 #include <stdio.h>
 
+// The mapped output of decompress() is allocated and released in chunks of this size
+#define MAPPED_CHUNK_SIZE (64 * 1024 * 1024)
 
 /*
 * Function: compress
@@ -10,14 +15,34 @@
 *
 * input_file: Pointer to the input_file
 * output_file: Pointer to the output_file
-* writer_buffer_size: Buffer size for writer (output buffer)
-* compressor_buffer_size: Buffer size for chunck reader (input buffer)
-* window_size: Sliding window size (dictionary size)
+* options: Level, match finder, threads, long range, filter, window and buffer sizes
+*          (buffer_size: writer buffer, chunk_size: chunk reader)
+* progress: Input bytes encoded so far (NULL: no progress)
+*
+* returns: If failed (0), On success (1)
+*/
+int compress(FILE* input_file, FILE* output_file, const Lz7Options* options, const Progress* progress);
+
+/*
+* Function: compress_frame
+* ------------------------
+* Compresses the input file into one frame at the current position of the
+* output, optionally with a primed window (FRAME_FLAG_PRIMED: the window
+* starts with the content before the input, the frame index of a multi-frame
+* file records how much of it). Priming rules out long range matching and a
+* prefilter, and the streaming encoder gives way to a single segment thread.
+*
+* input_file: Pointer to the input_file
+* output_file: Pointer to the output_file
+* options: See compress()
+* progress: Input bytes encoded so far (NULL: no progress)
+* prime: Content before the input (the end of it is the primed window)
+* prime_size: Bytes at prime, at most the window size (0: not primed)
 *
 * returns: If failed (0), On success (1)
 */
-int compress(FILE* input_file, FILE* output_file, size_t writer_buffer_size, 
-               size_t compressor_buffer_size, size_t window_size);
+int compress_frame(FILE* input_file, FILE* output_file, const Lz7Options* options, const Progress* progress,
+                   const unsigned char* prime, size_t prime_size);
 
 /*
 * Function: decompress
@@ -25,14 +50,37 @@ int compress(FILE* input_file, FILE* output_file, size_t writer_buffer_size,
 * Decompresses the input file using lz77 coding
 *
 * input_file: Pointer to the input_file
-* output_file: Pointer to the outpug_file
-* reader_buffer_size: Buffer size for reader (output buffer)
-* decompressor_buffer_size: Buffer size for chunck reader (input buffer)
-* window_size: Sliding window size (dictionary size)
+* output_file: Pointer to the outpug_file (NULL: integrity test, the output is discarded).
+*              Frames with long matches or a primed window read it back, so it must be
+*              opened with "w+b". A regular file opened that way is mapped and decoded
+*              into directly, when the input is a regular file read from its start.
+* options: Buffer sizes (buffer_size: reader buffer, chunk_size: chunk reader), token
+*          validation and the window size of streams without a frame header
+* progress: Token stream bytes decoded so far, per frame (NULL: no progress)
 *
 * returns: If failed (0), On success (1)
 */
-int decompress(FILE* input_file, FILE* output_file, size_t reader_buffer_size, 
-               size_t decompressor_buffer_size, size_t window_size);
-#endif
+int decompress(FILE* input_file, FILE* output_file, const Lz7Options* options, const Progress* progress);
 
+/*
+* Function: decompress_memory
+* ---------------------------
+* Decompresses a frame (or a legacy stream, or the frames of a multi-frame
+* file one after the other) from memory into a caller buffer, which is also
+* the history: nothing but the filter state is allocated. The frame may lie
+* at the tail of dst (in-place), its header and trailer are read before the
+* first byte is written.
+*
+* src: Compressed data
+* src_size: Compressed data size
+* dst: Output buffer
+* dst_size: Output buffer size (at least the content size of a frame)
+* content_size: Output decoded size
+* options: Token validation and the window size of streams without a frame header
+* progress: Token stream bytes decoded so far (NULL: no progress)
+*
+* returns: If failed (0), On success (1)
+*/
+int decompress_memory(const unsigned char* src, size_t src_size, unsigned char* dst, size_t dst_size,
+                      size_t* content_size, const Lz7Options* options, const Progress* progress);
+#endif
@@ -5,4 +5,9 @@
 #define COMPRESSED_BUFFER_SIZE (2 * KB)
 #define DECOMPRESSED_BUFFER_SIZE (4 * KB)
 #define WINDOW_SIZE (16 * KB)
+
+// Compression levels: the greedy hash chain or the optimal parse, nothing between
+#define LEVEL_FAST 1
+#define LEVEL_MAX 9
+#define DEFAULT_LEVEL LEVEL_FAST
 #endif
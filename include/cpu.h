@@ -0,0 +1,64 @@
+#ifndef CPU_H
+#define CPU_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes a wild copy may read/write past the end of the copied range
+#define WILD_COPY_SLACK 64
+
+// Kernel sets, from the most portable to the widest
+#define CPU_SCALAR 0
+#define CPU_SSE2 1
+#define CPU_SSE42 2
+#define CPU_AVX2 3
+#define CPU_AVX512 4
+#define CPU_LEVEL_COUNT 5
+
+typedef struct {
+    int level;
+    const char* name;
+    // Number of equal leading bytes of a and b (at most limit)
+    size_t (*match_length)(const unsigned char* a, const unsigned char* b, size_t limit);
+    // Number of leading bytes of data equal to data[0] (at most limit)
+    size_t (*run_length)(const unsigned char* data, size_t limit);
+    // Copies length bytes, may touch WILD_COPY_SLACK bytes past both ends
+    void (*wild_copy)(unsigned char* dst, const unsigned char* src, size_t length);
+    // CRC-32C (Castagnoli) of data, continued from crc (0 for a new checksum)
+    uint32_t (*crc32c)(uint32_t crc, const unsigned char* data, size_t size);
+} CpuKernels;
+
+/*
+* Function: cpu_kernels
+* ---------------------
+*  Returns the kernel set for the running CPU. It is picked once at startup
+*  from cpuid, the LZ7_CPU environment variable (scalar, sse2, sse4.2, avx2,
+*  avx512) can cap it to an older set.
+*
+*  returns: Pointer to the kernel set
+*/
+const CpuKernels* cpu_kernels(void);
+
+/*
+* Function: cpu_kernels_for
+* -------------------------
+*  Returns the kernel set of a level, or the best supported one below it
+*
+*  level: CPU_SCALAR to CPU_AVX512
+*
+*  returns: Pointer to the kernel set
+*/
+const CpuKernels* cpu_kernels_for(int level);
+
+/*
+* Function: crc32c_zeros
+* ----------------------
+*  Continues a CRC-32C with size zero bytes without reading them, in
+*  O(log size) steps (a hole of a sparse file is checksummed like its bytes)
+*
+*  crc: Checksum so far (0 for a new checksum)
+*  size: Number of zero bytes
+*
+*  returns: The checksum of the data so far followed by the zeros
+*/
+uint32_t crc32c_zeros(uint32_t crc, uint64_t size);
+#endif
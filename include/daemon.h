@@ -0,0 +1,74 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+#include "lz7.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Request: [magic 4][version][op][transfer][level][min_match][filter][flags][checked]
+//          [window size: 4][payload size: 8] (little endian), then the payload (inline)
+// Reply:   [magic 4][status: 4][payload size: 8], then the payload (inline output,
+//          the statistics report or the error message)
+#define DAEMON_REQUEST_MAGIC "LZ7Q"
+#define DAEMON_REPLY_MAGIC "LZ7P"
+#define DAEMON_MAGIC_SIZE 4
+#define DAEMON_VERSION 1
+#define DAEMON_REQUEST_SIZE 24
+#define DAEMON_REPLY_SIZE 16
+// Request flags (the first version had only long range, as 0 or 1)
+#define DAEMON_FLAG_LONG_RANGE 0x01
+#define DAEMON_FLAG_SPLIT 0x02
+
+// Transfers: the input and output files as two descriptors (SCM_RIGHTS, the
+// daemon reads and writes them directly), or the input in the request and the
+// output in the reply
+#define DAEMON_TRANSFER_FDS 0
+#define DAEMON_TRANSFER_INLINE 1
+#define DAEMON_MAX_INLINE_SIZE (1024ULL * 1024 * 1024)
+
+// Connections accepted but not picked up by a worker yet, per worker
+#define DAEMON_QUEUE_SIZE 256
+#define DAEMON_POLL_MS 200
+#define DAEMON_IO_SIZE (64 * 1024)
+// Latency histogram: bucket b holds [2^b, 2^(b + 1)) microseconds
+#define DAEMON_LATENCY_BUCKETS 32
+
+/*
+* Function: serve_daemon
+* ----------------------
+*  Listens on a Unix domain socket and serves compress/decompress requests
+*  until *stop is set (or a shutdown request of the same user arrives). Every
+*  connection carries one request. The acceptor spreads connections over the
+*  deques of a worker pool; a worker takes the newest connection of its own
+*  deque and steals the oldest one of another deque when its own is empty.
+*  Each worker keeps its temporary files and copy buffer between requests.
+*
+*  socket_path: Socket to create (a stale one is replaced, a live one is an error)
+*  options: Pool size (threads, 0: one per online CPU) and buffer sizes, the
+*           compression options come with each request
+*  stop: Checked every DAEMON_POLL_MS (i.e. set from a signal handler, may be NULL)
+*
+*  returns: If failed (0), On success (1)
+*/
+int serve_daemon(const char* socket_path, const Lz7Options* options, volatile sig_atomic_t* stop);
+
+/*
+* Function: remote_request
+* ------------------------
+*  Sends one request to a daemon and waits for its reply
+*
+*  socket_path: Socket of the daemon
+*  op: LZ7_REMOTE_*
+*  options: Compression options of the request
+*  input_file: Input of compress/decompress (sent as a descriptor, or read from
+*              its current position when inline)
+*  output_file: Output of compress/decompress (opened "w+b"), or where the
+*               statistics report goes
+*  inline_payload: Send the data through the socket instead of the descriptors
+*
+*  returns: If failed (0), On success (1)
+*/
+int remote_request(const char* socket_path, int op, const Lz7Options* options, FILE* input_file,
+                   FILE* output_file, int inline_payload);
+#endif
@@ -0,0 +1,64 @@
+#ifndef ERROR_H
+#define ERROR_H
+#include "lz7.h"
+
+#include <stdint.h>
+
+/*
+* Function: set_error
+* -------------------
+*  Records an error of the calling thread (instead of printing it). The first
+*  error since clear_error() is kept, it is the cause; the failures it makes
+*  the callers report only add context.
+*
+*  code: LZ7_ERROR_* code
+*  func_name: Name of the reporting function
+*  format: printf format of the message
+*/
+void set_error(int code, const char* func_name, const char* format, ...) __attribute__((format(printf, 3, 4)));
+void clear_error(void);
+int last_error(void);
+const char* last_error_message(void);
+
+// Error of a worker thread, handed over to the thread that joins it
+typedef struct {
+    int code;
+    char message[LZ7_MESSAGE_SIZE];
+} ErrorState;
+
+/*
+* Function: save_error
+* --------------------
+*  Copies the error of the calling thread into state, unless state already
+*  holds one (the caller serializes access to a shared state)
+*/
+void save_error(ErrorState* state);
+
+/*
+* Function: restore_error
+* -----------------------
+*  Records the error in state (if any) as the error of the calling thread
+*/
+void restore_error(const ErrorState* state);
+
+// Progress reporting of an operation (callback NULL: none)
+typedef struct {
+    Lz7ProgressCallback callback;
+    void* user_data;
+    uint64_t interval;
+    uint64_t next;          // Input bytes of the next call
+    // Memory decoders: makes the output writable up to at least end before it is written
+    // there and returns its new writable end (NULL: failed; reserve NULL: all of it is)
+    unsigned char* (*reserve)(void* reserve_data, unsigned char* end);
+    void* reserve_data;
+} Progress;
+
+/*
+* Function: report_progress
+* -------------------------
+*  Calls the progress callback once done passed the next interval (or reached total)
+*
+*  returns: Cancelled by the callback (0), Continue (1)
+*/
+int report_progress(Progress* progress, uint64_t done, uint64_t total);
+#endif
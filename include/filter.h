@@ -0,0 +1,88 @@
+#ifndef FILTER_H
+#define FILTER_H
+#include <stdio.h>
+
+// Filter types (stored in the frame header)
+#define FILTER_NONE 0
+#define FILTER_DELTA 1
+#define FILTER_CHANNEL 2
+#define FILTER_UP 3
+#define FILTER_PAETH 4
+#define FILTER_COUNT 5
+// Only used for selection, never stored
+#define FILTER_AUTO 0xFF
+
+typedef struct {
+    int type;
+    size_t stride;          // Bytes per pixel (left neighbour distance)
+    size_t row_size;        // Bytes per row (upper neighbour distance)
+    size_t offset;          // Stream position of the first filtered byte
+    size_t pos;             // Stream position of the next byte
+    unsigned char* context; // Last context_size bytes before pos (unfiltered)
+    size_t context_size;
+    unsigned char* work;
+    size_t work_size;
+} Filter;
+
+/*
+* Function: init_filter
+* ---------------------
+*  Initializes a streaming filter
+*
+*  filter: Pointer to the filter
+*  type: Filter type (FILTER_NONE, FILTER_DELTA, ...)
+*  stride: Bytes per pixel (used by FILTER_CHANNEL and FILTER_PAETH)
+*  row_size: Bytes per row (used by FILTER_UP and FILTER_PAETH)
+*  offset: Number of leading bytes to leave untouched (i.e. file header)
+*
+*  returns: If failed (0), On success (1)
+*/
+int init_filter(Filter* filter, int type, size_t stride, size_t row_size, size_t offset);
+
+/*
+* Function: detect_filter
+* -----------------------
+*  Reads a BMP header from the start of the file and picks the filter that
+*  compresses a sample of its pixel data best (possibly FILTER_NONE).
+*  The file position is restored.
+*
+*  file: Pointer to the input file
+*  type: Output filter type
+*  stride: Output bytes per pixel
+*  row_size: Output bytes per row
+*  offset: Output pixel data offset
+*
+*  returns: Not a raster file (0), Raster file (1)
+*/
+int detect_filter(FILE* file, int* type, size_t* stride, size_t* row_size, size_t* offset);
+
+/*
+* Function: filter_forward
+* ------------------------
+*  Filters the next chunk of the stream in place (encoder side)
+*
+*  filter: Pointer to the filter
+*  data: Chunk data
+*  size: Chunk size
+*
+*  returns: If failed (0), On success (1)
+*/
+int filter_forward(Filter* filter, unsigned char* data, size_t size);
+
+/*
+* Function: filter_inverse
+* ------------------------
+*  Reverts filter_forward() on the next chunk of the stream in place (decoder side)
+*
+*  filter: Pointer to the filter
+*  data: Chunk data
+*  size: Chunk size
+*
+*  returns: If failed (0), On success (1)
+*/
+int filter_inverse(Filter* filter, unsigned char* data, size_t size);
+
+void free_filter(Filter* filter);
+const char* filter_name(int type);
+int parse_filter_name(const char* name);
+#endif
@@ -0,0 +1,173 @@
+#ifndef FRAME_H
+#define FRAME_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Frame layout: [header][token stream or split blocks][trailer (if FRAME_FLAG_CHECKSUM)]
+#define FRAME_MAGIC "LZ7F"
+#define FRAME_MAGIC_SIZE 4
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 28
+
+// Header flags
+#define FRAME_FLAG_CHECKSUM 0x01    // CRC-32C of the content in the trailer
+#define FRAME_FLAG_LONG_RANGE 0x02  // Long match tokens, the decoder reads its output back
+#define FRAME_FLAG_SPLIT 0x04       // Split blocks instead of the interleaved tokens (see split.h)
+#define FRAME_FLAG_PRIMED 0x08      // The window starts with the content before the frame (index only)
+#define FRAME_FLAG_SPARSE 0x10      // Hole tokens, the decoder leaves holes in its output
+#define FRAME_FLAGS (FRAME_FLAG_CHECKSUM | FRAME_FLAG_LONG_RANGE | FRAME_FLAG_SPLIT | FRAME_FLAG_PRIMED \
+                     | FRAME_FLAG_SPARSE)
+#define FRAME_TRAILER_SIZE 4
+
+// Multi-frame file (appended frames): [frame]...[frame][index][tail][footer]
+//   index:  [frame offset: 8][frame size: 8][content size: 8][primed: 4] per frame
+//   tail:   the last content bytes, uncompressed (the window of the next append)
+//   footer: "LZ7I", version, reserved (3), frame count (4), tail size (4),
+//           index offset (8), content size (8), CRC-32C of index, tail and
+//           footer (4) (little endian)
+// primed: content bytes before the frame its window starts with. A file
+// without a valid footer is a single frame.
+#define FRAME_INDEX_MAGIC "LZ7I"
+#define FRAME_INDEX_VERSION 1
+#define FRAME_INDEX_ENTRY_SIZE 28
+#define FRAME_FOOTER_SIZE 36
+#define FRAME_MAX_COUNT (1024 * 1024)
+#define FRAME_MAX_TAIL_SIZE 0xFFFF
+
+typedef struct {
+    uint8_t version;
+    uint8_t flags;
+    uint8_t filter;
+    uint8_t filter_stride;
+    uint32_t window_size;
+    uint32_t filter_row_size;
+    uint32_t filter_offset;
+    uint64_t content_size;
+} FrameHeader;
+
+typedef struct {
+    uint64_t offset;        // File position of the frame header
+    uint64_t size;          // Header, stream and trailer
+    uint64_t content_size;
+    uint32_t primed;        // Window bytes from the content before the frame
+} FrameEntry;
+
+typedef struct {
+    FrameEntry* entries;
+    size_t count;
+    unsigned char* tail;    // Last content bytes (NULL: none stored)
+    size_t tail_size;
+    uint64_t offset;        // File position of the index (the end of the frames)
+    uint64_t content_size;  // All frames
+} FrameIndex;
+
+/*
+* Function: write_frame_header
+* ----------------------------
+*  Writes the frame header at the current position of the file
+*
+*  file: Pointer to the output file
+*  header: Pointer to the header
+*
+*  returns: If failed (0), On success (1)
+*/
+int write_frame_header(FILE* file, const FrameHeader* header);
+
+/*
+* Function: read_frame_header
+* ---------------------------
+*  Reads the frame header at the current position of the file. Streams written
+*  before frames existed start with a literal token ([0][0]...) and are left
+*  untouched (the file position is restored).
+*
+*  file: Pointer to the input file
+*  header: Pointer to the header
+*
+*  returns: If failed (-1), Legacy stream without header (0), On success (1)
+*/
+int read_frame_header(FILE* file, FrameHeader* header);
+
+/*
+* Function: parse_frame_header
+* ----------------------------
+*  Parses the frame header at the start of a memory buffer
+*
+*  data: Start of the compressed data
+*  size: Bytes available at data
+*  header: Pointer to the header
+*
+*  returns: If failed (-1), Legacy stream without header (0), On success (1)
+*/
+int parse_frame_header(const unsigned char* data, size_t size, FrameHeader* header);
+
+/*
+* Function: write_frame_trailer
+* -----------------------------
+*  Writes the content checksum at the current position of the file
+*
+*  file: Pointer to the output file
+*  checksum: CRC-32C of the uncompressed content
+*
+*  returns: If failed (0), On success (1)
+*/
+int write_frame_trailer(FILE* file, uint32_t checksum);
+
+/*
+* Function: read_frame_trailer
+* ----------------------------
+*  Reads the content checksum at the current position of the file
+*
+*  file: Pointer to the input file
+*  checksum: Output CRC-32C of the uncompressed content
+*
+*  returns: If failed (0), On success (1)
+*/
+int read_frame_trailer(FILE* file, uint32_t* checksum);
+
+// Content checksum stored in the FRAME_TRAILER_SIZE bytes at data
+uint32_t parse_frame_trailer(const unsigned char* data);
+
+/*
+* Function: parse_frame_index
+* ---------------------------
+*  Parses the index of a multi-frame file from the footer at the end of a
+*  memory buffer. The frames must follow each other from the start of the
+*  buffer up to the index.
+*
+*  data: Whole file
+*  size: File size
+*  index: Output index (free_frame_index() releases it)
+*
+*  returns: If failed (-1), Single frame without index (0), On success (1)
+*/
+int parse_frame_index(const unsigned char* data, size_t size, FrameIndex* index);
+
+/*
+* Function: read_frame_index
+* --------------------------
+*  Reads the index of a multi-frame file, like parse_frame_index(). The file
+*  position is restored.
+*
+*  file: Pointer to the input file
+*  index: Output index (free_frame_index() releases it)
+*
+*  returns: If failed (-1), Single frame without index (0), On success (1)
+*/
+int read_frame_index(FILE* file, FrameIndex* index);
+
+/*
+* Function: write_frame_index
+* ---------------------------
+*  Writes the index, the tail and the footer at the current position of the
+*  file, which must be index->offset
+*
+*  file: Pointer to the output file
+*  index: Pointer to the index
+*
+*  returns: If failed (0), On success (1)
+*/
+int write_frame_index(FILE* file, const FrameIndex* index);
+
+void free_frame_index(FrameIndex* index);
+#endif
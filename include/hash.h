@@ -6,21 +6,103 @@
 #include <stdint.h>
 #include <stdio.h>
 
-#define MAX_TABLE_SIZE (1UL << 16)
-#define MAX_CHAIN_SIZE 64
+#define MIN_TABLE_BITS 10
+#define MAX_TABLE_BITS 16
+#define MAX_TABLE_SIZE (1UL << MAX_TABLE_BITS)
+#define MAX_CHAIN_SIZE 30
+// Positions are 32-bit (the buffer base plus the buffer position, wrapping),
+// the longest buffer the encoder works on
+#define MAX_HASH_POSITION UINT32_MAX
 
+// Buckets are prefetched this many positions ahead of the encoder, and the
+// newest candidate of a bucket half as many (when the bucket has arrived)
+#define PREFETCH_DISTANCE 8
+
+// Supported minimum match lengths (each one has its own specialised match finder)
+#define MIN_HASH_LENGTH 2
+#define MAX_HASH_LENGTH 4
+
+/*
+* A chain entry: the low 16 bits of a position (no offset is longer) and a
+* tag, the first TAG_SIZE bytes at it. The tags reject most candidates (hash
+* collisions, and matches that can't be longer than the best one) without
+* loading the data at the position. An entry older than 64 kb looks nearer
+* than it is, which costs a compare: every candidate is checked against the
+* data.
+*/
+#define TAG_SIZE 2
 typedef struct {
-    int count;
-    size_t positions[MAX_CHAIN_SIZE];
-} HashItem;
+    uint16_t position;
+    uint16_t tag;
+} HashEntry;
 
+/*
+* A bucket keeps the MAX_CHAIN_SIZE newest entries in a ring (entry i at
+* i % MAX_CHAIN_SIZE), the ones out of the window are dropped from its front.
+* The counters and entries fill two cache lines, the table starts at one, so
+* a match search loads two lines per position. After 2^32 entries the ring
+* index jumps, which only misplaces a few entries: every candidate is
+* checked against the data.
+*/
+#define CACHE_LINE_SIZE 64
+#define HASH_ITEM_SIZE (2 * CACHE_LINE_SIZE)
 typedef struct {
-    HashItem* items;
-} HashTable;
+    uint32_t count;                     // Entries ever added (since the last reset)
+    uint32_t first;                     // Oldest entry still in the window
+    HashEntry entries[MAX_CHAIN_SIZE];
+} HashItem;
 
-int init_hash_table(HashTable* hash_table);
+typedef struct HashTable HashTable;
+
+struct HashTable {
+    HashItem* items;        // Aligned to a cache line in memory
+    void* memory;
+    size_t mask;            // Table size - 1 (power of two)
+    uint32_t base;          // Added to buffer positions, moved on by every refill
+    int min_match;
+    uint32_t depth;         // Newest chain entries find_best_match compares (MAX_CHAIN_SIZE: all)
+    // Match finder instance for min_match, selected by init_hash_table()
+    void (*update)(HashTable* hash_table, Buffer* buffer, size_t window_size);
+    size_t (*find)(HashTable* hash_table, Buffer* buffer, size_t window_size, size_t* best_match_length);
+    void (*prefetch)(const HashTable* hash_table, const unsigned char* data, size_t pos, int candidates);
+    size_t prefetched;      // Positions below it are prefetched (see prefetch_hash_table)
+    // Match extension and run kernels of the running CPU
+    size_t (*match_length)(const unsigned char* a, const unsigned char* b, size_t limit);
+    size_t (*run_length)(const unsigned char* data, size_t limit);
+};
+
+/*
+* Function: init_hash_table
+* -------------------------
+*  Allocates a hash table sized for the input. The table is zeroed by calloc(),
+*  so only the buckets the input hashes to are ever touched.
+*
+*  hash_table: Pointer to the hash table
+*  min_match: Minimum match length (MIN_HASH_LENGTH to MAX_HASH_LENGTH)
+*  size_hint: Number of bytes that will be hashed (0: unknown, full size)
+*
+*  returns: If failed (0), On success (1)
+*/
+int init_hash_table(HashTable* hash_table, int min_match, size_t size_hint);
+void reset_hash_table(HashTable* hash_table);
+// The buffer was refilled: the entries of its old content (size bytes) are out of reach
+void shift_hash_table(HashTable* hash_table, size_t size);
+// The buffer content moved distance bytes towards its start: the entries follow it
+void slide_hash_table(HashTable* hash_table, size_t distance);
+void free_hash_table(HashTable* hash_table);
 unsigned int hash(const unsigned char* data, int length);
 void update_hash_table(HashTable* hash_table, Buffer* buffer, size_t window_size);
 size_t find_best_match(HashTable* hash_table, Buffer* buffer, size_t window_size, size_t* best_match_length);
 
+/*
+* Function: prefetch_hash_table
+* -----------------------------
+*  Hashes the positions up to PREFETCH_DISTANCE ahead of buffer->pos and
+*  prefetches their buckets, then the newest candidate data of the positions
+*  half as far ahead. The encoder calls it once per token, so the loads of the
+*  next positions overlap with the compares of the current one. A match jumps
+*  ahead, the positions it skips are never fetched.
+*/
+void prefetch_hash_table(HashTable* hash_table, const Buffer* buffer);
+
 #endif
@@ -0,0 +1,87 @@
+#ifndef LONGRANGE_H
+#define LONGRANGE_H
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Bytes covered by the rolling hash, also the shortest long match
+#define LONG_RANGE_HASH_LENGTH 64
+// One table entry per 2^LONG_RANGE_SAMPLE_BITS input bytes (on average, content defined)
+#define LONG_RANGE_SAMPLE_BITS 6
+// How far a match may be extended backwards from its sample point
+#define LONG_RANGE_BACKTRACK (4 * 1024)
+#define LONG_RANGE_READ_SIZE (1024 * 1024)
+#define LONG_RANGE_MIN_TABLE_BITS 10
+#define LONG_RANGE_MAX_TABLE_BITS 26
+
+typedef struct {
+    size_t start;           // Content position of the first byte
+    size_t offset;          // Distance to the source (larger than the window)
+    size_t length;
+} LongMatch;
+
+typedef struct {
+    int fd;                 // Input file, read with pread() only
+    size_t file_size;
+    size_t min_offset;      // Shorter distances are left to the hash chain
+    uint64_t* table;        // [position + 1 : 48][check tag : 16], 0: empty
+    size_t table_mask;
+    LongMatch* matches;     // Found matches in order, [head, count) not taken yet
+    size_t head;
+    size_t count;
+    size_t capacity;
+    size_t ready;           // No match found later starts before this position
+    int done;
+    int failed;
+    int stop;               // Set by the encoder, the scan ends early
+    uint32_t checksum;      // CRC-32C of the whole input
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} LongRangeMatcher;
+
+/*
+* Function: start_long_range
+* --------------------------
+*  Starts the long range matcher on its own thread. It reads the whole input
+*  (independent of the file position of input_file), keeps a rolling hash of
+*  the last LONG_RANGE_HASH_LENGTH bytes and samples it by content, so the same
+*  data is sampled at the same points wherever it appears. Sampled positions go
+*  into a table of one entry per 64 input bytes (at most 2^26 entries); every sample is
+*  looked up first, and a hit further away than min_offset is verified against
+*  the file and extended into a long match.
+*
+*  matcher: Pointer to the matcher
+*  input_file: Pointer to the input file (must be a regular file)
+*  min_offset: Only matches further away than this are reported (window size)
+*
+*  returns: If failed (0), On success (1)
+*/
+int start_long_range(LongRangeMatcher* matcher, FILE* input_file, size_t min_offset);
+
+/*
+* Function: next_long_match
+* -------------------------
+*  Takes the next long match if it starts before end. Waits until the matcher
+*  has scanned far enough to know.
+*
+*  matcher: Pointer to the matcher
+*  end: Content position the caller is about to encode up to
+*  match: Output match
+*
+*  returns: If failed (-1), No match before end (0), Match taken (1)
+*/
+int next_long_match(LongRangeMatcher* matcher, size_t end, LongMatch* match);
+
+/*
+* Function: finish_long_range
+* ---------------------------
+*  Waits for the matcher thread to scan the whole input and frees its memory
+*
+*  matcher: Pointer to the matcher
+*  checksum: Output CRC-32C of the input (NULL: stop the scan early, i.e. on errors)
+*
+*  returns: If failed (0), On success (1)
+*/
+int finish_long_range(LongRangeMatcher* matcher, uint32_t* checksum);
+#endif
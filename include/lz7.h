@@ -0,0 +1,292 @@
+#ifndef LZ7_H
+#define LZ7_H
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+* Public interface of liblz7. Every call works on a caller-owned context and
+* nothing is shared between contexts, so each thread can use its own one.
+* The library never prints: failures return an error code and leave a
+* message in the context, progress goes to an optional callback.
+*/
+
+#define LZ7_API __attribute__((visibility("default")))
+
+// Error codes (negative, LZ7_OK on success)
+#define LZ7_OK 0
+#define LZ7_ERROR -1                // Unspecified failure
+#define LZ7_ERROR_PARAMETER -2      // Invalid or missing parameter
+#define LZ7_ERROR_MEMORY -3         // Allocation failed
+#define LZ7_ERROR_IO -4             // Reading or writing a file failed
+#define LZ7_ERROR_FORMAT -5         // Corrupted or truncated input
+#define LZ7_ERROR_CHECKSUM -6       // Content checksum mismatch
+#define LZ7_ERROR_UNSUPPORTED -7    // Unsupported version or option combination
+#define LZ7_ERROR_CANCELLED -8      // The progress callback asked to stop
+#define LZ7_MESSAGE_SIZE 256
+
+// Limits and defaults
+// The only two levels: greedy hash chain and optimal parse
+#define LZ7_LEVEL_FAST 1
+#define LZ7_LEVEL_MAX 9
+#define LZ7_DEFAULT_LEVEL LZ7_LEVEL_FAST
+#define LZ7_MIN_MATCH_MIN 2
+#define LZ7_MIN_MATCH_MAX 4
+#define LZ7_WINDOW_SIZE (16 * 1024)
+#define LZ7_MAX_WINDOW_SIZE 0xFFFF
+#define LZ7_BUFFER_SIZE (2 * 1024)
+#define LZ7_CHUNK_SIZE (4 * 1024)
+#define LZ7_SEGMENT_SIZE (1024 * 1024)
+#define LZ7_MAX_THREADS 64
+// Adaptive compression: effort picked per block, for this throughput without a target (MB/s)
+#define LZ7_ADAPTIVE_BLOCK_SIZE (256 * 1024)
+#define LZ7_ADAPTIVE_MBPS 100
+
+/*
+* Buffer size for lz7_decompress_in_place(). A literal token takes 3 bytes
+* and a match at least 3 bytes for 2, so while the output catches up with
+* the input it is never ahead by more than two thirds of the compressed size.
+* This is the worst case (literals after long matches), the decoder checks the
+* real distance and fails instead of overwriting unread input. Split frames
+* keep the literals of a block ahead of its matches and may need up to
+* content_size + compressed_size.
+*/
+#define LZ7_IN_PLACE_SIZE(content_size, compressed_size) ((content_size) + ((compressed_size) * 2 + 2) / 3)
+
+// Daemon requests (lz7_remote)
+#define LZ7_REMOTE_COMPRESS 1
+#define LZ7_REMOTE_DECOMPRESS 2
+#define LZ7_REMOTE_STATS 3          // Statistics report of the daemon into output_file
+#define LZ7_REMOTE_SHUTDOWN 4       // Drains the queue and stops (same user or root only)
+
+// Prefilters
+#define LZ7_FILTER_NONE 0
+#define LZ7_FILTER_DELTA 1
+#define LZ7_FILTER_CHANNEL 2
+#define LZ7_FILTER_UP 3
+#define LZ7_FILTER_PAETH 4
+#define LZ7_FILTER_AUTO 0xFF
+
+/*
+* Progress callback: done of total input bytes are processed. Returning
+* non-zero cancels the operation (LZ7_ERROR_CANCELLED).
+*/
+typedef int (*Lz7ProgressCallback)(void* user_data, uint64_t done, uint64_t total);
+
+typedef struct {
+    int level;              // LZ7_LEVEL_FAST (greedy) or LZ7_LEVEL_MAX (optimal parse)
+    int min_match;          // Shortest match of the hash chain
+    int threads;            // Compression: segment threads (0: streaming chunks). Tests/archives: pool size (0: one per CPU)
+    int long_range;         // Long matches beyond the window (streaming chunks only)
+    int filter;             // LZ7_FILTER_*, LZ7_FILTER_AUTO: detected from a BMP header
+    size_t filter_stride;   // 0: from the BMP header
+    size_t filter_row_size; // 0: from the BMP header
+    size_t window_size;     // Sliding window (dictionary) size
+    size_t buffer_size;     // Token writer / output reader buffer size
+    size_t chunk_size;      // Input chunk size
+    int checked;            // Validate every token when decoding (0 only for trusted input)
+    int split;              // Compression: literals, lengths and offsets in separate streams per block
+    int prime;              // Appending: the window starts with the end of the existing content
+    size_t target_mbps;     // Compression: effort picked per block to keep this throughput in MB/s (0: fixed level)
+} Lz7Options;
+
+typedef struct {
+    Lz7Options options;
+    Lz7ProgressCallback progress;
+    void* user_data;
+    uint64_t progress_interval;     // Input bytes between two callbacks
+    int error;                      // Code of the last call
+    char message[LZ7_MESSAGE_SIZE]; // Reason of the last failure
+} Lz7Context;
+
+typedef struct {
+    int ok;
+    int has_checksum;               // 0: only the tokens were validated
+    char message[LZ7_MESSAGE_SIZE]; // Reason of the failure
+} Lz7TestResult;
+
+typedef struct {
+    size_t files;
+    uint64_t input_bytes;           // Bytes of all files
+    uint64_t archive_bytes;
+    size_t chunks;                  // Chunk references of all files
+    size_t unique_chunks;
+    uint64_t duplicate_bytes;       // Bytes stored only once
+} Lz7ArchiveSummary;
+
+LZ7_API void lz7_default_options(Lz7Options* options);
+
+/*
+* Function: lz7_init
+* ------------------
+*  Initializes a context (options: NULL for the defaults)
+*/
+LZ7_API void lz7_init(Lz7Context* context, const Lz7Options* options);
+
+/*
+* Function: lz7_set_progress
+* --------------------------
+*  Sets the progress callback, called about every interval input bytes and
+*  once at the end (callback: NULL to disable)
+*/
+LZ7_API void lz7_set_progress(Lz7Context* context, Lz7ProgressCallback callback, void* user_data, uint64_t interval);
+
+/*
+* Function: lz7_compress_file
+* ---------------------------
+*  Compresses input_file (read from the start) into a frame at the current
+*  position of output_file
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_compress_file(Lz7Context* context, FILE* input_file, FILE* output_file);
+
+/*
+* Function: lz7_append_file
+* -------------------------
+*  Compresses input_file (read from the start) into a new frame at the end of
+*  the compressed file at path and updates its frame index. The file is
+*  replaced atomically (a temporary file renamed over it), only the new data
+*  is compressed. A missing file is created.
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_append_file(Lz7Context* context, FILE* input_file, const char* path);
+
+/*
+* Function: lz7_decompress_file
+* -----------------------------
+*  Decompresses a frame, the frames of a multi-frame file (or a legacy stream)
+*  into output_file. Frames with long matches or a primed window read the
+*  output back, so it must be opened with "w+b".
+*
+*  output_file: NULL to only validate the frame and its checksum
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_decompress_file(Lz7Context* context, FILE* input_file, FILE* output_file);
+
+/*
+* Function: lz7_content_size
+* --------------------------
+*  Reads the content size from the frame header at src, or from the index of
+*  a multi-frame file (src is the whole file then). Legacy streams without a
+*  header don't store it.
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_content_size(Lz7Context* context, const void* src, size_t src_size, uint64_t* content_size);
+
+/*
+* Function: lz7_decompress_buffer
+* -------------------------------
+*  Decompresses a frame from memory into dst, which is also the history: no
+*  window or output buffer is allocated. dst needs room for the content
+*  size only (see lz7_content_size).
+*
+*  content_size: Output decoded size (may be NULL)
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_decompress_buffer(Lz7Context* context, const void* src, size_t src_size, void* dst,
+                                  size_t dst_capacity, size_t* content_size);
+
+/*
+* Function: lz7_decompress_in_place
+* ---------------------------------
+*  Decompresses a frame stored in the last src_size bytes of buffer into the
+*  start of the same buffer. buffer_size must be at least LZ7_IN_PLACE_SIZE()
+*  to be safe for any frame; a smaller buffer works for most data and fails
+*  with LZ7_ERROR_PARAMETER, without corrupting anything, when it doesn't.
+*
+*  content_size: Output decoded size (may be NULL)
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_decompress_in_place(Lz7Context* context, void* buffer, size_t buffer_size, size_t src_size,
+                                    size_t* content_size);
+
+/*
+* Function: lz7_test_files
+* ------------------------
+*  Validates compressed files on a thread pool (options.threads) without
+*  writing any output
+*
+*  results: One result per path
+*
+*  returns: Number of failed files, or an error code
+*/
+LZ7_API int lz7_test_files(Lz7Context* context, char** paths, int count, Lz7TestResult* results);
+
+/*
+* Function: lz7_print_stats
+* -------------------------
+*  Writes a token statistics report of a compressed file to report
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_print_stats(Lz7Context* context, FILE* input_file, const char* name, FILE* report);
+
+/*
+* Function: lz7_create_archive
+* ----------------------------
+*  Writes a deduplicating archive of the given files (options.threads
+*  workers, options.window_size and options.min_match for the chunks)
+*
+*  summary: Output sizes and chunk counts (may be NULL)
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_create_archive(Lz7Context* context, const char* archive_path, char** paths, int count,
+                               Lz7ArchiveSummary* summary);
+
+/*
+* Function: lz7_extract_archive
+* -----------------------------
+*  Rebuilds the files of an archive below output_dir (NULL: current directory)
+*
+*  summary: Output file count (may be NULL)
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_extract_archive(Lz7Context* context, const char* archive_path, const char* output_dir,
+                                Lz7ArchiveSummary* summary);
+
+/*
+* Function: lz7_serve
+* -------------------
+*  Runs a compression daemon on a Unix domain socket (mode 0600) until *stop
+*  is set or a shutdown request arrives. A pool of options.threads workers
+*  (0: one per CPU) serves one request per connection, each worker keeps its
+*  temporary files and buffers between requests. The compression options come
+*  with every request, options only sets the pool and buffer sizes.
+*
+*  stop: Polled a few times per second, i.e. set from a signal handler (may be NULL)
+*
+*  returns: LZ7_OK once the queued requests are served, or an error code
+*/
+LZ7_API int lz7_serve(Lz7Context* context, const char* socket_path, volatile sig_atomic_t* stop);
+
+/*
+* Function: lz7_remote
+* --------------------
+*  Sends a request (LZ7_REMOTE_*) with the context options to a daemon. The
+*  daemon reads and writes the files through their descriptors, or with
+*  inline_payload the input goes through the socket and the output comes back
+*  (for clients that can't share their files). Remote failures return the
+*  error code and message of the daemon.
+*
+*  input_file: Input of compress/decompress (NULL otherwise)
+*  output_file: Output of compress/decompress (opened "w+b"), or the report of
+*               LZ7_REMOTE_STATS (NULL for LZ7_REMOTE_SHUTDOWN)
+*
+*  returns: LZ7_OK, or an error code (message in the context)
+*/
+LZ7_API int lz7_remote(Lz7Context* context, const char* socket_path, int op, FILE* input_file,
+                       FILE* output_file, int inline_payload);
+
+LZ7_API const char* lz7_error_string(int error);
+LZ7_API int lz7_parse_filter(const char* name);
+LZ7_API const char* lz7_cpu_name(void);
+#endif
@@ -1,9 +1,54 @@
 #ifndef LZ77_H
 #define LZ77_H
 #include "constants.h"
+#include "filter.h"
+#include "hash.h"
+#include "buffer.h"
+#include "error.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
+// Token layout: [offset lsb][offset msb][length] or [0][0][literal]
+#define TOKEN_SIZE 3
+#define MIN_MATCH_LENGTH 2
+#define MAX_MATCH_LENGTH 255
+#define MAX_OFFSET 0xFFFF
+
+// Extended token: [opcode][payload tokens][0] + payload. A match never has
+// length 0, so the escape can't be mistaken for a match or a literal.
+#define TOKEN_LONG_MATCH 0x01
+// Long match: [0x01][3][0][offset: 5 bytes][length: 4 bytes] (little endian),
+// the source is further back than the window
+#define LONG_MATCH_TOKEN_SIZE (4 * TOKEN_SIZE)
+#define LONG_MATCH_MAX_OFFSET ((1ULL << 40) - 1)
+#define LONG_MATCH_MAX_LENGTH 0xFFFFFFFFULL
+// Hole: [0x02][2][0][length: 6 bytes] (little endian), length zero bytes of
+// a sparse file. The decoder skips them in its output instead of writing them.
+#define TOKEN_HOLE 0x02
+#define HOLE_TOKEN_SIZE (3 * TOKEN_SIZE)
+#define HOLE_MAX_LENGTH ((1ULL << 48) - 1)
+
+// Repeat match: [code lsb][code msb][1], code = length << 2 | index. A match is
+// never 1 byte long, so the code can't be mistaken for one. The source is the
+// index-th most recent distinct match offset, the history holds REP_OFFSETS
+// of them (0: none yet) and only short matches update it.
+#define REP_MATCH_LENGTH 1
+#define REP_OFFSETS 4
+#define REP_MATCH_MAX_LENGTH 0x3FFF
+#define NO_TOKEN SIZE_MAX
+
+// A run of the byte before the position at least this long is covered by
+// offset 1 matches (one repeat match per REP_MATCH_MAX_LENGTH bytes), no
+// position inside it is hashed or searched
+#define RUN_MIN_LENGTH 64
+
+// Lazy matching: a match shorter than this is dropped for a literal when the
+// next position starts a longer one
+#define LAZY_MATCH_LENGTH 32
+
+// Token stream bytes between two progress reports of decode_memory()
+#define MEMORY_PROGRESS_STEP (64 * 1024)
 
 typedef struct {
     unsigned char* buffer;
@@ -11,23 +56,89 @@ typedef struct {
     size_t buffer_pos;
     size_t buffer_size;
     size_t window_size;
+    int level;
+    int min_match;          // Shortest match the hash chain looks for
+    int threads;            // Segment threads of the greedy level (0: streaming chunks)
+    int long_range;         // Long matches beyond the window (streaming chunks only)
+    int split;              // Flushes split blocks instead of the tokens (see split.h)
+    int sparse;             // Holes of the input become hole tokens (streaming chunks only)
+    int lazy;               // Looks one position ahead before taking a short match
+    size_t hashed;          // Hash position the lookahead already added (NO_TOKEN: none)
+    size_t flushed;         // Token bytes flushed so far
+    size_t target;          // Adaptive effort for this throughput in bytes per second (0: fixed level)
+    unsigned char* block;   // Split block of the flushed tokens (NULL: not allocated yet)
+    size_t block_size;
+    const unsigned char* prime; // Content before the input the window starts with (segments and optimal parse)
+    size_t prime_size;
+    size_t reps[REP_OFFSETS]; // Repeat offsets of the decoder (0: unknown)
+    size_t last_match;      // Buffer position of the last token if it is a match (NO_TOKEN: none)
+    int last_rep;           // Its repeat offset index (-1: plain match)
+    uint32_t checksum;      // CRC-32C of the content read so far
+    Progress progress;      // Input bytes encoded so far (callback NULL: none)
+    Filter filter;
 } LZWriter;
 
 typedef struct {
     unsigned char* buffer;
     unsigned char* dictionary;
-    FILE* file;
+    FILE* file;             // NULL: the output is only checked, then discarded
+    FILE* history;          // Written output long matches are read back from (NULL: none)
+    long history_start;     // File position of the first content byte in history
     size_t buffer_pos;
     size_t buffer_size;
     size_t dict_pos;
-    size_t dict_size;
+    size_t dict_size;       // Window size (longest valid offset)
+    size_t dict_mask;       // Ring size - 1, the ring is a power of two >= dict_size + WILD_COPY_SLACK
+    size_t produced;
+    size_t primed;          // Content before the frame at the start of the ring (primed window)
+    size_t stream_end;      // File position where the frame ends (SIZE_MAX: the end of the file)
+    size_t reps[REP_OFFSETS]; // Repeat offset history
+    size_t content_size;    // SIZE_MAX if unknown
+    int checked;            // Validate every token (untrusted input)
+    int split;              // The stream is made of split blocks (see split.h)
+    size_t trailer_size;    // Bytes after the token stream (frame trailer)
+    uint32_t checksum;      // CRC-32C of the content written so far
+    void (*wild_copy)(unsigned char* dst, const unsigned char* src, size_t length);
+    Progress progress;      // Token stream bytes decoded so far (callback NULL: none)
+    Filter filter;
 } LZReader;
 
-int init_writer(LZWriter* lz_writer, FILE* file, size_t buffer_size, size_t window_size);
+/*
+* Moves offset to the front of the repeat offset history. Every short match
+* (plain or repeat) does this, in the encoder as well as in the decoder.
+*/
+static inline void push_rep_offset(size_t* reps, size_t offset) {
+    size_t previous = reps[0];
+    reps[0] = offset;
+    // Shift down until the old slot of offset (or the end) is overwritten
+    for (int i = 1; i < REP_OFFSETS && previous != offset; i++) {
+        size_t next = reps[i];
+        reps[i] = previous;
+        previous = next;
+    }
+}
+
+int init_writer(LZWriter* lz_writer, FILE* file, size_t buffer_size, size_t window_size, int level, int min_match);
 int init_reader(LZReader* lz_reader, FILE* file, size_t buffer_size, size_t window_size);
 ssize_t encode(LZWriter* lz_writer, FILE* input_file, size_t read_chunk_size);
 ssize_t decode(LZReader* lz_reader, FILE* input_file, size_t read_chunk_size);
+// Decodes a whole token stream into dst, the output is the history (see decode_memory in lz77.c)
+ssize_t decode_memory(const unsigned char* src, size_t src_size, unsigned char* dst, size_t dst_size,
+                      size_t history, size_t window_size, int checked, Progress* progress);
+// The same for a stream of split blocks
+ssize_t decode_memory_split(const unsigned char* src, size_t src_size, unsigned char* dst, size_t dst_size,
+                            size_t history, size_t window_size, int checked, Progress* progress);
+ssize_t write_lz(LZWriter* lz_writer, HashTable* hash_table, Buffer* buffer);
+ssize_t read_lz(Buffer* buffer, LZReader* lz_reader);
+ssize_t write_literal(LZWriter* lz_writer, unsigned char value);
+ssize_t write_match(LZWriter* lz_writer, size_t offset, size_t length);
+ssize_t write_long_match(LZWriter* lz_writer, size_t offset, size_t length);
+ssize_t write_hole(LZWriter* lz_writer, size_t length);
 ssize_t flush_writer(LZWriter* lz_writer);
+// Writes whole tokens to the file of the writer, as a split block if it splits
+ssize_t write_tokens(LZWriter* lz_writer, const unsigned char* tokens, size_t size);
+// Empties the buffer and forgets the repeat offsets (the next token starts a new stream)
+void reset_writer(LZWriter* lz_writer);
 ssize_t flush_reader(LZReader* lz_reader);
-size_t dictionary_push(LZReader* lz_reader, unsigned char* value);
+size_t dictionary_push(LZReader* lz_reader, const unsigned char* value);
 #endif
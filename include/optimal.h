@@ -0,0 +1,78 @@
+#ifndef OPTIMAL_H
+#define OPTIMAL_H
+#include "lz77.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Number of new bytes parsed per suffix array (history excluded)
+#define OPTIMAL_BLOCK_SIZE (256 * KB)
+// Longest match the parse takes: a plain match and a repeat match of its offset
+#define OPTIMAL_MAX_LENGTH (MAX_MATCH_LENGTH + REP_MATCH_MAX_LENGTH)
+// Output bytes of a literal and of a match in a split block (see split.h): the
+// literal byte, and the length, the offset and (about) one runs byte of a sequence
+#define SPLIT_LITERAL_COST 1
+#define SPLIT_MATCH_COST (TOKEN_SIZE + 1)
+
+/*
+* Function: build_suffix_array
+* ----------------------------
+*  Builds the suffix array of data using SA-IS (induced sorting)
+*
+*  data: Pointer to the data
+*  size: Number of bytes in data
+*  sa: Output array of (size + 1) entries. sa[0] is the virtual sentinel (size)
+*
+*  returns: If failed (0), On success (1)
+*/
+int build_suffix_array(const unsigned char* data, int32_t size, int32_t* sa);
+
+/*
+* Function: build_lcp_array
+* -------------------------
+*  Builds the longest-common-prefix array of a suffix array (Kasai)
+*
+*  data: Pointer to the data
+*  size: Number of bytes in data
+*  sa: Suffix array from build_suffix_array() (size + 1 entries)
+*  rank: Output inverse suffix array (size + 1 entries)
+*  lcp: Output array (size + 1 entries). lcp[i] = lcp(sa[i - 1], sa[i])
+*/
+void build_lcp_array(const unsigned char* data, int32_t size, const int32_t* sa,
+                     int32_t* rank, int32_t* lcp);
+
+/*
+* Function: parse_optimal_block
+* -----------------------------
+*  Parses data[history .. size) and writes the token sequence with the fewest
+*  output bytes (TOKEN_SIZE per token, or SPLIT_LITERAL_COST and SPLIT_MATCH_COST
+*  with lz_writer->split). data[0 .. history) is already encoded and only used as
+*  match source. Repeat offsets other than the one a long match continues with
+*  are not priced.
+*
+*  lz_writer: Pointer to the writer
+*  data: Pointer to the history and the block
+*  history: Bytes before the block
+*  size: End of the block
+*  window: Longest match offset (at most MAX_OFFSET)
+*
+*  returns: Number of parsed bytes. If failed (-1)
+*/
+ssize_t parse_optimal_block(LZWriter* lz_writer, const unsigned char* data, int32_t history, int32_t size,
+                            int32_t window);
+
+/*
+* Function: encode_optimal
+* ------------------------
+*  Encodes the input file with an exact shortest-path parse of every block.
+*  The longest match of each position inside the sliding window is found with
+*  a suffix array + LCP, then the token sequence with the fewest output bytes
+*  is chosen backwards. The output is a normal token stream.
+*
+*  lz_writer: Pointer to the writer
+*  input_file: Pointer to the input file
+*
+*  returns: Number of processed bytes. If failed (-1)
+*/
+ssize_t encode_optimal(LZWriter* lz_writer, FILE* input_file);
+#endif
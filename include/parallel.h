@@ -0,0 +1,28 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include "lz77.h"
+
+#include <stdio.h>
+
+// Bytes every thread parses per block
+#define PARALLEL_SEGMENT_SIZE (1024 * KB)
+#define PARALLEL_MAX_THREADS 64
+
+/*
+* Function: encode_parallel
+* -------------------------
+*  Encodes the input file with the greedy hash chain on several threads.
+*  Every block is split into consecutive segments, one per thread. Each thread
+*  primes its own hash table with the window before its segment (read-only,
+*  parsed by the previous thread or kept from the previous block), so matches
+*  cross segment borders as in a single-threaded parse. The segments are
+*  written in order and the output is a normal token stream.
+*
+*  lz_writer: Pointer to the writer
+*  input_file: Pointer to the input file
+*  threads: Number of threads (1 to PARALLEL_MAX_THREADS)
+*
+*  returns: Number of processed bytes. If failed (-1)
+*/
+ssize_t encode_parallel(LZWriter* lz_writer, FILE* input_file, int threads);
+#endif
@@ -0,0 +1,29 @@
+#ifndef SHA256_H
+#define SHA256_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;        // Bytes hashed so far
+    unsigned char block[64];
+    size_t block_size;
+} Sha256;
+
+void sha256_init(Sha256* sha);
+void sha256_update(Sha256* sha, const unsigned char* data, size_t size);
+void sha256_final(Sha256* sha, unsigned char digest[SHA256_SIZE]);
+
+/*
+* Function: sha256
+* ----------------
+*  Hashes a buffer in one call (FIPS 180-4)
+*
+*  data: Input data
+*  size: Input size
+*  digest: Output hash
+*/
+void sha256(const unsigned char* data, size_t size, unsigned char digest[SHA256_SIZE]);
+#endif
@@ -0,0 +1,40 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+#include <stdint.h>
+#include <stdio.h>
+
+// Zeros written at a time where a hole can't be made (pipes, file systems
+// without hole punching)
+#define SPARSE_ZERO_SIZE (64 * 1024)
+
+/*
+* Function: find_hole
+* -------------------
+*  Finds the first hole of a sparse file at or after a position
+*  (SEEK_HOLE/SEEK_DATA). File systems without holes report none. The file
+*  position (of the stream and of its descriptor) is left untouched.
+*
+*  file: Pointer to the file (anything but a regular file has no holes)
+*  from: File position the search starts at
+*  start: Start of the hole
+*  end: End of the hole (the data after it, or the end of the file)
+*
+*  returns: No hole before the end of the file (0), Found (1)
+*/
+int find_hole(FILE* file, uint64_t from, uint64_t* start, uint64_t* end);
+
+/*
+* Function: skip_hole
+* -------------------
+*  Moves the file position length zero bytes further without writing them:
+*  the file grows to cover them and old data under them is punched out
+*  (FALLOC_FL_PUNCH_HOLE). Anything but a regular file, or a file system
+*  that can't punch, gets the zeros written.
+*
+*  file: Pointer to the output file
+*  length: Number of zero bytes
+*
+*  returns: If failed (0), On success (1)
+*/
+int skip_hole(FILE* file, uint64_t length);
+#endif
@@ -0,0 +1,110 @@
+#ifndef SPLIT_H
+#define SPLIT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Split block: the columns of a run of tokens stored apart, so the decoder
+// copies every literal run at once and branches on the match kind only.
+//   [literal count: 4][sequence count: 4][runs size: 4][offsets size: 4] (little endian)
+//   [literals][runs][lengths][offsets]
+// A sequence is a run of literals followed by a match:
+//   runs:    literals before the match (LEB128, 7 bits per byte)
+//   lengths: the length byte of the match token (1: repeat match, 0: long match)
+//   offsets: [offset: 2] of a plain match, [code: 2] of a repeat match,
+//            [offset: 5][length: 4] of a long match
+// The literals after the last match end the block.
+#define SPLIT_HEADER_SIZE 16
+// Token bytes the writer gathers per block (at least)
+#define SPLIT_BLOCK_SIZE (128 * 1024)
+// Largest block a decoder accepts
+#define SPLIT_MAX_BLOCK_SIZE (256 * 1024 * 1024)
+// Largest block a token run of size bytes turns into (a 3 byte match takes 4)
+#define SPLIT_BLOCK_BOUND(size) (SPLIT_HEADER_SIZE + (size) / 3 * 4 + 4)
+
+typedef struct {
+    const unsigned char* literals;
+    const unsigned char* runs;
+    const unsigned char* lengths;
+    const unsigned char* offsets;
+    size_t literal_count;
+    size_t sequence_count;
+    size_t runs_size;
+    size_t offsets_size;
+    size_t size;            // Whole block, with the header
+} SplitBlock;
+
+/*
+* Function: split_block_size
+* --------------------------
+*  Size of a block from its header
+*
+*  header: SPLIT_HEADER_SIZE bytes
+*
+*  returns: Block size with the header. If larger than SPLIT_MAX_BLOCK_SIZE (SIZE_MAX)
+*/
+size_t split_block_size(const unsigned char* header);
+
+/*
+* Function: split_tokens
+* ----------------------
+*  Turns a run of whole tokens into a split block
+*
+*  tokens: Token stream (no partial token at the end)
+*  size: Token stream size
+*  block: Output, at least SPLIT_BLOCK_BOUND(size) bytes
+*
+*  returns: Block size. If failed (-1)
+*/
+ssize_t split_tokens(const unsigned char* tokens, size_t size, unsigned char* block);
+
+/*
+* Function: parse_split_block
+* ---------------------------
+*  Locates the streams of the block at the start of data. The stream sizes are
+*  checked against the data, the streams themselves are not.
+*
+*  data: Block
+*  size: Bytes available at data (the block may be followed by more)
+*  block: Output streams
+*
+*  returns: If failed (0), On success (1)
+*/
+int parse_split_block(const unsigned char* data, size_t size, SplitBlock* block);
+
+/*
+* Function: join_tokens
+* ---------------------
+*  Turns a split block back into the token stream it was made of
+*
+*  block: Parsed block
+*  tokens: Output, at least TOKEN_SIZE * literal_count + LONG_MATCH_TOKEN_SIZE *
+*          sequence_count bytes
+*
+*  returns: Token stream size. If failed (-1)
+*/
+ssize_t join_tokens(const SplitBlock* block, unsigned char* tokens);
+
+/*
+* Reads one literal run length. Returns 0 if the stream ends inside it or it
+* doesn't fit in 32 bits.
+*/
+static inline int read_run(const unsigned char** run, const unsigned char* end, size_t* count) {
+    const unsigned char* p = *run;
+    if (p < end && *p < 0x80) {
+        *count = *p;
+        *run = p + 1;
+        return 1;
+    }
+    size_t value = 0;
+    for (int shift = 0; p < end && shift < 32; shift += 7) {
+        value |= (size_t) (*p & 0x7F) << shift;
+        if (*p++ < 0x80) {
+            *count = value;
+            *run = p;
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,23 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdio.h>
+
+// Content bytes per row of the per-block table (grown to keep at most STATS_MAX_BLOCKS rows)
+#define STATS_BLOCK_SIZE (1024 * 1024)
+#define STATS_MAX_BLOCKS 64
+
+/*
+* Function: print_stats
+* ---------------------
+*  Parses the token stream of a compressed file without decoding it and
+*  prints token counts, literal/match ratios, offset and length histograms,
+*  per-block ratios, and estimates for an entropy stage and a larger window.
+*
+*  input_file: Pointer to the compressed file
+*  name: File name used in the report
+*  report: Stream the report is written to
+*
+*  returns: If failed (0), On success (1)
+*/
+int print_stats(FILE* input_file, const char* name, FILE* report);
+#endif
@@ -15,7 +15,7 @@ void err(const char* func_name, const char* message);
 /*
 * Function open_file
 * ------------------
-*  Returns a file pointer
+*  Returns a file pointer (the error is recorded, not printed)
 *
 *  path: File path
 *  mode: fopen modes
@@ -0,0 +1,23 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+#include "lz7.h"
+
+#include <stdio.h>
+
+/*
+* Function: verify_files
+* ----------------------
+*  Tests the integrity of compressed files: every file is decoded with full
+*  token validation and its content checksum is verified, but the output is
+*  discarded. Files are spread over a pool of threads.
+*
+*  paths: Compressed file paths
+*  count: Number of paths
+*  options: Pool size (threads, 0: one per online CPU), buffer sizes and the
+*           window size of streams without a frame header
+*  results: One result per path (why it failed in the message)
+*
+*  returns: Number of files that failed the test. If failed (-1)
+*/
+int verify_files(char** paths, int count, const Lz7Options* options, Lz7TestResult* results);
+#endif
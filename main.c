@@ -1,29 +1,87 @@
-#include "include/constants.h"
-#include "include/compressor.h"
+#include "include/lz7.h"
 #include "include/utils.h"
 
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#define PROGRESS_INTERVAL (100 * 1024)
+
+// Long options without a short one
+#define OPT_DAEMON 256
+#define OPT_SERVER 257
+#define OPT_INLINE 258
+#define OPT_SERVER_STATS 259
+#define OPT_SERVER_STOP 260
+#define OPT_SPLIT 261
+#define OPT_APPEND 262
+#define OPT_PRIME 263
+#define OPT_TARGET 264
+#define OPT_ADAPTIVE 265
+
+static volatile sig_atomic_t stop_daemon = 0;
+
+static void request_stop(int signal) {
+    (void) signal;
+    stop_daemon = 1;
+}
+
+static int print_progress(void* user_data, uint64_t done, uint64_t total) {
+    (void) user_data;
+    printf("\rProcessing: %llu/%llu bytes...", (unsigned long long) done, (unsigned long long) total);
+    fflush(stdout);
+    return 0;
+}
+
+static void print_error(const Lz7Context* context) {
+    fprintf(stderr, "\n[ERROR]: %s\n", context->message);
+}
+
 int main(int argc, char* argv[]) {
     int opt;
     int compress_mode = 0;
     int decompress_mode = 0;
+    int test_mode = 0;
+    int stats_mode = 0;
+    int archive_mode = 0;
+    int extract_mode = 0;
+    int append_mode = 0;
     int output_file_mode = 0;
+    int inline_mode = 0;
+    // --daemon, --server-stats, --server-stop: LZ7_REMOTE_* of the request (0: serve)
+    int daemon_mode = 0;
+    int remote_op = 0;
+    char* socket_path = NULL;
     // int verbose_mode = 0;
     char* output_file_path = NULL;
     char* input_file_path = NULL;
-    size_t compressed_buffer_size = COMPRESSED_BUFFER_SIZE;
-    size_t decompressed_buffer_size = DECOMPRESSED_BUFFER_SIZE;
-    size_t window_size = WINDOW_SIZE;
+    Lz7Options options;
+    lz7_default_options(&options);
 
     // Setting up the CLI
-    while ((opt = getopt(argc, argv, "c:d:o:w:B:b:v")) != -1) {
+    static const struct option long_options[] = {
+        { "stats", required_argument, NULL, 'S' },
+        { "daemon", required_argument, NULL, OPT_DAEMON },
+        { "server", required_argument, NULL, OPT_SERVER },
+        { "inline", no_argument, NULL, OPT_INLINE },
+        { "server-stats", required_argument, NULL, OPT_SERVER_STATS },
+        { "server-stop", required_argument, NULL, OPT_SERVER_STOP },
+        { "split", no_argument, NULL, OPT_SPLIT },
+        { "append", required_argument, NULL, OPT_APPEND },
+        { "prime", no_argument, NULL, OPT_PRIME },
+        { "target-mbps", required_argument, NULL, OPT_TARGET },
+        { "adaptive", no_argument, NULL, OPT_ADAPTIVE },
+        { NULL, 0, NULL, 0 },
+    };
+    while ((opt = getopt_long(argc, argv, "c:d:t:S:A:X:o:w:B:b:l:m:T:f:LUv", long_options, NULL)) != -1) {
         switch (opt) {
             case 'c':
-                if (decompress_mode) {
+                if (decompress_mode || test_mode || stats_mode || archive_mode || extract_mode || append_mode) {
                     err("main", "Invalid flag combination!"
                                 "\n\tCan't use -c and -d at the same time.\n");
                     return EXIT_FAILURE;
@@ -38,7 +96,7 @@ int main(int argc, char* argv[]) {
                 strcpy(input_file_path, optarg);
                 break;
             case 'd':
-                if (compress_mode) {
+                if (compress_mode || test_mode || stats_mode || archive_mode || extract_mode || append_mode) {
                     err("main", "Invalid flag combination!"
                                 "\n\tCan't use -c and -d at the same time.\n");
                     return EXIT_FAILURE;
@@ -52,6 +110,29 @@ int main(int argc, char* argv[]) {
                 }
                 strcpy(input_file_path, optarg);
                 break;
+            case 't':
+            case 'S':
+            case 'A':
+            case 'X':
+            case OPT_APPEND:
+                if (compress_mode || decompress_mode || test_mode || stats_mode || archive_mode || extract_mode
+                    || append_mode) {
+                    err("main", "Invalid flag combination!"
+                                "\n\tCan't use -t, --stats, -A, -X or --append with -c, -d or each other.\n");
+                    return EXIT_FAILURE;
+                }
+                test_mode = opt == 't';
+                stats_mode = opt == 'S';
+                archive_mode = opt == 'A';
+                extract_mode = opt == 'X';
+                append_mode = opt == OPT_APPEND;
+                input_file_path = malloc(strlen(optarg) + 1);
+                if (input_file_path == NULL) {
+                    err("main", "Unable to allocate memory for input file name!\n");
+                    return EXIT_FAILURE;
+                }
+                strcpy(input_file_path, optarg);
+                break;
             case 'o':
                 output_file_mode = 1;
                 output_file_path = malloc(strlen(optarg) + 1);
@@ -61,44 +142,306 @@ int main(int argc, char* argv[]) {
                 }
                 strcpy(output_file_path, optarg);
                 break;
+            case OPT_DAEMON:
+            case OPT_SERVER_STATS:
+            case OPT_SERVER_STOP:
+                if (daemon_mode) {
+                    err("main", "Invalid flag combination!"
+                                "\n\tCan't use --daemon, --server-stats or --server-stop with each other.\n");
+                    return EXIT_FAILURE;
+                }
+                daemon_mode = 1;
+                remote_op = opt == OPT_SERVER_STATS ? LZ7_REMOTE_STATS
+                          : opt == OPT_SERVER_STOP ? LZ7_REMOTE_SHUTDOWN : 0;
+                socket_path = optarg;
+                break;
+            case OPT_SERVER:
+                socket_path = optarg;
+                break;
+            case OPT_INLINE:
+                inline_mode = 1;
+                break;
+            case 'L':
+                options.long_range = 1;
+                break;
+            case OPT_SPLIT:
+                options.split = 1;
+                break;
+            case OPT_PRIME:
+                options.prime = 1;
+                break;
+            case OPT_TARGET: {
+                size_t mbps = 0;
+                if (sscanf(optarg, "%zu", &mbps) == 1 && mbps >= 1) {
+                    options.target_mbps = mbps;
+                } else {
+                    err("main", "Invalid target throughput!\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case OPT_ADAPTIVE:
+                options.target_mbps = options.target_mbps > 0 ? options.target_mbps : LZ7_ADAPTIVE_MBPS;
+                break;
+            case 'U':
+                options.checked = 0;
+                break;
             case 'v':
                 // verbose_mode = 1;
                 break;
             case 'w': {
                 size_t w_size = 0;
-                if (scanf(optarg, "%zu", &w_size) == 1) {
-                    window_size = w_size;
+                if (sscanf(optarg, "%zu", &w_size) == 1) {
+                    options.window_size = w_size;
                 }
                 break;
             }
             case 'b': {
                 size_t c_buffer_size = 0;
-                if (scanf(optarg, "%zu", &c_buffer_size) == 1) {
-                    compressed_buffer_size = c_buffer_size;
+                if (sscanf(optarg, "%zu", &c_buffer_size) == 1) {
+                    options.buffer_size = c_buffer_size;
                 }
                 break;
             }
             case 'B': {
                 size_t d_buffer_size = 0;
-                if (scanf(optarg, "%zu", &d_buffer_size) == 1) {
-                    decompressed_buffer_size = d_buffer_size;
+                if (sscanf(optarg, "%zu", &d_buffer_size) == 1) {
+                    options.chunk_size = d_buffer_size;
+                }
+                break;
+            }
+            case 'l': {
+                int l = 0;
+                if (sscanf(optarg, "%d", &l) == 1 && (l == LZ7_LEVEL_FAST || l == LZ7_LEVEL_MAX)) {
+                    options.level = l;
+                } else if (strcasecmp(optarg, "max") == 0) {
+                    options.level = LZ7_LEVEL_MAX;
+                } else {
+                    err("main", "Invalid compression level!\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'm': {
+                int m = 0;
+                if (sscanf(optarg, "%d", &m) == 1 && m >= LZ7_MIN_MATCH_MIN && m <= LZ7_MIN_MATCH_MAX) {
+                    options.min_match = m;
+                } else {
+                    err("main", "Invalid minimum match length!\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'T': {
+                int t = 0;
+                if (sscanf(optarg, "%d", &t) == 1 && t >= 1 && t <= LZ7_MAX_THREADS) {
+                    options.threads = t;
+                } else {
+                    err("main", "Invalid number of threads!\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'f': {
+                // name[:stride[:row_size]]
+                char name[16] = {0};
+                sscanf(optarg, "%15[^:]:%zu:%zu", name, &options.filter_stride, &options.filter_row_size);
+                options.filter = lz7_parse_filter(name);
+                if (options.filter < 0) {
+                    err("main", "Invalid filter!\n");
+                    return EXIT_FAILURE;
                 }
                 break;
             }
             default:
-                fprintf(stderr, "[USAGE]: %s [-c filename] [-d filename] [-o output_file_name] [-v]"
+                fprintf(stderr, "[USAGE]: %s [-c filename] [-d filename] [-t filename...] [--stats filename...] [-A archive filename...] [-X archive] [-o output_file_name] [-l level] [-m min_match] [-T threads] [-L] [--split] [--adaptive | --target-mbps N] [-f filter] [-U] [-v]"
+                                "\n\t       %s --append filename [--prime] compressed_file"
+                                "\n\t       %s --daemon socket [-T threads] | --server-stats socket | --server-stop socket"
                                 "\n\t-c: compress file"
                                 "\n\t-d: decompress file"
+                                "\n\t-t: test compressed files (decode and verify the checksum, no output)"
+                                "\n\t--stats, -S: print token statistics of compressed files (no decoding)"
+                                "\n\t-A: archive files, every content-defined chunk is stored once"
+                                "\n\t-X: extract an archive (below the -o directory)"
+                                "\n\t--append: compress the file into a new frame at the end of compressed_file (or -o),"
+                                "\n\t    only the new data is compressed and the file is replaced atomically"
+                                "\n\t--prime: the appended frame starts with the end of the existing content as its window"
                                 "\n\t-o: output file"
                                 "\n\t-w: window slider (dictionary) size (default: %d bytes)"
                                 "\n\t-b: compressed buffer (reader/writer buffer) size (default: %d bytes)"
                                 "\n\t-B: decompressed buffer (chunck reader) size (default: %d bytes)"
-                                "\n\t-v: print logs\n\r", 
-                                argv[0], (WINDOW_SIZE), (COMPRESSED_BUFFER_SIZE), (DECOMPRESSED_BUFFER_SIZE));
+                                "\n\t-l: compression level, %d (greedy) or %d/'max' (optimal parse) (default: %d)"
+                                "\n\t-m: minimum match length, %d to %d (default: %d)"
+                                "\n\t-T: compress %d kb segments of one window on 1 to %d threads (greedy levels),"
+                                "\n\t    or test, archive or extract with that many threads (-t, -A, -X; default: one per CPU)"
+                                "\n\t-L: long range matching, also finds repeats further back than the window"
+                                "\n\t    anywhere in the file (streaming greedy encoder, no prefilter)"
+                                "\n\t--split: store literals, match lengths and offsets in separate streams per block"
+                                "\n\t    (faster decoding, smaller on literal-heavy data)"
+                                "\n\t--target-mbps: pick the effort of every %d kb block (chain depth, lazy matching,"
+                                "\n\t    optimal parse) to keep N MB/s, from the speed of the blocks before it"
+                                "\n\t--adaptive: the same, for %d MB/s (local compression only, no -T, no -L)"
+                                "\n\t-f: prefilter none|delta|channel|up|paeth|auto[:stride[:row_size]] (default: auto)"
+                                "\n\t--daemon: serve compress/decompress requests on a Unix socket (-T workers, default: one per CPU)"
+                                "\n\t--server: send -c/-d to the daemon on that socket, it works on the files directly"
+                                "\n\t--inline: send the data through the socket instead (the daemon can't open the files)"
+                                "\n\t--server-stats: print queue depth, request and latency statistics of a daemon"
+                                "\n\t--server-stop: serve the queued requests, then stop a daemon (same user only)"
+                                "\n\t-U: skip token validation when decompressing (trusted input only)"
+                                "\n\t-v: print logs"
+                                "\n\tCPU kernels: %s (LZ7_CPU=scalar|sse2|sse4.2|avx2|avx512 to cap)\n\r", 
+                                argv[0], argv[0], argv[0], (LZ7_WINDOW_SIZE), (LZ7_BUFFER_SIZE), (LZ7_CHUNK_SIZE),
+                                (LZ7_LEVEL_FAST), (LZ7_LEVEL_MAX), (LZ7_DEFAULT_LEVEL),
+                                (LZ7_MIN_MATCH_MIN), (LZ7_MIN_MATCH_MAX), (LZ7_MIN_MATCH_MIN),
+                                (LZ7_SEGMENT_SIZE / 1024), (LZ7_MAX_THREADS),
+                                (LZ7_ADAPTIVE_BLOCK_SIZE / 1024), (LZ7_ADAPTIVE_MBPS),
+                                lz7_cpu_name());
                 return EXIT_FAILURE;
         }
     }
 
+    Lz7Context context;
+    lz7_init(&context, &options);
+
+    // Daemon: --daemon socket, runs until SIGINT/SIGTERM or --server-stop
+    if (daemon_mode && remote_op == 0) {
+        if (compress_mode || decompress_mode || test_mode || stats_mode || archive_mode || extract_mode || append_mode) {
+            err("main", "Invalid flag combination!\n\tCan't use --daemon with another mode.\n");
+            return EXIT_FAILURE;
+        }
+        struct sigaction action = { .sa_handler = request_stop };
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        printf("Serving on %s\n", socket_path);
+        fflush(stdout);
+        int result = lz7_serve(&context, socket_path, &stop_daemon) == LZ7_OK;
+        if (!result) {
+            print_error(&context);
+        }
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Daemon control: --server-stats socket, --server-stop socket
+    if (daemon_mode) {
+        int result = lz7_remote(&context, socket_path, remote_op, NULL,
+                                remote_op == LZ7_REMOTE_STATS ? stdout : NULL, 0) == LZ7_OK;
+        if (!result) {
+            print_error(&context);
+        }
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Integrity test mode: -t file [file...]
+    if (test_mode) {
+        int count = 1 + argc - optind;
+        char** paths = malloc(count * sizeof(char*));
+        Lz7TestResult* results = malloc(count * sizeof(Lz7TestResult));
+        if (paths == NULL || results == NULL) {
+            err("main", "Unable to allocate memory for the file list!\n");
+            return EXIT_FAILURE;
+        }
+        paths[0] = input_file_path;
+        for (int i = optind; i < argc; i++) {
+            paths[1 + i - optind] = argv[i];
+        }
+        int failed = lz7_test_files(&context, paths, count, results);
+        if (failed < 0) {
+            print_error(&context);
+        }
+        for (int i = 0; failed >= 0 && i < count; i++) {
+            printf("%s: %s%s\n", paths[i], results[i].ok ? "OK" : "FAILED",
+                   results[i].ok && !results[i].has_checksum ? " (no checksum, tokens only)" : "");
+            if (!results[i].ok) {
+                fflush(stdout);
+                fprintf(stderr, "[ERROR]: %s\n", results[i].message);
+            }
+        }
+        if (failed >= 0) {
+            printf("\nTested %d file(s), %d failed.\n", count, failed);
+        }
+        free(results);
+        free(paths);
+        free(input_file_path);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Token statistics: --stats file [file...]
+    if (stats_mode) {
+        int failed = 0;
+        for (int i = optind - 1; i < argc; i++) {
+            const char* path = i < optind ? input_file_path : argv[i];
+            FILE* input_file = fopen(path, "rb");
+            if (input_file == NULL) {
+                fprintf(stderr, "\n[ERROR]: main() {} -> Unable to open '%s'!\n", path);
+                failed++;
+                continue;
+            }
+            if (lz7_print_stats(&context, input_file, path, stdout) != LZ7_OK) {
+                print_error(&context);
+                failed++;
+            }
+            fclose(input_file);
+        }
+        free(input_file_path);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Deduplicating archive: -A archive file [file...], -X archive [-o dir]
+    if (archive_mode || extract_mode) {
+        int result = 0;
+        Lz7ArchiveSummary summary;
+        if (archive_mode && optind < argc) {
+            result = lz7_create_archive(&context, input_file_path, argv + optind, argc - optind, &summary) == LZ7_OK;
+            if (result) {
+                printf("Archived %zu file(s): %llu bytes -> %llu bytes, %zu unique of %zu chunks (%llu bytes deduplicated)\n",
+                       summary.files, (unsigned long long) summary.input_bytes,
+                       (unsigned long long) summary.archive_bytes, summary.unique_chunks, summary.chunks,
+                       (unsigned long long) summary.duplicate_bytes);
+            }
+        } else if (archive_mode) {
+            err("main", "No files to archive!\n");
+        } else {
+            result = lz7_extract_archive(&context, input_file_path, output_file_path, &summary) == LZ7_OK;
+            if (result) {
+                printf("Extracted %zu file(s)\n", summary.files);
+            }
+        }
+        if (!result && context.error != LZ7_OK) {
+            print_error(&context);
+        }
+        free(output_file_path);
+        free(input_file_path);
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Append mode: --append file [--prime] compressed_file (or -o compressed_file)
+    if (append_mode) {
+        const char* target_path = output_file_mode ? output_file_path : optind < argc ? argv[optind] : NULL;
+        FILE* input_file = target_path != NULL ? fopen(input_file_path, "rb") : NULL;
+        if (target_path == NULL) {
+            err("main", "No compressed file to append to!\n");
+        } else if (input_file == NULL) {
+            fprintf(stderr, "\n[ERROR]: main() {} -> Unable to open '%s'!\n", input_file_path);
+        }
+        int result = 0;
+        if (input_file != NULL) {
+            lz7_set_progress(&context, print_progress, NULL, PROGRESS_INTERVAL);
+            clock_t start_time = clock();
+            result = lz7_append_file(&context, input_file, target_path) == LZ7_OK;
+            double time_spent = (double) (clock() - start_time) / CLOCKS_PER_SEC;
+            if (result) {
+                printf("\rAppended (%f s): %zu bytes -> %s\n", time_spent, get_file_size(input_file), target_path);
+            } else {
+                print_error(&context);
+            }
+            fclose(input_file);
+        }
+        free(output_file_path);
+        free(input_file_path);
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     // Compression mode:
     if (compress_mode && !decompress_mode) {
         // If user did not specify an output path, add '.lz7' at the end of the input file
@@ -113,14 +456,34 @@ int main(int argc, char* argv[]) {
             output_file_path[output_file_size - 1] = '\0';
         }
 
-        FILE* input_file = open_file(input_file_path, "rb");
-        FILE* output_file = open_file(output_file_path, "wb");
+        FILE* input_file = fopen(input_file_path, "rb");
+        FILE* output_file = input_file != NULL ? fopen(output_file_path, "wb") : NULL;
 
         if (input_file == NULL || output_file == NULL) {
+            fprintf(stderr, "\n[ERROR]: main() {} -> Unable to open '%s'!\n",
+                    input_file == NULL ? input_file_path : output_file_path);
+            if (input_file != NULL) {
+                fclose(input_file);
+            }
             return EXIT_FAILURE;
         }
 
-        int result = compress(input_file, output_file, compressed_buffer_size, decompressed_buffer_size, window_size);
+        lz7_set_progress(&context, print_progress, NULL, PROGRESS_INTERVAL);
+        clock_t start_time = clock();
+        int result = (socket_path != NULL ? lz7_remote(&context, socket_path, LZ7_REMOTE_COMPRESS, input_file,
+                                                       output_file, inline_mode)
+                                          : lz7_compress_file(&context, input_file, output_file)) == LZ7_OK;
+        double time_spent = (double) (clock() - start_time) / CLOCKS_PER_SEC;
+        if (result) {
+            size_t file_size = get_file_size(input_file);
+            long compressed_file_size = ftell(output_file);
+            long size_diff = (long) file_size - compressed_file_size;
+            double compression_rate = file_size > 0 ? (double) labs(size_diff) / file_size * 100 : 0;
+            printf("\rFinished processing (%f s): %zu bytes -> %ld bytes (%s%.2f%%)\n", time_spent, file_size,
+                   compressed_file_size, size_diff > 0 ? "-" : "+", compression_rate);
+        } else {
+            print_error(&context);
+        }
         fclose(input_file);
         fclose(output_file);
         printf("\n\t--->> Compression ");
@@ -165,14 +528,31 @@ int main(int argc, char* argv[]) {
             }
         }
 
-        FILE* input_file = open_file(input_file_path, "rb");
-        FILE* output_file = open_file(output_file_path, "wb");
+        // Long matches are read back from the output
+        FILE* input_file = fopen(input_file_path, "rb");
+        FILE* output_file = input_file != NULL ? fopen(output_file_path, "w+b") : NULL;
 
         if (input_file == NULL || output_file == NULL) {
+            fprintf(stderr, "\n[ERROR]: main() {} -> Unable to open '%s'!\n",
+                    input_file == NULL ? input_file_path : output_file_path);
+            if (input_file != NULL) {
+                fclose(input_file);
+            }
             return EXIT_FAILURE;
         }
 
-        int result = decompress(input_file, output_file, compressed_buffer_size, decompressed_buffer_size, window_size);
+        lz7_set_progress(&context, print_progress, NULL, PROGRESS_INTERVAL);
+        clock_t start_time = clock();
+        int result = (socket_path != NULL ? lz7_remote(&context, socket_path, LZ7_REMOTE_DECOMPRESS, input_file,
+                                                       output_file, inline_mode)
+                                          : lz7_decompress_file(&context, input_file, output_file)) == LZ7_OK;
+        double time_spent = (double) (clock() - start_time) / CLOCKS_PER_SEC;
+        if (result) {
+            printf("\rFinished Processing (%f s): %zu bytes -> %ld bytes.\n", time_spent,
+                   get_file_size(input_file), ftell(output_file));
+        } else {
+            print_error(&context);
+        }
         fclose(input_file);
         fclose(output_file);
         printf("\n\t--->> Decompression ");
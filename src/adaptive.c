@@ -0,0 +1,216 @@
+#include "../include/adaptive.h"
+#include "../include/lz77.h"
+#include "../include/hash.h"
+#include "../include/optimal.h"
+#include "../include/buffer.h"
+#include "../include/cpu.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    uint32_t depth;     // Chain entries compared (0: optimal parse)
+    int lazy;
+    int skip;           // Long literal runs are searched at fewer positions
+} AdaptiveStep;
+
+// From the fastest step to the smallest output
+static const AdaptiveStep steps[ADAPTIVE_STEPS] = {
+    { 4, 0, 1 },
+    { 16, 0, 0 },
+    { MAX_CHAIN_SIZE, 0, 0 },  // The greedy levels
+    { MAX_CHAIN_SIZE, 1, 0 },
+    { 0, 0, 0 },               // LEVEL_MAX
+};
+
+typedef struct {
+    double speed[ADAPTIVE_STEPS];   // Parsed bytes per second (0: not measured)
+    double ratio[ADAPTIVE_STEPS];   // Token bytes per input byte (0: not measured)
+    int step;
+    size_t blocks;                  // Blocks since the estimates were dropped
+} Controller;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Half of every estimate is the newest block
+static double smooth(double estimate, double sample) {
+    return estimate > 0 ? (estimate + sample) / 2 : sample;
+}
+
+// Parse time of size bytes at step, from the nearest measured step
+static double predict(const Controller* controller, int step, size_t size) {
+    double factor = 1;
+    for (int distance = 0; distance < ADAPTIVE_STEPS; distance++) {
+        if (step - distance >= 0 && controller->speed[step - distance] > 0) {
+            return size / controller->speed[step - distance] * factor;
+        }
+        if (step + distance < ADAPTIVE_STEPS && controller->speed[step + distance] > 0) {
+            return size / controller->speed[step + distance] / factor;
+        }
+        factor *= ADAPTIVE_STEP_COST;
+    }
+    return 0;
+}
+
+/*
+* The hardest step (at most one above the current one) whose parse fits the
+* budget. A step that didn't pay for itself last time is skipped.
+*/
+static int next_step(const Controller* controller, size_t size, double budget) {
+    int current = controller->step;
+    int top = current + 1 < ADAPTIVE_STEPS ? current + 1 : current;
+    for (int step = top; step > 0; step--) {
+        double limit = step > current ? budget * ADAPTIVE_HEADROOM / 100 : budget;
+        if (step > current && controller->ratio[step] > 0
+            && controller->ratio[step] > controller->ratio[current] * (100 - ADAPTIVE_MIN_GAIN) / 100) {
+            continue;
+        }
+        if (predict(controller, step, size) <= limit) {
+            return step;
+        }
+    }
+    return 0;
+}
+
+/*
+* Greedy parse of data[history .. size). The chains hold the history unless
+* stale (the last block was parsed without them).
+*/
+static int parse_greedy(LZWriter* lz_writer, HashTable* hash_table, unsigned char* data, size_t history,
+                        size_t size, int stale, int skip) {
+    Buffer buffer = { .data = data, .pos = 0, .size = size, .max_size = size };
+    if (stale) {
+        for (; buffer.pos < history; buffer.pos++) {
+            update_hash_table(hash_table, &buffer, lz_writer->window_size);
+        }
+    }
+    buffer.pos = history;
+    size_t misses = 0;
+    while (buffer.pos < size) {
+        ssize_t result = write_lz(lz_writer, hash_table, &buffer);
+        if (result < 1) {
+            return 0;
+        }
+        buffer.pos += result;
+
+        // Every ADAPTIVE_SKIP_RUN literals in a row, one more byte goes out unsearched
+        misses = result == 1 ? misses + 1 : 0;
+        for (size_t n = skip ? misses / ADAPTIVE_SKIP_RUN : 0; n > 0 && buffer.pos < size; n--) {
+            if (write_literal(lz_writer, data[buffer.pos++]) < 1) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+ssize_t encode_adaptive(LZWriter* lz_writer, FILE* input_file) {
+    if (lz_writer == NULL || input_file == NULL || lz_writer->target == 0) {
+        set_error(LZ7_ERROR_PARAMETER, "encode_adaptive", "Required parameters are NULL!");
+        return -1;
+    }
+
+    size_t file_size = get_file_size(input_file);
+    size_t block_size = file_size < ADAPTIVE_BLOCK_SIZE ? file_size : ADAPTIVE_BLOCK_SIZE;
+    block_size = block_size > 0 ? block_size : 1;
+    size_t window = lz_writer->window_size > MAX_OFFSET ? MAX_OFFSET : lz_writer->window_size;
+    unsigned char* data = malloc(window + block_size);
+    HashTable hash_table = { .items = NULL };
+    if (data == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "encode_adaptive", "Unable to allocate memory for the block!");
+        return -1;
+    }
+    if (!init_hash_table(&hash_table, lz_writer->min_match, window + block_size)) {
+        free(data);
+        return -1;
+    }
+
+    Controller controller = { .step = lz_writer->level >= LEVEL_MAX ? ADAPTIVE_STEPS - 1 : ADAPTIVE_GREEDY_STEP };
+    ssize_t processed = 0;
+    // A primed window starts with the content before the input
+    size_t history = lz_writer->prime_size < window ? lz_writer->prime_size : window;
+    if (history > 0) {
+        memcpy(data, lz_writer->prime + lz_writer->prime_size - history, history);
+    }
+    int stale = 1;
+    for (;;) {
+        double start = now();
+        size_t read_bytes = fread(data + history, sizeof(unsigned char), block_size, input_file);
+        if (read_bytes == 0) {
+            break;
+        }
+        lz_writer->checksum = cpu_kernels()->crc32c(lz_writer->checksum, data + history, read_bytes);
+        if (!filter_forward(&lz_writer->filter, data + history, read_bytes)) {
+            processed = -1;
+            break;
+        }
+
+        // The writes of the tokens count as parse time, a slow output slows the step down
+        const AdaptiveStep* step = &steps[controller.step];
+        size_t size = history + read_bytes;
+        size_t tokens = lz_writer->flushed + lz_writer->buffer_pos;
+        double parse_start = now();
+        int parsed = 0;
+        if (step->depth == 0) {
+            parsed = parse_optimal_block(lz_writer, data, history, size, window) >= 0;
+            stale = 1;
+        } else {
+            hash_table.depth = step->depth;
+            lz_writer->lazy = step->lazy;
+            parsed = parse_greedy(lz_writer, &hash_table, data, history, size, stale, step->skip);
+            stale = 0;
+        }
+        if (!parsed) {
+            set_error(LZ7_ERROR, "encode_adaptive", "Unable to parse the block!");
+            processed = -1;
+            break;
+        }
+        double end = now();
+
+        // Estimates of the step that ran, then the next step for what is left of the budget
+        int current = controller.step;
+        double parse_time = end - parse_start > 1e-9 ? end - parse_start : 1e-9;
+        // A busier or idler CPU slows down or speeds up every step alike
+        double speed = smooth(controller.speed[current], read_bytes / parse_time);
+        for (int i = 0; i < ADAPTIVE_STEPS; i++) {
+            controller.speed[i] = i == current || controller.speed[current] == 0 ? controller.speed[i]
+                : controller.speed[i] * speed / controller.speed[current];
+        }
+        controller.speed[current] = speed;
+        controller.ratio[current] = smooth(controller.ratio[current],
+                                           (double) (lz_writer->flushed + lz_writer->buffer_pos - tokens) / read_bytes);
+        double budget = (double) read_bytes / lz_writer->target - (parse_start - start);
+        controller.step = budget > 0 ? next_step(&controller, read_bytes, budget) : 0;
+        if (++controller.blocks == ADAPTIVE_PROBE_BLOCKS) {
+            for (int i = 0; i < ADAPTIVE_STEPS; i++) {
+                controller.ratio[i] = i == controller.step ? controller.ratio[i] : 0;
+            }
+            controller.blocks = 0;
+        }
+
+        // Keep the tail of the block as history for the next one
+        history = size < window ? size : window;
+        memmove(data, data + size - history, history);
+        slide_hash_table(&hash_table, size - history);
+        lz_writer->hashed = NO_TOKEN;
+
+        processed += read_bytes;
+        if (!report_progress(&lz_writer->progress, processed, file_size)) {
+            processed = -1;
+            break;
+        }
+    }
+
+    free_hash_table(&hash_table);
+    free(data);
+    return processed;
+}
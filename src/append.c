@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include "../include/append.h"
+#include "../include/compressor.h"
+#include "../include/frame.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+* Copies the first size bytes of input to output (an empty file) and leaves
+* the output position after them. A reflink shares the blocks, then the
+* kernel copies, then a plain read/write loop.
+*/
+static int copy_frames(int input, int output, uint64_t size) {
+#ifdef FICLONE
+    if (ioctl(output, FICLONE, input) == 0) {
+        return ftruncate(output, size) == 0 && lseek(output, size, SEEK_SET) == (off_t) size;
+    }
+#endif
+    uint64_t done = 0;
+    loff_t position = 0;
+    while (done < size) {
+        ssize_t copied = copy_file_range(input, &position, output, NULL, size - done, 0);
+        if (copied <= 0) {
+            break;
+        }
+        done += copied;
+    }
+
+    unsigned char* buffer = done < size ? malloc(APPEND_COPY_SIZE) : NULL;
+    if (done < size && buffer == NULL) {
+        return 0;
+    }
+    while (done < size) {
+        size_t step = size - done < APPEND_COPY_SIZE ? size - done : APPEND_COPY_SIZE;
+        ssize_t read_bytes = pread(input, buffer, step, done);
+        if (read_bytes <= 0 || write(output, buffer, read_bytes) != read_bytes) {
+            break;
+        }
+        done += read_bytes;
+    }
+    free(buffer);
+    return done == size;
+}
+
+/*
+* The last size bytes of content before the new frame: the tail kept in the
+* index, or the end of the decoded file
+*/
+static unsigned char* read_prime(FILE* target, const FrameIndex* index, const Lz7Options* options, size_t* size) {
+    size_t window = options->window_size < FRAME_MAX_TAIL_SIZE ? options->window_size : FRAME_MAX_TAIL_SIZE;
+    *size = index->tail_size > 0 ? index->tail_size : index->content_size;
+    *size = *size < window ? *size : window;
+    unsigned char* prime = malloc(*size > 0 ? *size : 1);
+    if (prime == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "append_file", "Unable to allocate memory for the primed window!");
+        return NULL;
+    }
+    if (index->tail_size > 0) {
+        memcpy(prime, index->tail + index->tail_size - *size, *size);
+        return prime;
+    }
+
+    FILE* content = tmpfile();
+    fseek(target, 0, SEEK_SET);
+    int result = content != NULL && decompress(target, content, options, NULL) && fflush(content) == 0;
+    long end = result ? ftell(content) : -1;
+    if (!result || end < (long) *size || pread(fileno(content), prime, *size, end - *size) != (ssize_t) *size) {
+        if (last_error() == LZ7_OK) {
+            set_error(LZ7_ERROR_IO, "append_file", "Unable to decode the end of the existing content!");
+        }
+        free(prime);
+        prime = NULL;
+    }
+    if (content != NULL) {
+        fclose(content);
+    }
+    return prime;
+}
+
+/*
+* The last window of content after the new frame: the end of the input,
+* after the end of the content before it
+*/
+static int read_tail(FILE* input_file, const unsigned char* prime, size_t prime_size, size_t input_size,
+                     size_t window, FrameIndex* index) {
+    window = window < FRAME_MAX_TAIL_SIZE ? window : FRAME_MAX_TAIL_SIZE;
+    size_t from_input = input_size < window ? input_size : window;
+    size_t from_prime = window - from_input < prime_size ? window - from_input : prime_size;
+    index->tail_size = from_prime + from_input;
+    index->tail = malloc(index->tail_size > 0 ? index->tail_size : 1);
+    if (index->tail == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "append_file", "Unable to allocate memory for the index tail!");
+        return 0;
+    }
+    memcpy(index->tail, prime + prime_size - from_prime, from_prime);
+    if (fseek(input_file, input_size - from_input, SEEK_SET) != 0
+        || fread(index->tail + from_prime, sizeof(unsigned char), from_input, input_file) < from_input) {
+        set_error(LZ7_ERROR_IO, "append_file", "Unable to read the end of the input!");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+* Opens the target and locks it until it is closed. A concurrent append waits
+* for the lock, then finds the file renamed over the one it locked and opens
+* that one instead. NULL with errno ENOENT: there is no target yet.
+*/
+static FILE* lock_target(const char* path) {
+    while (1) {
+        FILE* target = fopen(path, "rb");
+        if (target == NULL) {
+            return NULL;
+        }
+        struct stat locked;
+        struct stat current;
+        if (flock(fileno(target), LOCK_EX) != 0 || fstat(fileno(target), &locked) != 0) {
+            int error = errno;
+            fclose(target);
+            errno = error;
+            return NULL;
+        }
+        if (stat(path, &current) == 0 && current.st_dev == locked.st_dev && current.st_ino == locked.st_ino) {
+            return target;
+        }
+        fclose(target);
+    }
+}
+
+// The rename is durable once the directory is
+static void sync_directory(const char* path) {
+    char* copy = strdup(path);
+    int fd = copy != NULL ? open(dirname(copy), O_RDONLY | O_DIRECTORY) : -1;
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(copy);
+}
+
+int append_file(FILE* input_file, const char* path, const Lz7Options* options, const Progress* progress) {
+    if (input_file == NULL || path == NULL || options == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "append_file", "Required parameters are NULL!");
+        return 0;
+    }
+
+    // The frames so far: the index of a multi-frame file, a plain frame or nothing
+    FrameIndex index = { .entries = NULL, .tail = NULL, .count = 0, .tail_size = 0, .offset = 0, .content_size = 0 };
+    FrameEntry* entries = NULL;
+    unsigned char* prime = NULL;
+    size_t prime_size = 0;
+    char* temp_path = NULL;
+    FILE* output_file = NULL;
+    int fd = -1;
+    int result = 0;
+    mode_t mode = 0644;
+    FILE* target = lock_target(path);
+    if (target == NULL && errno != ENOENT) {
+        set_error(LZ7_ERROR_IO, "append_file", "Unable to open '%s'!", path);
+        return 0;
+    }
+    if (target != NULL) {
+        struct stat status;
+        if (fstat(fileno(target), &status) == 0) {
+            mode = status.st_mode & 07777;
+        }
+        int indexed = read_frame_index(target, &index);
+        if (indexed < 0) {
+            goto cleanup;
+        }
+        FrameHeader header;
+        if (indexed == 0 && (read_frame_header(target, &header) <= 0 || (header.flags & FRAME_FLAG_PRIMED))) {
+            set_error(LZ7_ERROR_UNSUPPORTED, "append_file", "'%s' is not a frame, only frames can be appended to!", path);
+            goto cleanup;
+        }
+        if (indexed == 0) {
+            index.count = 1;
+            index.entries = malloc(sizeof(FrameEntry));
+            index.offset = get_file_size(target);
+            index.content_size = header.content_size;
+            if (index.entries == NULL) {
+                set_error(LZ7_ERROR_MEMORY, "append_file", "Unable to allocate memory for the frame index!");
+                goto cleanup;
+            }
+            index.entries[0] = (FrameEntry) { .offset = 0, .size = index.offset, .content_size = header.content_size };
+        }
+    }
+    if (index.count >= FRAME_MAX_COUNT) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "append_file", "'%s' has the most frames a file can have!", path);
+        goto cleanup;
+    }
+    if (options->prime && index.content_size > 0
+        && (prime = read_prime(target, &index, options, &prime_size)) == NULL) {
+        goto cleanup;
+    }
+
+    // The new file is written next to the target and replaces it at once
+    temp_path = malloc(strlen(path) + strlen(".XXXXXX") + 1);
+    if (temp_path == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "append_file", "Unable to allocate memory for the file name!");
+        goto cleanup;
+    }
+    sprintf(temp_path, "%s.XXXXXX", path);
+    fd = mkstemp(temp_path);
+    if (fd < 0) {
+        set_error(LZ7_ERROR_IO, "append_file", "Unable to create a temporary file next to '%s'!", path);
+        free(temp_path);
+        temp_path = NULL;
+        goto cleanup;
+    }
+    if (fchmod(fd, mode) != 0 || (target != NULL && !copy_frames(fileno(target), fd, index.offset))
+        || (output_file = fdopen(fd, "w+b")) == NULL || fseeko(output_file, index.offset, SEEK_SET) != 0) {
+        set_error(LZ7_ERROR_IO, "append_file", "Unable to copy the frames of '%s'!", path);
+        goto cleanup;
+    }
+
+    size_t input_size = get_file_size(input_file);
+    if (!compress_frame(input_file, output_file, options, progress, prime, prime_size)) {
+        goto cleanup;
+    }
+    off_t frame_end = ftello(output_file);
+    entries = realloc(index.entries, (index.count + 1) * sizeof(FrameEntry));
+    if (entries == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "append_file", "Unable to allocate memory for the frame index!");
+        goto cleanup;
+    }
+    index.entries = entries;
+    index.entries[index.count++] = (FrameEntry) {
+        .offset = index.offset,
+        .size = frame_end - index.offset,
+        .content_size = input_size,
+        .primed = prime_size,
+    };
+    index.offset = frame_end;
+    index.content_size += input_size;
+
+    // The tail of a primed file moves on with it, without priming it is dropped
+    free(index.tail);
+    index.tail = NULL;
+    index.tail_size = 0;
+    if (options->prime && !read_tail(input_file, prime, prime_size, input_size, options->window_size, &index)) {
+        goto cleanup;
+    }
+    if (!write_frame_index(output_file, &index)) {
+        goto cleanup;
+    }
+    if (fflush(output_file) != 0 || fsync(fd) != 0) {
+        set_error(LZ7_ERROR_IO, "append_file", "Unable to write '%s'!", temp_path);
+        goto cleanup;
+    }
+    // The lock on the target is held until it is replaced, a new file must not replace one made meanwhile
+    if (target == NULL && renameat2(AT_FDCWD, temp_path, AT_FDCWD, path, RENAME_NOREPLACE) != 0) {
+        set_error(LZ7_ERROR_IO, "append_file", errno == EEXIST ? "'%s' was created by another append!"
+                  : "Unable to create '%s'!", path);
+        goto cleanup;
+    }
+    if (target != NULL && rename(temp_path, path) != 0) {
+        set_error(LZ7_ERROR_IO, "append_file", "Unable to replace '%s'!", path);
+        goto cleanup;
+    }
+    sync_directory(path);
+    result = 1;
+
+cleanup:
+    if (output_file != NULL) {
+        fclose(output_file);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    if (!result && temp_path != NULL) {
+        unlink(temp_path);
+    }
+    if (target != NULL) {
+        fclose(target);
+    }
+    free(temp_path);
+    free(prime);
+    free_frame_index(&index);
+    return result;
+}
@@ -0,0 +1,800 @@
+#include "../include/archive.h"
+#include "../include/buffer.h"
+#include "../include/cpu.h"
+#include "../include/hash.h"
+#include "../include/lz77.h"
+#include "../include/parallel.h"
+#include "../include/sha256.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHUNK_AVERAGE_SIZE ((size_t) 1 << CHUNK_AVERAGE_BITS)
+// Top bits of the Gear hash (they depend on the last 64 bytes)
+#define CHUNK_MASK_HARD (~0ULL << (64 - CHUNK_AVERAGE_BITS - 2))
+#define CHUNK_MASK_EASY (~0ULL << (64 - CHUNK_AVERAGE_BITS + 2))
+#define FILE_RECORD_SIZE 14
+
+typedef struct {
+    unsigned char hash[SHA256_SIZE];
+    uint64_t position;      // Archive position of the stored data
+    uint32_t stored_size;
+    uint32_t size;
+    uint32_t checksum;      // CRC-32C of the chunk
+    uint8_t method;
+} ChunkEntry;
+
+typedef struct {
+    char* path;
+    uint64_t size;
+    uint32_t* chunks;       // Chunk ids in file order
+    size_t chunk_count;
+    size_t chunk_capacity;
+} FileEntry;
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t file;            // Owner file and the chunk's place in it
+    size_t index;
+} ChunkJob;
+
+typedef struct {
+    FILE* file;
+    size_t window_size;
+    int min_match;
+    ChunkEntry* chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    uint32_t* map;          // Open addressing on the hash, chunk id + 1 (0: empty)
+    size_t map_mask;
+    FileEntry* files;
+    size_t file_count;
+    ChunkJob queue[ARCHIVE_QUEUE_SIZE];
+    size_t queue_head;
+    size_t queue_count;
+    int closing;            // No more jobs, idle workers exit
+    int failed;
+    ErrorState error;       // Why the first worker failed
+    uint64_t stored_bytes;
+    pthread_mutex_t lock;   // Guards everything above but the file's position
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} Archive;
+
+typedef struct {
+    const char* archive_path;
+    const char* output_dir;
+    size_t reader_buffer_size;
+    size_t window_size;
+    uint64_t data_end;      // Chunk data ends where the index starts
+    ChunkEntry* chunks;
+    size_t chunk_count;
+    FileEntry* files;
+    size_t file_count;
+    size_t next;            // Next file to extract (guarded by lock)
+    int failed;
+    ErrorState error;       // Why the first file failed
+    pthread_mutex_t lock;
+} Extraction;
+
+static uint64_t gear[256];
+
+// splitmix64 with a fixed seed: cut points must never change
+__attribute__((constructor))
+static void init_gear(void) {
+    uint64_t seed = 0x4C5A3741ULL;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+static void put_le(unsigned char* p, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get_le(const unsigned char* p, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/*
+* FastCDC: length of the next chunk of data (the whole rest if it is shorter
+* than CHUNK_MIN_SIZE, at most CHUNK_MAX_SIZE)
+*/
+static size_t cut_chunk(const unsigned char* data, size_t size) {
+    if (size <= CHUNK_MIN_SIZE) {
+        return size;
+    }
+    size_t limit = size < CHUNK_MAX_SIZE ? size : CHUNK_MAX_SIZE;
+    size_t normal = CHUNK_AVERAGE_SIZE < limit ? CHUNK_AVERAGE_SIZE : limit;
+    uint64_t hash = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_HARD) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_EASY) == 0) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+static void free_files(FileEntry* files, size_t count) {
+    for (size_t i = 0; files != NULL && i < count; i++) {
+        free(files[i].path);
+        free(files[i].chunks);
+    }
+    free(files);
+}
+
+// Chunk id of the hash, a new one if it is not known yet (lock held)
+static long find_or_add_chunk(Archive* archive, const unsigned char* hash, int* added) {
+    if ((archive->chunk_count + 1) * 2 > archive->map_mask + 1) {
+        size_t mask = archive->map_mask * 2 + 1;
+        uint32_t* map = calloc(mask + 1, sizeof(uint32_t));
+        if (map == NULL) {
+            return -1;
+        }
+        for (size_t id = 0; id < archive->chunk_count; id++) {
+            uint64_t key;
+            memcpy(&key, archive->chunks[id].hash, sizeof(key));
+            size_t slot = key & mask;
+            while (map[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            map[slot] = id + 1;
+        }
+        free(archive->map);
+        archive->map = map;
+        archive->map_mask = mask;
+    }
+
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));
+    size_t slot = key & archive->map_mask;
+    for (; archive->map[slot] != 0; slot = (slot + 1) & archive->map_mask) {
+        uint32_t id = archive->map[slot] - 1;
+        if (memcmp(archive->chunks[id].hash, hash, SHA256_SIZE) == 0) {
+            *added = 0;
+            return id;
+        }
+    }
+
+    if (archive->chunk_count == archive->chunk_capacity) {
+        size_t capacity = archive->chunk_capacity > 0 ? archive->chunk_capacity * 2 : 1024;
+        ChunkEntry* chunks = realloc(archive->chunks, capacity * sizeof(ChunkEntry));
+        if (chunks == NULL) {
+            return -1;
+        }
+        archive->chunks = chunks;
+        archive->chunk_capacity = capacity;
+    }
+    size_t id = archive->chunk_count++;
+    memset(&archive->chunks[id], 0, sizeof(ChunkEntry));
+    memcpy(archive->chunks[id].hash, hash, SHA256_SIZE);
+    archive->map[slot] = id + 1;
+    *added = 1;
+    return id;
+}
+
+/*
+* Hashes a chunk, and compresses and writes it if the hash is new. Every
+* chunk is encoded on its own, so any file decodes without the others.
+*/
+static int store_chunk(Archive* archive, HashTable* hash_table, LZWriter* writer, const ChunkJob* job) {
+    unsigned char hash[SHA256_SIZE];
+    sha256(job->data, job->size, hash);
+
+    pthread_mutex_lock(&archive->lock);
+    int added = 0;
+    long id = find_or_add_chunk(archive, hash, &added);
+    if (id >= 0) {
+        archive->files[job->file].chunks[job->index] = id;
+    }
+    pthread_mutex_unlock(&archive->lock);
+    if (id < 0) {
+        set_error(LZ7_ERROR_MEMORY, "store_chunk", "Unable to allocate memory for the chunk table!");
+        return 0;
+    }
+    if (!added) {
+        return 1;
+    }
+
+    reset_hash_table(hash_table);
+    Buffer buffer = { .data = job->data, .pos = 0, .size = job->size, .max_size = job->size };
+    reset_writer(writer);
+    while (buffer.pos < buffer.size) {
+        ssize_t result = write_lz(writer, hash_table, &buffer);
+        if (result < 1) {
+            return 0;
+        }
+        buffer.pos += result;
+    }
+    int method = writer->buffer_pos < job->size ? CHUNK_LZ : CHUNK_STORED;
+    const unsigned char* data = method == CHUNK_LZ ? writer->buffer : job->data;
+    size_t stored_size = method == CHUNK_LZ ? writer->buffer_pos : job->size;
+    uint32_t checksum = cpu_kernels()->crc32c(0, job->data, job->size);
+
+    pthread_mutex_lock(&archive->lock);
+    long position = ftell(archive->file);
+    int result = position >= 0 && fwrite(data, sizeof(unsigned char), stored_size, archive->file) == stored_size;
+    ChunkEntry* chunk = &archive->chunks[id];
+    chunk->position = position;
+    chunk->stored_size = stored_size;
+    chunk->size = job->size;
+    chunk->checksum = checksum;
+    chunk->method = method;
+    archive->stored_bytes += stored_size;
+    pthread_mutex_unlock(&archive->lock);
+    if (!result) {
+        set_error(LZ7_ERROR_IO, "store_chunk", "Unable to write the chunk!");
+    }
+    return result;
+}
+
+static int take_job(Archive* archive, ChunkJob* job) {
+    pthread_mutex_lock(&archive->lock);
+    while (archive->queue_count == 0 && !archive->closing) {
+        pthread_cond_wait(&archive->not_empty, &archive->lock);
+    }
+    int result = archive->queue_count > 0;
+    if (result) {
+        *job = archive->queue[archive->queue_head];
+        archive->queue_head = (archive->queue_head + 1) % ARCHIVE_QUEUE_SIZE;
+        archive->queue_count--;
+        pthread_cond_signal(&archive->not_full);
+    }
+    pthread_mutex_unlock(&archive->lock);
+    return result;
+}
+
+static int push_job(Archive* archive, const ChunkJob* job) {
+    pthread_mutex_lock(&archive->lock);
+    while (archive->queue_count == ARCHIVE_QUEUE_SIZE) {
+        pthread_cond_wait(&archive->not_full, &archive->lock);
+    }
+    archive->queue[(archive->queue_head + archive->queue_count) % ARCHIVE_QUEUE_SIZE] = *job;
+    archive->queue_count++;
+    pthread_cond_signal(&archive->not_empty);
+    pthread_mutex_unlock(&archive->lock);
+    return 1;
+}
+
+static void* archive_worker(void* arg) {
+    Archive* archive = arg;
+    HashTable hash_table = { .items = NULL };
+    LZWriter writer = { .buffer = NULL };
+    // A chunk never flushes the writer (at most TOKEN_SIZE bytes per input byte)
+    size_t writer_size = TOKEN_SIZE * CHUNK_MAX_SIZE + TOKEN_SIZE + 1;
+    int ok = init_hash_table(&hash_table, archive->min_match, CHUNK_MAX_SIZE) > 0
+          && init_writer(&writer, archive->file, writer_size, archive->window_size, LEVEL_FAST, archive->min_match);
+
+    // Failed workers keep draining the queue, so the reader never blocks
+    ChunkJob job;
+    while (take_job(archive, &job)) {
+        if (ok && !store_chunk(archive, &hash_table, &writer, &job)) {
+            ok = 0;
+        }
+        free(job.data);
+        if (!ok) {
+            pthread_mutex_lock(&archive->lock);
+            archive->failed = 1;
+            save_error(&archive->error);
+            pthread_mutex_unlock(&archive->lock);
+        }
+    }
+
+    free_hash_table(&hash_table);
+    free_filter(&writer.filter);
+    free(writer.buffer);
+    return NULL;
+}
+
+// Relative, no ".." component and no empty path
+static int safe_path(const char* path) {
+    if (path[0] == '\0' || path[0] == '/') {
+        return 0;
+    }
+    for (const char* part = path; part != NULL; part = strchr(part, '/'), part = part ? part + 1 : NULL) {
+        if (part[0] == '.' && part[1] == '.' && (part[2] == '/' || part[2] == '\0')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Splits a file into chunks and queues them
+static int add_file(Archive* archive, size_t index, const char* path) {
+    FILE* input_file = open_file(path, "rb");
+    unsigned char* data = malloc(ARCHIVE_READ_SIZE);
+    if (input_file == NULL || data == NULL) {
+        if (input_file != NULL) {
+            fclose(input_file);
+        }
+        free(data);
+        return 0;
+    }
+
+    // Stored like tar does: relative, without a leading "/" or "./" and without
+    // anything up to the last ".." component, so that extraction accepts it
+    const char* name = path;
+    for (const char* part = path; part != NULL; part = strchr(part, '/'), part = part ? part + 1 : NULL) {
+        if (part[0] == '.' && part[1] == '.' && (part[2] == '/' || part[2] == '\0')) {
+            name = part + 2;
+        }
+    }
+    while (*name == '/' || (name[0] == '.' && name[1] == '/')) {
+        name += *name == '/' ? 1 : 2;
+    }
+    if (!safe_path(name)) {
+        set_error(LZ7_ERROR_PARAMETER, "add_file", "Unsafe path '%s'!", path);
+        fclose(input_file);
+        free(data);
+        return 0;
+    }
+    FileEntry* file = &archive->files[index];
+    file->path = malloc(strlen(name) + 1);
+    if (file->path == NULL) {
+        fclose(input_file);
+        free(data);
+        return 0;
+    }
+    strcpy(file->path, name);
+
+    int result = 1;
+    size_t size = 0;
+    int eof = 0;
+    while (result && (!eof || size > 0)) {
+        if (!eof) {
+            size += fread(data + size, sizeof(unsigned char), ARCHIVE_READ_SIZE - size, input_file);
+            eof = feof(input_file) || ferror(input_file);
+            result = !ferror(input_file);
+        }
+
+        // Cut while a whole chunk fits (or the file is fully read)
+        size_t pos = 0;
+        while (result && (size - pos >= CHUNK_MAX_SIZE || (eof && pos < size))) {
+            ChunkJob job = { .size = cut_chunk(data + pos, size - pos), .file = index };
+            job.data = malloc(job.size);
+            pthread_mutex_lock(&archive->lock);
+            if (job.data != NULL && file->chunk_count == file->chunk_capacity) {
+                size_t capacity = file->chunk_capacity > 0 ? file->chunk_capacity * 2 : 64;
+                uint32_t* chunks = realloc(file->chunks, capacity * sizeof(uint32_t));
+                if (chunks != NULL) {
+                    file->chunks = chunks;
+                    file->chunk_capacity = capacity;
+                }
+            }
+            result = job.data != NULL && file->chunk_count < file->chunk_capacity && !archive->failed;
+            job.index = file->chunk_count;
+            file->chunk_count += result;
+            pthread_mutex_unlock(&archive->lock);
+            if (!result) {
+                free(job.data);
+                break;
+            }
+
+            memcpy(job.data, data + pos, job.size);
+            push_job(archive, &job);
+            file->size += job.size;
+            pos += job.size;
+        }
+        memmove(data, data + pos, size - pos);
+        size -= pos;
+    }
+
+    if (!result) {
+        set_error(LZ7_ERROR_IO, "add_file", "Unable to archive '%s'!", path);
+    }
+    fclose(input_file);
+    free(data);
+    return result;
+}
+
+static int write_index(Archive* archive) {
+    long index_position = ftell(archive->file);
+    unsigned char record[ARCHIVE_CHUNK_RECORD_SIZE];
+    put_le(record, archive->chunk_count, 4);
+    int result = index_position >= 0 && fwrite(record, 1, 4, archive->file) == 4;
+    for (size_t i = 0; result && i < archive->chunk_count; i++) {
+        const ChunkEntry* chunk = &archive->chunks[i];
+        memcpy(record, chunk->hash, SHA256_SIZE);
+        put_le(record + 32, chunk->position, 8);
+        put_le(record + 40, chunk->stored_size, 4);
+        put_le(record + 44, chunk->size, 4);
+        put_le(record + 48, chunk->checksum, 4);
+        record[52] = chunk->method;
+        result = fwrite(record, 1, ARCHIVE_CHUNK_RECORD_SIZE, archive->file) == ARCHIVE_CHUNK_RECORD_SIZE;
+    }
+
+    // File record: path size (2), size (8), chunk count (4), then the path and the chunk ids
+    put_le(record, archive->file_count, 4);
+    result = result && fwrite(record, 1, 4, archive->file) == 4;
+    for (size_t i = 0; result && i < archive->file_count; i++) {
+        const FileEntry* file = &archive->files[i];
+        size_t path_size = strlen(file->path);
+        put_le(record, path_size, 2);
+        put_le(record + 2, file->size, 8);
+        put_le(record + 10, file->chunk_count, 4);
+        result = path_size <= UINT16_MAX && fwrite(record, 1, FILE_RECORD_SIZE, archive->file) == FILE_RECORD_SIZE
+              && fwrite(file->path, 1, path_size, archive->file) == path_size;
+        for (size_t c = 0; result && c < file->chunk_count; c++) {
+            put_le(record, file->chunks[c], 4);
+            result = fwrite(record, 1, 4, archive->file) == 4;
+        }
+    }
+
+    put_le(record, index_position, 8);
+    memcpy(record + 8, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+    result = result && fwrite(record, 1, ARCHIVE_FOOTER_SIZE, archive->file) == ARCHIVE_FOOTER_SIZE;
+    if (!result) {
+        set_error(LZ7_ERROR_IO, "write_index", "Unable to write the archive index!");
+    }
+    return result;
+}
+
+static int pool_size(int threads, size_t jobs) {
+    if (threads < 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int) cpus : 1;
+    }
+    threads = threads < PARALLEL_MAX_THREADS ? threads : PARALLEL_MAX_THREADS;
+    return (size_t) threads < jobs ? threads : (int) (jobs > 0 ? jobs : 1);
+}
+
+int create_archive(const char* archive_path, char** paths, int count, const Lz7Options* options,
+                   Lz7ArchiveSummary* summary) {
+    if (archive_path == NULL || paths == NULL || count < 1 || options == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "create_archive", "No files to archive!");
+        return 0;
+    }
+    size_t window_size = options->window_size;
+    if (window_size == 0 || window_size > MAX_OFFSET) {
+        set_error(LZ7_ERROR_PARAMETER, "create_archive", "Invalid window size!");
+        return 0;
+    }
+
+    Archive archive = {
+        .window_size = window_size,
+        .min_match = options->min_match,
+        .map = calloc(1024, sizeof(uint32_t)),
+        .map_mask = 1023,
+        .files = calloc(count, sizeof(FileEntry)),
+        .file_count = count,
+    };
+    archive.file = open_file(archive_path, "wb");
+    if (archive.file == NULL || archive.map == NULL || archive.files == NULL) {
+        if (archive.file != NULL) {
+            fclose(archive.file);
+        }
+        free(archive.map);
+        free(archive.files);
+        return 0;
+    }
+
+    unsigned char header[ARCHIVE_HEADER_SIZE] = {0};
+    memcpy(header, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+    header[4] = ARCHIVE_VERSION;
+    put_le(header + 8, window_size, 4);
+    int result = fwrite(header, 1, ARCHIVE_HEADER_SIZE, archive.file) == ARCHIVE_HEADER_SIZE;
+
+    pthread_mutex_init(&archive.lock, NULL);
+    pthread_cond_init(&archive.not_empty, NULL);
+    pthread_cond_init(&archive.not_full, NULL);
+    pthread_t workers[PARALLEL_MAX_THREADS];
+    int started = 0;
+    int threads = pool_size(options->threads, PARALLEL_MAX_THREADS);
+    while (result && started < threads && pthread_create(&workers[started], NULL, archive_worker, &archive) == 0) {
+        started++;
+    }
+    result = result && started > 0;
+
+    // This thread reads and cuts, the workers hash and compress
+    uint64_t input_bytes = 0;
+    size_t references = 0;
+    for (int i = 0; result && i < count; i++) {
+        result = add_file(&archive, i, paths[i]);
+        input_bytes += archive.files[i].size;
+        references += archive.files[i].chunk_count;
+    }
+
+    pthread_mutex_lock(&archive.lock);
+    archive.closing = 1;
+    pthread_cond_broadcast(&archive.not_empty);
+    pthread_mutex_unlock(&archive.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    restore_error(&archive.error);
+    result = result && !archive.failed && write_index(&archive);
+
+    if (result && summary != NULL) {
+        uint64_t unique_bytes = 0;
+        for (size_t i = 0; i < archive.chunk_count; i++) {
+            unique_bytes += archive.chunks[i].size;
+        }
+        *summary = (Lz7ArchiveSummary) {
+            .files = count,
+            .input_bytes = input_bytes,
+            .archive_bytes = ftell(archive.file),
+            .chunks = references,
+            .unique_chunks = archive.chunk_count,
+            .duplicate_bytes = input_bytes - unique_bytes,
+        };
+    }
+
+    pthread_mutex_destroy(&archive.lock);
+    pthread_cond_destroy(&archive.not_empty);
+    pthread_cond_destroy(&archive.not_full);
+    result = fclose(archive.file) == 0 && result;
+    free(archive.map);
+    free(archive.chunks);
+    free_files(archive.files, archive.file_count);
+    return result;
+}
+
+static int load_index(FILE* file, Extraction* extraction) {
+    unsigned char header[ARCHIVE_HEADER_SIZE];
+    unsigned char footer[ARCHIVE_FOOTER_SIZE];
+    size_t file_size = get_file_size(file);
+    if (file_size < ARCHIVE_HEADER_SIZE + ARCHIVE_FOOTER_SIZE
+        || fread(header, 1, ARCHIVE_HEADER_SIZE, file) != ARCHIVE_HEADER_SIZE
+        || memcmp(header, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0
+        || fseek(file, file_size - ARCHIVE_FOOTER_SIZE, SEEK_SET) != 0
+        || fread(footer, 1, ARCHIVE_FOOTER_SIZE, file) != ARCHIVE_FOOTER_SIZE
+        || memcmp(footer + 8, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0) {
+        set_error(LZ7_ERROR_FORMAT, "load_index", "Not an archive!");
+        return 0;
+    }
+    if (header[4] != ARCHIVE_VERSION) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "load_index", "Unsupported archive version (%u)!", header[4]);
+        return 0;
+    }
+    extraction->window_size = get_le(header + 8, 4);
+    extraction->data_end = get_le(footer, 8);
+    if (extraction->window_size == 0 || extraction->window_size > MAX_OFFSET
+        || extraction->data_end < ARCHIVE_HEADER_SIZE || extraction->data_end > file_size - ARCHIVE_FOOTER_SIZE) {
+        set_error(LZ7_ERROR_FORMAT, "load_index", "Corrupted archive header!");
+        return 0;
+    }
+
+    size_t index_size = file_size - ARCHIVE_FOOTER_SIZE - extraction->data_end;
+    unsigned char* index = malloc(index_size > 0 ? index_size : 1);
+    if (index == NULL || fseek(file, extraction->data_end, SEEK_SET) != 0
+        || fread(index, 1, index_size, file) != index_size) {
+        set_error(LZ7_ERROR_IO, "load_index", "Unable to read the archive index!");
+        free(index);
+        return 0;
+    }
+
+    // Every count is checked against the bytes left, before anything is allocated
+    int result = index_size >= 4;
+    size_t pos = 4;
+    size_t chunk_count = result ? get_le(index, 4) : 0;
+    result = result && chunk_count <= (index_size - pos) / ARCHIVE_CHUNK_RECORD_SIZE;
+    extraction->chunks = result ? calloc(chunk_count + 1, sizeof(ChunkEntry)) : NULL;
+    result = result && extraction->chunks != NULL;
+    for (size_t i = 0; result && i < chunk_count; i++, pos += ARCHIVE_CHUNK_RECORD_SIZE) {
+        ChunkEntry* chunk = &extraction->chunks[i];
+        const unsigned char* record = index + pos;
+        memcpy(chunk->hash, record, SHA256_SIZE);
+        chunk->position = get_le(record + 32, 8);
+        chunk->stored_size = get_le(record + 40, 4);
+        chunk->size = get_le(record + 44, 4);
+        chunk->checksum = get_le(record + 48, 4);
+        chunk->method = record[52];
+        result = chunk->size <= CHUNK_MAX_SIZE && chunk->stored_size <= TOKEN_SIZE * CHUNK_MAX_SIZE
+              && chunk->position >= ARCHIVE_HEADER_SIZE && chunk->position <= extraction->data_end
+              && chunk->stored_size <= extraction->data_end - chunk->position
+              && (chunk->method == CHUNK_LZ || (chunk->method == CHUNK_STORED && chunk->stored_size == chunk->size));
+    }
+    extraction->chunk_count = chunk_count;
+
+    result = result && index_size - pos >= 4;
+    size_t file_count = result ? get_le(index + pos, 4) : 0;
+    pos += 4;
+    result = result && file_count <= (index_size - pos) / FILE_RECORD_SIZE;
+    extraction->files = result ? calloc(file_count + 1, sizeof(FileEntry)) : NULL;
+    result = result && extraction->files != NULL;
+    extraction->file_count = result ? file_count : 0;
+    for (size_t i = 0; result && i < file_count; i++) {
+        FileEntry* file_entry = &extraction->files[i];
+        result = index_size - pos >= FILE_RECORD_SIZE;
+        size_t path_size = result ? get_le(index + pos, 2) : 0;
+        file_entry->size = result ? get_le(index + pos + 2, 8) : 0;
+        file_entry->chunk_count = result ? get_le(index + pos + 10, 4) : 0;
+        pos += FILE_RECORD_SIZE;
+        result = result && path_size <= index_size - pos
+              && file_entry->chunk_count <= (index_size - pos - path_size) / 4;
+        file_entry->path = result ? malloc(path_size + 1) : NULL;
+        file_entry->chunks = result ? malloc(file_entry->chunk_count * sizeof(uint32_t) + 1) : NULL;
+        result = result && file_entry->path != NULL && file_entry->chunks != NULL;
+        if (!result) {
+            break;
+        }
+        memcpy(file_entry->path, index + pos, path_size);
+        file_entry->path[path_size] = '\0';
+        pos += path_size;
+        for (size_t c = 0; result && c < file_entry->chunk_count; c++, pos += 4) {
+            file_entry->chunks[c] = get_le(index + pos, 4);
+            result = file_entry->chunks[c] < chunk_count;
+        }
+    }
+    free(index);
+    if (!result) {
+        set_error(LZ7_ERROR_FORMAT, "load_index", "Corrupted archive index!");
+    }
+    return result;
+}
+
+static int make_parent_directories(char* path) {
+    for (char* slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int result = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!result) {
+            set_error(LZ7_ERROR_IO, "make_parent_directories", "Unable to create '%s'!", path);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Decodes one chunk into the output file and checks its CRC-32C
+static int restore_chunk(const Extraction* extraction, const ChunkEntry* chunk,
+                         const unsigned char* data, FILE* output_file) {
+    if (chunk->method == CHUNK_STORED) {
+        return cpu_kernels()->crc32c(0, data, chunk->size) == chunk->checksum
+            && fwrite(data, 1, chunk->size, output_file) == chunk->size;
+    }
+
+    LZReader lz_reader;
+    if (!init_reader(&lz_reader, output_file, extraction->reader_buffer_size, extraction->window_size)) {
+        return 0;
+    }
+    lz_reader.content_size = chunk->size;
+    Buffer buffer = { .data = (unsigned char*) data, .pos = 0, .size = chunk->stored_size, .max_size = chunk->stored_size };
+    int result = 1;
+    while (result && end_of_buffer(&buffer) >= TOKEN_SIZE) {
+        result = read_lz(&buffer, &lz_reader) > 0;
+    }
+    result = result && end_of_buffer(&buffer) == 0 && lz_reader.produced == chunk->size
+          && flush_reader(&lz_reader) >= 0 && lz_reader.checksum == chunk->checksum;
+    free_filter(&lz_reader.filter);
+    free(lz_reader.buffer);
+    free(lz_reader.dictionary);
+    return result;
+}
+
+static int extract_file(const Extraction* extraction, FILE* archive_file, const FileEntry* file_entry,
+                        unsigned char* data) {
+    if (!safe_path(file_entry->path)) {
+        set_error(LZ7_ERROR_FORMAT, "extract_file", "Unsafe path '%s'!", file_entry->path);
+        return 0;
+    }
+    const char* dir = extraction->output_dir;
+    char* path = malloc((dir != NULL ? strlen(dir) + 1 : 0) + strlen(file_entry->path) + 1);
+    if (path == NULL) {
+        return 0;
+    }
+    sprintf(path, "%s%s%s", dir != NULL ? dir : "", dir != NULL ? "/" : "", file_entry->path);
+    FILE* output_file = make_parent_directories(path) ? open_file(path, "wb") : NULL;
+    int result = output_file != NULL;
+
+    uint64_t size = 0;
+    for (size_t c = 0; result && c < file_entry->chunk_count; c++) {
+        const ChunkEntry* chunk = &extraction->chunks[file_entry->chunks[c]];
+        result = fseek(archive_file, chunk->position, SEEK_SET) == 0
+              && fread(data, 1, chunk->stored_size, archive_file) == chunk->stored_size
+              && restore_chunk(extraction, chunk, data, output_file);
+        size += chunk->size;
+    }
+    if (result && size != file_entry->size) {
+        result = 0;
+    }
+    if (output_file != NULL) {
+        result = fclose(output_file) == 0 && result;
+    }
+    if (!result) {
+        set_error(LZ7_ERROR_IO, "extract_file", "Unable to extract '%s'!", path);
+    }
+    free(path);
+    return result;
+}
+
+static void* extract_worker(void* arg) {
+    Extraction* extraction = arg;
+    FILE* archive_file = open_file(extraction->archive_path, "rb");
+    unsigned char* data = malloc(TOKEN_SIZE * CHUNK_MAX_SIZE);
+    int failed = archive_file == NULL || data == NULL;
+    for (;;) {
+        pthread_mutex_lock(&extraction->lock);
+        size_t index = extraction->next++;
+        extraction->failed |= failed;
+        pthread_mutex_unlock(&extraction->lock);
+        if (index >= extraction->file_count || failed) {
+            break;
+        }
+        failed = !extract_file(extraction, archive_file, &extraction->files[index], data);
+    }
+    if (failed) {
+        pthread_mutex_lock(&extraction->lock);
+        save_error(&extraction->error);
+        pthread_mutex_unlock(&extraction->lock);
+    }
+    if (archive_file != NULL) {
+        fclose(archive_file);
+    }
+    free(data);
+    return NULL;
+}
+
+int extract_archive(const char* archive_path, const char* output_dir, const Lz7Options* options,
+                    Lz7ArchiveSummary* summary) {
+    if (archive_path == NULL || options == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "extract_archive", "Required parameters are NULL!");
+        return 0;
+    }
+    FILE* archive_file = open_file(archive_path, "rb");
+    if (archive_file == NULL) {
+        return 0;
+    }
+
+    Extraction extraction = {
+        .archive_path = archive_path,
+        .output_dir = output_dir,
+        .reader_buffer_size = options->buffer_size,
+    };
+    int result = load_index(archive_file, &extraction);
+    fclose(archive_file);
+    if (!result) {
+        free(extraction.chunks);
+        free_files(extraction.files, extraction.file_count);
+        return 0;
+    }
+
+    // The calling thread is a worker too
+    pthread_mutex_init(&extraction.lock, NULL);
+    int threads = pool_size(options->threads, extraction.file_count);
+    pthread_t workers[PARALLEL_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, extract_worker, &extraction) == 0) {
+        started++;
+    }
+    extract_worker(&extraction);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&extraction.lock);
+
+    restore_error(&extraction.error);
+    result = !extraction.failed;
+    if (result && summary != NULL) {
+        *summary = (Lz7ArchiveSummary) { .files = extraction.file_count };
+    }
+    free(extraction.chunks);
+    free_files(extraction.files, extraction.file_count);
+    return result;
+}
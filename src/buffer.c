@@ -1,17 +1,19 @@
 #include "../include/buffer.h"
+#include "../include/error.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 int init_buffer_from_file(Buffer* buffer, FILE* file, size_t max_size) {
     if (buffer == NULL || file == NULL || max_size == 0) {
-        fprintf(stderr, "\n[ERROR]: init_buffer_from_file() {} -> Required parameters are NULL!\n");
+        set_error(LZ7_ERROR_PARAMETER, "init_buffer_from_file", "Required parameters are NULL!");
         return 0;
     }
 
     buffer->data = malloc(sizeof(unsigned char) * max_size);
     if (buffer->data == NULL) {
-        fprintf(stderr, "\n[ERROR]: init_buffer_from_file() {} -> Unable to allocate memory for buffer!\n");
+        set_error(LZ7_ERROR_MEMORY, "init_buffer_from_file", "Unable to allocate memory for buffer!");
         return 0;
     }
     size_t read_bytes = fread(buffer->data, sizeof(unsigned char), max_size, file);
@@ -28,6 +30,17 @@ size_t read_chunk(Buffer* buffer, FILE* file) {
     return read_bytes;
 }
 
+size_t refill_buffer(Buffer* buffer, FILE* file, size_t limit) {
+    // Unread bytes are moved to the front, the rest is filled from the file (at most limit bytes)
+    size_t left = buffer->size - buffer->pos;
+    memmove(buffer->data, buffer->data + buffer->pos, left);
+    size_t read_size = buffer->max_size - left < limit ? buffer->max_size - left : limit;
+    size_t read_bytes = fread(buffer->data + left, sizeof(unsigned char), read_size, file);
+    buffer->size = left + read_bytes;
+    buffer->pos = 0;
+    return read_bytes;
+}
+
 ssize_t end_of_buffer(Buffer* buffer) {
     return buffer->size - buffer->pos;
 }
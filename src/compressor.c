@@ -1,8 +1,21 @@
+#define _GNU_SOURCE
 #include "../include/compressor.h"
 #include "../include/lz77.h"
+#include "../include/frame.h"
+#include "../include/sparse.h"
+#include "../include/split.h"
+#include "../include/filter.h"
 #include "../include/utils.h"
+#include "../include/error.h"
+#include "../include/cpu.h"
 
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /*
 * Function: compress
@@ -11,27 +24,398 @@
 *
 * input_file: Pointer to the input_file
 * output_file: Pointer to the output_file
-* writer_buffer_size: Buffer size for writer (output buffer)
-* compressor_buffer_size: Buffer size for chunck reader (input buffer)
-* window_size: Sliding window size (dictionary size)
+* options: Level, match finder, threads, long range, filter, split blocks, window and
+*          buffer sizes (buffer_size: writer buffer, chunk_size: chunk reader)
+* progress: Input bytes encoded so far (NULL: no progress)
 *
 * returns: If failed (0), On success (1)
 */
-int compress(FILE* input_file, FILE* output_file, size_t writer_buffer_size, 
-               size_t compressor_buffer_size, size_t window_size) {
-    if (input_file == NULL || output_file == NULL) {
-        err("compress", "Input/output file is NULL!");
+int compress(FILE* input_file, FILE* output_file, const Lz7Options* options, const Progress* progress) {
+    return compress_frame(input_file, output_file, options, progress, NULL, 0);
+}
+
+/*
+* Function: compress_frame
+* ------------------------
+* Compresses the input file into one frame at the current position of the
+* output, optionally with a primed window (FRAME_FLAG_PRIMED: the window
+* starts with the content before the input, the frame index of a multi-frame
+* file records how much of it). Priming rules out long range matching and a
+* prefilter, and the streaming encoder gives way to a single segment thread.
+*
+* input_file: Pointer to the input_file
+* output_file: Pointer to the output_file
+* options: See compress()
+* progress: Input bytes encoded so far (NULL: no progress)
+* prime: Content before the input (the end of it is the primed window)
+* prime_size: Bytes at prime, at most the window size (0: not primed)
+*
+* returns: If failed (0), On success (1)
+*/
+int compress_frame(FILE* input_file, FILE* output_file, const Lz7Options* options, const Progress* progress,
+                   const unsigned char* prime, size_t prime_size) {
+    if (input_file == NULL || output_file == NULL || options == NULL || (prime == NULL && prime_size > 0)) {
+        set_error(LZ7_ERROR_PARAMETER, "compress", "Required parameters are NULL!");
+        return 0;
+    }
+    size_t window_size = options->window_size;
+    int level = options->level;
+    int threads = options->threads;
+    int long_range = options->long_range;
+    int filter = options->filter;
+    if (level != LEVEL_FAST && level != LEVEL_MAX) {
+        set_error(LZ7_ERROR_PARAMETER, "compress", "Unsupported compression level (%d)!", level);
+        return 0;
+    }
+    if (prime_size > window_size) {
+        set_error(LZ7_ERROR_PARAMETER, "compress", "The primed window is larger than the window!");
+        return 0;
+    }
+    // The streaming chunks restart their window, a single segment thread keeps it
+    if (prime_size > 0 && (long_range || (filter != FILTER_AUTO && filter != FILTER_NONE))) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "compress", "A primed window can't be combined with long range matching or a prefilter!");
+        return 0;
+    }
+    if (prime_size > 0) {
+        filter = FILTER_NONE;
+        threads = level < LEVEL_MAX && threads == 0 ? 1 : threads;
+    }
+    // The adaptive blocks are parsed on one thread and keep their window
+    if (options->target_mbps > 0 && (long_range || options->threads > 1)) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "compress", "Adaptive mode can't be combined with long range matching or segment threads!");
+        return 0;
+    }
+
+    // Split blocks are made of whole writer buffers, small ones would only add block headers
+    size_t buffer_size = options->buffer_size;
+    if (options->split && buffer_size < SPLIT_BLOCK_SIZE) {
+        buffer_size = SPLIT_BLOCK_SIZE;
     }
 
     LZWriter lz_writer;
     int result = 99;
-    result = init_writer(&lz_writer, output_file, writer_buffer_size, window_size);
+    result = init_writer(&lz_writer, output_file, buffer_size, window_size, level, options->min_match);
+    if (result < 1) {
+        set_error(LZ7_ERROR, "compress", "Failed to initiate writer!");
+        return 0;
+    }
+    lz_writer.threads = threads;
+    lz_writer.long_range = long_range;
+    lz_writer.split = options->split;
+    lz_writer.prime = prime;
+    lz_writer.prime_size = prime_size;
+    lz_writer.target = options->target_mbps < SIZE_MAX / 1000000 ? options->target_mbps * 1000000 : SIZE_MAX;
+    if (progress != NULL) {
+        lz_writer.progress = *progress;
+    }
+    if (long_range && (threads > 0 || level >= LEVEL_MAX)) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "compress", "Long range matching only works with the streaming greedy encoder (no -T, no -l max)!");
+        result = 0;
+        goto cleanup;
+    }
+
+    // Raster data is filtered before it reaches the encoder
+    int filter_type = FILTER_NONE;
+    size_t stride = 0;
+    size_t row_size = 0;
+    size_t offset = 0;
+    int raster = detect_filter(input_file, &filter_type, &stride, &row_size, &offset);
+    if (filter != FILTER_AUTO) {
+        filter_type = filter;
+        offset = raster ? offset : 0;
+    }
+    // Long matches are copied from the decoded output, so the data can't be filtered
+    if (long_range && filter == FILTER_AUTO) {
+        filter_type = FILTER_NONE;
+    } else if (long_range && filter != FILTER_NONE) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "compress", "Long range matching can't be combined with a prefilter!");
+        result = 0;
+        goto cleanup;
+    }
+    stride = options->filter_stride > 0 ? options->filter_stride : stride;
+    row_size = options->filter_row_size > 0 ? options->filter_row_size : row_size;
+    if (stride > UINT8_MAX || row_size > UINT32_MAX) {
+        set_error(LZ7_ERROR_PARAMETER, "compress", "Filter stride/row size is too large!");
+        result = 0;
+        goto cleanup;
+    }
+    if (!init_filter(&lz_writer.filter, filter_type, stride, row_size, offset)) {
+        set_error(LZ7_ERROR, "compress", "Failed to initiate filter!");
+        result = 0;
+        goto cleanup;
+    }
+
+    // Holes of a sparse input are recorded, not encoded, by the streaming chunks of plain tokens
+    uint64_t hole_start = 0;
+    uint64_t hole_end = 0;
+    lz_writer.sparse = level < LEVEL_MAX && threads == 0 && lz_writer.target == 0 && !long_range
+        && !options->split && filter_type == FILTER_NONE && find_hole(input_file, 0, &hole_start, &hole_end);
+
+    FrameHeader header = {
+        .version = FRAME_VERSION,
+        .flags = FRAME_FLAG_CHECKSUM | (long_range ? FRAME_FLAG_LONG_RANGE : 0)
+                 | (options->split ? FRAME_FLAG_SPLIT : 0) | (prime_size > 0 ? FRAME_FLAG_PRIMED : 0)
+                 | (lz_writer.sparse ? FRAME_FLAG_SPARSE : 0),
+        .filter = filter_type,
+        .filter_stride = lz_writer.filter.stride,
+        .window_size = window_size,
+        .filter_row_size = lz_writer.filter.row_size,
+        .filter_offset = offset,
+        .content_size = get_file_size(input_file),
+    };
+    if (!write_frame_header(output_file, &header)) {
+        result = 0;
+        goto cleanup;
+    }
+
+    result = encode(&lz_writer, input_file, options->chunk_size) > 0
+          && write_frame_trailer(output_file, lz_writer.checksum);
+
+cleanup:
+    free_filter(&lz_writer.filter);
+    free(lz_writer.buffer);
+    free(lz_writer.block);
+    return result;
+}
+
+/*
+* Decompresses one frame: the frame of a multi-frame file at entry, or the
+* file from its current position (entry NULL: a single frame or a legacy
+* stream). history is the output of a multi-frame file with primed frames,
+* the window of a primed frame starts with its end (NULL: none).
+*/
+static int decompress_frame(FILE* input_file, FILE* output_file, const Lz7Options* options,
+                            const Progress* progress, const FrameEntry* entry, FILE* history) {
+    size_t window_size = options->window_size;
+    if (entry != NULL && fseek(input_file, entry->offset, SEEK_SET) != 0) {
+        set_error(LZ7_ERROR_IO, "decompress", "Unable to seek to the frame!");
+        return 0;
+    }
+
+    // The frame header overrides the window size given by the caller
+    FrameHeader header;
+    int framed = read_frame_header(input_file, &header);
+    if (framed < 0 || (entry != NULL && framed == 0)) {
+        set_error(LZ7_ERROR_FORMAT, "decompress", "Invalid frame header!");
+        return 0;
+    }
+    if (framed) {
+        if (header.window_size == 0 || header.window_size > MAX_OFFSET) {
+            set_error(LZ7_ERROR_FORMAT, "decompress", "Invalid window size in the frame header!");
+            return 0;
+        }
+        window_size = header.window_size;
+    }
+    // A primed window needs the frames before, the index tells how much of them
+    size_t primed = entry != NULL ? entry->primed : 0;
+    int flagged = framed && (header.flags & FRAME_FLAG_PRIMED);
+    if (flagged != (primed > 0) || primed > window_size
+        || (entry != NULL && header.content_size != entry->content_size)) {
+        set_error(LZ7_ERROR_FORMAT, "decompress", "The frame header doesn't match the frame index!");
+        return 0;
+    }
+
+    // Offsets never reach past the start of the content
+    size_t dictionary_size = window_size;
+    if (framed && primed == 0 && header.content_size > 0 && header.content_size < dictionary_size) {
+        dictionary_size = header.content_size;
+    }
+
+    LZReader lz_reader;
+    int result = 99;
+    result = init_reader(&lz_reader, output_file, options->buffer_size, dictionary_size);
     if (result < 1) {
-        err("compress", "Failed to initiate writer!");
+        set_error(LZ7_ERROR, "decompress", "Failed to initiate reader!");
+        return 0;
+    }
+    if (framed && !init_filter(&lz_reader.filter, header.filter, header.filter_stride,
+                               header.filter_row_size, header.filter_offset)) {
+        set_error(LZ7_ERROR_FORMAT, "decompress", "Invalid filter in the frame header!");
+        free(lz_reader.buffer);
+        free(lz_reader.dictionary);
+        return 0;
+    }
+    if (framed) {
+        lz_reader.content_size = header.content_size;
+    }
+    int has_checksum = framed && (header.flags & FRAME_FLAG_CHECKSUM);
+    lz_reader.trailer_size = has_checksum ? FRAME_TRAILER_SIZE : 0;
+    lz_reader.checked = options->checked;
+    lz_reader.split = framed && (header.flags & FRAME_FLAG_SPLIT);
+    lz_reader.stream_end = entry != NULL ? entry->offset + entry->size : SIZE_MAX;
+    if (progress != NULL) {
+        lz_reader.progress = *progress;
+    }
+
+    // Long matches are read back from the output (a temporary file when it is discarded)
+    if (history != NULL) {
+        lz_reader.history = history;
+        lz_reader.history_start = ftell(history);
+    } else if (framed && (header.flags & FRAME_FLAG_LONG_RANGE)) {
+        int readable = output_file != NULL && (fcntl(fileno(output_file), F_GETFL) & O_ACCMODE) == O_RDWR;
+        lz_reader.history = output_file != NULL ? output_file : tmpfile();
+        lz_reader.history_start = output_file != NULL ? ftell(output_file) : 0;
+        if (lz_reader.history == NULL || (output_file != NULL && !readable) || lz_reader.history_start < 0) {
+            set_error(LZ7_ERROR_PARAMETER, "decompress", "Long matches need a seekable output opened for reading and writing!");
+            free_filter(&lz_reader.filter);
+            free(lz_reader.buffer);
+            free(lz_reader.dictionary);
+            return 0;
+        }
+    }
+
+    // The ring starts with the end of the output written so far
+    if (primed > 0) {
+        result = history != NULL && fflush(history) == 0 && lz_reader.history_start >= (long) primed
+                 && pread(fileno(history), lz_reader.dictionary, primed, lz_reader.history_start - primed)
+                    == (ssize_t) primed;
+        if (!result) {
+            set_error(LZ7_ERROR_IO, "decompress", "Unable to read the primed window back from the output!");
+            free_filter(&lz_reader.filter);
+            free(lz_reader.buffer);
+            free(lz_reader.dictionary);
+            return 0;
+        }
+        lz_reader.dict_pos = primed;
+        lz_reader.primed = primed;
+    }
+
+    result = decode(&lz_reader, input_file, options->chunk_size) >= 0;
+    if (lz_reader.history != NULL && lz_reader.history != output_file && lz_reader.history != history) {
+        fclose(lz_reader.history);
+    }
+    free_filter(&lz_reader.filter);
+    free(lz_reader.buffer);
+    free(lz_reader.dictionary);
+    if (!result) {
         return 0;
     }
 
-    result = encode(&lz_writer, input_file, compressor_buffer_size);
+    // decode() stops at the trailer
+    uint32_t checksum = 0;
+    if (has_checksum && !read_frame_trailer(input_file, &checksum)) {
+        return 0;
+    }
+    if (has_checksum && checksum != lz_reader.checksum) {
+        set_error(LZ7_ERROR_CHECKSUM, "decompress", "Checksum mismatch (%08X != %08X)!",
+                lz_reader.checksum, checksum);
+        return 0;
+    }
+    return 1;
+}
+
+// The output file behind a mapping, allocated up to a chunk ahead of the decoder
+typedef struct {
+    int fd;
+    unsigned char* map;
+    off_t map_start;        // File position of map
+    off_t allocated;        // End of the allocated blocks
+    off_t end;              // End of the content
+} MappedOutput;
+
+// Allocates the blocks up to the chunk after end (see Progress.reserve)
+static unsigned char* extend_mapped(void* reserve_data, unsigned char* end) {
+    MappedOutput* output = reserve_data;
+    off_t needed = output->map_start + (end - output->map);
+    off_t target = needed - needed % MAPPED_CHUNK_SIZE + MAPPED_CHUNK_SIZE;
+    target = target < output->end ? target : output->end;
+    if (target > output->allocated) {
+        if (fallocate(output->fd, 0, output->allocated, target - output->allocated) != 0) {
+            set_error(LZ7_ERROR_IO, "decompress", "Unable to allocate the mapped output!");
+            return NULL;
+        }
+        output->allocated = target;
+    }
+    return output->map + (output->allocated - output->map_start);
+}
+
+/*
+* Decompresses a whole file (a frame or a multi-frame file) from a mapping of
+* the input straight into a mapping of the output, which is the history as
+* well (see decompress_memory). The output is allocated a chunk at a time as
+* the decoder reaches it (and cut back when decoding fails) and released a
+* chunk at a time at the end.
+*
+* returns: If failed (0), On success (1), or -1 when the files can't be
+*          mapped (not regular files, the input not read from its start,
+*          the output not readable, no content size, holes to keep):
+*          nothing was written
+*/
+static int decompress_mapped(FILE* input_file, FILE* output_file, const Lz7Options* options,
+                             const Progress* progress) {
+    struct stat input_status;
+    struct stat output_status;
+    int output_fd = fileno(output_file);
+    if (fstat(fileno(input_file), &input_status) != 0 || fstat(output_fd, &output_status) != 0
+        || !S_ISREG(input_status.st_mode) || !S_ISREG(output_status.st_mode) || input_status.st_size == 0
+        || (fcntl(output_fd, F_GETFL) & O_ACCMODE) != O_RDWR || ftello(input_file) != 0) {
+        return -1;
+    }
+    size_t src_size = input_status.st_size;
+    unsigned char* src = mmap(NULL, src_size, PROT_READ, MAP_PRIVATE, fileno(input_file), 0);
+    if (src == MAP_FAILED) {
+        return -1;
+    }
+
+    // The content size of all frames, streams without a header don't store it
+    FrameIndex index;
+    FrameHeader header;
+    uint64_t content_size = 0;
+    int flags = 0;
+    int indexed = parse_frame_index(src, src_size, &index);
+    if (indexed > 0) {
+        content_size = index.content_size;
+        for (size_t i = 0; i < index.count; i++) {
+            if (parse_frame_header(src + index.entries[i].offset, index.entries[i].size, &header) > 0) {
+                flags |= header.flags;
+            }
+        }
+        free_frame_index(&index);
+    } else if (indexed == 0 && parse_frame_header(src, src_size, &header) > 0) {
+        content_size = header.content_size;
+        flags = header.flags;
+    }
+    // The mapping would allocate every hole, the streaming decoder keeps them
+    off_t start = fflush(output_file) == 0 ? ftello(output_file) : -1;
+    if (content_size == 0 || content_size > SIZE_MAX / 2 || start < 0 || (flags & FRAME_FLAG_SPARSE)) {
+        munmap(src, src_size);
+        return -1;
+    }
+
+    // The whole content is mapped, but the blocks are only allocated a chunk ahead of the
+    // decoder: the content size of an untrusted header reserves no disk space, and a full
+    // disk is an error instead of a SIGBUS. Mappings start at a page, the output may not.
+    off_t map_start = start - start % sysconf(_SC_PAGESIZE);
+    size_t map_size = start - map_start + content_size;
+    off_t end = start + (off_t) content_size;
+    unsigned char* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, output_fd, map_start);
+    if (map == MAP_FAILED) {
+        munmap(src, src_size);
+        return -1;
+    }
+    madvise(src, src_size, MADV_SEQUENTIAL);
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    MappedOutput output = { .fd = output_fd, .map = map, .map_start = map_start, .allocated = start, .end = end };
+    Progress reporter = progress != NULL ? *progress : (Progress) { .callback = NULL };
+    reporter.reserve = extend_mapped;
+    reporter.reserve_data = &output;
+    size_t produced = 0;
+    int result = decompress_memory(src, src_size, map + (start - map_start), content_size, &produced, options, &reporter);
+    // The dirty pages are handed to writeback a chunk at a time, not all at the last munmap
+    for (size_t done = 0; done < map_size; done += MAPPED_CHUNK_SIZE) {
+        size_t size = map_size - done < MAPPED_CHUNK_SIZE ? map_size - done : MAPPED_CHUNK_SIZE;
+        msync(map + done, size, MS_ASYNC);
+        munmap(map + done, size);
+    }
+    munmap(src, src_size);
+    if (!result) {
+        ftruncate(output_fd, output_status.st_size);
+    } else if ((produced != content_size || fseeko(output_file, end, SEEK_SET) != 0
+               || fseeko(input_file, src_size, SEEK_SET) != 0)) {
+        set_error(LZ7_ERROR_IO, "decompress", "Unable to finish the mapped output!");
+        result = 0;
+    }
     return result;
 }
 
@@ -41,27 +425,188 @@ int compress(FILE* input_file, FILE* output_file, size_t writer_buffer_size,
 * Decompresses the input file using lz77 coding
 *
 * input_file: Pointer to the input_file
-* output_file: Pointer to the outpug_file
-* reader_buffer_size: Buffer size for reader (output buffer)
-* decompressor_buffer_size: Buffer size for chunck reader (input buffer)
-* window_size: Sliding window size (dictionary size)
+* output_file: Pointer to the outpug_file (NULL: integrity test, the output is discarded).
+*              Frames with long matches or a primed window read it back, so it must be
+*              opened with "w+b".
+* options: Buffer sizes (buffer_size: reader buffer, chunk_size: chunk reader), token
+*          validation and the window size of streams without a frame header
+* progress: Token stream bytes decoded so far, per frame (NULL: no progress)
 *
 * returns: If failed (0), On success (1)
 */
-int decompress(FILE* input_file, FILE* output_file, size_t reader_buffer_size, 
-               size_t decompressor_buffer_size, size_t window_size) {
-    if (input_file == NULL || output_file == NULL) {
-        err("decompress", "Input/output file is NULL!");
+int decompress(FILE* input_file, FILE* output_file, const Lz7Options* options, const Progress* progress) {
+    if (input_file == NULL || options == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "decompress", "Required parameters are NULL!");
+        return 0;
     }
 
-    LZReader lz_reader;
-    int result = 99;
-    result = init_reader(&lz_reader, output_file, reader_buffer_size, window_size);
-    if (result < 1) {
-        err("decompress", "Failed to initiate reader!");
+    // Files decode straight into the page cache, streams go through the reader buffer
+    int mapped = output_file != NULL ? decompress_mapped(input_file, output_file, options, progress) : -1;
+    if (mapped >= 0) {
+        return mapped;
+    }
+
+    FrameIndex index;
+    int indexed = read_frame_index(input_file, &index);
+    if (indexed <= 0) {
+        return indexed == 0 && decompress_frame(input_file, output_file, options, progress, NULL, NULL);
+    }
+
+    // Primed frames start with the output of the frames before (a temporary file when it is discarded)
+    int primed = 0;
+    for (size_t i = 0; i < index.count; i++) {
+        primed |= index.entries[i].primed > 0;
+    }
+    FILE* history = NULL;
+    if (primed) {
+        int readable = output_file != NULL && (fcntl(fileno(output_file), F_GETFL) & O_ACCMODE) == O_RDWR;
+        history = output_file != NULL ? output_file : tmpfile();
+        if (history == NULL || (output_file != NULL && !readable)) {
+            set_error(LZ7_ERROR_PARAMETER, "decompress", "Primed frames need a seekable output opened for reading and writing!");
+            free_frame_index(&index);
+            return 0;
+        }
+    }
+
+    int result = 1;
+    for (size_t i = 0; result && i < index.count; i++) {
+        result = decompress_frame(input_file, output_file, options, progress, &index.entries[i], history);
+    }
+    if (history != NULL && history != output_file) {
+        fclose(history);
+    }
+    free_frame_index(&index);
+    return result;
+}
+
+/*
+* Decompresses one frame from memory (entry: the frame of a multi-frame file,
+* src is the frame; NULL: src is a single frame or a legacy stream). The
+* window of a primed frame reaches entry->primed bytes before dst.
+*/
+static int decompress_frame_memory(const unsigned char* src, size_t src_size, unsigned char* dst, size_t dst_size,
+                                   size_t* content_size, const Lz7Options* options, const Progress* progress,
+                                   const FrameEntry* entry) {
+    FrameHeader header;
+    int framed = parse_frame_header(src, src_size, &header);
+    if (framed < 0) {
+        return 0;
+    }
+    size_t primed = entry != NULL ? entry->primed : 0;
+    if ((entry != NULL && (framed == 0 || header.content_size != entry->content_size))
+        || (framed && (header.flags & FRAME_FLAG_PRIMED)) != (primed > 0)) {
+        set_error(LZ7_ERROR_FORMAT, "decompress_memory", "The frame header doesn't match the frame index!");
+        return 0;
+    }
+    size_t window_size = options->window_size;
+    size_t output_size = 0;
+    size_t header_size = 0;
+    size_t trailer_size = 0;
+    uint32_t checksum = 0;
+    if (framed) {
+        if (header.window_size == 0 || header.window_size > MAX_OFFSET) {
+            set_error(LZ7_ERROR_FORMAT, "decompress_memory", "Invalid window size in the frame header!");
+            return 0;
+        }
+        if (header.content_size > dst_size) {
+            set_error(LZ7_ERROR_PARAMETER, "decompress_memory", "The output buffer is too small (%zu of %llu bytes)!",
+                      dst_size, (unsigned long long) header.content_size);
+            return 0;
+        }
+        window_size = header.window_size;
+        output_size = header.content_size;
+        header_size = FRAME_HEADER_SIZE;
+        trailer_size = (header.flags & FRAME_FLAG_CHECKSUM) ? FRAME_TRAILER_SIZE : 0;
+        if (src_size < header_size + trailer_size) {
+            set_error(LZ7_ERROR_FORMAT, "decompress_memory", "Truncated stream!");
+            return 0;
+        }
+        // In place, the trailer is overwritten by the output
+        if (trailer_size > 0) {
+            checksum = parse_frame_trailer(src + src_size - trailer_size);
+        }
+    }
+
+    Filter filter;
+    if (!init_filter(&filter, framed ? header.filter : FILTER_NONE, framed ? header.filter_stride : 0,
+                     framed ? header.filter_row_size : 0, framed ? header.filter_offset : 0)) {
+        set_error(LZ7_ERROR_FORMAT, "decompress_memory", "Invalid filter in the frame header!");
+        return 0;
+    }
+    Progress reporter = progress != NULL ? *progress : (Progress) { .callback = NULL };
+    // The whole buffer goes to the decoder, it tells an in-place frame by the overlap
+    ssize_t (*decode_stream)(const unsigned char*, size_t, unsigned char*, size_t, size_t, size_t, int, Progress*)
+        = framed && (header.flags & FRAME_FLAG_SPLIT) ? decode_memory_split : decode_memory;
+    ssize_t produced = decode_stream(src + header_size, src_size - header_size - trailer_size, dst, dst_size,
+                                     primed, window_size, options->checked, &reporter);
+    int result = produced >= 0;
+    if (result && framed && (size_t) produced != output_size) {
+        set_error(LZ7_ERROR_FORMAT, "decompress_memory", "Decoded %zd bytes, the frame header says %zu!",
+                  produced, output_size);
+        result = 0;
+    }
+    result = result && filter_inverse(&filter, dst, produced);
+    free_filter(&filter);
+    if (!result) {
         return 0;
     }
 
-    result = decode(&lz_reader, input_file, decompressor_buffer_size);
+    uint32_t content_checksum = cpu_kernels()->crc32c(0, dst, produced);
+    if (trailer_size > 0 && checksum != content_checksum) {
+        set_error(LZ7_ERROR_CHECKSUM, "decompress_memory", "Checksum mismatch (%08X != %08X)!", content_checksum, checksum);
+        return 0;
+    }
+    if (content_size != NULL) {
+        *content_size = produced;
+    }
+    return 1;
+}
+
+/*
+* Function: decompress_memory
+* ---------------------------
+* Decompresses a frame (or a legacy stream, or the frames of a multi-frame
+* file one after the other) from memory into a caller buffer, which is also
+* the history: nothing but the filter state is allocated. The frame may lie
+* at the tail of dst (in-place), its header and trailer are read before the
+* first byte is written.
+*
+* src: Compressed data
+* src_size: Compressed data size
+* dst: Output buffer
+* dst_size: Output buffer size (at least the content size of a frame)
+* content_size: Output decoded size
+* options: Token validation and the window size of streams without a frame header
+* progress: Token stream bytes decoded so far (NULL: no progress)
+*
+* returns: If failed (0), On success (1)
+*/
+int decompress_memory(const unsigned char* src, size_t src_size, unsigned char* dst, size_t dst_size,
+                      size_t* content_size, const Lz7Options* options, const Progress* progress) {
+    if (src == NULL || dst == NULL || options == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "decompress_memory", "Required parameters are NULL!");
+        return 0;
+    }
+    FrameIndex index;
+    int indexed = parse_frame_index(src, src_size, &index);
+    if (indexed <= 0) {
+        return indexed == 0 && decompress_frame_memory(src, src_size, dst, dst_size, content_size, options,
+                                                       progress, NULL);
+    }
+
+    // The index was copied, in place the frames overwrite it
+    size_t done = 0;
+    int result = 1;
+    for (size_t i = 0; result && i < index.count; i++) {
+        const FrameEntry* entry = &index.entries[i];
+        size_t produced = 0;
+        result = decompress_frame_memory(src + entry->offset, entry->size, dst + done, dst_size - done, &produced,
+                                         options, progress, entry);
+        done += produced;
+    }
+    free_frame_index(&index);
+    if (result && content_size != NULL) {
+        *content_size = done;
+    }
     return result;
 }
@@ -0,0 +1,361 @@
+#include "../include/cpu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_X86 1
+#else
+#define CPU_X86 0
+#endif
+
+// Reflected CRC-32C polynomial
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[8][256];
+
+// 8 bytes per step in general purpose registers, inlined into every variant
+// so the vector ones never call into code of another instruction set
+static inline __attribute__((always_inline))
+size_t match_length_words(const unsigned char* a, const unsigned char* b, size_t limit) {
+    size_t length = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (length + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + length, 8);
+        memcpy(&y, b + length, 8);
+        if (x != y) {
+            return length + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += 8;
+    }
+#endif
+    while (length < limit && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+static size_t match_length_scalar(const unsigned char* a, const unsigned char* b, size_t limit) {
+    return match_length_words(a, b, limit);
+}
+
+// Leading bytes of data equal to value, every word is compared with value repeated
+static inline __attribute__((always_inline))
+size_t run_length_words(const unsigned char* data, unsigned char value, size_t limit) {
+    size_t length = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t run = value * 0x0101010101010101ULL;
+    while (length + 8 <= limit) {
+        uint64_t x;
+        memcpy(&x, data + length, 8);
+        if (x != run) {
+            return length + (__builtin_ctzll(x ^ run) >> 3);
+        }
+        length += 8;
+    }
+#endif
+    while (length < limit && data[length] == value) {
+        length++;
+    }
+    return length;
+}
+
+static size_t run_length_scalar(const unsigned char* data, size_t limit) {
+    return limit > 0 ? run_length_words(data, data[0], limit) : 0;
+}
+
+static void wild_copy_scalar(unsigned char* dst, const unsigned char* src, size_t length) {
+    unsigned char* end = dst + length;
+    do {
+        memcpy(dst, src, 8);
+        dst += 8;
+        src += 8;
+    } while (dst < end);
+}
+
+// Slicing-by-8, 8 table lookups per 8 bytes
+static uint32_t crc32c_scalar(uint32_t crc, const unsigned char* data, size_t size) {
+    crc = ~crc;
+    while (size >= 8) {
+        uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+        crc = crc32c_table[7][low & 0xFF] ^ crc32c_table[6][(low >> 8) & 0xFF]
+            ^ crc32c_table[5][(low >> 16) & 0xFF] ^ crc32c_table[4][low >> 24]
+            ^ crc32c_table[3][data[4]] ^ crc32c_table[2][data[5]]
+            ^ crc32c_table[1][data[6]] ^ crc32c_table[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xFF];
+    }
+    return ~crc;
+}
+
+#if CPU_X86
+__attribute__((target("sse2")))
+static size_t match_length_sse2(const unsigned char* a, const unsigned char* b, size_t limit) {
+    size_t length = 0;
+    while (length + 16 <= limit) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (a + length));
+        __m128i y = _mm_loadu_si128((const __m128i*) (b + length));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFF;
+        if (mask != 0) {
+            return length + __builtin_ctz(mask);
+        }
+        length += 16;
+    }
+    return length + match_length_words(a + length, b + length, limit - length);
+}
+
+__attribute__((target("sse2")))
+static size_t run_length_sse2(const unsigned char* data, size_t limit) {
+    if (limit == 0) {
+        return 0;
+    }
+    size_t length = 0;
+    __m128i run = _mm_set1_epi8((char) data[0]);
+    while (length + 16 <= limit) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (data + length));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, run)) ^ 0xFFFF;
+        if (mask != 0) {
+            return length + __builtin_ctz(mask);
+        }
+        length += 16;
+    }
+    return length + run_length_words(data + length, data[0], limit - length);
+}
+
+__attribute__((target("sse2")))
+static void wild_copy_sse2(unsigned char* dst, const unsigned char* src, size_t length) {
+    unsigned char* end = dst + length;
+    do {
+        _mm_storeu_si128((__m128i*) dst, _mm_loadu_si128((const __m128i*) src));
+        dst += 16;
+        src += 16;
+    } while (dst < end);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t size) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        size -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+    while (size >= 4) {
+        uint32_t value;
+        memcpy(&value, data, 4);
+        crc = _mm_crc32_u32(crc, value);
+        data += 4;
+        size -= 4;
+    }
+    while (size--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return ~crc;
+}
+
+__attribute__((target("avx2")))
+static size_t match_length_avx2(const unsigned char* a, const unsigned char* b, size_t limit) {
+    size_t length = 0;
+    while (length + 32 <= limit) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (a + length));
+        __m256i y = _mm256_loadu_si256((const __m256i*) (b + length));
+        unsigned int mask = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (mask != 0) {
+            return length + __builtin_ctz(mask);
+        }
+        length += 32;
+    }
+    return length + match_length_words(a + length, b + length, limit - length);
+}
+
+__attribute__((target("avx2")))
+static size_t run_length_avx2(const unsigned char* data, size_t limit) {
+    if (limit == 0) {
+        return 0;
+    }
+    size_t length = 0;
+    __m256i run = _mm256_set1_epi8((char) data[0]);
+    while (length + 32 <= limit) {
+        __m256i x = _mm256_loadu_si256((const __m256i*) (data + length));
+        unsigned int mask = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, run));
+        if (mask != 0) {
+            return length + __builtin_ctz(mask);
+        }
+        length += 32;
+    }
+    return length + run_length_words(data + length, data[0], limit - length);
+}
+
+__attribute__((target("avx2")))
+static void wild_copy_avx2(unsigned char* dst, const unsigned char* src, size_t length) {
+    unsigned char* end = dst + length;
+    do {
+        _mm256_storeu_si256((__m256i*) dst, _mm256_loadu_si256((const __m256i*) src));
+        dst += 32;
+        src += 32;
+    } while (dst < end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t match_length_avx512(const unsigned char* a, const unsigned char* b, size_t limit) {
+    size_t length = 0;
+    while (length + 64 <= limit) {
+        __m512i x = _mm512_loadu_si512((const void*) (a + length));
+        __m512i y = _mm512_loadu_si512((const void*) (b + length));
+        __mmask64 mask = _mm512_cmpneq_epi8_mask(x, y);
+        if (mask != 0) {
+            return length + __builtin_ctzll(mask);
+        }
+        length += 64;
+    }
+    // Masked loads for the tail, nothing past limit is read
+    __mmask64 tail = limit - length < 64 ? (1ULL << (limit - length)) - 1 : ~0ULL;
+    __m512i x = _mm512_maskz_loadu_epi8(tail, a + length);
+    __m512i y = _mm512_maskz_loadu_epi8(tail, b + length);
+    __mmask64 mask = _mm512_mask_cmpneq_epi8_mask(tail, x, y);
+    return mask != 0 ? length + __builtin_ctzll(mask) : limit;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t run_length_avx512(const unsigned char* data, size_t limit) {
+    if (limit == 0) {
+        return 0;
+    }
+    size_t length = 0;
+    __m512i run = _mm512_set1_epi8((char) data[0]);
+    while (length + 64 <= limit) {
+        __mmask64 mask = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512((const void*) (data + length)), run);
+        if (mask != 0) {
+            return length + __builtin_ctzll(mask);
+        }
+        length += 64;
+    }
+    __mmask64 tail = (1ULL << (limit - length)) - 1;
+    __mmask64 mask = _mm512_mask_cmpneq_epi8_mask(tail, _mm512_maskz_loadu_epi8(tail, data + length), run);
+    return mask != 0 ? length + __builtin_ctzll(mask) : limit;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void wild_copy_avx512(unsigned char* dst, const unsigned char* src, size_t length) {
+    unsigned char* end = dst + length;
+    do {
+        _mm512_storeu_si512((void*) dst, _mm512_loadu_si512((const void*) src));
+        dst += 64;
+        src += 64;
+    } while (dst < end);
+}
+#endif
+
+static const CpuKernels kernel_sets[CPU_LEVEL_COUNT] = {
+    { CPU_SCALAR, "scalar", match_length_scalar, run_length_scalar, wild_copy_scalar, crc32c_scalar },
+#if CPU_X86
+    { CPU_SSE2, "sse2", match_length_sse2, run_length_sse2, wild_copy_sse2, crc32c_scalar },
+    { CPU_SSE42, "sse4.2", match_length_sse2, run_length_sse2, wild_copy_sse2, crc32c_sse42 },
+    { CPU_AVX2, "avx2", match_length_avx2, run_length_avx2, wild_copy_avx2, crc32c_sse42 },
+    { CPU_AVX512, "avx512", match_length_avx512, run_length_avx512, wild_copy_avx512, crc32c_sse42 },
+#endif
+};
+
+static int supported_level = CPU_SCALAR;
+static const CpuKernels* active_kernels = &kernel_sets[CPU_SCALAR];
+
+static int parse_cpu_level(const char* name) {
+    for (int level = 0; level < CPU_LEVEL_COUNT; level++) {
+        if (kernel_sets[level].name != NULL && strcasecmp(name, kernel_sets[level].name) == 0) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+// Runs before main(), like an ifunc resolver
+__attribute__((constructor))
+static void init_cpu_kernels(void) {
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 8; slice++) {
+            uint32_t prev = crc32c_table[slice - 1][i];
+            crc32c_table[slice][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+
+#if CPU_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) supported_level = CPU_SSE2;
+    if (supported_level == CPU_SSE2 && __builtin_cpu_supports("sse4.2")) supported_level = CPU_SSE42;
+    if (supported_level == CPU_SSE42 && __builtin_cpu_supports("avx2")) supported_level = CPU_AVX2;
+    if (supported_level == CPU_AVX2 && __builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512bw")) {
+        supported_level = CPU_AVX512;
+    }
+#endif
+
+    int level = supported_level;
+    const char* cap = getenv("LZ7_CPU");
+    if (cap != NULL) {
+        int cap_level = parse_cpu_level(cap);
+        if (cap_level >= 0 && cap_level < level) {
+            level = cap_level;
+        }
+    }
+    active_kernels = &kernel_sets[level];
+}
+
+const CpuKernels* cpu_kernels(void) {
+    return active_kernels;
+}
+
+const CpuKernels* cpu_kernels_for(int level) {
+    if (level < 0) {
+        level = CPU_SCALAR;
+    }
+    if (level > supported_level) {
+        level = supported_level;
+    }
+    return &kernel_sets[level];
+}
+
+// Product of two polynomials modulo the CRC-32C polynomial (bit reflected, x^0 is the top bit)
+static uint32_t multiply_mod(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+        if (a & bit) {
+            product ^= b;
+        }
+        b = (b >> 1) ^ (CRC32C_POLY & (0u - (b & 1)));
+    }
+    return product;
+}
+
+uint32_t crc32c_zeros(uint32_t crc, uint64_t size) {
+    // x^(8 * size) from the squares x^(2^k), then the register times it
+    uint32_t power = 1u << 31;
+    uint32_t square = 1u << 23;     // x^8
+    for (; size > 0; size >>= 1) {
+        if (size & 1) {
+            power = multiply_mod(power, square);
+        }
+        square = multiply_mod(square, square);
+    }
+    return ~multiply_mod(power, ~crc);
+}
@@ -0,0 +1,851 @@
+#define _GNU_SOURCE
+#include "../include/daemon.h"
+#include "../include/compressor.h"
+#include "../include/constants.h"
+#include "../include/lz77.h"
+#include "../include/hash.h"
+#include "../include/parallel.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// A client that stops talking in the middle of a request releases its worker
+#define DAEMON_TIMEOUT_S 30
+
+typedef struct {
+    uint8_t op;
+    uint8_t transfer;
+    uint8_t level;
+    uint8_t min_match;
+    uint8_t filter;
+    uint8_t flags;          // DAEMON_FLAG_*
+    uint8_t checked;
+    uint32_t window_size;
+    uint64_t payload_size;
+} Request;
+
+// Connections of one worker: the owner pops at the tail (newest, its data is
+// the most likely to be cached), thieves take from the head (oldest)
+typedef struct {
+    int fds[DAEMON_QUEUE_SIZE];
+    uint64_t accepted[DAEMON_QUEUE_SIZE];  // Accept time (us) of each connection
+    size_t head;
+    size_t tail;                // head == tail: empty (both only grow)
+    pthread_mutex_t lock;
+} Deque;
+
+typedef struct {
+    uint64_t requests[LZ7_REMOTE_SHUTDOWN + 1];
+    uint64_t errors;
+    uint64_t busy;              // Connections refused with all deques full
+    uint64_t steals;
+    size_t max_depth;
+    uint64_t latency[DAEMON_LATENCY_BUCKETS];
+    uint64_t latency_total;     // Microseconds
+    uint64_t latency_max;
+} DaemonStats;
+
+struct Daemon;
+
+// Everything a worker keeps between requests
+typedef struct {
+    struct Daemon* daemon;
+    int index;
+    pthread_t thread;
+    Deque deque;
+    FILE* input;                // Inline payloads
+    FILE* output;               // Inline results and reports
+    unsigned char* buffer;      // DAEMON_IO_SIZE
+    Lz7Options options;
+} Worker;
+
+typedef struct Daemon {
+    Worker* workers;
+    int count;
+    size_t pending;             // Queued connections not reserved by a worker (guarded by lock)
+    int stopping;
+    volatile sig_atomic_t shutdown; // Set by a shutdown request
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    DaemonStats stats;          // Guarded by lock
+    uint64_t started;
+} Daemon;
+
+static void put_le(unsigned char* p, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get_le(const unsigned char* p, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) {
+        value |= (uint64_t) p[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint64_t now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int send_all(int fd, const void* data, size_t size) {
+    const unsigned char* p = data;
+    while (size > 0) {
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            set_error(LZ7_ERROR_IO, "send_all", "Failed to write to the socket: %s!", strerror(errno));
+            return 0;
+        }
+        p += sent;
+        size -= sent;
+    }
+    return 1;
+}
+
+static int recv_all(int fd, void* data, size_t size) {
+    unsigned char* p = data;
+    while (size > 0) {
+        ssize_t received = recv(fd, p, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            set_error(LZ7_ERROR_IO, "recv_all", "%s!", received == 0 ? "The peer closed the connection"
+                                                                    : strerror(errno));
+            return 0;
+        }
+        p += received;
+        size -= received;
+    }
+    return 1;
+}
+
+// Streams size bytes of file (from its current position) into the socket
+static int send_file(int fd, FILE* file, uint64_t size, unsigned char* buffer) {
+    while (size > 0) {
+        size_t length = size < DAEMON_IO_SIZE ? size : DAEMON_IO_SIZE;
+        if (fread(buffer, 1, length, file) != length) {
+            set_error(LZ7_ERROR_IO, "send_file", "Failed to read the payload!");
+            return 0;
+        }
+        if (!send_all(fd, buffer, length)) {
+            return 0;
+        }
+        size -= length;
+    }
+    return 1;
+}
+
+static int recv_file(int fd, FILE* file, uint64_t size, unsigned char* buffer) {
+    while (size > 0) {
+        size_t length = size < DAEMON_IO_SIZE ? size : DAEMON_IO_SIZE;
+        if (!recv_all(fd, buffer, length)) {
+            return 0;
+        }
+        if (fwrite(buffer, 1, length, file) != length) {
+            set_error(LZ7_ERROR_IO, "recv_file", "Failed to write the payload!");
+            return 0;
+        }
+        size -= length;
+    }
+    return 1;
+}
+
+// Empties a pooled temporary file
+static int reset_file(FILE* file) {
+    rewind(file);
+    return ftruncate(fileno(file), 0) == 0;
+}
+
+static int connect_socket(const char* socket_path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        set_error(LZ7_ERROR_PARAMETER, "connect_socket", "Socket path is too long: %s!", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        set_error(LZ7_ERROR_IO, "connect_socket", "Failed to connect to %s: %s!", socket_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static int send_reply(int fd, int status, const void* payload, uint64_t payload_size) {
+    unsigned char reply[DAEMON_REPLY_SIZE];
+    memcpy(reply, DAEMON_REPLY_MAGIC, DAEMON_MAGIC_SIZE);
+    put_le(reply + 4, (uint32_t) status, 4);
+    put_le(reply + 8, payload_size, 8);
+    return send_all(fd, reply, sizeof(reply)) && (payload == NULL || send_all(fd, payload, payload_size));
+}
+
+// Replies with the error of the current request (or the given one)
+static int send_error(int fd, int status, const char* message) {
+    status = last_error() != LZ7_OK ? last_error() : status;
+    message = last_error() != LZ7_OK ? last_error_message() : message;
+    return send_reply(fd, status, message, strlen(message));
+}
+
+/*
+* Reads the request header (-1: the peer sent nothing). Descriptors arrive
+* with its first byte, fds receives them (-1: none).
+*/
+static int read_request(int fd, Request* request, int fds[2]) {
+    unsigned char header[DAEMON_REQUEST_SIZE];
+    union {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof(header) };
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+    fds[0] = fds[1] = -1;
+    ssize_t received;
+    do {
+        received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    // Closed without a request (i.e. probed by another daemon)
+    if (received == 0) {
+        return -1;
+    }
+    if (received < 0) {
+        set_error(LZ7_ERROR_IO, "read_request", "Failed to read the request!");
+        return 0;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int received_fd;
+            memcpy(&received_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (i < 2 && fds[i] < 0) {
+                fds[i] = received_fd;
+            } else {
+                close(received_fd);
+            }
+        }
+    }
+    if ((size_t) received < sizeof(header) && !recv_all(fd, header + received, sizeof(header) - received)) {
+        return 0;
+    }
+    if (memcmp(header, DAEMON_REQUEST_MAGIC, DAEMON_MAGIC_SIZE) != 0 || header[4] != DAEMON_VERSION) {
+        set_error(LZ7_ERROR_FORMAT, "read_request", "Not an lz7 request (or another protocol version)!");
+        return 0;
+    }
+    *request = (Request) {
+        .op = header[5],
+        .transfer = header[6],
+        .level = header[7],
+        .min_match = header[8],
+        .filter = header[9],
+        .flags = header[10],
+        .checked = header[11],
+        .window_size = get_le(header + 12, 4),
+        .payload_size = get_le(header + 16, 8),
+    };
+    return 1;
+}
+
+static void write_request(unsigned char* header, int op, int transfer, const Lz7Options* options, uint64_t payload_size) {
+    memcpy(header, DAEMON_REQUEST_MAGIC, DAEMON_MAGIC_SIZE);
+    header[4] = DAEMON_VERSION;
+    header[5] = op;
+    header[6] = transfer;
+    header[7] = options->level;
+    header[8] = options->min_match;
+    header[9] = options->filter;
+    header[10] = (options->long_range ? DAEMON_FLAG_LONG_RANGE : 0) | (options->split ? DAEMON_FLAG_SPLIT : 0);
+    header[11] = options->checked != 0;
+    put_le(header + 12, options->window_size, 4);
+    put_le(header + 16, payload_size, 8);
+}
+
+static int latency_bucket(uint64_t latency) {
+    int bucket = 0;
+    while (latency > 1 && bucket < DAEMON_LATENCY_BUCKETS - 1) {
+        latency >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Upper bound of the bucket holding the given fraction of the requests
+static uint64_t latency_percentile(const DaemonStats* stats, uint64_t count, double fraction) {
+    uint64_t rank = (uint64_t) (count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < DAEMON_LATENCY_BUCKETS; i++) {
+        seen += stats->latency[i];
+        if (seen > rank) {
+            return 2ULL << i;
+        }
+    }
+    return 0;
+}
+
+static void write_report(Daemon* daemon, FILE* report) {
+    pthread_mutex_lock(&daemon->lock);
+    DaemonStats stats = daemon->stats;
+    size_t depth = daemon->pending;
+    pthread_mutex_unlock(&daemon->lock);
+
+    uint64_t count = 0;
+    for (int i = 0; i < DAEMON_LATENCY_BUCKETS; i++) {
+        count += stats.latency[i];
+    }
+    fprintf(report, "Workers: %d\n", daemon->count);
+    fprintf(report, "Uptime: %.1f s\n", (now_us() - daemon->started) / 1e6);
+    fprintf(report, "Requests: %llu compress, %llu decompress, %llu stats\n",
+            (unsigned long long) stats.requests[LZ7_REMOTE_COMPRESS],
+            (unsigned long long) stats.requests[LZ7_REMOTE_DECOMPRESS],
+            (unsigned long long) stats.requests[LZ7_REMOTE_STATS]);
+    fprintf(report, "Errors: %llu\n", (unsigned long long) stats.errors);
+    fprintf(report, "Refused (queue full): %llu\n", (unsigned long long) stats.busy);
+    fprintf(report, "Steals: %llu\n", (unsigned long long) stats.steals);
+    fprintf(report, "Queue depth: %zu (max %zu)\n", depth, stats.max_depth);
+    if (count > 0) {
+        fprintf(report, "Latency: avg %llu us, p50 < %llu us, p99 < %llu us, max %llu us\n",
+                (unsigned long long) (stats.latency_total / count),
+                (unsigned long long) latency_percentile(&stats, count, 0.5),
+                (unsigned long long) latency_percentile(&stats, count, 0.99),
+                (unsigned long long) stats.latency_max);
+    }
+}
+
+// Options of a compress/decompress request, validated
+static int request_options(const Worker* worker, const Request* request, Lz7Options* options) {
+    *options = worker->options;
+    options->level = request->level;
+    options->min_match = request->min_match;
+    options->filter = request->filter;
+    options->long_range = (request->flags & DAEMON_FLAG_LONG_RANGE) != 0;
+    options->split = (request->flags & DAEMON_FLAG_SPLIT) != 0;
+    options->checked = request->checked;
+    options->window_size = request->window_size;
+    // Requests run side by side, each one on a single worker
+    options->threads = 0;
+    options->filter_stride = 0;
+    options->filter_row_size = 0;
+    if ((options->level != LEVEL_FAST && options->level != LEVEL_MAX)
+        || options->min_match < MIN_HASH_LENGTH || options->min_match > MAX_HASH_LENGTH
+        || options->window_size == 0 || options->window_size > MAX_OFFSET) {
+        set_error(LZ7_ERROR_PARAMETER, "request_options", "Invalid level, minimum match or window size!");
+        return 0;
+    }
+    return 1;
+}
+
+static int serve_codec(Worker* worker, int fd, const Request* request, int fds[2]) {
+    Lz7Options options;
+    if (!request_options(worker, request, &options)) {
+        return send_error(fd, LZ7_ERROR_PARAMETER, ""), 0;
+    }
+    int compressing = request->op == LZ7_REMOTE_COMPRESS;
+
+    if (request->transfer == DAEMON_TRANSFER_FDS) {
+        if (fds[0] < 0 || fds[1] < 0) {
+            set_error(LZ7_ERROR_PARAMETER, "serve_codec", "The request carries no input and output descriptors!");
+            return send_error(fd, LZ7_ERROR_PARAMETER, ""), 0;
+        }
+        // The files now own the descriptors. Long matches read a "w+b" output back.
+        int readable = (fcntl(fds[1], F_GETFL) & O_ACCMODE) == O_RDWR;
+        FILE* input_file = fdopen(fds[0], "rb");
+        FILE* output_file = input_file != NULL ? fdopen(fds[1], readable ? "r+b" : "wb") : NULL;
+        fds[0] = input_file != NULL ? -1 : fds[0];
+        fds[1] = output_file != NULL ? -1 : fds[1];
+        int result = output_file != NULL;
+        if (!result) {
+            set_error(LZ7_ERROR_IO, "serve_codec", "Failed to open the descriptors: %s!", strerror(errno));
+        }
+        result = result && (compressing ? compress(input_file, output_file, &options, NULL)
+                                        : decompress(input_file, output_file, &options, NULL));
+        if (output_file != NULL && fclose(output_file) != 0 && result) {
+            set_error(LZ7_ERROR_IO, "serve_codec", "Failed to write the output!");
+            result = 0;
+        }
+        if (input_file != NULL) {
+            fclose(input_file);
+        }
+        return result ? send_reply(fd, LZ7_OK, NULL, 0) : (send_error(fd, LZ7_ERROR, "Failed!"), 0);
+    }
+
+    if (request->transfer != DAEMON_TRANSFER_INLINE || request->payload_size > DAEMON_MAX_INLINE_SIZE) {
+        set_error(LZ7_ERROR_PARAMETER, "serve_codec", "Unknown transfer or payload too large!");
+        return send_error(fd, LZ7_ERROR_PARAMETER, ""), 0;
+    }
+    int result = reset_file(worker->input) && reset_file(worker->output);
+    if (!result) {
+        set_error(LZ7_ERROR_IO, "serve_codec", "Failed to reset the temporary files!");
+    }
+    result = result && recv_file(fd, worker->input, request->payload_size, worker->buffer) && fflush(worker->input) == 0;
+    if (!result) {
+        return send_error(fd, LZ7_ERROR_IO, "Failed!"), 0;
+    }
+    rewind(worker->input);
+    result = compressing ? compress(worker->input, worker->output, &options, NULL)
+                         : decompress(worker->input, worker->output, &options, NULL);
+    long output_size = result && fflush(worker->output) == 0 ? ftell(worker->output) : -1;
+    if (output_size < 0) {
+        return send_error(fd, LZ7_ERROR, "Failed!"), 0;
+    }
+    rewind(worker->output);
+    return send_reply(fd, LZ7_OK, NULL, output_size) && send_file(fd, worker->output, output_size, worker->buffer);
+}
+
+// Only the user the daemon runs as (or root) may stop it
+static int serve_shutdown(Worker* worker, int fd) {
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0
+        || (credentials.uid != geteuid() && credentials.uid != 0)) {
+        set_error(LZ7_ERROR_PARAMETER, "serve_shutdown", "Only the owner of the daemon can stop it!");
+        return send_error(fd, LZ7_ERROR_PARAMETER, ""), 0;
+    }
+    worker->daemon->shutdown = 1;
+    return send_reply(fd, LZ7_OK, NULL, 0);
+}
+
+static int serve_stats(Worker* worker, int fd) {
+    if (!reset_file(worker->output)) {
+        set_error(LZ7_ERROR_IO, "serve_stats", "Failed to reset the temporary file!");
+        return send_error(fd, LZ7_ERROR_IO, ""), 0;
+    }
+    write_report(worker->daemon, worker->output);
+    long size = fflush(worker->output) == 0 ? ftell(worker->output) : -1;
+    if (size < 0) {
+        return send_error(fd, LZ7_ERROR_IO, "Failed to write the report!"), 0;
+    }
+    rewind(worker->output);
+    return send_reply(fd, LZ7_OK, NULL, size) && send_file(fd, worker->output, size, worker->buffer);
+}
+
+static void serve_connection(Worker* worker, int fd, uint64_t accepted) {
+    Daemon* daemon = worker->daemon;
+    struct timeval timeout = { .tv_sec = DAEMON_TIMEOUT_S };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Every request starts with a clean error, its own one goes to the client
+    clear_error();
+    Request request = { 0 };
+    int fds[2];
+    int result = read_request(fd, &request, fds);
+    if (result < 0) {
+        close(fd);
+        return;
+    }
+    if (!result) {
+        send_error(fd, LZ7_ERROR_FORMAT, "");
+    } else if (request.op == LZ7_REMOTE_COMPRESS || request.op == LZ7_REMOTE_DECOMPRESS) {
+        result = serve_codec(worker, fd, &request, fds);
+    } else if (request.op == LZ7_REMOTE_STATS) {
+        result = serve_stats(worker, fd);
+    } else if (request.op == LZ7_REMOTE_SHUTDOWN) {
+        result = serve_shutdown(worker, fd);
+    } else {
+        set_error(LZ7_ERROR_UNSUPPORTED, "serve_connection", "Unknown request %d!", request.op);
+        result = 0;
+        send_error(fd, LZ7_ERROR_UNSUPPORTED, "");
+    }
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    close(fd);
+    clear_error();
+
+    uint64_t latency = now_us() - accepted;
+    pthread_mutex_lock(&daemon->lock);
+    if (result && request.op <= LZ7_REMOTE_SHUTDOWN) {
+        daemon->stats.requests[request.op]++;
+    }
+    daemon->stats.errors += !result;
+    daemon->stats.latency[latency_bucket(latency)]++;
+    daemon->stats.latency_total += latency;
+    daemon->stats.latency_max = latency > daemon->stats.latency_max ? latency : daemon->stats.latency_max;
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+// Takes a connection reserved through pending: its own newest one, or another worker's oldest
+static int take_connection(Worker* worker, uint64_t* accepted) {
+    Daemon* daemon = worker->daemon;
+    for (;;) {
+        Deque* deque = &worker->deque;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->tail != deque->head) {
+            deque->tail--;
+            int fd = deque->fds[deque->tail % DAEMON_QUEUE_SIZE];
+            *accepted = deque->accepted[deque->tail % DAEMON_QUEUE_SIZE];
+            pthread_mutex_unlock(&deque->lock);
+            return fd;
+        }
+        pthread_mutex_unlock(&deque->lock);
+
+        for (int i = 1; i < daemon->count; i++) {
+            deque = &daemon->workers[(worker->index + i) % daemon->count].deque;
+            pthread_mutex_lock(&deque->lock);
+            if (deque->tail != deque->head) {
+                int fd = deque->fds[deque->head % DAEMON_QUEUE_SIZE];
+                *accepted = deque->accepted[deque->head % DAEMON_QUEUE_SIZE];
+                deque->head++;
+                pthread_mutex_unlock(&deque->lock);
+                pthread_mutex_lock(&daemon->lock);
+                daemon->stats.steals++;
+                pthread_mutex_unlock(&daemon->lock);
+                return fd;
+            }
+            pthread_mutex_unlock(&deque->lock);
+        }
+        // The reserved connection is being pushed (or taken by a worker reserved earlier)
+        sched_yield();
+    }
+}
+
+static void* daemon_worker(void* arg) {
+    Worker* worker = arg;
+    Daemon* daemon = worker->daemon;
+    for (;;) {
+        pthread_mutex_lock(&daemon->lock);
+        while (daemon->pending == 0 && !daemon->stopping) {
+            pthread_cond_wait(&daemon->ready, &daemon->lock);
+        }
+        // Queued connections are still served when stopping
+        if (daemon->pending == 0) {
+            pthread_mutex_unlock(&daemon->lock);
+            return NULL;
+        }
+        daemon->pending--;
+        pthread_mutex_unlock(&daemon->lock);
+
+        uint64_t accepted = 0;
+        int fd = take_connection(worker, &accepted);
+        serve_connection(worker, fd, accepted);
+    }
+}
+
+// Queues a connection round robin, skipping full deques
+static int queue_connection(Daemon* daemon, int fd, int* next) {
+    uint64_t accepted = now_us();
+    for (int i = 0; i < daemon->count; i++) {
+        Deque* deque = &daemon->workers[*next].deque;
+        *next = (*next + 1) % daemon->count;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->tail - deque->head < DAEMON_QUEUE_SIZE) {
+            deque->fds[deque->tail % DAEMON_QUEUE_SIZE] = fd;
+            deque->accepted[deque->tail % DAEMON_QUEUE_SIZE] = accepted;
+            deque->tail++;
+            pthread_mutex_unlock(&deque->lock);
+
+            pthread_mutex_lock(&daemon->lock);
+            daemon->pending++;
+            daemon->stats.max_depth = daemon->pending > daemon->stats.max_depth ? daemon->pending
+                                                                                 : daemon->stats.max_depth;
+            pthread_cond_signal(&daemon->ready);
+            pthread_mutex_unlock(&daemon->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+    pthread_mutex_lock(&daemon->lock);
+    daemon->stats.busy++;
+    pthread_mutex_unlock(&daemon->lock);
+    return 0;
+}
+
+static int open_socket(const char* socket_path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        set_error(LZ7_ERROR_PARAMETER, "open_socket", "Socket path is too long: %s!", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    // A socket nobody answers on is left over from a daemon that died
+    int probe = connect_socket(socket_path);
+    if (probe >= 0) {
+        close(probe);
+        set_error(LZ7_ERROR_PARAMETER, "open_socket", "A daemon is already serving %s!", socket_path);
+        return -1;
+    }
+    clear_error();
+    struct stat info;
+    if (lstat(socket_path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0
+        || chmod(socket_path, S_IRUSR | S_IWUSR) < 0 || listen(fd, SOMAXCONN) < 0) {
+        set_error(LZ7_ERROR_IO, "open_socket", "Failed to listen on %s: %s!", socket_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static void free_workers(Daemon* daemon, int count) {
+    for (int i = 0; i < count; i++) {
+        Worker* worker = &daemon->workers[i];
+        pthread_mutex_destroy(&worker->deque.lock);
+        if (worker->input != NULL) {
+            fclose(worker->input);
+        }
+        if (worker->output != NULL) {
+            fclose(worker->output);
+        }
+        free(worker->buffer);
+    }
+    free(daemon->workers);
+}
+
+int serve_daemon(const char* socket_path, const Lz7Options* options, volatile sig_atomic_t* stop) {
+    if (socket_path == NULL || options == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "serve_daemon", "Required parameters are NULL!");
+        return 0;
+    }
+    int threads = options->threads;
+    if (threads < 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int) cpus : 1;
+    }
+    threads = threads < PARALLEL_MAX_THREADS ? threads : PARALLEL_MAX_THREADS;
+
+    Daemon daemon = {
+        .count = threads,
+        .started = now_us(),
+    };
+    daemon.workers = calloc(threads, sizeof(Worker));
+    if (daemon.workers == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "serve_daemon", "Failed to allocate the workers!");
+        return 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        Worker* worker = &daemon.workers[i];
+        worker->daemon = &daemon;
+        worker->index = i;
+        worker->options = *options;
+        worker->input = tmpfile();
+        worker->output = tmpfile();
+        worker->buffer = malloc(DAEMON_IO_SIZE);
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        if (worker->input == NULL || worker->output == NULL || worker->buffer == NULL) {
+            set_error(LZ7_ERROR_MEMORY, "serve_daemon", "Failed to allocate the worker buffers!");
+            free_workers(&daemon, i + 1);
+            return 0;
+        }
+    }
+
+    int listener = open_socket(socket_path);
+    if (listener < 0) {
+        free_workers(&daemon, threads);
+        return 0;
+    }
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.ready, NULL);
+    int started = 0;
+    while (started < threads && pthread_create(&daemon.workers[started].thread, NULL, daemon_worker,
+                                               &daemon.workers[started]) == 0) {
+        started++;
+    }
+    // Connections of workers that failed to start are stolen by the others
+    int result = started > 0;
+    if (!result) {
+        set_error(LZ7_ERROR, "serve_daemon", "Failed to start the workers!");
+    }
+
+    int next = 0;
+    while (result && !daemon.shutdown && (stop == NULL || !*stop)) {
+        struct pollfd poll_fd = { .fd = listener, .events = POLLIN };
+        if (poll(&poll_fd, 1, DAEMON_POLL_MS) <= 0) {
+            continue;
+        }
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        if (!queue_connection(&daemon, fd, &next)) {
+            send_reply(fd, LZ7_ERROR, "Busy!", 5);
+            close(fd);
+        }
+    }
+
+    // Queued requests are served before the workers exit
+    close(listener);
+    unlink(socket_path);
+    pthread_mutex_lock(&daemon.lock);
+    daemon.stopping = 1;
+    pthread_cond_broadcast(&daemon.ready);
+    pthread_mutex_unlock(&daemon.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(daemon.workers[i].thread, NULL);
+    }
+    pthread_cond_destroy(&daemon.ready);
+    pthread_mutex_destroy(&daemon.lock);
+    free_workers(&daemon, threads);
+    return result;
+}
+
+// Copies what is left of file into a temporary one (pipes have no size)
+static FILE* spool_input(FILE* input_file, uint64_t* size, unsigned char* buffer) {
+    long position = ftell(input_file);
+    if (position >= 0 && fseek(input_file, 0, SEEK_END) == 0) {
+        long end = ftell(input_file);
+        fseek(input_file, position, SEEK_SET);
+        *size = end - position;
+        return input_file;
+    }
+    FILE* spool = tmpfile();
+    if (spool == NULL) {
+        return NULL;
+    }
+    size_t length;
+    while ((length = fread(buffer, 1, DAEMON_IO_SIZE, input_file)) > 0) {
+        if (fwrite(buffer, 1, length, spool) != length) {
+            fclose(spool);
+            return NULL;
+        }
+    }
+    *size = ftell(spool);
+    rewind(spool);
+    return spool;
+}
+
+static int send_request(int fd, int op, const Lz7Options* options, FILE* input_file, FILE* output_file,
+                        int inline_payload, unsigned char* buffer) {
+    unsigned char header[DAEMON_REQUEST_SIZE];
+    int codec = op == LZ7_REMOTE_COMPRESS || op == LZ7_REMOTE_DECOMPRESS;
+    if (!codec || inline_payload) {
+        FILE* payload = NULL;
+        uint64_t payload_size = 0;
+        if (codec && (payload = spool_input(input_file, &payload_size, buffer)) == NULL) {
+            set_error(LZ7_ERROR_IO, "send_request", "Failed to read the input!");
+            return 0;
+        }
+        if (payload_size > DAEMON_MAX_INLINE_SIZE) {
+            set_error(LZ7_ERROR_PARAMETER, "send_request", "The input is too large to send inline!");
+            return 0;
+        }
+        write_request(header, op, DAEMON_TRANSFER_INLINE, options, payload_size);
+        int result = send_all(fd, header, sizeof(header))
+                     && (payload == NULL || send_file(fd, payload, payload_size, buffer));
+        if (payload != NULL && payload != input_file) {
+            fclose(payload);
+        }
+        return result;
+    }
+
+    // The daemon works on the descriptors, so whatever is buffered must reach them first
+    if (fflush(output_file) != 0 || fflush(input_file) != 0) {
+        set_error(LZ7_ERROR_IO, "send_request", "Failed to flush the files!");
+        return 0;
+    }
+    write_request(header, op, DAEMON_TRANSFER_FDS, options, 0);
+    int fds[2] = { fileno(input_file), fileno(output_file) };
+    union {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof(header) };
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        set_error(LZ7_ERROR_IO, "send_request", "Failed to send the request: %s!", strerror(errno));
+        return 0;
+    }
+    return (size_t) sent == sizeof(header) || send_all(fd, header + sent, sizeof(header) - sent);
+}
+
+int remote_request(const char* socket_path, int op, const Lz7Options* options, FILE* input_file,
+                   FILE* output_file, int inline_payload) {
+    int codec = op == LZ7_REMOTE_COMPRESS || op == LZ7_REMOTE_DECOMPRESS;
+    if (socket_path == NULL || options == NULL || op < LZ7_REMOTE_COMPRESS || op > LZ7_REMOTE_SHUTDOWN
+        || (codec && (input_file == NULL || output_file == NULL)) || (op == LZ7_REMOTE_STATS && output_file == NULL)) {
+        set_error(LZ7_ERROR_PARAMETER, "remote_request", "Required parameters are NULL!");
+        return 0;
+    }
+    unsigned char* buffer = malloc(DAEMON_IO_SIZE);
+    if (buffer == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "remote_request", "Failed to allocate the buffer!");
+        return 0;
+    }
+    int fd = connect_socket(socket_path);
+    int result = fd >= 0 && send_request(fd, op, options, input_file, output_file, inline_payload, buffer);
+
+    unsigned char reply[DAEMON_REPLY_SIZE];
+    result = result && recv_all(fd, reply, sizeof(reply));
+    if (result && memcmp(reply, DAEMON_REPLY_MAGIC, DAEMON_MAGIC_SIZE) != 0) {
+        set_error(LZ7_ERROR_FORMAT, "remote_request", "Not an lz7 daemon reply!");
+        result = 0;
+    }
+    if (result) {
+        int status = (int32_t) get_le(reply + 4, 4);
+        uint64_t payload_size = get_le(reply + 8, 8);
+        if (status != LZ7_OK) {
+            // The payload is the error message of the daemon
+            char message[LZ7_MESSAGE_SIZE] = "";
+            size_t length = payload_size < sizeof(message) - 1 ? payload_size : sizeof(message) - 1;
+            if (recv_all(fd, message, length)) {
+                message[length] = '\0';
+            }
+            clear_error();
+            set_error(status, "remote_request", "%s", message);
+            result = 0;
+        } else {
+            result = recv_file(fd, output_file, payload_size, buffer);
+        }
+    }
+    // The daemon moved the descriptor offsets behind the back of the streams
+    if (result && codec && !inline_payload) {
+        fseek(output_file, 0, SEEK_END);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buffer);
+    return result;
+}
@@ -0,0 +1,66 @@
+#include "../include/error.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// One error slot per thread, so contexts on different threads never mix
+static __thread int error_code = LZ7_OK;
+static __thread char error_message[LZ7_MESSAGE_SIZE];
+
+void set_error(int code, const char* func_name, const char* format, ...) {
+    if (error_code != LZ7_OK) {
+        return;
+    }
+    error_code = code;
+    int size = snprintf(error_message, sizeof(error_message), "%s() {} -> ", func_name);
+    if (size < 0 || (size_t) size >= sizeof(error_message)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error_message + size, sizeof(error_message) - size, format, args);
+    va_end(args);
+}
+
+void clear_error(void) {
+    error_code = LZ7_OK;
+    error_message[0] = '\0';
+}
+
+int last_error(void) {
+    return error_code;
+}
+
+const char* last_error_message(void) {
+    return error_message;
+}
+
+void save_error(ErrorState* state) {
+    if (state->code != LZ7_OK || error_code == LZ7_OK) {
+        return;
+    }
+    state->code = error_code;
+    memcpy(state->message, error_message, sizeof(state->message));
+}
+
+void restore_error(const ErrorState* state) {
+    if (error_code != LZ7_OK || state->code == LZ7_OK) {
+        return;
+    }
+    error_code = state->code;
+    memcpy(error_message, state->message, sizeof(error_message));
+}
+
+int report_progress(Progress* progress, uint64_t done, uint64_t total) {
+    if (progress == NULL || progress->callback == NULL || (done < progress->next && done < total)) {
+        return 1;
+    }
+    progress->next = done + (progress->interval > 0 ? progress->interval : 1);
+    if (progress->callback(progress->user_data, done, total) != 0) {
+        set_error(LZ7_ERROR_CANCELLED, "report_progress", "Cancelled by the progress callback!");
+        return 0;
+    }
+    return 1;
+}
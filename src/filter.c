@@ -0,0 +1,419 @@
+#include "../include/filter.h"
+#include "../include/error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define BMP_HEADER_SIZE 54
+#define MIN_CONTEXT_SIZE 16
+#define SAMPLE_SIZE (64 * 1024)
+#define SAMPLE_HASH_BITS 14
+
+static const char* filter_names[FILTER_COUNT] = { "none", "delta", "channel", "up", "paeth" };
+
+static uint32_t read_le32(const unsigned char* p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static unsigned char paeth_predict(int a, int b, int c) {
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - 2 * c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+/*
+* Forward kernels: dst[i] = src[i] - prediction. src[-context_size .. 0) is valid.
+*/
+static void forward_sub(const unsigned char* src, unsigned char* dst, size_t size, size_t distance) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i p = _mm_loadu_si128((const __m128i*) (src + i - distance));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_sub_epi8(x, p));
+    }
+#endif
+    for (; i < size; i++) {
+        dst[i] = src[i] - src[i - distance];
+    }
+}
+
+#if defined(__SSE2__)
+static __m128i paeth_predict_epi16(__m128i a, __m128i b, __m128i c) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pa, pb);
+    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+    __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    __m128i use_c = _mm_cmpgt_epi16(pb, pc);
+    __m128i bc = _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, b));
+    return _mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a));
+}
+#endif
+
+static void forward_paeth(const unsigned char* src, unsigned char* dst, size_t size, size_t stride, size_t row_size) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*) (src + i));
+        __m128i a = _mm_loadu_si128((const __m128i*) (src + i - stride));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + i - row_size));
+        __m128i c = _mm_loadu_si128((const __m128i*) (src + i - row_size - stride));
+        __m128i lo = paeth_predict_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                         _mm_unpacklo_epi8(c, zero));
+        __m128i hi = paeth_predict_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                         _mm_unpackhi_epi8(c, zero));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_sub_epi8(x, _mm_packus_epi16(lo, hi)));
+    }
+#endif
+    for (; i < size; i++) {
+        dst[i] = src[i] - paeth_predict(src[i - stride], src[i - row_size], src[i - row_size - stride]);
+    }
+}
+
+/*
+* Inverse kernels: x[i] += prediction, in place. x[-context_size .. 0) is already reconstructed.
+*/
+
+// Distance of at least 16 bytes: a whole vector only depends on reconstructed bytes
+static void inverse_add_far(unsigned char* x, size_t size, size_t distance) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (distance >= 16) {
+        for (; i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (x + i));
+            __m128i p = _mm_loadu_si128((const __m128i*) (x + i - distance));
+            _mm_storeu_si128((__m128i*) (x + i), _mm_add_epi8(v, p));
+        }
+    }
+#endif
+    for (; i < size; i++) {
+        x[i] += x[i - distance];
+    }
+}
+
+#if defined(__SSE2__)
+// Short distances: strided prefix sum inside the vector (log-step shifts), the
+// first 'd' lanes are seeded with the tail of the previous vector
+#define DEFINE_INVERSE_ADD_NEAR(d)                                                    \
+static void inverse_add_near_##d(unsigned char* x, size_t size) {                     \
+    size_t i = 0;                                                                     \
+    for (; i + 16 <= size; i += 16) {                                                 \
+        __m128i prev = _mm_loadu_si128((const __m128i*) (x + i - 16));                \
+        __m128i v = _mm_loadu_si128((const __m128i*) (x + i));                        \
+        v = _mm_add_epi8(v, _mm_srli_si128(prev, 16 - (d)));                          \
+        v = _mm_add_epi8(v, _mm_slli_si128(v, (d)));                                  \
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2 * (d)));                              \
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4 * (d)));                              \
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8 * (d)));                              \
+        _mm_storeu_si128((__m128i*) (x + i), v);                                      \
+    }                                                                                 \
+    for (; i < size; i++) {                                                           \
+        x[i] += x[i - (d)];                                                           \
+    }                                                                                 \
+}
+
+DEFINE_INVERSE_ADD_NEAR(1)
+DEFINE_INVERSE_ADD_NEAR(2)
+DEFINE_INVERSE_ADD_NEAR(3)
+DEFINE_INVERSE_ADD_NEAR(4)
+#endif
+
+static void inverse_add(unsigned char* x, size_t size, size_t distance) {
+#if defined(__SSE2__)
+    switch (distance) {
+        case 1: inverse_add_near_1(x, size); return;
+        case 2: inverse_add_near_2(x, size); return;
+        case 3: inverse_add_near_3(x, size); return;
+        case 4: inverse_add_near_4(x, size); return;
+        default: break;
+    }
+#endif
+    inverse_add_far(x, size, distance);
+}
+
+static void inverse_paeth(unsigned char* x, size_t size, size_t stride, size_t row_size) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    // One pixel per step: the left neighbour is the pixel reconstructed just before
+    if (stride == 3 || stride == 4) {
+        __m128i zero = _mm_setzero_si128();
+        for (; i + stride <= size; i += stride) {
+            uint32_t va = 0, vb = 0, vc = 0, vy = 0;
+            memcpy(&va, x + i - stride, stride);
+            memcpy(&vb, x + i - row_size, stride);
+            memcpy(&vc, x + i - row_size - stride, stride);
+            memcpy(&vy, x + i, stride);
+            __m128i p = paeth_predict_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(va), zero),
+                                            _mm_unpacklo_epi8(_mm_cvtsi32_si128(vb), zero),
+                                            _mm_unpacklo_epi8(_mm_cvtsi32_si128(vc), zero));
+            __m128i v = _mm_add_epi8(_mm_cvtsi32_si128(vy), _mm_packus_epi16(p, p));
+            uint32_t out = _mm_cvtsi128_si32(v);
+            memcpy(x + i, &out, stride);
+        }
+    }
+#endif
+    for (; i < size; i++) {
+        x[i] += paeth_predict(x[i - stride], x[i - row_size], x[i - row_size - stride]);
+    }
+}
+
+int init_filter(Filter* filter, int type, size_t stride, size_t row_size, size_t offset) {
+    if (filter == NULL || type < FILTER_NONE || type >= FILTER_COUNT) {
+        set_error(LZ7_ERROR_PARAMETER, "init_filter", "Required parameters are NULL!");
+        return 0;
+    }
+    if (type == FILTER_DELTA) {
+        stride = 1;
+    }
+    if ((type == FILTER_CHANNEL || type == FILTER_PAETH) && stride == 0) {
+        set_error(LZ7_ERROR_PARAMETER, "init_filter", "Filter requires a pixel stride!");
+        return 0;
+    }
+    if ((type == FILTER_UP || type == FILTER_PAETH) && row_size == 0) {
+        set_error(LZ7_ERROR_PARAMETER, "init_filter", "Filter requires a row size!");
+        return 0;
+    }
+
+    filter->type = type;
+    filter->stride = stride;
+    filter->row_size = row_size;
+    filter->offset = offset;
+    filter->pos = 0;
+    filter->work = NULL;
+    filter->work_size = 0;
+    filter->context = NULL;
+    filter->context_size = 0;
+    if (type == FILTER_NONE) {
+        return 1;
+    }
+
+    // Bytes before the pixel data act as zeros
+    size_t reach = (type == FILTER_UP ? 0 : stride) + (type == FILTER_UP || type == FILTER_PAETH ? row_size : 0);
+    filter->context_size = reach > MIN_CONTEXT_SIZE ? reach : MIN_CONTEXT_SIZE;
+    filter->context = calloc(filter->context_size, sizeof(unsigned char));
+    if (filter->context == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "init_filter", "Unable to allocate memory for the filter context!");
+        return 0;
+    }
+    return 1;
+}
+
+static int filter_chunk(Filter* filter, unsigned char* data, size_t size, int inverse) {
+    if (filter == NULL || (data == NULL && size > 0)) {
+        set_error(LZ7_ERROR_PARAMETER, "filter_chunk", "Required parameters are NULL!");
+        return 0;
+    }
+
+    size_t skip = 0;
+    if (filter->pos < filter->offset) {
+        skip = filter->offset - filter->pos < size ? filter->offset - filter->pos : size;
+    }
+    filter->pos += size;
+    size_t n = size - skip;
+    if (filter->type == FILTER_NONE || n == 0) {
+        return 1;
+    }
+
+    size_t context_size = filter->context_size;
+    if (filter->work_size < context_size + n) {
+        unsigned char* work = realloc(filter->work, context_size + n);
+        if (work == NULL) {
+            set_error(LZ7_ERROR_MEMORY, "filter_chunk", "Unable to allocate memory for the filter buffer!");
+            return 0;
+        }
+        filter->work = work;
+        filter->work_size = context_size + n;
+    }
+
+    unsigned char* x = filter->work + context_size;
+    memcpy(filter->work, filter->context, context_size);
+    memcpy(x, data + skip, n);
+
+    if (inverse) {
+        switch (filter->type) {
+            case FILTER_DELTA:
+            case FILTER_CHANNEL:
+                inverse_add(x, n, filter->stride);
+                break;
+            case FILTER_UP:
+                inverse_add_far(x, n, filter->row_size);
+                break;
+            case FILTER_PAETH:
+                inverse_paeth(x, n, filter->stride, filter->row_size);
+                break;
+        }
+        memcpy(data + skip, x, n);
+    } else {
+        switch (filter->type) {
+            case FILTER_DELTA:
+            case FILTER_CHANNEL:
+                forward_sub(x, data + skip, n, filter->stride);
+                break;
+            case FILTER_UP:
+                forward_sub(x, data + skip, n, filter->row_size);
+                break;
+            case FILTER_PAETH:
+                forward_paeth(x, data + skip, n, filter->stride, filter->row_size);
+                break;
+        }
+    }
+
+    // Keep the unfiltered tail as context for the next chunk
+    memcpy(filter->context, filter->work + n, context_size);
+    return 1;
+}
+
+int filter_forward(Filter* filter, unsigned char* data, size_t size) {
+    return filter_chunk(filter, data, size, 0);
+}
+
+int filter_inverse(Filter* filter, unsigned char* data, size_t size) {
+    return filter_chunk(filter, data, size, 1);
+}
+
+/*
+* Rough greedy LZ token count of data (single candidate per hash slot)
+*/
+static size_t estimate_tokens(const unsigned char* data, size_t size) {
+    uint32_t* last = calloc(1 << SAMPLE_HASH_BITS, sizeof(uint32_t));
+    if (last == NULL) {
+        return size;
+    }
+
+    size_t tokens = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t length = 0;
+        if (i + 3 <= size) {
+            uint32_t key = ((data[i] << 16) | (data[i + 1] << 8) | data[i + 2]) * 2654435761u;
+            key >>= 32 - SAMPLE_HASH_BITS;
+            uint32_t candidate = last[key];
+            last[key] = i + 1;
+            if (candidate > 0) {
+                candidate--;
+                while (i + length < size && length < 255 && data[candidate + length] == data[i + length]) {
+                    length++;
+                }
+            }
+        }
+        i += length >= 2 ? length : 1;
+        tokens++;
+    }
+
+    free(last);
+    return tokens;
+}
+
+/*
+* Filters a sample of the pixel data with every candidate and keeps the one that
+* leaves the fewest tokens (filters only help when they turn smooth areas into repeats)
+*/
+static int choose_filter(FILE* file, size_t stride, size_t row_size, size_t offset) {
+    static const int candidates[] = { FILTER_CHANNEL, FILTER_UP, FILTER_PAETH };
+    unsigned char* sample = malloc(2 * SAMPLE_SIZE);
+    if (sample == NULL) {
+        return FILTER_NONE;
+    }
+
+    long current_pos = ftell(file);
+    fseek(file, offset, SEEK_SET);
+    size_t size = fread(sample, sizeof(unsigned char), SAMPLE_SIZE, file);
+    fseek(file, current_pos, SEEK_SET);
+
+    int best_type = FILTER_NONE;
+    size_t best_tokens = estimate_tokens(sample, size);
+    unsigned char* filtered = sample + SAMPLE_SIZE;
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        Filter filter;
+        if (!init_filter(&filter, candidates[i], stride, row_size, 0)) {
+            continue;
+        }
+        memcpy(filtered, sample, size);
+        if (filter_forward(&filter, filtered, size)) {
+            size_t tokens = estimate_tokens(filtered, size);
+            if (tokens < best_tokens) {
+                best_tokens = tokens;
+                best_type = candidates[i];
+            }
+        }
+        free_filter(&filter);
+    }
+
+    free(sample);
+    return best_type;
+}
+
+int detect_filter(FILE* file, int* type, size_t* stride, size_t* row_size, size_t* offset) {
+    unsigned char header[BMP_HEADER_SIZE];
+    long current_pos = ftell(file);
+    size_t read_bytes = fread(header, sizeof(unsigned char), BMP_HEADER_SIZE, file);
+    fseek(file, current_pos, SEEK_SET);
+
+    *type = FILTER_NONE;
+    if (read_bytes < BMP_HEADER_SIZE || header[0] != 'B' || header[1] != 'M') {
+        return 0;
+    }
+
+    uint32_t data_offset = read_le32(header + 10);
+    uint32_t info_size = read_le32(header + 14);
+    int32_t width = (int32_t) read_le32(header + 18);
+    uint16_t bits_per_pixel = header[28] | (header[29] << 8);
+    uint32_t compression = read_le32(header + 30);
+
+    // Only uncompressed true-color rasters; palette indices do not predict well
+    if (info_size < 40 || width <= 0 || data_offset < BMP_HEADER_SIZE || (compression != 0 && compression != 3)
+        || (bits_per_pixel != 16 && bits_per_pixel != 24 && bits_per_pixel != 32)) {
+        return 0;
+    }
+
+    *stride = bits_per_pixel / 8;
+    *row_size = (((size_t) width * bits_per_pixel + 31) / 32) * 4;
+    *offset = data_offset;
+    *type = choose_filter(file, *stride, *row_size, *offset);
+    return 1;
+}
+
+void free_filter(Filter* filter) {
+    if (filter != NULL) {
+        free(filter->context);
+        free(filter->work);
+        filter->context = NULL;
+        filter->work = NULL;
+    }
+}
+
+const char* filter_name(int type) {
+    if (type < FILTER_NONE || type >= FILTER_COUNT) {
+        return "unknown";
+    }
+    return filter_names[type];
+}
+
+int parse_filter_name(const char* name) {
+    if (strcasecmp(name, "auto") == 0) {
+        return FILTER_AUTO;
+    }
+    for (int i = 0; i < FILTER_COUNT; i++) {
+        if (strcasecmp(name, filter_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,296 @@
+#include "../include/frame.h"
+#include "../include/error.h"
+#include "../include/cpu.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void put_le(unsigned char* p, uint64_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        p[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get_le(const unsigned char* p, int size) {
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+int write_frame_header(FILE* file, const FrameHeader* header) {
+    if (file == NULL || header == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "write_frame_header", "Required parameters are NULL!");
+        return 0;
+    }
+
+    unsigned char data[FRAME_HEADER_SIZE];
+    memcpy(data, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+    data[4] = header->version;
+    data[5] = header->flags;
+    data[6] = header->filter;
+    data[7] = header->filter_stride;
+    put_le(data + 8, header->window_size, 4);
+    put_le(data + 12, header->filter_row_size, 4);
+    put_le(data + 16, header->filter_offset, 4);
+    put_le(data + 20, header->content_size, 8);
+
+    if (fwrite(data, sizeof(unsigned char), FRAME_HEADER_SIZE, file) < FRAME_HEADER_SIZE) {
+        set_error(LZ7_ERROR_IO, "write_frame_header", "Unable to write the frame header!");
+        return 0;
+    }
+    return 1;
+}
+
+int parse_frame_header(const unsigned char* data, size_t size, FrameHeader* header) {
+    if (data == NULL || header == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "parse_frame_header", "Required parameters are NULL!");
+        return -1;
+    }
+    if (size < FRAME_MAGIC_SIZE || memcmp(data, FRAME_MAGIC, FRAME_MAGIC_SIZE) != 0) {
+        return 0;
+    }
+    if (size < FRAME_HEADER_SIZE) {
+        set_error(LZ7_ERROR_FORMAT, "parse_frame_header", "Truncated frame header!");
+        return -1;
+    }
+
+    header->version = data[4];
+    header->flags = data[5];
+    header->filter = data[6];
+    header->filter_stride = data[7];
+    header->window_size = get_le(data + 8, 4);
+    header->filter_row_size = get_le(data + 12, 4);
+    header->filter_offset = get_le(data + 16, 4);
+    header->content_size = get_le(data + 20, 8);
+
+    if (header->version != FRAME_VERSION) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "parse_frame_header", "Unsupported frame version (%u)!", header->version);
+        return -1;
+    }
+    if (header->flags & ~FRAME_FLAGS) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "parse_frame_header", "Unsupported frame flags (%02X)!", header->flags);
+        return -1;
+    }
+    return 1;
+}
+
+int read_frame_header(FILE* file, FrameHeader* header) {
+    if (file == NULL || header == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "read_frame_header", "Required parameters are NULL!");
+        return -1;
+    }
+
+    unsigned char data[FRAME_HEADER_SIZE];
+    long start = ftell(file);
+    size_t read_bytes = fread(data, sizeof(unsigned char), FRAME_HEADER_SIZE, file);
+    int result = parse_frame_header(data, read_bytes, header);
+    if (result == 0) {
+        fseek(file, start, SEEK_SET);
+    }
+    return result;
+}
+
+int write_frame_trailer(FILE* file, uint32_t checksum) {
+    unsigned char data[FRAME_TRAILER_SIZE];
+    put_le(data, checksum, FRAME_TRAILER_SIZE);
+    if (file == NULL || fwrite(data, sizeof(unsigned char), FRAME_TRAILER_SIZE, file) < FRAME_TRAILER_SIZE) {
+        set_error(LZ7_ERROR_IO, "write_frame_trailer", "Unable to write the frame trailer!");
+        return 0;
+    }
+    return 1;
+}
+
+uint32_t parse_frame_trailer(const unsigned char* data) {
+    return get_le(data, FRAME_TRAILER_SIZE);
+}
+
+int read_frame_trailer(FILE* file, uint32_t* checksum) {
+    unsigned char data[FRAME_TRAILER_SIZE];
+    if (file == NULL || checksum == NULL
+        || fread(data, sizeof(unsigned char), FRAME_TRAILER_SIZE, file) < FRAME_TRAILER_SIZE) {
+        set_error(LZ7_ERROR_FORMAT, "read_frame_trailer", "Truncated frame trailer!");
+        return 0;
+    }
+    *checksum = get_le(data, FRAME_TRAILER_SIZE);
+    return 1;
+}
+
+/*
+* Locates the index from the footer at the end of a file of file_size bytes
+*
+* returns: If failed (-1), No footer (0), On success (1)
+*/
+static int parse_footer(const unsigned char* footer, uint64_t file_size, uint64_t* offset) {
+    if (memcmp(footer, FRAME_INDEX_MAGIC, FRAME_MAGIC_SIZE) != 0) {
+        return 0;
+    }
+    if (footer[4] != FRAME_INDEX_VERSION) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "read_frame_index", "Unsupported frame index version (%u)!", footer[4]);
+        return -1;
+    }
+    uint64_t count = get_le(footer + 8, 4);
+    uint64_t tail_size = get_le(footer + 12, 4);
+    *offset = get_le(footer + 16, 8);
+    if (count == 0 || count > FRAME_MAX_COUNT || tail_size > FRAME_MAX_TAIL_SIZE || *offset > file_size
+        || file_size - *offset != count * FRAME_INDEX_ENTRY_SIZE + tail_size + FRAME_FOOTER_SIZE) {
+        set_error(LZ7_ERROR_FORMAT, "read_frame_index", "Invalid frame index footer!");
+        return -1;
+    }
+    return 1;
+}
+
+/*
+* Parses the index, the tail and the footer (data, from the index offset to
+* the end of the file)
+*/
+static int parse_index(const unsigned char* data, size_t size, uint64_t offset, FrameIndex* index) {
+    const unsigned char* footer = data + size - FRAME_FOOTER_SIZE;
+    if (cpu_kernels()->crc32c(0, data, size - FRAME_TRAILER_SIZE) != get_le(footer + 32, 4)) {
+        set_error(LZ7_ERROR_CHECKSUM, "read_frame_index", "Frame index checksum mismatch!");
+        return 0;
+    }
+    *index = (FrameIndex) {
+        .count = get_le(footer + 8, 4),
+        .tail_size = get_le(footer + 12, 4),
+        .offset = offset,
+        .content_size = get_le(footer + 24, 8),
+    };
+    index->entries = malloc(index->count * sizeof(FrameEntry));
+    index->tail = index->tail_size > 0 ? malloc(index->tail_size) : NULL;
+    if (index->entries == NULL || (index->tail_size > 0 && index->tail == NULL)) {
+        set_error(LZ7_ERROR_MEMORY, "read_frame_index", "Unable to allocate memory for the frame index!");
+        free_frame_index(index);
+        return 0;
+    }
+
+    // The frames follow each other from the start of the file up to the index
+    uint64_t position = 0;
+    uint64_t content = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        const unsigned char* entry = data + i * FRAME_INDEX_ENTRY_SIZE;
+        FrameEntry* frame = &index->entries[i];
+        frame->offset = get_le(entry, 8);
+        frame->size = get_le(entry + 8, 8);
+        frame->content_size = get_le(entry + 16, 8);
+        frame->primed = get_le(entry + 24, 4);
+        if (frame->offset != position || frame->size < FRAME_HEADER_SIZE || frame->size > offset - position
+            || frame->content_size > UINT64_MAX - content || frame->primed > content) {
+            set_error(LZ7_ERROR_FORMAT, "read_frame_index", "Invalid entry of frame %zu!", i);
+            free_frame_index(index);
+            return 0;
+        }
+        position += frame->size;
+        content += frame->content_size;
+    }
+    if (position != offset || content != index->content_size || index->tail_size > content) {
+        set_error(LZ7_ERROR_FORMAT, "read_frame_index", "The frame index doesn't cover the file!");
+        free_frame_index(index);
+        return 0;
+    }
+    if (index->tail_size > 0) {
+        memcpy(index->tail, data + index->count * FRAME_INDEX_ENTRY_SIZE, index->tail_size);
+    }
+    return 1;
+}
+
+int parse_frame_index(const unsigned char* data, size_t size, FrameIndex* index) {
+    if (data == NULL || index == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "parse_frame_index", "Required parameters are NULL!");
+        return -1;
+    }
+    uint64_t offset = 0;
+    int result = size >= FRAME_FOOTER_SIZE ? parse_footer(data + size - FRAME_FOOTER_SIZE, size, &offset) : 0;
+    if (result <= 0) {
+        return result;
+    }
+    return parse_index(data + offset, size - offset, offset, index) ? 1 : -1;
+}
+
+int read_frame_index(FILE* file, FrameIndex* index) {
+    if (file == NULL || index == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "read_frame_index", "Required parameters are NULL!");
+        return -1;
+    }
+    long start = ftell(file);
+    unsigned char footer[FRAME_FOOTER_SIZE];
+    uint64_t offset = 0;
+    int result = 0;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long size = ftell(file);
+        if (size >= FRAME_FOOTER_SIZE && fseek(file, size - FRAME_FOOTER_SIZE, SEEK_SET) == 0
+            && fread(footer, sizeof(unsigned char), FRAME_FOOTER_SIZE, file) == FRAME_FOOTER_SIZE) {
+            result = parse_footer(footer, size, &offset);
+        }
+        if (result > 0) {
+            // Bounded by the footer checks: FRAME_MAX_COUNT entries and the tail
+            size_t index_size = size - offset;
+            unsigned char* data = malloc(index_size);
+            if (data == NULL) {
+                set_error(LZ7_ERROR_MEMORY, "read_frame_index", "Unable to allocate memory for the frame index!");
+                result = -1;
+            } else if (fseek(file, offset, SEEK_SET) != 0
+                       || fread(data, sizeof(unsigned char), index_size, file) < index_size) {
+                set_error(LZ7_ERROR_IO, "read_frame_index", "Unable to read the frame index!");
+                result = -1;
+            } else {
+                result = parse_index(data, index_size, offset, index) ? 1 : -1;
+            }
+            free(data);
+        }
+    }
+    fseek(file, start, SEEK_SET);
+    return result;
+}
+
+int write_frame_index(FILE* file, const FrameIndex* index) {
+    if (file == NULL || index == NULL || index->count == 0 || index->count > FRAME_MAX_COUNT
+        || index->tail_size > FRAME_MAX_TAIL_SIZE) {
+        set_error(LZ7_ERROR_PARAMETER, "write_frame_index", "Invalid frame index!");
+        return 0;
+    }
+    size_t size = index->count * FRAME_INDEX_ENTRY_SIZE + index->tail_size + FRAME_FOOTER_SIZE;
+    unsigned char* data = malloc(size);
+    if (data == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "write_frame_index", "Unable to allocate memory for the frame index!");
+        return 0;
+    }
+    for (size_t i = 0; i < index->count; i++) {
+        unsigned char* entry = data + i * FRAME_INDEX_ENTRY_SIZE;
+        put_le(entry, index->entries[i].offset, 8);
+        put_le(entry + 8, index->entries[i].size, 8);
+        put_le(entry + 16, index->entries[i].content_size, 8);
+        put_le(entry + 24, index->entries[i].primed, 4);
+    }
+    if (index->tail_size > 0) {
+        memcpy(data + index->count * FRAME_INDEX_ENTRY_SIZE, index->tail, index->tail_size);
+    }
+    unsigned char* footer = data + size - FRAME_FOOTER_SIZE;
+    memcpy(footer, FRAME_INDEX_MAGIC, FRAME_MAGIC_SIZE);
+    footer[4] = FRAME_INDEX_VERSION;
+    memset(footer + 5, 0, 3);
+    put_le(footer + 8, index->count, 4);
+    put_le(footer + 12, index->tail_size, 4);
+    put_le(footer + 16, index->offset, 8);
+    put_le(footer + 24, index->content_size, 8);
+    put_le(footer + 32, cpu_kernels()->crc32c(0, data, size - FRAME_TRAILER_SIZE), 4);
+
+    int result = fwrite(data, sizeof(unsigned char), size, file) == size;
+    if (!result) {
+        set_error(LZ7_ERROR_IO, "write_frame_index", "Unable to write the frame index!");
+    }
+    free(data);
+    return result;
+}
+
+void free_frame_index(FrameIndex* index) {
+    if (index != NULL) {
+        free(index->entries);
+        free(index->tail);
+        index->entries = NULL;
+        index->tail = NULL;
+    }
+}
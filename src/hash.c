@@ -1,5 +1,8 @@
 #include "../include/hash.h"
 #include "../include/buffer.h"
+#include "../include/cpu.h"
+#include "../include/lz77.h"
+#include "../include/error.h"
 
 #include <stddef.h>
 #include <stdio.h>
@@ -7,76 +10,236 @@
 #include <string.h>
 #include <stdint.h>
 
-int init_hash_table(HashTable* hash_table) {
-    hash_table->items = malloc(MAX_TABLE_SIZE * sizeof(HashItem));
-    if (hash_table->items == NULL) {
-        fprintf(stderr, "\n[ERROR]: init_hash_table() {} -> Unable to allocate memory for the hash table!\n");
+_Static_assert(sizeof(HashItem) == HASH_ITEM_SIZE, "A bucket is two cache lines");
+
+/*
+* First TAG_SIZE bytes at data (available: bytes left in the buffer, the
+* missing ones are 0)
+*/
+static inline uint16_t load_tag(const unsigned char* data, size_t available) {
+    return available >= TAG_SIZE ? (uint16_t) (data[0] | data[1] << 8) : available > 0 ? data[0] : 0;
+}
+
+/*
+* Match finder instances. N (the minimum match length) is a compile-time
+* constant in each of them, so the hash loop and the first compare are
+* unrolled and the table index is a mask.
+*/
+#define DEFINE_MATCH_FINDER(N)                                                                  \
+static inline unsigned int hash_##N(const unsigned char* data, size_t mask) {                   \
+    unsigned int hash_value = 2166136261u;                                                      \
+    for (int i = 0; i < (N); i++) {                                                             \
+        hash_value = (hash_value * 16777619u) ^ data[i];                                        \
+    }                                                                                           \
+    return hash_value & mask;                                                                   \
+}                                                                                               \
+                                                                                                \
+static void update_hash_table_##N(HashTable* hash_table, Buffer* buffer, size_t window_size) {  \
+    size_t pos = buffer->pos;                                                                   \
+    if (pos + (N) > buffer->size) return;                                                       \
+    HashItem* hash_item = &hash_table->items[hash_##N(buffer->data + pos, hash_table->mask)];   \
+                                                                                                \
+    /* A full ring overwrites its oldest entry */                                               \
+    uint16_t position = (uint16_t) (hash_table->base + (uint32_t) pos);                         \
+    HashEntry* entry = &hash_item->entries[hash_item->count++ % MAX_CHAIN_SIZE];                \
+    entry->position = position;                                                                 \
+    entry->tag = load_tag(buffer->data + pos, buffer->size - pos);                              \
+    if (hash_item->count - hash_item->first > MAX_CHAIN_SIZE) {                                 \
+        hash_item->first = hash_item->count - MAX_CHAIN_SIZE;                                   \
+    }                                                                                           \
+    /* Entries of an earlier buffer content are out of reach too */                             \
+    for (;;) {                                                                                  \
+        uint16_t distance = position - hash_item->entries[hash_item->first % MAX_CHAIN_SIZE].position; \
+        if (distance <= window_size && distance <= pos) {                                       \
+            break;                                                                              \
+        }                                                                                       \
+        hash_item->first++;                                                                     \
+    }                                                                                           \
+}                                                                                               \
+                                                                                                \
+static size_t find_best_match_##N(HashTable* hash_table, Buffer* buffer, size_t window_size,    \
+                                  size_t* best_match_length) {                                  \
+    *best_match_length = 0;                                                                     \
+    size_t pos = buffer->pos;                                                                   \
+    size_t data_size = buffer->size;                                                            \
+    size_t best_match_pos = pos;                                                                \
+    const unsigned char* data = buffer->data;                                                   \
+                                                                                                \
+    if (pos + (N) > data_size) return best_match_pos;                                           \
+                                                                                                \
+    const HashItem* hash_item = &hash_table->items[hash_##N(data + pos, hash_table->mask)];     \
+    uint16_t tag = load_tag(data + pos, data_size - pos);                                       \
+    uint16_t position = (uint16_t) (hash_table->base + (uint32_t) pos);                         \
+    uint32_t count = hash_item->count;                                                          \
+                                                                                                \
+    /* Oldest to newest, the first of equally long matches wins. A shallow chain               \
+       only compares the newest (nearest) entries. */                                           \
+    uint32_t first = count - hash_item->first > hash_table->depth                               \
+        ? count - hash_table->depth : hash_item->first;                                         \
+    for (uint32_t i = first; i != count; i++) {                                                 \
+        const HashEntry* entry = &hash_item->entries[i % MAX_CHAIN_SIZE];                       \
+        size_t distance = (uint16_t) (position - entry->position);                              \
+        if (distance > window_size || distance > pos || distance < (N)) {                       \
+            continue;                                                                           \
+        }                                                                                       \
+        size_t prev_pos = pos - distance;                                                       \
+        /* Common prefix with the tag: a hash collision below N (or the whole tag),             \
+           the exact length below TAG_SIZE */                                                   \
+        unsigned int diff = entry->tag ^ tag;                                                   \
+        size_t common = diff != 0 ? (size_t) __builtin_ctz(diff) / 8 : TAG_SIZE;                \
+        if (common < ((N) < TAG_SIZE ? (N) : TAG_SIZE)                                          \
+            || (common < TAG_SIZE && common <= *best_match_length)) {                           \
+            continue;                                                                           \
+        }                                                                                       \
+                                                                                                \
+        size_t limit = data_size - pos;                                                         \
+        limit = limit < pos - prev_pos ? limit : pos - prev_pos;                                \
+        limit = limit < MAX_MATCH_LENGTH ? limit : MAX_MATCH_LENGTH;                            \
+        /* The data decides, from the first byte */                                             \
+        size_t match_length = hash_table->match_length(data + pos, data + prev_pos, limit);     \
+                                                                                                \
+        if (match_length >= (N) && match_length > *best_match_length) {                        \
+            best_match_pos = pos - prev_pos;                                                    \
+            *best_match_length = match_length;                                                  \
+        }                                                                                       \
+    }                                                                                           \
+    return best_match_pos;                                                                      \
+}                                                                                               \
+                                                                                                \
+static void prefetch_##N(const HashTable* hash_table, const unsigned char* data, size_t pos,    \
+                         int candidates) {                                                      \
+    const HashItem* hash_item = &hash_table->items[hash_##N(data + pos, hash_table->mask)];     \
+    if (!candidates) {                                                                          \
+        __builtin_prefetch(hash_item);                                                          \
+        __builtin_prefetch((const char*) hash_item + 64);                                       \
+        return;                                                                                 \
+    }                                                                                           \
+    uint32_t count = hash_item->count;                                                          \
+    if (count > 0) {                                                                            \
+        const HashEntry* entry = &hash_item->entries[(count - 1) % MAX_CHAIN_SIZE];             \
+        size_t distance = (uint16_t) (hash_table->base + (uint32_t) pos - entry->position);     \
+        if (distance <= pos) {                                                                  \
+            __builtin_prefetch(data + pos - distance);                                          \
+        }                                                                                       \
+    }                                                                                           \
+}
+
+DEFINE_MATCH_FINDER(2)
+DEFINE_MATCH_FINDER(3)
+DEFINE_MATCH_FINDER(4)
+
+int init_hash_table(HashTable* hash_table, int min_match, size_t size_hint) {
+    switch (min_match) {
+        case 2:
+            hash_table->update = update_hash_table_2;
+            hash_table->find = find_best_match_2;
+            hash_table->prefetch = prefetch_2;
+            break;
+        case 3:
+            hash_table->update = update_hash_table_3;
+            hash_table->find = find_best_match_3;
+            hash_table->prefetch = prefetch_3;
+            break;
+        case 4:
+            hash_table->update = update_hash_table_4;
+            hash_table->find = find_best_match_4;
+            hash_table->prefetch = prefetch_4;
+            break;
+        default:
+            set_error(LZ7_ERROR_PARAMETER, "init_hash_table", "Unsupported minimum match length (%d)!", min_match);
+            return 0;
+    }
+    hash_table->min_match = min_match;
+    hash_table->depth = MAX_CHAIN_SIZE;
+    hash_table->prefetched = 0;
+    hash_table->base = 0;
+    hash_table->match_length = cpu_kernels()->match_length;
+    hash_table->run_length = cpu_kernels()->run_length;
+
+    // One bucket per 8 input bytes is plenty (chains hold MAX_CHAIN_SIZE),
+    // small inputs get small tables
+    size_t table_size = 1UL << MIN_TABLE_BITS;
+    while (table_size < MAX_TABLE_SIZE && (size_hint == 0 || table_size * 8 < size_hint)) {
+        table_size <<= 1;
+    }
+    hash_table->mask = table_size - 1;
+
+    hash_table->memory = calloc(table_size * sizeof(HashItem) + CACHE_LINE_SIZE, 1);
+    if (hash_table->memory == NULL) {
+        hash_table->items = NULL;
+        set_error(LZ7_ERROR_MEMORY, "init_hash_table", "Unable to allocate memory for the hash table!");
         return 0;
     }
-    for (size_t i = 0; i < MAX_TABLE_SIZE; i++) {
+    uintptr_t address = (uintptr_t) hash_table->memory;
+    hash_table->items = (HashItem*) ((address + CACHE_LINE_SIZE - 1) & ~(uintptr_t) (CACHE_LINE_SIZE - 1));
+    return 1;
+}
+
+void reset_hash_table(HashTable* hash_table) {
+    hash_table->prefetched = 0;
+    hash_table->base = 0;
+    for (size_t i = 0; i <= hash_table->mask; i++) {
         hash_table->items[i].count = 0;
+        hash_table->items[i].first = 0;
+    }
+}
+
+void shift_hash_table(HashTable* hash_table, size_t size) {
+    // Every old entry is at least size + 1 bytes back, further than any buffer position
+    hash_table->base += (uint32_t) size + 1;
+    hash_table->prefetched = 0;
+}
+
+void slide_hash_table(HashTable* hash_table, size_t distance) {
+    // Entries that moved in front of the buffer fail the distance <= pos check
+    hash_table->base += (uint32_t) distance;
+    hash_table->prefetched = 0;
+}
+
+void free_hash_table(HashTable* hash_table) {
+    if (hash_table != NULL && hash_table->items != NULL) {
+        free(hash_table->memory);
+        hash_table->items = NULL;
+        hash_table->memory = NULL;
     }
-    return 1;
 }
 
 unsigned int hash(const unsigned char* data, int length) {
     // FNV-1a offset basis
     unsigned int hash_value = 2166136261u;
-    for (int i = 0; i < length && i < 2; i++) {
+    for (int i = 0; i < length && i < MAX_HASH_LENGTH; i++) {
         hash_value = (hash_value * 16777619u) ^ data[i];
     }
     return hash_value % MAX_TABLE_SIZE;
 }
 
 void update_hash_table(HashTable* hash_table, Buffer* buffer, size_t window_size) {
-    size_t pos = buffer->pos;
-    unsigned int hash_value = hash(buffer->data + pos, 2);
-    HashItem* hash_item = &hash_table->items[hash_value];
-
-    if (hash_item->count >= MAX_CHAIN_SIZE) {
-        memmove(hash_item->positions, hash_item->positions + 1, (MAX_CHAIN_SIZE - 1) * sizeof(size_t));
-        hash_item->count--;
-    }
-
-    hash_item->positions[hash_item->count++] = pos;
-
-    while (hash_item->count > 0 && pos - hash_item->positions[0] > window_size) {
-        memmove(hash_item->positions, hash_item->positions + 1, (hash_item->count - 1) * sizeof(size_t));
-        hash_item->count--;
-    }
+    hash_table->update(hash_table, buffer, window_size);
 }
 
 size_t find_best_match(HashTable* hash_table, Buffer* buffer, size_t window_size, size_t* best_match_length) {
-    *best_match_length = 0;
+    return hash_table->find(hash_table, buffer, window_size, best_match_length);
+}
+
+void prefetch_hash_table(HashTable* hash_table, const Buffer* buffer) {
     size_t pos = buffer->pos;
-    size_t data_size = buffer->size;
-    size_t best_match_pos = pos;
-
-    if (pos + 1 >= data_size) return best_match_pos;
-
-    unsigned int hash_value = hash(buffer->data + pos, 2);
-    HashItem* hash_item = &hash_table->items[hash_value];
-
-    for (int i = 0; i < hash_item->count; i++) {
-        size_t prev_pos = hash_item->positions[i];
-        if (pos - prev_pos > window_size || pos <= prev_pos) {
-            continue;
-        }
-
-        int match_length = 0;
-        // printf("------|match at %zu\n", prev_pos);
-        while (pos + match_length < data_size
-            && prev_pos + match_length < pos
-            && buffer->data[pos + match_length] == buffer->data[prev_pos + match_length]
-            && match_length < 255) {
-            // printf("[%zu]: %02X == %02X :[%zu]\n", pos + match_length, data[pos + match_length], data[prev_pos + match_length], prev_pos + match_length);
-            match_length++;
-        }
-
-        if (match_length >= 2 && match_length > *best_match_length) {
-            best_match_pos = pos - prev_pos;
-            *best_match_length = match_length;
-        }
+    // A new chunk starts over at 0, a match may have jumped past the prefetched positions
+    size_t start = hash_table->prefetched;
+    if (start > pos + PREFETCH_DISTANCE || start <= pos) {
+        start = pos + 1;
+    }
+    size_t end = pos + PREFETCH_DISTANCE;
+    if (end + hash_table->min_match > buffer->size) {
+        end = buffer->size >= (size_t) hash_table->min_match ? buffer->size - hash_table->min_match : 0;
+    }
+    for (size_t next = start; next <= end; next++) {
+        hash_table->prefetch(hash_table, buffer->data, next, 0);
+    }
+    hash_table->prefetched = end + 1 > start ? end + 1 : start;
+
+    // Its bucket was requested PREFETCH_DISTANCE / 2 tokens ago
+    size_t middle = pos + PREFETCH_DISTANCE / 2;
+    if (middle + hash_table->min_match <= buffer->size && middle < start) {
+        hash_table->prefetch(hash_table, buffer->data, middle, 1);
     }
-    return best_match_pos;
 }
@@ -0,0 +1,258 @@
+#include "../include/longrange.h"
+#include "../include/cpu.h"
+#include "../include/lz77.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HASH_PRIME 0x100000001B3ULL
+// Candidates are compared in steps that double up to COMPARE_MAX_SIZE
+#define COMPARE_MIN_SIZE 256
+#define COMPARE_MAX_SIZE (64 * 1024)
+
+static int read_at(int fd, unsigned char* data, size_t size, size_t pos) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = pread(fd, data + done, size - done, pos + done);
+        if (result <= 0) {
+            return 0;
+        }
+        done += result;
+    }
+    return 1;
+}
+
+// Common length of the data at src and dst, read from the file
+static size_t extend_forward(const LongRangeMatcher* matcher, unsigned char* a, unsigned char* b,
+                             size_t src, size_t dst, size_t limit) {
+    size_t length = 0;
+    size_t step = COMPARE_MIN_SIZE;
+    while (length < limit) {
+        size_t size = limit - length < step ? limit - length : step;
+        if (!read_at(matcher->fd, a, size, src + length) || !read_at(matcher->fd, b, size, dst + length)) {
+            break;
+        }
+        size_t common = cpu_kernels()->match_length(a, b, size);
+        length += common;
+        if (common < size) {
+            break;
+        }
+        step = step < COMPARE_MAX_SIZE ? step * 2 : COMPARE_MAX_SIZE;
+    }
+    return length;
+}
+
+// Common length of the data before src and dst (at most limit <= COMPARE_MAX_SIZE bytes)
+static size_t extend_backward(const LongRangeMatcher* matcher, unsigned char* a, unsigned char* b,
+                              size_t src, size_t dst, size_t limit) {
+    if (limit == 0 || !read_at(matcher->fd, a, limit, src - limit) || !read_at(matcher->fd, b, limit, dst - limit)) {
+        return 0;
+    }
+    size_t length = 0;
+    while (length < limit && a[limit - 1 - length] == b[limit - 1 - length]) {
+        length++;
+    }
+    return length;
+}
+
+static int add_match(LongRangeMatcher* matcher, size_t start, size_t offset, size_t length) {
+    pthread_mutex_lock(&matcher->lock);
+    if (matcher->count == matcher->capacity) {
+        size_t capacity = matcher->capacity > 0 ? matcher->capacity * 2 : 1024;
+        LongMatch* matches = realloc(matcher->matches, capacity * sizeof(LongMatch));
+        if (matches == NULL) {
+            pthread_mutex_unlock(&matcher->lock);
+            return 0;
+        }
+        matcher->matches = matches;
+        matcher->capacity = capacity;
+    }
+    matcher->matches[matcher->count++] = (LongMatch) { .start = start, .offset = offset, .length = length };
+    pthread_mutex_unlock(&matcher->lock);
+    return 1;
+}
+
+// Publishes the scan progress, returns 0 if the encoder asked to stop
+static int publish(LongRangeMatcher* matcher, size_t ready, int done, int failed) {
+    pthread_mutex_lock(&matcher->lock);
+    matcher->ready = ready;
+    matcher->done = done;
+    matcher->failed = failed;
+    int stop = matcher->stop;
+    pthread_cond_broadcast(&matcher->cond);
+    pthread_mutex_unlock(&matcher->lock);
+    return !stop;
+}
+
+static void* scan_input(void* arg) {
+    LongRangeMatcher* matcher = arg;
+    unsigned char* data = malloc(LONG_RANGE_HASH_LENGTH + LONG_RANGE_READ_SIZE);
+    unsigned char* a = malloc(COMPARE_MAX_SIZE);
+    unsigned char* b = malloc(COMPARE_MAX_SIZE);
+    int failed = data == NULL || a == NULL || b == NULL;
+
+    // Multiplier of the byte that leaves the hash window
+    uint64_t power = 1;
+    for (int i = 0; i < LONG_RANGE_HASH_LENGTH; i++) {
+        power *= HASH_PRIME;
+    }
+    // Table index from the bits below the sampling bits, check tag from bits 16..31
+    int table_shift = 64 - LONG_RANGE_SAMPLE_BITS - __builtin_ctzll(matcher->table_mask + 1);
+
+    uint64_t hash = 0;
+    size_t pos = 0;         // Content position of data[kept]
+    size_t kept = 0;        // Bytes of the previous read kept for the hash window
+    size_t skip = 0;        // No lookups before this position (inside the last match)
+    int running = 1;
+    while (!failed && running && pos < matcher->file_size) {
+        size_t size = matcher->file_size - pos < LONG_RANGE_READ_SIZE ? matcher->file_size - pos : LONG_RANGE_READ_SIZE;
+        if (!read_at(matcher->fd, data + kept, size, pos)) {
+            failed = 1;
+            break;
+        }
+        matcher->checksum = cpu_kernels()->crc32c(matcher->checksum, data + kept, size);
+
+        for (size_t i = kept; i < kept + size && !failed; i++) {
+            hash = hash * HASH_PRIME + data[i] + 1;
+            size_t end = pos + i - kept + 1;
+            if (end > LONG_RANGE_HASH_LENGTH) {
+                hash -= (data[i - LONG_RANGE_HASH_LENGTH] + 1) * power;
+            } else if (end < LONG_RANGE_HASH_LENGTH) {
+                continue;
+            }
+            // Content defined sampling: the top bits of the hash are zero
+            if ((hash >> (64 - LONG_RANGE_SAMPLE_BITS)) != 0) {
+                continue;
+            }
+
+            size_t start = end - LONG_RANGE_HASH_LENGTH;
+            uint64_t tag = (hash >> 16) & 0xFFFF;
+            uint64_t* slot = &matcher->table[(hash >> table_shift) & matcher->table_mask];
+            uint64_t entry = *slot;
+            *slot = ((uint64_t) (start + 1) << 16) | tag;
+            if (entry == 0 || (entry & 0xFFFF) != tag || start < skip) {
+                continue;
+            }
+
+            size_t src = (entry >> 16) - 1;
+            if (start - src <= matcher->min_offset || start - src > LONG_MATCH_MAX_OFFSET) {
+                continue;
+            }
+            size_t limit = matcher->file_size - start;
+            limit = limit < LONG_MATCH_MAX_LENGTH ? limit : LONG_MATCH_MAX_LENGTH;
+            size_t length = extend_forward(matcher, a, b, src, start, limit);
+            if (length < LONG_RANGE_HASH_LENGTH) {
+                continue;
+            }
+
+            // The repeat usually starts before the sample point
+            size_t back = start - skip < LONG_RANGE_BACKTRACK ? start - skip : LONG_RANGE_BACKTRACK;
+            back = back < src ? back : src;
+            back = extend_backward(matcher, a, b, src, start, back);
+            if (length + back > LONG_MATCH_MAX_LENGTH) {
+                length = LONG_MATCH_MAX_LENGTH - back;
+            }
+            failed = !add_match(matcher, start - back, start - src, length + back);
+            skip = start + length;
+        }
+
+        // Keep the hash window for the next read
+        size_t total = kept + size;
+        kept = total < LONG_RANGE_HASH_LENGTH ? total : LONG_RANGE_HASH_LENGTH;
+        memmove(data, data + total - kept, kept);
+        pos += size;
+
+        // Later matches start after the last one, and at most the backtrack
+        // distance before the next sample
+        size_t ready = pos > LONG_RANGE_HASH_LENGTH + LONG_RANGE_BACKTRACK
+            ? pos - LONG_RANGE_HASH_LENGTH - LONG_RANGE_BACKTRACK : 0;
+        running = publish(matcher, ready > skip ? ready : skip, 0, failed);
+    }
+
+    free(data);
+    free(a);
+    free(b);
+    publish(matcher, matcher->file_size, 1, failed || !running);
+    return NULL;
+}
+
+int start_long_range(LongRangeMatcher* matcher, FILE* input_file, size_t min_offset) {
+    if (matcher == NULL || input_file == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "start_long_range", "Required parameters are NULL!");
+        return 0;
+    }
+
+    memset(matcher, 0, sizeof(LongRangeMatcher));
+    matcher->fd = fileno(input_file);
+    matcher->file_size = get_file_size(input_file);
+    matcher->min_offset = min_offset;
+
+    // One entry per 2^LONG_RANGE_SAMPLE_BITS bytes of input
+    size_t table_bits = LONG_RANGE_MIN_TABLE_BITS;
+    while (table_bits < LONG_RANGE_MAX_TABLE_BITS
+           && ((size_t) 1 << (table_bits + LONG_RANGE_SAMPLE_BITS)) < matcher->file_size) {
+        table_bits++;
+    }
+    matcher->table = calloc((size_t) 1 << table_bits, sizeof(uint64_t));
+    if (matcher->table == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "start_long_range", "Unable to allocate memory for the long range table!");
+        return 0;
+    }
+    matcher->table_mask = ((size_t) 1 << table_bits) - 1;
+
+    pthread_mutex_init(&matcher->lock, NULL);
+    pthread_cond_init(&matcher->cond, NULL);
+    if (pthread_create(&matcher->thread, NULL, scan_input, matcher) != 0) {
+        set_error(LZ7_ERROR, "start_long_range", "Unable to start the long range thread!");
+        pthread_mutex_destroy(&matcher->lock);
+        pthread_cond_destroy(&matcher->cond);
+        free(matcher->table);
+        return 0;
+    }
+    return 1;
+}
+
+int next_long_match(LongRangeMatcher* matcher, size_t end, LongMatch* match) {
+    pthread_mutex_lock(&matcher->lock);
+    while (matcher->ready < end && !matcher->done) {
+        pthread_cond_wait(&matcher->cond, &matcher->lock);
+    }
+    int result = 0;
+    if (matcher->failed) {
+        result = -1;
+    } else if (matcher->head < matcher->count && matcher->matches[matcher->head].start < end) {
+        *match = matcher->matches[matcher->head++];
+        if (matcher->head == matcher->count) {
+            matcher->head = 0;
+            matcher->count = 0;
+        }
+        result = 1;
+    }
+    pthread_mutex_unlock(&matcher->lock);
+    return result;
+}
+
+int finish_long_range(LongRangeMatcher* matcher, uint32_t* checksum) {
+    if (checksum == NULL) {
+        pthread_mutex_lock(&matcher->lock);
+        matcher->stop = 1;
+        pthread_mutex_unlock(&matcher->lock);
+    }
+    pthread_join(matcher->thread, NULL);
+
+    int result = !matcher->failed;
+    if (checksum != NULL) {
+        *checksum = matcher->checksum;
+    }
+    pthread_mutex_destroy(&matcher->lock);
+    pthread_cond_destroy(&matcher->cond);
+    free(matcher->table);
+    free(matcher->matches);
+    return result;
+}
@@ -0,0 +1,221 @@
+#include "../include/lz7.h"
+#include "../include/append.h"
+#include "../include/archive.h"
+#include "../include/compressor.h"
+#include "../include/constants.h"
+#include "../include/cpu.h"
+#include "../include/daemon.h"
+#include "../include/error.h"
+#include "../include/filter.h"
+#include "../include/frame.h"
+#include "../include/hash.h"
+#include "../include/lz77.h"
+#include "../include/parallel.h"
+#include "../include/stats.h"
+#include "../include/verify.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// The public constants mirror the internal ones
+_Static_assert(LZ7_LEVEL_FAST == LEVEL_FAST && LZ7_LEVEL_MAX == LEVEL_MAX, "Levels differ");
+_Static_assert(LZ7_MIN_MATCH_MIN == MIN_HASH_LENGTH && LZ7_MIN_MATCH_MAX == MAX_HASH_LENGTH, "Match lengths differ");
+_Static_assert(LZ7_WINDOW_SIZE == WINDOW_SIZE && LZ7_MAX_WINDOW_SIZE == MAX_OFFSET, "Window sizes differ");
+_Static_assert(LZ7_BUFFER_SIZE == COMPRESSED_BUFFER_SIZE && LZ7_CHUNK_SIZE == DECOMPRESSED_BUFFER_SIZE,
+               "Buffer sizes differ");
+_Static_assert(LZ7_SEGMENT_SIZE == PARALLEL_SEGMENT_SIZE && LZ7_MAX_THREADS == PARALLEL_MAX_THREADS,
+               "Thread limits differ");
+_Static_assert(LZ7_FILTER_NONE == FILTER_NONE && LZ7_FILTER_DELTA == FILTER_DELTA && LZ7_FILTER_CHANNEL == FILTER_CHANNEL
+               && LZ7_FILTER_UP == FILTER_UP && LZ7_FILTER_PAETH == FILTER_PAETH && LZ7_FILTER_AUTO == FILTER_AUTO,
+               "Filters differ");
+
+void lz7_default_options(Lz7Options* options) {
+    *options = (Lz7Options) {
+        .level = LZ7_DEFAULT_LEVEL,
+        .min_match = LZ7_MIN_MATCH_MIN,
+        .threads = 0,
+        .long_range = 0,
+        .filter = LZ7_FILTER_AUTO,
+        .filter_stride = 0,
+        .filter_row_size = 0,
+        .window_size = LZ7_WINDOW_SIZE,
+        .buffer_size = LZ7_BUFFER_SIZE,
+        .chunk_size = LZ7_CHUNK_SIZE,
+        .checked = 1,
+        .split = 0,
+        .prime = 0,
+        .target_mbps = 0,
+    };
+}
+
+void lz7_init(Lz7Context* context, const Lz7Options* options) {
+    memset(context, 0, sizeof(*context));
+    if (options != NULL) {
+        context->options = *options;
+    } else {
+        lz7_default_options(&context->options);
+    }
+}
+
+void lz7_set_progress(Lz7Context* context, Lz7ProgressCallback callback, void* user_data, uint64_t interval) {
+    context->progress = callback;
+    context->user_data = user_data;
+    context->progress_interval = interval;
+}
+
+// Every call starts with a clean error slot and copies it into the context
+static void begin(Lz7Context* context) {
+    clear_error();
+    context->error = LZ7_OK;
+    context->message[0] = '\0';
+}
+
+static int finish(Lz7Context* context, int result) {
+    if (!result) {
+        context->error = last_error() != LZ7_OK ? last_error() : LZ7_ERROR;
+        snprintf(context->message, sizeof(context->message), "%s",
+                 last_error() != LZ7_OK ? last_error_message() : lz7_error_string(context->error));
+    }
+    clear_error();
+    return context->error;
+}
+
+static Progress progress_of(const Lz7Context* context) {
+    return (Progress) {
+        .callback = context->progress,
+        .user_data = context->user_data,
+        .interval = context->progress_interval,
+        .next = context->progress_interval,
+    };
+}
+
+int lz7_compress_file(Lz7Context* context, FILE* input_file, FILE* output_file) {
+    begin(context);
+    Progress progress = progress_of(context);
+    return finish(context, compress(input_file, output_file, &context->options, &progress));
+}
+
+int lz7_append_file(Lz7Context* context, FILE* input_file, const char* path) {
+    begin(context);
+    Progress progress = progress_of(context);
+    return finish(context, append_file(input_file, path, &context->options, &progress));
+}
+
+int lz7_decompress_file(Lz7Context* context, FILE* input_file, FILE* output_file) {
+    begin(context);
+    Progress progress = progress_of(context);
+    return finish(context, decompress(input_file, output_file, &context->options, &progress));
+}
+
+int lz7_content_size(Lz7Context* context, const void* src, size_t src_size, uint64_t* content_size) {
+    begin(context);
+    FrameHeader header;
+    FrameIndex index;
+    int indexed = src != NULL && content_size != NULL ? parse_frame_index(src, src_size, &index) : -1;
+    if (indexed > 0) {
+        *content_size = index.content_size;
+        free_frame_index(&index);
+        return finish(context, 1);
+    }
+    int framed = indexed == 0 ? parse_frame_header(src, src_size, &header) : -1;
+    if (framed == 0) {
+        set_error(LZ7_ERROR_UNSUPPORTED, "lz7_content_size", "Streams without a frame header don't store the content size!");
+    } else if (framed > 0) {
+        *content_size = header.content_size;
+    } else if (last_error() == LZ7_OK) {
+        set_error(LZ7_ERROR_PARAMETER, "lz7_content_size", "Required parameters are NULL!");
+    }
+    return finish(context, framed > 0);
+}
+
+int lz7_decompress_buffer(Lz7Context* context, const void* src, size_t src_size, void* dst,
+                          size_t dst_capacity, size_t* content_size) {
+    begin(context);
+    Progress progress = progress_of(context);
+    return finish(context, decompress_memory(src, src_size, dst, dst_capacity, content_size,
+                                             &context->options, &progress));
+}
+
+int lz7_decompress_in_place(Lz7Context* context, void* buffer, size_t buffer_size, size_t src_size,
+                            size_t* content_size) {
+    begin(context);
+    if (buffer == NULL || src_size > buffer_size) {
+        set_error(LZ7_ERROR_PARAMETER, "lz7_decompress_in_place", "The input is larger than the buffer!");
+        return finish(context, 0);
+    }
+    Progress progress = progress_of(context);
+    unsigned char* data = buffer;
+    return finish(context, decompress_memory(data + buffer_size - src_size, src_size, data, buffer_size,
+                                             content_size, &context->options, &progress));
+}
+
+int lz7_test_files(Lz7Context* context, char** paths, int count, Lz7TestResult* results) {
+    begin(context);
+    int failed = verify_files(paths, count, &context->options, results);
+    if (failed < 0) {
+        return finish(context, 0);
+    }
+    finish(context, 1);
+    return failed;
+}
+
+int lz7_print_stats(Lz7Context* context, FILE* input_file, const char* name, FILE* report) {
+    begin(context);
+    return finish(context, print_stats(input_file, name, report));
+}
+
+int lz7_create_archive(Lz7Context* context, const char* archive_path, char** paths, int count,
+                       Lz7ArchiveSummary* summary) {
+    begin(context);
+    return finish(context, create_archive(archive_path, paths, count, &context->options, summary));
+}
+
+int lz7_extract_archive(Lz7Context* context, const char* archive_path, const char* output_dir,
+                        Lz7ArchiveSummary* summary) {
+    begin(context);
+    return finish(context, extract_archive(archive_path, output_dir, &context->options, summary));
+}
+
+int lz7_serve(Lz7Context* context, const char* socket_path, volatile sig_atomic_t* stop) {
+    begin(context);
+    return finish(context, serve_daemon(socket_path, &context->options, stop));
+}
+
+int lz7_remote(Lz7Context* context, const char* socket_path, int op, FILE* input_file,
+               FILE* output_file, int inline_payload) {
+    begin(context);
+    return finish(context, remote_request(socket_path, op, &context->options, input_file, output_file,
+                                          inline_payload));
+}
+
+const char* lz7_error_string(int error) {
+    switch (error) {
+        case LZ7_OK:
+            return "No error";
+        case LZ7_ERROR_PARAMETER:
+            return "Invalid parameter";
+        case LZ7_ERROR_MEMORY:
+            return "Out of memory";
+        case LZ7_ERROR_IO:
+            return "I/O error";
+        case LZ7_ERROR_FORMAT:
+            return "Corrupted or truncated input";
+        case LZ7_ERROR_CHECKSUM:
+            return "Checksum mismatch";
+        case LZ7_ERROR_UNSUPPORTED:
+            return "Unsupported version or option";
+        case LZ7_ERROR_CANCELLED:
+            return "Cancelled";
+        default:
+            return "Failed";
+    }
+}
+
+int lz7_parse_filter(const char* name) {
+    return parse_filter_name(name);
+}
+
+const char* lz7_cpu_name(void) {
+    return cpu_kernels()->name;
+}
@@ -1,15 +1,22 @@
 #include "../include/lz77.h"
+#include "../include/adaptive.h"
 #include "../include/buffer.h"
+#include "../include/cpu.h"
 #include "../include/hash.h"
+#include "../include/longrange.h"
+#include "../include/optimal.h"
+#include "../include/parallel.h"
+#include "../include/sparse.h"
+#include "../include/split.h"
 #include "../include/utils.h"
 #include "../include/constants.h"
+#include "../include/error.h"
 
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 
 
@@ -34,35 +41,81 @@ void compare_buffers(const unsigned char* buff1, size_t buff1_size,
     }
 }
 
-int init_writer(LZWriter* lz_writer, FILE* file, size_t buffer_size, size_t window_size) {
+int init_writer(LZWriter* lz_writer, FILE* file, size_t buffer_size, size_t window_size, int level, int min_match) {
     if (lz_writer == NULL || file == NULL || buffer_size == 0 || window_size == 0) {
-        fprintf(stderr, "\n[ERROR]: init_writer() {} -> Required parameters are NULL!\n");
+        set_error(LZ7_ERROR_PARAMETER, "init_writer", "Required parameters are NULL!");
         return 0;
     }
+    if (window_size > MAX_OFFSET) {
+        set_error(LZ7_ERROR_PARAMETER, "init_writer", "Window size can not be larger than %d bytes!", MAX_OFFSET);
+        return 0;
+    }
+    if (min_match < MIN_HASH_LENGTH || min_match > MAX_HASH_LENGTH) {
+        set_error(LZ7_ERROR_PARAMETER, "init_writer", "Minimum match length must be %d to %d bytes!",
+                MIN_HASH_LENGTH, MAX_HASH_LENGTH);
+        return 0;
+    }
+
+    // A long match token always fits in the buffer
+    if (buffer_size <= LONG_MATCH_TOKEN_SIZE) {
+        buffer_size = LONG_MATCH_TOKEN_SIZE + 1;
+    }
 
     lz_writer->file = file;
     lz_writer->buffer = malloc(buffer_size * sizeof(unsigned char));
     if (lz_writer->buffer == NULL) {
-        fprintf(stderr, "\n[ERROR]: init_writer() {} -> Unable to allocate memory for buffer!\n");
+        set_error(LZ7_ERROR_MEMORY, "init_writer", "Unable to allocate memory for buffer!");
         return 0;
     }
     // memset(lz_writer->buffer, 0, lz_writer->buffer_size * sizeof(unsigned char));
     lz_writer->buffer_pos = 0;
     lz_writer->buffer_size = buffer_size;
     lz_writer->window_size = window_size;
-    return 1;
+    lz_writer->level = level;
+    lz_writer->min_match = min_match;
+    lz_writer->checksum = 0;
+    lz_writer->threads = 0;
+    lz_writer->long_range = 0;
+    lz_writer->split = 0;
+    lz_writer->sparse = 0;
+    lz_writer->lazy = 0;
+    lz_writer->hashed = NO_TOKEN;
+    lz_writer->flushed = 0;
+    lz_writer->target = 0;
+    lz_writer->block = NULL;
+    lz_writer->block_size = 0;
+    lz_writer->prime = NULL;
+    lz_writer->prime_size = 0;
+    memset(lz_writer->reps, 0, sizeof(lz_writer->reps));
+    lz_writer->last_match = NO_TOKEN;
+    lz_writer->last_rep = -1;
+    lz_writer->progress = (Progress) { .callback = NULL };
+    return init_filter(&lz_writer->filter, FILTER_NONE, 0, 0, 0);
 }
 
 int init_reader(LZReader* lz_reader, FILE* file, size_t buffer_size, size_t window_size) {
-    if (lz_reader == NULL || file == NULL) {
-        fprintf(stderr, "\n[ERROR]: init_reader() {} -> Required parameters are NULL!\n");
+    if (lz_reader == NULL || window_size == 0) {
+        set_error(LZ7_ERROR_PARAMETER, "init_reader", "Required parameters are NULL!");
         return 0;
     }
+    // A whole match always fits in the output buffer
+    if (buffer_size < MAX_MATCH_LENGTH) {
+        buffer_size = MAX_MATCH_LENGTH;
+    }
+    // Power of two ring, so wrapping is a mask instead of a modulo. The slack
+    // bytes a wild copy overwrites past the newest byte are older than the window.
+    // Overlapping matches can be longer than a tiny window, a token always fits.
+    size_t ring_size = 1;
+    while (ring_size < window_size + WILD_COPY_SLACK || ring_size < MAX_MATCH_LENGTH + WILD_COPY_SLACK) {
+        ring_size <<= 1;
+    }
     lz_reader->file = file;
-    lz_reader->buffer = malloc(buffer_size * sizeof(unsigned char));
-    lz_reader->dictionary = malloc(window_size * sizeof(unsigned char));
+    lz_reader->history = NULL;
+    lz_reader->history_start = 0;
+    lz_reader->buffer = malloc((buffer_size + WILD_COPY_SLACK) * sizeof(unsigned char));
+    lz_reader->dictionary = calloc(ring_size + WILD_COPY_SLACK, sizeof(unsigned char));
     if (lz_reader->buffer == NULL || lz_reader->dictionary == NULL) {
-        fprintf(stderr, "\n[ERROR]: init_writer() {} -> Unable to allocate memory for buffer!\n");
+        set_error(LZ7_ERROR_MEMORY, "init_reader", "Unable to allocate memory for buffer!");
         return 0;
     }
     // memset(lz_reader->buffer, 0, lz_reader->buffer_size * sizeof(unsigned char));
@@ -71,12 +124,25 @@ int init_reader(LZReader* lz_reader, FILE* file, size_t buffer_size, size_t wind
     lz_reader->buffer_size = buffer_size;
     lz_reader->dict_pos = 0;
     lz_reader->dict_size = window_size;
-    return 1;
+    lz_reader->dict_mask = ring_size - 1;
+    lz_reader->produced = 0;
+    lz_reader->primed = 0;
+    lz_reader->stream_end = SIZE_MAX;
+    memset(lz_reader->reps, 0, sizeof(lz_reader->reps));
+    lz_reader->content_size = SIZE_MAX;
+    lz_reader->checked = 1;
+    lz_reader->split = 0;
+    lz_reader->trailer_size = 0;
+    lz_reader->checksum = 0;
+    lz_reader->wild_copy = cpu_kernels()->wild_copy;
+    lz_reader->progress = (Progress) { .callback = NULL };
+    return init_filter(&lz_reader->filter, FILTER_NONE, 0, 0, 0);
 }
 
 void free_writer(LZWriter* lz_writer) {
     if (lz_writer) {
         if (lz_writer->buffer) free(lz_writer->buffer);
+        if (lz_writer->block) free(lz_writer->block);
         free(lz_writer);
     }
 }
@@ -89,109 +155,793 @@ void free_reader(LZReader* lz_reader) {
     }
 }
 
-size_t dictionary_push(LZReader* lz_reader, unsigned char* value) {
+size_t dictionary_push(LZReader* lz_reader, const unsigned char* value) {
     size_t pos = lz_reader->dict_pos;
     lz_reader->dictionary[pos] = *value;
-    lz_reader->dict_pos = (lz_reader->dict_pos + 1) % lz_reader->dict_size;
+    lz_reader->dict_pos = (lz_reader->dict_pos + 1) & lz_reader->dict_mask;
     return pos;
 }
 
-ssize_t write_lz(LZWriter* lz_writer, HashTable* hash_table, Buffer* buffer) {
-    if (lz_writer == NULL || buffer == NULL || buffer->data == NULL) {
-        fprintf(stderr, "\n[ERROR]: write_lz() {} -> Required parameters are NULL!\n");
-        return -1;
+ssize_t write_literal(LZWriter* lz_writer, unsigned char value) {
+    if (lz_writer->buffer_pos + TOKEN_SIZE >= lz_writer->buffer_size) {
+        ssize_t result = flush_writer(lz_writer);
+        if (result < 0) {
+            return -1;
+        }
     }
 
-    if (lz_writer->buffer_pos + 3 >= lz_writer->buffer_size) {
+    lz_writer->buffer[lz_writer->buffer_pos++] = 0; 
+    lz_writer->buffer[lz_writer->buffer_pos++] = 0; 
+    lz_writer->buffer[lz_writer->buffer_pos++] = value; 
+    lz_writer->last_match = NO_TOKEN;
+    return 1;
+}
+
+static void put_match(unsigned char* token, int rep, size_t offset, size_t length) {
+    if (rep >= 0) {
+        size_t code = (length << 2) | rep;
+        token[0] = code & 0xFF;
+        token[1] = (code >> 8) & 0xFF;
+        token[2] = REP_MATCH_LENGTH;
+    } else {
+        token[0] = offset & 0xFF;
+        token[1] = (offset >> 8) & 0xFF;
+        token[2] = (uint8_t) length;
+    }
+}
+
+/*
+* Writes a match as a repeat match if its offset is in the history, else as
+* a plain one. A match right after a match with the same offset extends that
+* token instead (the copies are the same), as far as its length field allows.
+*
+* returns: Bytes covered (may be less than length), If failed (-1)
+*/
+ssize_t write_match(LZWriter* lz_writer, size_t offset, size_t length) {
+    if (lz_writer->last_match != NO_TOKEN && lz_writer->reps[0] == offset) {
+        unsigned char* token = lz_writer->buffer + lz_writer->last_match;
+        int rep = lz_writer->last_rep;
+        size_t previous = rep >= 0 ? (size_t) (token[0] | (token[1] << 8)) >> 2 : token[2];
+        size_t limit = rep >= 0 ? REP_MATCH_MAX_LENGTH : MAX_MATCH_LENGTH;
+        if (previous < limit) {
+            length = length < limit - previous ? length : limit - previous;
+            put_match(token, rep, offset, previous + length);
+            return length;
+        }
+    }
+
+    if (lz_writer->buffer_pos + TOKEN_SIZE >= lz_writer->buffer_size) {
         ssize_t result = flush_writer(lz_writer);
         if (result < 0) {
             return -1;
         }
     }
 
-    update_hash_table(hash_table, buffer, lz_writer->window_size);
+    int rep = 0;
+    while (rep < REP_OFFSETS && lz_writer->reps[rep] != offset) {
+        rep++;
+    }
+    rep = rep < REP_OFFSETS ? rep : -1;
+    size_t limit = rep >= 0 ? REP_MATCH_MAX_LENGTH : MAX_MATCH_LENGTH;
+    length = length < limit ? length : limit;
+    put_match(lz_writer->buffer + lz_writer->buffer_pos, rep, offset, length);
+    push_rep_offset(lz_writer->reps, offset);
+    lz_writer->last_match = lz_writer->buffer_pos;
+    lz_writer->last_rep = rep;
+    lz_writer->buffer_pos += TOKEN_SIZE;
+    return length;
+}
+
+ssize_t write_long_match(LZWriter* lz_writer, size_t offset, size_t length) {
+    if (lz_writer->buffer_pos + LONG_MATCH_TOKEN_SIZE >= lz_writer->buffer_size) {
+        ssize_t result = flush_writer(lz_writer);
+        if (result < 0) {
+            return -1;
+        }
+    }
+
+    unsigned char* token = lz_writer->buffer + lz_writer->buffer_pos;
+    token[0] = TOKEN_LONG_MATCH;
+    token[1] = LONG_MATCH_TOKEN_SIZE / TOKEN_SIZE - 1;
+    token[2] = 0;
+    for (int i = 0; i < 5; i++) {
+        token[3 + i] = (offset >> (8 * i)) & 0xFF;
+    }
+    for (int i = 0; i < 4; i++) {
+        token[8 + i] = (length >> (8 * i)) & 0xFF;
+    }
+    lz_writer->buffer_pos += LONG_MATCH_TOKEN_SIZE;
+    lz_writer->last_match = NO_TOKEN;
+    return length;
+}
+
+ssize_t write_hole(LZWriter* lz_writer, size_t length) {
+    for (size_t done = 0; done < length;) {
+        if (lz_writer->buffer_pos + HOLE_TOKEN_SIZE >= lz_writer->buffer_size) {
+            ssize_t result = flush_writer(lz_writer);
+            if (result < 0) {
+                return -1;
+            }
+        }
+
+        uint64_t part = length - done < HOLE_MAX_LENGTH ? length - done : HOLE_MAX_LENGTH;
+        unsigned char* token = lz_writer->buffer + lz_writer->buffer_pos;
+        token[0] = TOKEN_HOLE;
+        token[1] = HOLE_TOKEN_SIZE / TOKEN_SIZE - 1;
+        token[2] = 0;
+        for (int i = 0; i < 6; i++) {
+            token[3 + i] = (part >> (8 * i)) & 0xFF;
+        }
+        lz_writer->buffer_pos += HOLE_TOKEN_SIZE;
+        done += part;
+    }
+    lz_writer->last_match = NO_TOKEN;
+    return length;
+}
+
+/*
+* Longest match at one of the repeat offsets, up to REP_MATCH_MAX_LENGTH
+* (no hash lookup, and matches may overlap their source)
+*/
+static size_t find_rep_match(const LZWriter* lz_writer, const HashTable* hash_table, const Buffer* buffer,
+                             size_t* length) {
+    const unsigned char* data = buffer->data + buffer->pos;
+    size_t limit = buffer->size - buffer->pos;
+    limit = limit < REP_MATCH_MAX_LENGTH ? limit : REP_MATCH_MAX_LENGTH;
+    size_t best_offset = 0;
+    *length = 0;
+    for (int i = 0; i < REP_OFFSETS && limit >= MIN_MATCH_LENGTH; i++) {
+        size_t offset = lz_writer->reps[i];
+        if (offset == 0 || offset > buffer->pos || offset > lz_writer->window_size
+            || data[0] != data[-(ptrdiff_t) offset] || data[1] != data[1 - (ptrdiff_t) offset]) {
+            continue;
+        }
+        size_t match_length = hash_table->match_length(data, data - offset, limit);
+        if (match_length > *length) {
+            *length = match_length;
+            best_offset = offset;
+        }
+    }
+    return best_offset;
+}
+
+/*
+* Covers a run with offset 1 matches, every one extends the token of the one
+* before it. A last byte a full token leaves over is not a match on its own.
+*
+* returns: Bytes covered (length or length - 1), If failed (-1)
+*/
+static ssize_t write_run(LZWriter* lz_writer, size_t length) {
+    size_t done = 0;
+    while (length - done >= MIN_MATCH_LENGTH) {
+        ssize_t written = write_match(lz_writer, 1, length - done);
+        if (written < 1) {
+            return -1;
+        }
+        done += written;
+    }
+    return done;
+}
+
+ssize_t write_lz(LZWriter* lz_writer, HashTable* hash_table, Buffer* buffer) {
+    if (lz_writer == NULL || buffer == NULL || buffer->data == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "write_lz", "Required parameters are NULL!");
+        return -1;
+    }
 
+    // A long run of the previous byte goes out whole, before any hashing (the
+    // first and the last byte rule out most positions without a scan)
     size_t pos = buffer->pos;
+    const unsigned char* data = buffer->data + pos;
+    if (pos > 0 && pos + RUN_MIN_LENGTH <= buffer->size
+        && data[0] == data[-1] && data[RUN_MIN_LENGTH - 1] == data[-1]) {
+        size_t run = hash_table->run_length(data - 1, buffer->size - pos + 1) - 1;
+        if (run >= RUN_MIN_LENGTH) {
+            lz_writer->hashed = NO_TOKEN;
+            return write_run(lz_writer, run);
+        }
+    }
+
+    // The buckets of the next positions load while this one is searched
+    prefetch_hash_table(hash_table, buffer);
+    if (lz_writer->hashed != hash_table->base + (uint32_t) pos) {
+        update_hash_table(hash_table, buffer, lz_writer->window_size);
+    }
+    lz_writer->hashed = NO_TOKEN;
+
+    // The repeat offsets first: no chain match is longer than MAX_MATCH_LENGTH,
+    // so a repeat match that long skips the chain scan
+    size_t rep_length = 0;
+    size_t rep_offset = find_rep_match(lz_writer, hash_table, buffer, &rep_length);
     size_t best_match_length = 0;
-    size_t best_match_pos = find_best_match(hash_table, buffer, lz_writer->window_size, &best_match_length);
+    size_t best_match_pos = rep_length < MAX_MATCH_LENGTH
+        ? find_best_match(hash_table, buffer, lz_writer->window_size, &best_match_length) : 0;
+
+    // A longer match one byte later is worth a literal now. The next call
+    // starts there and doesn't add the position to the chain again.
+    size_t length = rep_length > best_match_length ? rep_length : best_match_length;
+    if (lz_writer->lazy && length >= MIN_MATCH_LENGTH && length < LAZY_MATCH_LENGTH && pos + 1 < buffer->size) {
+        buffer->pos = pos + 1;
+        update_hash_table(hash_table, buffer, lz_writer->window_size);
+        size_t next_rep_length = 0;
+        size_t next_length = 0;
+        find_rep_match(lz_writer, hash_table, buffer, &next_rep_length);
+        find_best_match(hash_table, buffer, lz_writer->window_size, &next_length);
+        buffer->pos = pos;
+        if (next_rep_length > length || next_length > length) {
+            lz_writer->hashed = hash_table->base + (uint32_t) (pos + 1);
+            return write_literal(lz_writer, buffer->data[pos]);
+        }
+    }
 
-    if (best_match_length >= 2) {
-        lz_writer->buffer[lz_writer->buffer_pos++] = (best_match_pos) & 0xFF; 
-        lz_writer->buffer[lz_writer->buffer_pos++] =  (best_match_pos >> 8) & 0xFF; 
-        lz_writer->buffer[lz_writer->buffer_pos++] = (uint8_t) best_match_length; 
-        return best_match_length;
+    if (rep_length >= MIN_MATCH_LENGTH && rep_length >= best_match_length) {
+        return write_match(lz_writer, rep_offset, rep_length);
+    } else if (best_match_length >= MIN_MATCH_LENGTH) {
+        return write_match(lz_writer, best_match_pos, best_match_length);
     } else {
-        lz_writer->buffer[lz_writer->buffer_pos++] = 0; 
-        lz_writer->buffer[lz_writer->buffer_pos++] = 0; 
-        lz_writer->buffer[lz_writer->buffer_pos++] = buffer->data[pos]; 
-        return 1;
+        return write_literal(lz_writer, buffer->data[pos]);
+    }
+}
+
+/*
+* Copies one token into the output buffer and the dictionary. The caller has
+* made sure the output buffer has room for MAX_MATCH_LENGTH bytes (plus the
+* WILD_COPY_SLACK bytes every reader buffer has).
+*/
+static inline __attribute__((always_inline)) void copy_token(LZReader* lz_reader, size_t offset, size_t length, const unsigned char* literal) {
+    unsigned char* dictionary = lz_reader->dictionary;
+    unsigned char* out = lz_reader->buffer + lz_reader->buffer_pos;
+    size_t mask = lz_reader->dict_mask;
+    size_t dict_pos = lz_reader->dict_pos;
+    if (offset > 0) {
+        size_t src = (dict_pos - offset) & mask;
+        if (offset >= length && src + length <= mask + 1) {
+            lz_reader->wild_copy(out, dictionary + src, length);
+        } else if (offset == 1) {
+            // A run of the last byte
+            memset(out, dictionary[src], length);
+        } else {
+            // Overlapping or wrapping match: one period from the dictionary, then
+            // the output repeats it. Whole periods double until a wild copy is
+            // far enough behind its destination to never read unwritten bytes.
+            size_t period = offset < length ? offset : length;
+            for (size_t i = 0; i < period; i++) {
+                out[i] = dictionary[(src + i) & mask];
+            }
+            size_t done = period;
+            for (; done < length && done < WILD_COPY_SLACK; done *= 2) {
+                memcpy(out + done, out, done < length - done ? done : length - done);
+            }
+            if (done < length) {
+                lz_reader->wild_copy(out + done, out, length - done);
+            }
+        }
+        if (dict_pos + length <= mask + 1) {
+            lz_reader->wild_copy(dictionary + dict_pos, out, length);
+        } else {
+            size_t first = mask + 1 - dict_pos;
+            memcpy(dictionary + dict_pos, out, first);
+            memcpy(dictionary, out + first, length - first);
+        }
+        lz_reader->dict_pos = (dict_pos + length) & mask;
+    } else {
+        out[0] = *literal;
+        dictionary[dict_pos] = *literal;
+        lz_reader->dict_pos = (dict_pos + 1) & mask;
+    }
+    lz_reader->buffer_pos += length;
+    lz_reader->produced += length;
+}
+
+/*
+* Validates a token against the produced output and the content size
+*/
+static int check_token(const LZReader* lz_reader, size_t offset, size_t length) {
+    size_t decoded = lz_reader->produced + lz_reader->primed;
+    size_t history = decoded < lz_reader->dict_size ? decoded : lz_reader->dict_size;
+    if (offset > history) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Match offset %zu is behind the decoded data!", offset);
+        return 0;
+    }
+    if (offset > 0 && length < MIN_MATCH_LENGTH) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Invalid match length %zu!", length);
+        return 0;
+    }
+    if (length > lz_reader->content_size - lz_reader->produced) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Token is past the end of the content!");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+* Copies a long match from the output written so far. Every step flushes the
+* output, reads at most offset bytes back from the history file into the
+* output buffer and appends them to the dictionary, so overlapping matches
+* read bytes the previous step wrote.
+*/
+static int copy_long_match(LZReader* lz_reader, size_t offset, size_t length) {
+    if (offset == 0 || offset > lz_reader->produced) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Long match offset %zu is behind the decoded data!", offset);
+        return 0;
+    }
+    if (length > lz_reader->content_size - lz_reader->produced) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Token is past the end of the content!");
+        return 0;
+    }
+    if (lz_reader->history == NULL || lz_reader->filter.type != FILTER_NONE) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Long matches need a readable, unfiltered output!");
+        return 0;
+    }
+
+    unsigned char* dictionary = lz_reader->dictionary;
+    size_t ring_size = lz_reader->dict_mask + 1;
+    while (length > 0) {
+        if (flush_reader(lz_reader) < 0 || fflush(lz_reader->history) != 0) {
+            return 0;
+        }
+        size_t size = length < offset ? length : offset;
+        size = size < lz_reader->buffer_size ? size : lz_reader->buffer_size;
+        off_t src = lz_reader->history_start + lz_reader->produced - offset;
+        if (pread(fileno(lz_reader->history), lz_reader->buffer, size, src) != (ssize_t) size) {
+            set_error(LZ7_ERROR_IO, "read_lz", "Unable to read the long match source!");
+            return 0;
+        }
+        for (size_t done = 0; done < size;) {
+            size_t part = ring_size - lz_reader->dict_pos;
+            part = part < size - done ? part : size - done;
+            memcpy(dictionary + lz_reader->dict_pos, lz_reader->buffer + done, part);
+            lz_reader->dict_pos = (lz_reader->dict_pos + part) & lz_reader->dict_mask;
+            done += part;
+        }
+        lz_reader->buffer_pos = size;
+        lz_reader->produced += size;
+        length -= size;
+    }
+    return 1;
+}
+
+/*
+* Skips a hole: the output written so far goes out, the file positions move
+* past the zeros and only the end of them is kept in the dictionary
+*/
+static int copy_hole(LZReader* lz_reader, uint64_t length) {
+    if (length > lz_reader->content_size - lz_reader->produced) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Token is past the end of the content!");
+        return 0;
+    }
+    if (lz_reader->filter.type != FILTER_NONE) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Holes need an unfiltered output!");
+        return 0;
+    }
+    if (flush_reader(lz_reader) < 0) {
+        return 0;
+    }
+    lz_reader->checksum = crc32c_zeros(lz_reader->checksum, length);
+    if ((lz_reader->file != NULL && !skip_hole(lz_reader->file, length))
+        || (lz_reader->history != NULL && lz_reader->history != lz_reader->file
+            && !skip_hole(lz_reader->history, length))) {
+        return 0;
+    }
+
+    size_t ring_size = lz_reader->dict_mask + 1;
+    size_t zeros = length < ring_size ? length : ring_size;
+    size_t first = ring_size - lz_reader->dict_pos < zeros ? ring_size - lz_reader->dict_pos : zeros;
+    memset(lz_reader->dictionary + lz_reader->dict_pos, 0, first);
+    memset(lz_reader->dictionary, 0, zeros - first);
+    lz_reader->dict_pos = (lz_reader->dict_pos + length) & lz_reader->dict_mask;
+    lz_reader->produced += length;
+    return 1;
+}
+
+/*
+* Decodes an extended token ([opcode][payload tokens][0] + payload)
+*/
+static ssize_t read_extended(Buffer* buffer, LZReader* lz_reader) {
+    const unsigned char* token = buffer->data + buffer->pos;
+    size_t size = TOKEN_SIZE * (1 + token[1]);
+    if ((size_t) end_of_buffer(buffer) < size) {
+        // Completed by the next refill
+        return 0;
+    }
+    if (token[0] == TOKEN_HOLE && size == HOLE_TOKEN_SIZE) {
+        uint64_t length = 0;
+        for (int i = 5; i >= 0; i--) {
+            length = (length << 8) | token[3 + i];
+        }
+        if (!copy_hole(lz_reader, length)) {
+            return -1;
+        }
+        buffer->pos += size;
+        return size;
+    }
+    if (token[0] != TOKEN_LONG_MATCH || size != LONG_MATCH_TOKEN_SIZE) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Unknown extended token %u!", token[0]);
+        return -1;
+    }
+
+    size_t offset = 0;
+    size_t length = 0;
+    for (int i = 4; i >= 0; i--) {
+        offset = (offset << 8) | token[3 + i];
+    }
+    for (int i = 3; i >= 0; i--) {
+        length = (length << 8) | token[8 + i];
     }
+    if (!copy_long_match(lz_reader, offset, length)) {
+        return -1;
+    }
+    buffer->pos += size;
+    return size;
+}
+
+/*
+* Copies a repeat match (code = length << 2 | index). It may be longer than the
+* room read_lz() makes in the output buffer, so it is copied in steps of
+* MAX_MATCH_LENGTH bytes.
+*/
+static int copy_rep_match(LZReader* lz_reader, size_t code) {
+    size_t offset = lz_reader->reps[code & (REP_OFFSETS - 1)];
+    size_t length = code >> 2;
+    if (offset == 0 || length < MIN_MATCH_LENGTH) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Invalid repeat match (index %zu, length %zu)!",
+                  code & (REP_OFFSETS - 1), length);
+        return 0;
+    }
+    if (lz_reader->checked && !check_token(lz_reader, offset, length)) {
+        return 0;
+    }
+    push_rep_offset(lz_reader->reps, offset);
+
+    for (size_t done = 0; done < length;) {
+        size_t step = length - done < MAX_MATCH_LENGTH ? length - done : MAX_MATCH_LENGTH;
+        if (lz_reader->buffer_pos + step > lz_reader->buffer_size && flush_reader(lz_reader) < 0) {
+            return 0;
+        }
+        copy_token(lz_reader, offset, step, NULL);
+        done += step;
+    }
+    return 1;
+}
+
+/*
+* Decodes a repeat match token
+*/
+static ssize_t read_rep_match(Buffer* buffer, LZReader* lz_reader) {
+    const unsigned char* token = buffer->data + buffer->pos;
+    if (!copy_rep_match(lz_reader, token[0] | (token[1] << 8))) {
+        return -1;
+    }
+    buffer->pos += TOKEN_SIZE;
+    return TOKEN_SIZE;
 }
 
 ssize_t read_lz(Buffer* buffer, LZReader* lz_reader) {
     if (lz_reader == NULL || buffer == NULL || buffer->data == NULL) {
-        fprintf(stderr, "\n[ERROR]: reader_lz() {} -> Required parameters are NULL!\n");
+        set_error(LZ7_ERROR_PARAMETER, "read_lz", "Required parameters are NULL!");
+        return -1;
+    }
+    if (end_of_buffer(buffer) < TOKEN_SIZE) {
+        set_error(LZ7_ERROR_FORMAT, "read_lz", "Truncated token!");
+        return -1;
+    }
+
+    if (lz_reader->buffer_pos + MAX_MATCH_LENGTH > lz_reader->buffer_size) {
+        ssize_t result = flush_reader(lz_reader);
+        if (result < 0) {
+            return -1;
+        }
+    }
+
+    const unsigned char* token = buffer->data + buffer->pos;
+    size_t offset = token[0] | (token[1] << 8);
+    size_t length = offset > 0 ? token[2] : 1;
+    if (length == 0) {
+        return read_extended(buffer, lz_reader);
+    }
+    if (length == REP_MATCH_LENGTH && offset > 0) {
+        return read_rep_match(buffer, lz_reader);
+    }
+    if (lz_reader->checked && !check_token(lz_reader, offset, length)) {
         return -1;
     }
 
-    size_t pos = buffer->pos;
-    uint8_t lsb = buffer->data[buffer->pos++];
-    uint8_t msb = buffer->data[buffer->pos++];
-    uint16_t offset = (msb << 8) | lsb;
     if (offset > 0) {
-        // Match
-        uint8_t length = buffer->data[buffer->pos++];
-        if (lz_reader->buffer_pos + length >= lz_reader->buffer_size) {
-            ssize_t result = flush_reader(lz_reader);
-            if (result < lz_reader->buffer_pos) {
-                return -1;
+        push_rep_offset(lz_reader->reps, offset);
+    }
+    copy_token(lz_reader, offset, length, &token[2]);
+    buffer->pos += TOKEN_SIZE;
+    return TOKEN_SIZE;
+}
+
+/*
+* Copies a run of literals into the output buffer and the dictionary. The
+* literals may be read up to WILD_COPY_SLACK bytes past their end.
+*/
+static inline int copy_literals(LZReader* lz_reader, const unsigned char* literals, size_t count) {
+    if (lz_reader->checked && count > lz_reader->content_size - lz_reader->produced) {
+        set_error(LZ7_ERROR_FORMAT, "decode", "Literal run is past the end of the content!");
+        return 0;
+    }
+    size_t ring_size = lz_reader->dict_mask + 1;
+    if (lz_reader->buffer_pos + count <= lz_reader->buffer_size && lz_reader->dict_pos + count <= ring_size) {
+        // Short runs: two wild copies, neither buffer ends nor the ring wraps
+        lz_reader->wild_copy(lz_reader->buffer + lz_reader->buffer_pos, literals, count);
+        lz_reader->wild_copy(lz_reader->dictionary + lz_reader->dict_pos, literals, count);
+        lz_reader->buffer_pos += count;
+        lz_reader->dict_pos = (lz_reader->dict_pos + count) & lz_reader->dict_mask;
+        lz_reader->produced += count;
+        return 1;
+    }
+    while (count > 0) {
+        if (lz_reader->buffer_pos == lz_reader->buffer_size && flush_reader(lz_reader) < 0) {
+            return 0;
+        }
+        size_t size = lz_reader->buffer_size - lz_reader->buffer_pos;
+        size = size < count ? size : count;
+        memcpy(lz_reader->buffer + lz_reader->buffer_pos, literals, size);
+        size_t first = ring_size - lz_reader->dict_pos;
+        first = first < size ? first : size;
+        memcpy(lz_reader->dictionary + lz_reader->dict_pos, literals, first);
+        memcpy(lz_reader->dictionary, literals + first, size - first);
+        lz_reader->dict_pos = (lz_reader->dict_pos + size) & lz_reader->dict_mask;
+        lz_reader->buffer_pos += size;
+        lz_reader->produced += size;
+        literals += size;
+        count -= size;
+    }
+    return 1;
+}
+
+/*
+* Executes the sequences of a split block: every literal run is one copy, the
+* length byte of the match tells a plain, a repeat and a long match apart.
+* The streams are bounds checked always, the tokens as read_lz() does.
+*/
+static int read_split_block(LZReader* lz_reader, const SplitBlock* block) {
+    const unsigned char* literal = block->literals;
+    const unsigned char* literal_end = literal + block->literal_count;
+    const unsigned char* run = block->runs;
+    const unsigned char* run_end = run + block->runs_size;
+    const unsigned char* code = block->offsets;
+    const unsigned char* code_end = code + block->offsets_size;
+    for (size_t s = 0; s < block->sequence_count; s++) {
+        size_t count = 0;
+        if (!read_run(&run, run_end, &count) || count > (size_t) (literal_end - literal)) {
+            set_error(LZ7_ERROR_FORMAT, "decode", "Invalid literal run in sequence %zu!", s);
+            return 0;
+        }
+        if (count > 0 && !copy_literals(lz_reader, literal, count)) {
+            return 0;
+        }
+        literal += count;
+
+        size_t length = block->lengths[s];
+        if (length >= MIN_MATCH_LENGTH && code_end - code >= 2) {
+            size_t offset = code[0] | (code[1] << 8);
+            code += 2;
+            if (offset == 0) {
+                set_error(LZ7_ERROR_FORMAT, "decode", "Match offset 0 in sequence %zu!", s);
+                return 0;
+            }
+            if (lz_reader->checked && !check_token(lz_reader, offset, length)) {
+                return 0;
+            }
+            if (lz_reader->buffer_pos + MAX_MATCH_LENGTH > lz_reader->buffer_size && flush_reader(lz_reader) < 0) {
+                return 0;
+            }
+            push_rep_offset(lz_reader->reps, offset);
+            copy_token(lz_reader, offset, length, NULL);
+        } else if (length == REP_MATCH_LENGTH && code_end - code >= 2) {
+            if (!copy_rep_match(lz_reader, code[0] | (code[1] << 8))) {
+                return 0;
+            }
+            code += 2;
+        } else if (length == 0 && code_end - code >= LONG_MATCH_TOKEN_SIZE - TOKEN_SIZE) {
+            size_t offset = 0;
+            for (int i = 4; i >= 0; i--) {
+                offset = (offset << 8) | code[i];
             }
+            for (int i = 3; i >= 0; i--) {
+                length = (length << 8) | code[5 + i];
+            }
+            if (!copy_long_match(lz_reader, offset, length)) {
+                return 0;
+            }
+            code += LONG_MATCH_TOKEN_SIZE - TOKEN_SIZE;
+        } else {
+            set_error(LZ7_ERROR_FORMAT, "decode", "Truncated offset stream in sequence %zu!", s);
+            return 0;
+        }
+    }
+
+    // The literals after the last match end the block
+    if (literal < literal_end && !copy_literals(lz_reader, literal, literal_end - literal)) {
+        return 0;
+    }
+    if (run != run_end || code != code_end) {
+        set_error(LZ7_ERROR_FORMAT, "decode", "Unused bytes at the end of the block streams!");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+* Decodes a stream of split blocks, each one is read whole
+*
+* returns: Stream bytes decoded. If failed (-1)
+*/
+static ssize_t decode_split(LZReader* lz_reader, FILE* input_file, size_t stream_size) {
+    unsigned char* data = NULL;
+    size_t capacity = 0;
+    size_t processed = 0;
+    while (processed < stream_size) {
+        unsigned char header[SPLIT_HEADER_SIZE];
+        if (stream_size - processed < SPLIT_HEADER_SIZE
+            || fread(header, sizeof(unsigned char), SPLIT_HEADER_SIZE, input_file) < SPLIT_HEADER_SIZE) {
+            set_error(LZ7_ERROR_FORMAT, "decode", "Truncated block header!");
+            break;
         }
-        for (uint8_t i = 0; i < length; i++) {
-            size_t dict_idx = lz_reader->dict_pos - offset;
-            lz_reader->buffer[lz_reader->buffer_pos++] = lz_reader->dictionary[dict_idx];
-            dictionary_push(lz_reader, &lz_reader->dictionary[dict_idx]);
+        size_t size = split_block_size(header);
+        if (size == SIZE_MAX || size > stream_size - processed) {
+            set_error(LZ7_ERROR_FORMAT, "decode", "Invalid or truncated block!");
+            break;
         }
-    } else {
-        // Literal
-        if (lz_reader->buffer_pos + 1 >= lz_reader->dict_size) {
-            ssize_t result = flush_reader(lz_reader);
-            if (result < lz_reader->buffer_pos) {
-                return -1;
+        // The literal copies may read past the end of the block
+        if (size + WILD_COPY_SLACK > capacity) {
+            unsigned char* grown = realloc(data, size + WILD_COPY_SLACK);
+            if (grown == NULL) {
+                set_error(LZ7_ERROR_MEMORY, "decode", "Unable to allocate memory for the block!");
+                break;
             }
+            data = grown;
+            capacity = size + WILD_COPY_SLACK;
+        }
+        memcpy(data, header, SPLIT_HEADER_SIZE);
+        if (fread(data + SPLIT_HEADER_SIZE, sizeof(unsigned char), size - SPLIT_HEADER_SIZE, input_file)
+            < size - SPLIT_HEADER_SIZE) {
+            set_error(LZ7_ERROR_IO, "decode", "Unable to read the block!");
+            break;
+        }
+
+        SplitBlock block;
+        if (!parse_split_block(data, size, &block) || !read_split_block(lz_reader, &block)) {
+            break;
+        }
+        processed += size;
+        if (!report_progress(&lz_reader->progress, processed, stream_size)) {
+            break;
         }
-        lz_reader->buffer[lz_reader->buffer_pos++] = buffer->data[buffer->pos];
-        dictionary_push(lz_reader, &buffer->data[buffer->pos++]);
     }
+    free(data);
+    return processed == stream_size ? (ssize_t) processed : -1;
+}
 
-    return buffer->pos - pos;
+/*
+* Decodes 'tokens' tokens without any input/output bounds checks. The caller
+* guarantees the input holds them and the output and content size have room
+* for MAX_MATCH_LENGTH bytes per token (the "margin"). Only the match offsets
+* are validated, and only in the checked instance. Stops before an extended
+* token or a repeat match longer than the margin, read_lz() decodes those.
+*/
+#define DEFINE_READ_LZ_RUN(NAME, CHECKED)                                                           \
+static ssize_t NAME(Buffer* buffer, LZReader* lz_reader, size_t tokens) {                           \
+    const unsigned char* start = buffer->data + buffer->pos;                                        \
+    const unsigned char* token = start;                                                             \
+    for (size_t t = 0; t < tokens; t++, token += TOKEN_SIZE) {                                      \
+        size_t offset = token[0] | (token[1] << 8);                                                 \
+        size_t length = offset > 0 ? token[2] : 1;                                                  \
+        if (length == 0) {                                                                          \
+            break;                                                                                  \
+        }                                                                                           \
+        if (length == REP_MATCH_LENGTH && offset > 0) {                                             \
+            length = offset >> 2;                                                                   \
+            offset = lz_reader->reps[offset & (REP_OFFSETS - 1)];                                   \
+            if (offset == 0 || length < MIN_MATCH_LENGTH || length > MAX_MATCH_LENGTH) {            \
+                break;                                                                              \
+            }                                                                                       \
+        }                                                                                           \
+        if (CHECKED) {                                                                              \
+            size_t decoded = lz_reader->produced + lz_reader->primed;                               \
+            size_t history = decoded < lz_reader->dict_size ? decoded : lz_reader->dict_size;       \
+            if (offset > history || (offset > 0 && length < MIN_MATCH_LENGTH)) {                    \
+                /* Report the reason */                                                             \
+                check_token(lz_reader, offset, length);                                             \
+                return -1;                                                                          \
+            }                                                                                       \
+        }                                                                                           \
+        if (offset > 0) {                                                                           \
+            push_rep_offset(lz_reader->reps, offset);                                               \
+        }                                                                                           \
+        copy_token(lz_reader, offset, length, &token[2]);                                           \
+    }                                                                                               \
+    buffer->pos = token - buffer->data;                                                             \
+    return (token - start) / TOKEN_SIZE;                                                            \
+}
+
+DEFINE_READ_LZ_RUN(read_lz_run_checked, 1)
+DEFINE_READ_LZ_RUN(read_lz_run_unchecked, 0)
+
+/*
+* Number of tokens that can be decoded before any buffer end is near
+*/
+static size_t safe_token_count(const Buffer* buffer, const LZReader* lz_reader) {
+    size_t input_tokens = end_of_buffer((Buffer*) buffer) / TOKEN_SIZE;
+    size_t output_tokens = (lz_reader->buffer_size - lz_reader->buffer_pos) / MAX_MATCH_LENGTH;
+    size_t content_tokens = (lz_reader->content_size - lz_reader->produced) / MAX_MATCH_LENGTH;
+    size_t tokens = input_tokens < output_tokens ? input_tokens : output_tokens;
+    return tokens < content_tokens ? tokens : content_tokens;
 }
 
 ssize_t flush_writer(LZWriter* lz_writer) {
     if (lz_writer == NULL) {
-        fprintf(stderr, "\n[ERROR]: flush_writer() {} -> Required parameters are NULL!\n");
+        set_error(LZ7_ERROR_PARAMETER, "flush_writer", "Required parameters are NULL!");
         return -1;
     }
 
-    ssize_t result = fwrite(lz_writer->buffer, sizeof(unsigned char), lz_writer->buffer_pos, lz_writer->file);
-    if (result < lz_writer->buffer_pos) {
-        fprintf(stderr, "\n[ERROR]: flush_writer() {} -> Unable to flush the writer!\n");
+    ssize_t result = write_tokens(lz_writer, lz_writer->buffer, lz_writer->buffer_pos);
+    if (result < 0) {
         return -1;
     }
     // memset(lz_writer->buffer, 0, lz_writer->buffer_size * sizeof(unsigned char));
+    lz_writer->flushed += lz_writer->buffer_pos;
     lz_writer->buffer_pos = 0;
+    lz_writer->last_match = NO_TOKEN;
     return result;
 }
 
+ssize_t write_tokens(LZWriter* lz_writer, const unsigned char* tokens, size_t size) {
+    if (lz_writer->split && size > 0) {
+        if (lz_writer->block_size < SPLIT_BLOCK_BOUND(size)) {
+            unsigned char* block = realloc(lz_writer->block, SPLIT_BLOCK_BOUND(size));
+            if (block == NULL) {
+                set_error(LZ7_ERROR_MEMORY, "write_tokens", "Unable to allocate memory for the split block!");
+                return -1;
+            }
+            lz_writer->block = block;
+            lz_writer->block_size = SPLIT_BLOCK_BOUND(size);
+        }
+        ssize_t block_size = split_tokens(tokens, size, lz_writer->block);
+        if (block_size < 0) {
+            return -1;
+        }
+        tokens = lz_writer->block;
+        size = block_size;
+    }
+    if (fwrite(tokens, sizeof(unsigned char), size, lz_writer->file) < size) {
+        set_error(LZ7_ERROR_IO, "write_tokens", "Unable to flush the writer!");
+        return -1;
+    }
+    return size;
+}
+
+void reset_writer(LZWriter* lz_writer) {
+    lz_writer->buffer_pos = 0;
+    lz_writer->hashed = NO_TOKEN;
+    memset(lz_writer->reps, 0, sizeof(lz_writer->reps));
+    lz_writer->last_match = NO_TOKEN;
+}
+
 ssize_t flush_reader(LZReader* lz_reader) {
     if (lz_reader == NULL) {
-        fprintf(stderr, "\n[ERROR]: flush_reader() {} -> Required parameters are NULL!\n");
+        set_error(LZ7_ERROR_PARAMETER, "flush_reader", "Required parameters are NULL!");
         return -1;
     }
 
-    ssize_t result = fwrite(lz_reader->buffer, sizeof(unsigned char), lz_reader->buffer_pos, lz_reader->file);
+    if (!filter_inverse(&lz_reader->filter, lz_reader->buffer, lz_reader->buffer_pos)) {
+        set_error(LZ7_ERROR, "flush_reader", "Unable to revert the filter!");
+        return -1;
+    }
+    lz_reader->checksum = cpu_kernels()->crc32c(lz_reader->checksum, lz_reader->buffer, lz_reader->buffer_pos);
+
+    ssize_t result = lz_reader->file == NULL ? (ssize_t) lz_reader->buffer_pos
+        : (ssize_t) fwrite(lz_reader->buffer, sizeof(unsigned char), lz_reader->buffer_pos, lz_reader->file);
+    if (result == (ssize_t) lz_reader->buffer_pos && lz_reader->history != NULL && lz_reader->history != lz_reader->file
+        && fwrite(lz_reader->buffer, sizeof(unsigned char), lz_reader->buffer_pos, lz_reader->history) < lz_reader->buffer_pos) {
+        result = -1;
+    }
     if (result < lz_reader->buffer_pos) {
-        fprintf(stderr, "\n[ERROR]: flush_reader() {} -> Unable to flush the reader!\n");
+        set_error(LZ7_ERROR_IO, "flush_reader", "Unable to flush the reader!");
         return -1;
     }
     // memset(lz_reader->buffer, 0, lz_reader->buffer_size * sizeof(unsigned char));
@@ -201,108 +951,561 @@ ssize_t flush_reader(LZReader* lz_reader) {
 
 ssize_t encode(LZWriter* lz_writer, FILE* input_file, size_t read_chunk_size) {
     if (lz_writer == NULL || input_file == NULL) {
-        fprintf(stderr, "\n[ERROR]: encode() {} -> Required parameters are NULL!\n");
+        set_error(LZ7_ERROR_PARAMETER, "encode", "Required parameters are NULL!");
         return -1;
     }
 
-    HashTable hash_table;
-    init_hash_table(&hash_table);
+    // Streaming chunks, unless the adaptive, the optimal or the segment parser reads the file
+    int streaming = lz_writer->level < LEVEL_MAX && lz_writer->threads == 0 && lz_writer->target == 0;
+
+    // The match finder instance is picked once, here. Its positions are 32-bit.
+    if (streaming && read_chunk_size > MAX_HASH_POSITION) {
+        set_error(LZ7_ERROR_PARAMETER, "encode", "Chunks are limited to %llu bytes!",
+                  (unsigned long long) MAX_HASH_POSITION);
+        return -1;
+    }
+    HashTable hash_table = { .items = NULL };
+    if (streaming && init_hash_table(&hash_table, lz_writer->min_match, get_file_size(input_file)) < 1) {
+        return -1;
+    }
 
     Buffer buffer;
     init_buffer_from_file(&buffer, input_file, read_chunk_size);
 
     size_t file_size = get_file_size(input_file);
     size_t processed = 0;
-    clock_t start_time = clock();
     fseek(input_file, 0, SEEK_SET);
 
-    while (read_chunk(&buffer, input_file) != 0) {
-        while (end_of_buffer(&buffer) > 0) {
-            size_t result = write_lz(lz_writer, &hash_table, &buffer);
-            if (result < 1) {
-                fprintf(stderr, "\n[ERROR]: encode() {} -> Unable to write the encoded data into the buffer!\n");
-                free_buffer(&buffer);
-                return -1;
+    if (!streaming) {
+        ssize_t result = lz_writer->target > 0 ? encode_adaptive(lz_writer, input_file)
+            : lz_writer->level >= LEVEL_MAX ? encode_optimal(lz_writer, input_file)
+            : encode_parallel(lz_writer, input_file, lz_writer->threads);
+        if (result < 0) {
+            free_buffer(&buffer);
+            free_hash_table(&hash_table);
+            return -1;
+        }
+        processed = result;
+    }
+
+    // The long range matcher scans ahead on its own thread (and checksums the
+    // input, the encoder skips the bytes its matches cover)
+    LongRangeMatcher matcher;
+    int long_range = streaming && lz_writer->long_range;
+    if (long_range && !start_long_range(&matcher, input_file, lz_writer->window_size)) {
+        free_buffer(&buffer);
+        free_hash_table(&hash_table);
+        return -1;
+    }
+
+    // Holes of a sparse input are never read, a chunk stops where the next one starts
+    uint64_t hole_start = 0;
+    uint64_t hole_end = 0;
+    int hole = streaming && lz_writer->sparse && find_hole(input_file, 0, &hole_start, &hole_end);
+    size_t chunk_limit = buffer.max_size;
+
+    size_t chunk_start = 0;     // Content position of buffer.data[0]
+    int failed = 0;
+    while (streaming && !failed) {
+        if (hole && chunk_start == hole_start) {
+            if (write_hole(lz_writer, hole_end - hole_start) < 0 || fseeko(input_file, hole_end, SEEK_SET) != 0) {
+                failed = 1;
+                break;
             }
-            buffer.pos += result;
+            lz_writer->checksum = crc32c_zeros(lz_writer->checksum, hole_end - hole_start);
+            processed += hole_end - hole_start;
+            chunk_start = hole_end;
+            hole = find_hole(input_file, chunk_start, &hole_start, &hole_end);
+            failed = !report_progress(&lz_writer->progress, processed, file_size);
+            continue;
+        }
+        buffer.max_size = hole && hole_start - chunk_start < chunk_limit ? hole_start - chunk_start : chunk_limit;
+        if (read_chunk(&buffer, input_file) == 0) {
+            break;
+        }
+        size_t chunk_size = buffer.size;
+        size_t next_chunk = chunk_start + chunk_size;
+        if (!long_range) {
+            lz_writer->checksum = cpu_kernels()->crc32c(lz_writer->checksum, buffer.data, buffer.size);
         }
+        if (!filter_forward(&lz_writer->filter, buffer.data, buffer.size)) {
+            failed = 1;
+            break;
+        }
+        while (!failed && buffer.pos < chunk_size) {
+            // Short matches stop where the next long match starts
+            LongMatch match;
+            int found = long_range ? next_long_match(&matcher, next_chunk, &match) : 0;
+            failed = found < 0;
+            buffer.size = found > 0 ? match.start - chunk_start : chunk_size;
+            while (!failed && end_of_buffer(&buffer) > 0) {
+                ssize_t result = write_lz(lz_writer, &hash_table, &buffer);
+                if (result < 1) {
+                    set_error(LZ7_ERROR_IO, "encode", "Unable to write the encoded data into the buffer!");
+                    failed = 1;
+                    break;
+                }
+                buffer.pos += result;
+            }
+            if (failed || found <= 0) {
+                break;
+            }
 
-        processed += buffer.size;
-        if (processed % (100 * KB) == 0) {
-            printf("\rProcessing: %zu/%zu bytes...", processed, file_size);
+            if (write_long_match(lz_writer, match.offset, match.length) < 0) {
+                failed = 1;
+                break;
+            }
+            size_t match_end = match.start + match.length;
+            buffer.size = chunk_size;
+            if (match_end <= next_chunk) {
+                buffer.pos = match_end - chunk_start;
+            } else {
+                // The match covers the rest of the chunk, continue after it
+                next_chunk = match_end;
+                fseek(input_file, match_end, SEEK_SET);
+                break;
+            }
         }
-    }    
+
+        processed += next_chunk - chunk_start;
+        chunk_start = next_chunk;
+        // The next chunk overwrites the buffer
+        shift_hash_table(&hash_table, chunk_size);
+        failed = !report_progress(&lz_writer->progress, processed, file_size);
+    }
+
+    if (long_range && !finish_long_range(&matcher, failed ? NULL : &lz_writer->checksum)) {
+        set_error(LZ7_ERROR, "encode", "Long range matching failed!");
+        failed = 1;
+    }
+    if (failed) {
+        free_buffer(&buffer);
+        free_hash_table(&hash_table);
+        return -1;
+    }
 
     if (lz_writer->buffer_pos > 0) {
         int result = flush_writer(lz_writer);
         if (result < 0) {
             free_buffer(&buffer);
+            free_hash_table(&hash_table);
             return -1;
         }
     }
 
-    clock_t end_time = clock();
-    long compressed_file_size = ftell(lz_writer->file);
-    int size_diff = file_size - compressed_file_size;
-    double compression_rate = (double) abs(size_diff) / file_size * 100;
-    double time_spent = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-    printf("\rFinished processing (%f s): %zu bytes -> %ld bytes (%s%.2f%%)\n", time_spent, file_size, 
-           compressed_file_size, size_diff > 0 ? "-" : "+", compression_rate);
-    
     free_buffer(&buffer);
+    free_hash_table(&hash_table);
     return processed;
 }
 
 
+/*
+* Checks the decoded size and writes out the rest of the output
+*/
+static ssize_t finish_decode(LZReader* lz_reader, size_t processed) {
+    if (lz_reader->content_size != SIZE_MAX && lz_reader->produced != lz_reader->content_size) {
+        set_error(LZ7_ERROR_FORMAT, "decode", "Truncated stream (%zu of %zu bytes)!",
+                lz_reader->produced, lz_reader->content_size);
+        return -1;
+    }
+    if (lz_reader->buffer_pos > 0 && flush_reader(lz_reader) < 0) {
+        return -1;
+    }
+    return processed;
+}
+
 ssize_t decode(LZReader* lz_reader, FILE* input_file, size_t read_chunk_size) {
     if (lz_reader == NULL || input_file == NULL) {
-        fprintf(stderr, "\n[ERROR]: decode() {} -> Required parameters are NULL!\n");
+        set_error(LZ7_ERROR_PARAMETER, "decode", "Required parameters are NULL!");
         return -1;
     }
 
+    // Tokens start after the frame header
+    long start_pos = ftell(input_file);
+    // A long match token always fits in the input buffer
+    if (read_chunk_size < LONG_MATCH_TOKEN_SIZE) {
+        read_chunk_size = LONG_MATCH_TOKEN_SIZE;
+    }
     Buffer buffer;
     init_buffer_from_file(&buffer, input_file, read_chunk_size);
 
-    size_t file_size = get_file_size(input_file);
+    size_t file_size = lz_reader->stream_end != SIZE_MAX ? lz_reader->stream_end : get_file_size(input_file);
     size_t processed = 0;
-    fseek(input_file, 0, SEEK_SET);
-    clock_t start_time = clock();
+    fseek(input_file, start_pos, SEEK_SET);
 
-    while (read_chunk(&buffer, input_file) != 0) {
-        size_t bytes_left = 0;
-        while ((bytes_left = end_of_buffer(&buffer)) > 0) {
-            if (bytes_left < 3) {
-                fseek(input_file, -bytes_left, SEEK_CUR);
-                break;
-            }
+    // The token stream ends where the frame trailer starts
+    if (file_size < (size_t) start_pos + lz_reader->trailer_size) {
+        set_error(LZ7_ERROR_FORMAT, "decode", "Truncated stream!");
+        free_buffer(&buffer);
+        return -1;
+    }
+    size_t stream_left = file_size - start_pos - lz_reader->trailer_size;
+    if (lz_reader->split) {
+        free_buffer(&buffer);
+        ssize_t result = decode_split(lz_reader, input_file, stream_left);
+        return result < 0 ? -1 : finish_decode(lz_reader, result);
+    }
 
-            ssize_t result = read_lz(&buffer, lz_reader);
+    // Partial tokens are carried over to the next chunk
+    buffer.size = 0;
+    buffer.pos = 0;
+    size_t read_bytes = 0;
+    ssize_t (*read_lz_run)(Buffer*, LZReader*, size_t) = lz_reader->checked
+        ? read_lz_run_checked : read_lz_run_unchecked;
+    while ((read_bytes = refill_buffer(&buffer, input_file, stream_left)) != 0) {
+        stream_left -= read_bytes;
+        while (end_of_buffer(&buffer) >= TOKEN_SIZE) {
+            // Hot loop far from the buffer ends, single checked tokens near them
+            size_t tokens = safe_token_count(&buffer, lz_reader);
+            ssize_t result = tokens > 0 ? read_lz_run(&buffer, lz_reader, tokens) : 0;
+            if (result == 0) {
+                result = read_lz(&buffer, lz_reader);
+                if (result == 0) {
+                    // Partial extended token, refill first
+                    break;
+                }
+            }
             if (result < 1) {
-                fprintf(stderr, "\n[ERROR]: decode() {} -> Unable to write the decoded data into the buffer!\n");
+                set_error(LZ7_ERROR_IO, "decode", "Unable to write the decoded data into the buffer!");
                 free_buffer(&buffer);
                 return -1;
             }
         }
 
-        processed += buffer.size;
-        if (processed % (100 * KB) == 0) {
-            printf("\rProcessing: %zu/%zu bytes...", processed, file_size);
+        processed += read_bytes;
+        if (!report_progress(&lz_reader->progress, processed, file_size - start_pos - lz_reader->trailer_size)) {
+            free_buffer(&buffer);
+            return -1;
         }
     }
 
-    if (lz_reader->buffer_pos > 0) {
-        int result = flush_reader(lz_reader);
-        if (result < 0) {
-            free_buffer(&buffer);
+    int truncated = end_of_buffer(&buffer) > 0;
+    free_buffer(&buffer);
+    if (truncated) {
+        set_error(LZ7_ERROR_FORMAT, "decode", "Truncated token at the end of the stream!");
+        return -1;
+    }
+    return finish_decode(lz_reader, processed);
+}
+
+/*
+* Copies a match within the output of decode_memory(). room is the number of
+* bytes that may be written at out, the caller has checked length against it.
+*/
+static inline void copy_memory_match(unsigned char* out, size_t offset, size_t length, size_t room,
+                                     void (*wild_copy)(unsigned char*, const unsigned char*, size_t)) {
+    if (offset >= length && room >= length + WILD_COPY_SLACK) {
+        wild_copy(out, out - offset, length);
+        return;
+    }
+    if (offset == 1) {
+        // A run of the last byte
+        memset(out, out[-1], length);
+        return;
+    }
+    // Near the limit or overlapping: one period, then doubling copies of
+    // whole periods (wild once they are a wild copy apart and there is room)
+    size_t period = offset < length ? offset : length;
+    memcpy(out, out - offset, period);
+    int wild = room >= length + WILD_COPY_SLACK;
+    size_t done = period;
+    for (; done < length && (done < WILD_COPY_SLACK || !wild); done *= 2) {
+        memcpy(out + done, out, done < length - done ? done : length - done);
+    }
+    if (done < length) {
+        wild_copy(out + done, out, length - done);
+    }
+}
+
+/*
+* Makes length bytes at out and the slack of a wild copy after them writable
+* (see Progress.reserve), writable is the writable end of the output so far
+*/
+static int reserve_output(Progress* progress, unsigned char* out, size_t length, unsigned char* dst_end,
+                          unsigned char** writable) {
+    unsigned char* end = (size_t) (dst_end - out) > length + WILD_COPY_SLACK ? out + length + WILD_COPY_SLACK : dst_end;
+    *writable = progress->reserve(progress->reserve_data, end);
+    return *writable != NULL;
+}
+
+/*
+* Function: decode_memory
+* -----------------------
+*  Decodes a whole token stream into a caller buffer. The buffer itself is the
+*  history, so there is neither a dictionary nor an output buffer, and long
+*  matches are plain copies. The stream may lie inside dst (in-place, at its
+*  tail): then a token whose output would reach its own unread bytes fails
+*  instead of overwriting them.
+*
+*  src: Token stream (no frame header, no trailer)
+*  src_size: Token stream size
+*  dst: Output buffer
+*  dst_size: Output buffer size (exactly the content size, when it is known)
+*  history: Bytes before dst matches may reach (earlier frames of a primed frame)
+*  window_size: Longest valid offset of a short match (checked only)
+*  checked: Validate every token (untrusted input). Offsets and lengths are always
+*           bounds checked, the buffer is never read or written outside.
+*  progress: Token stream bytes decoded so far and the writable output (NULL: none)
+*
+*  returns: Decoded bytes. If failed (-1)
+*/
+ssize_t decode_memory(const unsigned char* src, size_t src_size, unsigned char* dst, size_t dst_size,
+                      size_t history, size_t window_size, int checked, Progress* progress) {
+    if (src == NULL || dst == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "decode_memory", "Required parameters are NULL!");
+        return -1;
+    }
+    const unsigned char* token = src;
+    const unsigned char* src_end = src + src_size;
+    unsigned char* out = dst;
+    unsigned char* dst_end = dst + dst_size;
+    // In place, the output may only grow up to the next unread token
+    int in_place = src < dst_end && src_end > dst;
+    if (in_place && (src < dst || src_end > dst_end)) {
+        set_error(LZ7_ERROR_PARAMETER, "decode_memory", "The input overlaps the output but is not at its tail!");
+        return -1;
+    }
+
+    void (*wild_copy)(unsigned char* dst, const unsigned char* src, size_t length) = cpu_kernels()->wild_copy;
+    size_t reps[REP_OFFSETS] = { 0 };
+    const unsigned char* report = progress != NULL && progress->callback != NULL ? src + MEMORY_PROGRESS_STEP : src_end;
+    unsigned char* writable = progress != NULL && progress->reserve != NULL ? dst : dst_end;
+    while (src_end - token >= TOKEN_SIZE) {
+        size_t offset = token[0] | (token[1] << 8);
+        size_t length = offset > 0 ? token[2] : 1;
+        size_t size = TOKEN_SIZE;
+        int hole = 0;
+        if (length == 0) {
+            size = TOKEN_SIZE * (1 + token[1]);
+            if ((size_t) (src_end - token) < size) {
+                set_error(LZ7_ERROR_FORMAT, "decode_memory", "Truncated token at the end of the stream!");
+                return -1;
+            }
+            hole = token[0] == TOKEN_HOLE && size == HOLE_TOKEN_SIZE;
+            if (!hole && (token[0] != TOKEN_LONG_MATCH || size != LONG_MATCH_TOKEN_SIZE)) {
+                set_error(LZ7_ERROR_FORMAT, "decode_memory", "Unknown extended token %u!", token[0]);
+                return -1;
+            }
+            offset = 0;
+            for (int i = hole ? 5 : 4; i >= 0; i--) {
+                offset = (offset << 8) | token[3 + i];
+            }
+            for (int i = 3; i >= 0 && !hole; i--) {
+                length = (length << 8) | token[8 + i];
+            }
+            if (hole) {
+                // The zeros are written, the buffer has no holes
+                length = offset;
+                offset = 0;
+            } else if (offset == 0) {
+                set_error(LZ7_ERROR_FORMAT, "decode_memory", "Invalid long match offset!");
+                return -1;
+            }
+        } else if (offset > 0) {
+            if (length == REP_MATCH_LENGTH) {
+                length = offset >> 2;
+                offset = reps[offset & (REP_OFFSETS - 1)];
+                if (offset == 0 || length < MIN_MATCH_LENGTH) {
+                    set_error(LZ7_ERROR_FORMAT, "decode_memory", "Invalid repeat match (length %zu)!", length);
+                    return -1;
+                }
+            }
+            if (checked && (offset > window_size || length < MIN_MATCH_LENGTH)) {
+                set_error(LZ7_ERROR_FORMAT, "decode_memory", "Invalid match (offset %zu, length %zu)!", offset, length);
+                return -1;
+            }
+            push_rep_offset(reps, offset);
+        }
+
+        const unsigned char* limit = in_place ? token + size : dst_end;
+        if (offset > (size_t) (out - dst) + history) {
+            set_error(LZ7_ERROR_FORMAT, "decode_memory", "Match offset %zu is behind the decoded data!", offset);
             return -1;
         }
+        if (length > (size_t) (limit - out)) {
+            if (in_place && out + length <= dst_end) {
+                set_error(LZ7_ERROR_PARAMETER, "decode_memory", "The output reached the unread input, the buffer is too small!");
+            } else {
+                set_error(LZ7_ERROR_FORMAT, "decode_memory", "Token is past the end of the content!");
+            }
+            return -1;
+        }
+        if (length + WILD_COPY_SLACK > (size_t) (writable - out) && writable < dst_end
+            && !reserve_output(progress, out, length, dst_end, &writable)) {
+            return -1;
+        }
+
+        if (hole) {
+            memset(out, 0, length);
+        } else if (offset == 0) {
+            *out = token[2];
+        } else {
+            copy_memory_match(out, offset, length, limit - out, wild_copy);
+        }
+        out += length;
+        token += size;
+
+        if (token >= report) {
+            if (!report_progress(progress, token - src, src_size)) {
+                return -1;
+            }
+            report = token + MEMORY_PROGRESS_STEP;
+        }
+    }
+    if (token != src_end) {
+        set_error(LZ7_ERROR_FORMAT, "decode_memory", "Truncated token at the end of the stream!");
+        return -1;
     }
+    if (!report_progress(progress, src_size, src_size)) {
+        return -1;
+    }
+    return out - dst;
+}
 
-    clock_t end_time = clock();
-    double time_spent = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-    long compressed_file_size = ftell(lz_reader->file);
-    printf("\rFinished Processing (%f s): %zu bytes -> %ld bytes.\n", time_spent, file_size, compressed_file_size);
+/*
+* Function: decode_memory_split
+* -----------------------------
+*  Decodes a stream of split blocks into a caller buffer, like decode_memory().
+*  In place, the output may grow up to the first unread byte of the block
+*  streams. The literals come first in a block, so a frame needs a larger
+*  margin at the tail of dst than an interleaved one.
+*
+*  src: Block stream (no frame header, no trailer)
+*  src_size: Block stream size
+*  dst: Output buffer
+*  dst_size: Output buffer size (exactly the content size, when it is known)
+*  history: Bytes before dst matches may reach (earlier frames of a primed frame)
+*  window_size: Longest valid offset of a short match (checked only)
+*  checked: Validate every match offset (untrusted input). The streams are
+*           always bounds checked, the buffer is never read or written outside.
+*  progress: Block stream bytes decoded so far and the writable output (NULL: none)
+*
+*  returns: Decoded bytes. If failed (-1)
+*/
+ssize_t decode_memory_split(const unsigned char* src, size_t src_size, unsigned char* dst, size_t dst_size,
+                            size_t history, size_t window_size, int checked, Progress* progress) {
+    if (src == NULL || dst == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "decode_memory_split", "Required parameters are NULL!");
+        return -1;
+    }
+    const unsigned char* data = src;
+    const unsigned char* src_end = src + src_size;
+    unsigned char* out = dst;
+    unsigned char* dst_end = dst + dst_size;
+    int in_place = src < dst_end && src_end > dst;
+    if (in_place && (src < dst || src_end > dst_end)) {
+        set_error(LZ7_ERROR_PARAMETER, "decode_memory_split", "The input overlaps the output but is not at its tail!");
+        return -1;
+    }
 
-    free_buffer(&buffer);
-    return processed;
+    void (*wild_copy)(unsigned char* dst, const unsigned char* src, size_t length) = cpu_kernels()->wild_copy;
+    size_t reps[REP_OFFSETS] = { 0 };
+    unsigned char* writable = progress != NULL && progress->reserve != NULL ? dst : dst_end;
+    while (data < src_end) {
+        SplitBlock block;
+        if (!parse_split_block(data, src_end - data, &block)) {
+            return -1;
+        }
+        const unsigned char* literal = block.literals;
+        const unsigned char* literal_end = literal + block.literal_count;
+        const unsigned char* run = block.runs;
+        const unsigned char* run_end = run + block.runs_size;
+        const unsigned char* code = block.offsets;
+        const unsigned char* code_end = code + block.offsets_size;
+        const unsigned char* block_end = data + block.size;
+        for (size_t s = 0; s <= block.sequence_count; s++) {
+            // The literals after the last match end the block
+            int last = s == block.sequence_count;
+            size_t count = literal_end - literal;
+            size_t offset = 0;
+            size_t length = 0;
+            if (!last) {
+                if (!read_run(&run, run_end, &count) || count > (size_t) (literal_end - literal)) {
+                    set_error(LZ7_ERROR_FORMAT, "decode_memory_split", "Invalid literal run in sequence %zu!", s);
+                    return -1;
+                }
+                length = block.lengths[s];
+                size_t size = length == 0 ? LONG_MATCH_TOKEN_SIZE - TOKEN_SIZE : 2;
+                if ((size_t) (code_end - code) < size) {
+                    set_error(LZ7_ERROR_FORMAT, "decode_memory_split", "Truncated offset stream in sequence %zu!", s);
+                    return -1;
+                }
+                if (length == 0) {
+                    for (int i = 4; i >= 0; i--) {
+                        offset = (offset << 8) | code[i];
+                    }
+                    for (int i = 3; i >= 0; i--) {
+                        length = (length << 8) | code[5 + i];
+                    }
+                } else {
+                    offset = code[0] | (code[1] << 8);
+                    if (length == REP_MATCH_LENGTH) {
+                        length = offset >> 2;
+                        offset = reps[offset & (REP_OFFSETS - 1)];
+                        if (length < MIN_MATCH_LENGTH) {
+                            offset = 0;
+                        }
+                    }
+                    if (checked && offset > window_size) {
+                        set_error(LZ7_ERROR_FORMAT, "decode_memory_split", "Invalid match (offset %zu, length %zu)!",
+                                  offset, length);
+                        return -1;
+                    }
+                    push_rep_offset(reps, offset);
+                }
+                if (offset == 0) {
+                    set_error(LZ7_ERROR_FORMAT, "decode_memory_split", "Invalid match in sequence %zu!", s);
+                    return -1;
+                }
+                code += size;
+            }
+
+            // In place, the first unread byte: the streams lie in this order
+            const unsigned char* limit = dst_end;
+            if (in_place) {
+                limit = literal + count < literal_end ? literal + count
+                      : run < run_end ? run
+                      : s + 1 < block.sequence_count ? block.lengths + s + 1
+                      : code < code_end ? code : block_end;
+            }
+            if (count + length > (size_t) (limit - out)) {
+                if (in_place && count + length <= (size_t) (dst_end - out)) {
+                    set_error(LZ7_ERROR_PARAMETER, "decode_memory_split", "The output reached the unread input, the buffer is too small!");
+                } else {
+                    set_error(LZ7_ERROR_FORMAT, "decode_memory_split", "Sequence is past the end of the content!");
+                }
+                return -1;
+            }
+            if (count + length + WILD_COPY_SLACK > (size_t) (writable - out) && writable < dst_end
+                && !reserve_output(progress, out, count + length, dst_end, &writable)) {
+                return -1;
+            }
+            // In place, the literals may overlap their own copy
+            if (!in_place && (size_t) (limit - out) >= count + WILD_COPY_SLACK
+                && (size_t) (src_end - literal) >= count + WILD_COPY_SLACK) {
+                wild_copy(out, literal, count);
+            } else {
+                memmove(out, literal, count);
+            }
+            literal += count;
+            out += count;
+            if (length > 0) {
+                if (offset > (size_t) (out - dst) + history) {
+                    set_error(LZ7_ERROR_FORMAT, "decode_memory_split", "Match offset %zu is behind the decoded data!", offset);
+                    return -1;
+                }
+                copy_memory_match(out, offset, length, limit - out, wild_copy);
+                out += length;
+            }
+        }
+        if (run != run_end || code != code_end) {
+            set_error(LZ7_ERROR_FORMAT, "decode_memory_split", "Unused bytes at the end of the block streams!");
+            return -1;
+        }
+        data = block_end;
+        if (!report_progress(progress, data - src, src_size)) {
+            return -1;
+        }
+    }
+    return out - dst;
 }
@@ -0,0 +1,467 @@
+#include "../include/optimal.h"
+#include "../include/lz77.h"
+#include "../include/cpu.h"
+#include "../include/utils.h"
+#include "../include/constants.h"
+#include "../include/error.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IS_LMS(t, i) ((i) > 0 && (t)[i] && !(t)[(i) - 1])
+
+static void get_buckets(const int32_t* s, int32_t n, int32_t* bkt, int32_t k, int end) {
+    memset(bkt, 0, (k + 1) * sizeof(int32_t));
+    for (int32_t i = 0; i < n; i++) {
+        bkt[s[i]]++;
+    }
+    int32_t sum = 0;
+    for (int32_t i = 0; i <= k; i++) {
+        sum += bkt[i];
+        bkt[i] = end ? sum : sum - bkt[i];
+    }
+}
+
+static void induce_l(const int32_t* s, int32_t* sa, const unsigned char* t, int32_t* bkt, int32_t n, int32_t k) {
+    get_buckets(s, n, bkt, k, 0);
+    for (int32_t i = 0; i < n; i++) {
+        int32_t j = sa[i] - 1;
+        if (sa[i] > 0 && !t[j]) {
+            sa[bkt[s[j]]++] = j;
+        }
+    }
+}
+
+static void induce_s(const int32_t* s, int32_t* sa, const unsigned char* t, int32_t* bkt, int32_t n, int32_t k) {
+    get_buckets(s, n, bkt, k, 1);
+    for (int32_t i = n - 1; i >= 0; i--) {
+        int32_t j = sa[i] - 1;
+        if (sa[i] > 0 && t[j]) {
+            sa[--bkt[s[j]]] = j;
+        }
+    }
+}
+
+/*
+* SA-IS over an integer string whose last symbol is a unique sentinel (0).
+* k is the largest symbol value.
+*/
+static int sais(const int32_t* s, int32_t* sa, int32_t n, int32_t k) {
+    unsigned char* t = malloc(n);
+    int32_t* bkt = malloc((k + 1) * sizeof(int32_t));
+    if (t == NULL || bkt == NULL) {
+        free(t);
+        free(bkt);
+        return 0;
+    }
+
+    // Classify suffixes: S-type (1) or L-type (0)
+    t[n - 1] = 1;
+    for (int32_t i = n - 2; i >= 0; i--) {
+        t[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1]);
+    }
+
+    // Sort LMS substrings
+    get_buckets(s, n, bkt, k, 1);
+    for (int32_t i = 0; i < n; i++) {
+        sa[i] = -1;
+    }
+    for (int32_t i = 1; i < n; i++) {
+        if (IS_LMS(t, i)) {
+            sa[--bkt[s[i]]] = i;
+        }
+    }
+    induce_l(s, sa, t, bkt, n, k);
+    induce_s(s, sa, t, bkt, n, k);
+
+    // Compact sorted LMS substrings into the first n1 items
+    int32_t n1 = 0;
+    for (int32_t i = 0; i < n; i++) {
+        if (IS_LMS(t, sa[i])) {
+            sa[n1++] = sa[i];
+        }
+    }
+
+    // Name the LMS substrings
+    for (int32_t i = n1; i < n; i++) {
+        sa[i] = -1;
+    }
+    int32_t name = 0;
+    int32_t prev = -1;
+    for (int32_t i = 0; i < n1; i++) {
+        int32_t pos = sa[i];
+        int diff = 0;
+        for (int32_t d = 0; d < n; d++) {
+            if (prev == -1 || s[pos + d] != s[prev + d] || t[pos + d] != t[prev + d]) {
+                diff = 1;
+                break;
+            } else if (d > 0 && (IS_LMS(t, pos + d) || IS_LMS(t, prev + d))) {
+                break;
+            }
+        }
+        if (diff) {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (int32_t i = n - 1, j = n - 1; i >= n1; i--) {
+        if (sa[i] >= 0) {
+            sa[j--] = sa[i];
+        }
+    }
+
+    // Sort the reduced string, recursing while names are not unique
+    int32_t* s1 = sa + n - n1;
+    if (name < n1) {
+        if (!sais(s1, sa, n1, name - 1)) {
+            free(t);
+            free(bkt);
+            return 0;
+        }
+    } else {
+        for (int32_t i = 0; i < n1; i++) {
+            sa[s1[i]] = i;
+        }
+    }
+
+    // Induce the final suffix array from the sorted LMS suffixes
+    get_buckets(s, n, bkt, k, 1);
+    for (int32_t i = 1, j = 0; i < n; i++) {
+        if (IS_LMS(t, i)) {
+            s1[j++] = i;
+        }
+    }
+    for (int32_t i = 0; i < n1; i++) {
+        sa[i] = s1[sa[i]];
+    }
+    for (int32_t i = n1; i < n; i++) {
+        sa[i] = -1;
+    }
+    for (int32_t i = n1 - 1; i >= 0; i--) {
+        int32_t j = sa[i];
+        sa[i] = -1;
+        sa[--bkt[s[j]]] = j;
+    }
+    induce_l(s, sa, t, bkt, n, k);
+    induce_s(s, sa, t, bkt, n, k);
+
+    free(t);
+    free(bkt);
+    return 1;
+}
+
+int build_suffix_array(const unsigned char* data, int32_t size, int32_t* sa) {
+    if (data == NULL || sa == NULL || size < 0) {
+        set_error(LZ7_ERROR_PARAMETER, "build_suffix_array", "Required parameters are NULL!");
+        return 0;
+    }
+
+    // Shift the alphabet by one so 0 can be used as the sentinel
+    int32_t* s = malloc((size + 1) * sizeof(int32_t));
+    if (s == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "build_suffix_array", "Unable to allocate memory for the string!");
+        return 0;
+    }
+    for (int32_t i = 0; i < size; i++) {
+        s[i] = data[i] + 1;
+    }
+    s[size] = 0;
+
+    int result = 1;
+    if (size == 0) {
+        sa[0] = 0;
+    } else {
+        result = sais(s, sa, size + 1, 256);
+    }
+    free(s);
+    if (!result) {
+        set_error(LZ7_ERROR_MEMORY, "build_suffix_array", "Unable to allocate memory for induced sorting!");
+    }
+    return result;
+}
+
+void build_lcp_array(const unsigned char* data, int32_t size, const int32_t* sa,
+                     int32_t* rank, int32_t* lcp) {
+    for (int32_t i = 0; i <= size; i++) {
+        rank[sa[i]] = i;
+    }
+    lcp[0] = 0;
+    int32_t h = 0;
+    for (int32_t i = 0; i < size; i++) {
+        int32_t r = rank[i];
+        int32_t j = sa[r - 1];
+        while (i + h < size && j + h < size && data[i + h] == data[j + h]) {
+            h++;
+        }
+        lcp[r] = h;
+        if (h > 0) {
+            h--;
+        }
+    }
+}
+
+/*
+* Fenwick tree over suffix ranks, marking which positions are inside the window
+*/
+typedef struct {
+    int32_t* tree;
+    int32_t size;
+    int32_t top_bit;
+    int32_t count;
+} RankSet;
+
+static void rank_set_update(RankSet* set, int32_t rank, int32_t delta) {
+    set->count += delta;
+    for (int32_t i = rank + 1; i <= set->size; i += i & -i) {
+        set->tree[i] += delta;
+    }
+}
+
+// Number of marked ranks below rank
+static int32_t rank_set_count(const RankSet* set, int32_t rank) {
+    int32_t sum = 0;
+    for (int32_t i = rank; i > 0; i -= i & -i) {
+        sum += set->tree[i];
+    }
+    return sum;
+}
+
+// Rank of the k-th (1-based) marked item
+static int32_t rank_set_select(const RankSet* set, int32_t k) {
+    int32_t pos = 0;
+    for (int32_t bit = set->top_bit; bit > 0; bit >>= 1) {
+        if (pos + bit <= set->size && set->tree[pos + bit] < k) {
+            pos += bit;
+            k -= set->tree[pos];
+        }
+    }
+    return pos;
+}
+
+/*
+* Segment tree for range-minimum queries over the LCP array
+*/
+static int32_t lcp_min(const int32_t* tree, int32_t size, int32_t from, int32_t to) {
+    int32_t result = INT32_MAX;
+    for (from += size, to += size + 1; from < to; from >>= 1, to >>= 1) {
+        if (from & 1) {
+            int32_t v = tree[from++];
+            if (v < result) result = v;
+        }
+        if (to & 1) {
+            int32_t v = tree[--to];
+            if (v < result) result = v;
+        }
+    }
+    return result;
+}
+
+ssize_t parse_optimal_block(LZWriter* lz_writer, const unsigned char* data, int32_t history, int32_t size,
+                            int32_t window) {
+    int32_t n = size + 1;
+    int32_t block = size - history;
+    int32_t* sa = malloc(n * sizeof(int32_t));
+    int32_t* rank = malloc(n * sizeof(int32_t));
+    int32_t* lcp = malloc(n * sizeof(int32_t));
+    int32_t* tree = calloc(2 * n, sizeof(int32_t));
+    int32_t* fenwick = calloc(n + 1, sizeof(int32_t));
+    uint16_t* offsets = malloc(block * sizeof(uint16_t));
+    uint16_t* lengths = malloc(block * sizeof(uint16_t));
+    uint32_t* costs = malloc((block + 1) * sizeof(uint32_t));
+    uint8_t* runs = calloc(n, sizeof(uint8_t));
+    ssize_t result = -1;
+
+    if (sa == NULL || rank == NULL || lcp == NULL || tree == NULL || fenwick == NULL
+        || offsets == NULL || lengths == NULL || costs == NULL || runs == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "parse_optimal_block", "Unable to allocate memory for the parser!");
+        goto cleanup;
+    }
+
+    if (!build_suffix_array(data, size, sa)) {
+        goto cleanup;
+    }
+    build_lcp_array(data, size, sa, rank, lcp);
+    for (int32_t i = 0; i < n; i++) {
+        tree[n + i] = lcp[i];
+    }
+    for (int32_t i = n - 1; i > 0; i--) {
+        tree[i] = tree[2 * i] < tree[2 * i + 1] ? tree[2 * i] : tree[2 * i + 1];
+    }
+
+    // Positions inside a run (more than MAX_MATCH_LENGTH bytes of the byte
+    // before them follow) match the previous byte up to the end of the run.
+    // They are never searched and stay out of the rank set: the run positions
+    // near its end are as long a match for any later position (up to a token).
+    size_t (*run_length)(const unsigned char* data, size_t limit) = cpu_kernels()->run_length;
+    for (int32_t i = 1; i < size;) {
+        int32_t end = i - 1 + (int32_t) run_length(data + i - 1, size - i + 1);
+        if (end - i > MAX_MATCH_LENGTH) {
+            memset(runs + i, 1, end - i - MAX_MATCH_LENGTH);
+            for (int32_t j = i > history ? i : history; j < end - MAX_MATCH_LENGTH; j++) {
+                lengths[j - history] = end - j < OPTIMAL_MAX_LENGTH ? end - j : OPTIMAL_MAX_LENGTH;
+                offsets[j - history] = 1;
+            }
+        }
+        i = end + 1;
+    }
+
+    RankSet set = { fenwick, n, 1, 0 };
+    while (set.top_bit * 2 <= n) {
+        set.top_bit *= 2;
+    }
+    for (int32_t i = history > window ? history - window : 0; i < history; i++) {
+        if (!runs[i]) {
+            rank_set_update(&set, rank[i], 1);
+        }
+    }
+
+    // Longest match of every position against the window
+    for (int32_t i = history; i < size; i++) {
+        if (!runs[i]) {
+            int32_t r = rank[i];
+            int32_t best_length = 0;
+            int32_t best_pos = 0;
+            int32_t below = rank_set_count(&set, r);
+
+            if (below > 0) {
+                int32_t p = rank_set_select(&set, below);
+                int32_t length = lcp_min(tree, n, p + 1, r);
+                best_length = length;
+                best_pos = sa[p];
+            }
+            if (below < set.count) {
+                int32_t p = rank_set_select(&set, below + 1);
+                int32_t length = lcp_min(tree, n, r + 1, p);
+                if (length > best_length || (length == best_length && sa[p] > best_pos)) {
+                    best_length = length;
+                    best_pos = sa[p];
+                }
+            }
+
+            if (best_length > OPTIMAL_MAX_LENGTH) {
+                best_length = OPTIMAL_MAX_LENGTH;
+            }
+            lengths[i - history] = best_length >= MIN_MATCH_LENGTH ? best_length : 0;
+            offsets[i - history] = i - best_pos;
+
+            rank_set_update(&set, r, 1);
+        }
+        if (i - window >= 0 && !runs[i - window]) {
+            rank_set_update(&set, rank[i - window], -1);
+        }
+    }
+
+    // Cheapest path from the end of the block, in output bytes. A match longer
+    // than a token takes a repeat match of the same offset after it.
+    uint32_t literal_cost = lz_writer->split ? SPLIT_LITERAL_COST : TOKEN_SIZE;
+    uint32_t match_cost = lz_writer->split ? SPLIT_MATCH_COST : TOKEN_SIZE;
+    costs[block] = 0;
+    for (int32_t i = block - 1; i >= 0; i--) {
+        int32_t longest = lengths[i];
+        uint32_t long_cost = longest > MAX_MATCH_LENGTH ? 2 * match_cost : match_cost;
+        // No shorter match inside a run lands anywhere cheaper
+        if (runs[history + i]) {
+            costs[i] = costs[i + longest] + long_cost;
+            continue;
+        }
+        uint32_t best_cost = costs[i + 1] + literal_cost;
+        int32_t best_length = 1;
+        for (int32_t length = MIN_MATCH_LENGTH; length <= longest && length <= MAX_MATCH_LENGTH; length++) {
+            if (costs[i + length] + match_cost <= best_cost) {
+                best_cost = costs[i + length] + match_cost;
+                best_length = length;
+            }
+        }
+        if (longest > MAX_MATCH_LENGTH && costs[i + longest] + long_cost <= best_cost) {
+            best_cost = costs[i + longest] + long_cost;
+            best_length = longest;
+        }
+        costs[i] = best_cost;
+        lengths[i] = best_length;
+    }
+
+    for (int32_t i = 0; i < block;) {
+        // The writer covers a long match with more than one token (a byte
+        // left over after them is a literal)
+        size_t offset = offsets[i];
+        for (int32_t end = i + lengths[i]; i < end;) {
+            ssize_t written = end - i >= MIN_MATCH_LENGTH
+                ? write_match(lz_writer, offset, end - i)
+                : write_literal(lz_writer, data[history + i]);
+            if (written < 1) {
+                goto cleanup;
+            }
+            i += written;
+        }
+    }
+    result = block;
+
+cleanup:
+    free(sa);
+    free(rank);
+    free(lcp);
+    free(tree);
+    free(fenwick);
+    free(offsets);
+    free(lengths);
+    free(costs);
+    free(runs);
+    return result;
+}
+
+ssize_t encode_optimal(LZWriter* lz_writer, FILE* input_file) {
+    if (lz_writer == NULL || input_file == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "encode_optimal", "Required parameters are NULL!");
+        return -1;
+    }
+
+    // Small inputs get a block of their own size
+    size_t file_size = get_file_size(input_file);
+    size_t block_size = file_size < OPTIMAL_BLOCK_SIZE ? file_size : OPTIMAL_BLOCK_SIZE;
+    block_size = block_size > 0 ? block_size : 1;
+
+    size_t window = lz_writer->window_size > MAX_OFFSET ? MAX_OFFSET : lz_writer->window_size;
+    unsigned char* data = malloc(window + block_size);
+    if (data == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "encode_optimal", "Unable to allocate memory for the block!");
+        return -1;
+    }
+
+    size_t processed = 0;
+    // A primed window starts with the content before the input
+    size_t history = lz_writer->prime_size < window ? lz_writer->prime_size : window;
+    if (history > 0) {
+        memcpy(data, lz_writer->prime + lz_writer->prime_size - history, history);
+    }
+    size_t read_bytes = 0;
+    while ((read_bytes = fread(data + history, sizeof(unsigned char), block_size, input_file)) != 0) {
+        lz_writer->checksum = cpu_kernels()->crc32c(lz_writer->checksum, data + history, read_bytes);
+        if (!filter_forward(&lz_writer->filter, data + history, read_bytes)) {
+            free(data);
+            return -1;
+        }
+        if (parse_optimal_block(lz_writer, data, history, history + read_bytes, window) < 0) {
+            set_error(LZ7_ERROR, "encode_optimal", "Unable to parse the block!");
+            free(data);
+            return -1;
+        }
+
+        // Keep the tail of the block as history for the next one
+        size_t size = history + read_bytes;
+        history = size < window ? size : window;
+        memmove(data, data + size - history, history);
+
+        processed += read_bytes;
+        if (!report_progress(&lz_writer->progress, processed, file_size)) {
+            free(data);
+            return -1;
+        }
+    }
+
+    free(data);
+    return processed;
+}
@@ -0,0 +1,177 @@
+#include "../include/parallel.h"
+#include "../include/lz77.h"
+#include "../include/hash.h"
+#include "../include/buffer.h"
+#include "../include/cpu.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const unsigned char* data;  // Whole block, history included (shared, read-only)
+    size_t prime;               // First byte fed into the hash table only
+    size_t start;               // First byte of the segment
+    size_t end;                 // End of the segment
+    size_t window_size;
+    HashTable hash_table;
+    LZWriter writer;            // Token buffer, holds a whole segment
+    int dirty;                  // The hash table holds positions of another segment
+    int result;
+    ErrorState error;       // Why the segment failed
+} Segment;
+
+static void* encode_segment(void* arg) {
+    Segment* segment = arg;
+    if (segment->dirty) {
+        reset_hash_table(&segment->hash_table);
+    }
+    segment->dirty = 1;
+
+    // Matches never run past the segment, the next thread encodes those bytes
+    Buffer buffer = {
+        .data = (unsigned char*) segment->data,
+        .pos = segment->prime,
+        .size = segment->end,
+        .max_size = segment->end,
+    };
+    for (; buffer.pos < segment->start; buffer.pos++) {
+        update_hash_table(&segment->hash_table, &buffer, segment->window_size);
+    }
+
+    reset_writer(&segment->writer);
+    while (buffer.pos < segment->end) {
+        ssize_t result = write_lz(&segment->writer, &segment->hash_table, &buffer);
+        if (result < 1) {
+            save_error(&segment->error);
+            segment->result = 0;
+            return NULL;
+        }
+        buffer.pos += result;
+    }
+    segment->result = 1;
+    return NULL;
+}
+
+static void free_segments(Segment* segments, int threads) {
+    for (int i = 0; i < threads; i++) {
+        free_hash_table(&segments[i].hash_table);
+        free_filter(&segments[i].writer.filter);
+        free(segments[i].writer.buffer);
+    }
+    free(segments);
+}
+
+ssize_t encode_parallel(LZWriter* lz_writer, FILE* input_file, int threads) {
+    if (lz_writer == NULL || input_file == NULL || threads < 1 || threads > PARALLEL_MAX_THREADS) {
+        set_error(LZ7_ERROR_PARAMETER, "encode_parallel", "Required parameters are NULL!");
+        return -1;
+    }
+
+    // Nothing is sized past the input: no idle threads, tables or buffers
+    size_t file_size = get_file_size(input_file);
+    size_t segment_size = file_size < PARALLEL_SEGMENT_SIZE ? file_size : PARALLEL_SEGMENT_SIZE;
+    segment_size = segment_size > 0 ? segment_size : 1;
+    size_t segment_count = (file_size + PARALLEL_SEGMENT_SIZE - 1) / PARALLEL_SEGMENT_SIZE;
+    if ((size_t) threads > segment_count) {
+        threads = segment_count > 0 ? segment_count : 1;
+    }
+
+    size_t window = lz_writer->window_size;
+    size_t block_size = threads == 1 ? segment_size : (size_t) threads * PARALLEL_SEGMENT_SIZE;
+    unsigned char* data = malloc(window + block_size);
+    Segment* segments = calloc(threads, sizeof(Segment));
+    if (data == NULL || segments == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "encode_parallel", "Unable to allocate memory for the block!");
+        free(data);
+        free(segments);
+        return -1;
+    }
+
+    // Every token takes at most TOKEN_SIZE bytes per input byte, so a
+    // segment never flushes its writer
+    size_t writer_size = TOKEN_SIZE * segment_size + TOKEN_SIZE + 1;
+    for (int i = 0; i < threads; i++) {
+        if (!init_writer(&segments[i].writer, lz_writer->file, writer_size, window,
+                         lz_writer->level, lz_writer->min_match)
+            || !init_hash_table(&segments[i].hash_table, lz_writer->min_match, window + segment_size)) {
+            free_segments(segments, threads);
+            free(data);
+            return -1;
+        }
+        segments[i].data = data;
+        segments[i].window_size = window;
+    }
+
+    pthread_t workers[PARALLEL_MAX_THREADS];
+    size_t processed = 0;
+    // A primed window starts with the content before the input
+    size_t history = lz_writer->prime_size < window ? lz_writer->prime_size : window;
+    if (history > 0) {
+        memcpy(data, lz_writer->prime + lz_writer->prime_size - history, history);
+    }
+    size_t read_bytes = 0;
+    while ((read_bytes = fread(data + history, sizeof(unsigned char), block_size, input_file)) != 0) {
+        lz_writer->checksum = cpu_kernels()->crc32c(lz_writer->checksum, data + history, read_bytes);
+        if (!filter_forward(&lz_writer->filter, data + history, read_bytes)) {
+            free_segments(segments, threads);
+            free(data);
+            return -1;
+        }
+
+        // Consecutive segments, each one primed with the window before it
+        size_t used = 0;
+        for (size_t start = history; start < history + read_bytes; start += PARALLEL_SEGMENT_SIZE) {
+            Segment* segment = &segments[used];
+            segment->start = start;
+            segment->end = start + PARALLEL_SEGMENT_SIZE < history + read_bytes
+                ? start + PARALLEL_SEGMENT_SIZE : history + read_bytes;
+            segment->prime = start > window ? start - window : 0;
+            segment->result = 0;
+            if (pthread_create(&workers[used], NULL, encode_segment, segment) != 0) {
+                set_error(LZ7_ERROR, "encode_parallel", "Unable to start a thread!");
+                break;
+            }
+            used++;
+        }
+
+        int failed = used == 0;
+        for (size_t i = 0; i < used; i++) {
+            pthread_join(workers[i], NULL);
+            restore_error(&segments[i].error);
+            failed |= !segments[i].result;
+        }
+        for (size_t i = 0; i < used && !failed; i++) {
+            LZWriter* writer = &segments[i].writer;
+            if (write_tokens(lz_writer, writer->buffer, writer->buffer_pos) < 0) {
+                failed = 1;
+            }
+        }
+        if (failed || used * PARALLEL_SEGMENT_SIZE < read_bytes) {
+            free_segments(segments, threads);
+            free(data);
+            return -1;
+        }
+
+        // Keep the tail of the block as history for the next one
+        size_t size = history + read_bytes;
+        history = size < window ? size : window;
+        memmove(data, data + size - history, history);
+
+        processed += read_bytes;
+        if (!report_progress(&lz_writer->progress, processed, file_size)) {
+            free_segments(segments, threads);
+            free(data);
+            return -1;
+        }
+    }
+
+    free_segments(segments, threads);
+    free(data);
+    return processed;
+}
@@ -0,0 +1,82 @@
+#define _GNU_SOURCE
+#include "../include/sparse.h"
+#include "../include/error.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const unsigned char zeros[SPARSE_ZERO_SIZE];
+
+int find_hole(FILE* file, uint64_t from, uint64_t* start, uint64_t* end) {
+    if (file == NULL || start == NULL || end == NULL) {
+        return 0;
+    }
+    int fd = fileno(file);
+    struct stat status;
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode) || from >= (uint64_t) status.st_size) {
+        return 0;
+    }
+
+    // The stream reads through the descriptor, its offset goes back afterwards
+    off_t saved = lseek(fd, 0, SEEK_CUR);
+    off_t hole = lseek(fd, from, SEEK_HOLE);
+    off_t data = hole >= 0 && hole < status.st_size ? lseek(fd, hole, SEEK_DATA) : -1;
+    if (hole >= 0 && hole < status.st_size && data < 0 && errno == ENXIO) {
+        // The hole runs to the end of the file
+        data = status.st_size;
+    }
+    lseek(fd, saved, SEEK_SET);
+    if (data <= hole) {
+        return 0;
+    }
+    *start = hole;
+    *end = data;
+    return 1;
+}
+
+// Writes length zeros at the current position of the stream
+static int write_zeros(FILE* file, uint64_t length) {
+    while (length > 0) {
+        size_t size = length < SPARSE_ZERO_SIZE ? length : SPARSE_ZERO_SIZE;
+        if (fwrite(zeros, sizeof(unsigned char), size, file) < size) {
+            return 0;
+        }
+        length -= size;
+    }
+    return 1;
+}
+
+int skip_hole(FILE* file, uint64_t length) {
+    if (file == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "skip_hole", "Required parameters are NULL!");
+        return 0;
+    }
+    int fd = fileno(file);
+    struct stat status;
+    off_t start = fflush(file) == 0 && fstat(fd, &status) == 0 ? ftello(file) : -1;
+    if (start < 0 || !S_ISREG(status.st_mode)) {
+        if (!write_zeros(file, length)) {
+            set_error(LZ7_ERROR_IO, "skip_hole", "Unable to write the zeros of a hole!");
+            return 0;
+        }
+        return 1;
+    }
+
+    // Old bytes under the hole are released, the rest of it is past the end
+    off_t end = start + (off_t) length;
+    off_t overlap = end < status.st_size ? end : status.st_size;
+    int result = overlap <= start
+        || fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, overlap - start) == 0
+        || write_zeros(file, overlap - start);
+    result = result && fflush(file) == 0
+        && (end <= status.st_size || ftruncate(fd, end) == 0) && fseeko(file, end, SEEK_SET) == 0;
+    if (!result) {
+        set_error(LZ7_ERROR_IO, "skip_hole", "Unable to make a hole in the output!");
+        return 0;
+    }
+    return 1;
+}
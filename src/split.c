@@ -0,0 +1,198 @@
+#include "../include/split.h"
+#include "../include/lz77.h"
+#include "../include/error.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void put_u32(unsigned char* data, size_t value) {
+    for (int i = 0; i < 4; i++) {
+        data[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static size_t get_u32(const unsigned char* data) {
+    return (size_t) data[0] | ((size_t) data[1] << 8) | ((size_t) data[2] << 16) | ((size_t) data[3] << 24);
+}
+
+static unsigned char* put_run(unsigned char* run, size_t count) {
+    while (count >= 0x80) {
+        *run++ = (count & 0x7F) | 0x80;
+        count >>= 7;
+    }
+    *run++ = (unsigned char) count;
+    return run;
+}
+
+size_t split_block_size(const unsigned char* header) {
+    size_t literal_count = get_u32(header);
+    size_t sequence_count = get_u32(header + 4);
+    size_t runs_size = get_u32(header + 8);
+    size_t offsets_size = get_u32(header + 12);
+    // Each term is below 2^32, the sum can't overflow
+    size_t size = SPLIT_HEADER_SIZE + literal_count + sequence_count + runs_size + offsets_size;
+    return size <= SPLIT_MAX_BLOCK_SIZE ? size : SIZE_MAX;
+}
+
+ssize_t split_tokens(const unsigned char* tokens, size_t size, unsigned char* block) {
+    if (tokens == NULL || block == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "split_tokens", "Required parameters are NULL!");
+        return -1;
+    }
+
+    // Literals and match fields are counted first, so every stream goes straight to its place
+    size_t literal_count = 0;
+    size_t sequence_count = 0;
+    size_t offsets_size = 0;
+    for (size_t pos = 0; pos + TOKEN_SIZE <= size;) {
+        const unsigned char* token = tokens + pos;
+        if (token[0] == 0 && token[1] == 0) {
+            literal_count++;
+            pos += TOKEN_SIZE;
+        } else if (token[2] == 0) {
+            sequence_count++;
+            offsets_size += LONG_MATCH_TOKEN_SIZE - TOKEN_SIZE;
+            pos += LONG_MATCH_TOKEN_SIZE;
+        } else {
+            sequence_count++;
+            offsets_size += 2;
+            pos += TOKEN_SIZE;
+        }
+    }
+
+    unsigned char* literal = block + SPLIT_HEADER_SIZE;
+    unsigned char* run_start = literal + literal_count;
+    unsigned char* run = run_start;
+    // The runs are written before their size is known, the lengths and offsets go to the end
+    unsigned char* length_end = block + SPLIT_BLOCK_BOUND(size) - offsets_size;
+    unsigned char* length = length_end - sequence_count;
+    unsigned char* offset = length_end;
+    size_t count = 0;
+    size_t pos = 0;
+    while (pos + TOKEN_SIZE <= size) {
+        const unsigned char* token = tokens + pos;
+        if (token[0] == 0 && token[1] == 0) {
+            *literal++ = token[2];
+            count++;
+            pos += TOKEN_SIZE;
+            continue;
+        }
+        size_t token_size = token[2] == 0 ? LONG_MATCH_TOKEN_SIZE : TOKEN_SIZE;
+        if (pos + token_size > size || (token[2] == 0 && (token[0] != TOKEN_LONG_MATCH
+                || token[1] != LONG_MATCH_TOKEN_SIZE / TOKEN_SIZE - 1))) {
+            set_error(LZ7_ERROR_FORMAT, "split_tokens", "Invalid token at %zu!", pos);
+            return -1;
+        }
+        run = put_run(run, count);
+        count = 0;
+        *length++ = token[2];
+        if (token[2] == 0) {
+            // The payload alone, the length byte tells the opcode
+            memcpy(offset, token + TOKEN_SIZE, LONG_MATCH_TOKEN_SIZE - TOKEN_SIZE);
+            offset += LONG_MATCH_TOKEN_SIZE - TOKEN_SIZE;
+        } else {
+            offset[0] = token[0];
+            offset[1] = token[1];
+            offset += 2;
+        }
+        pos += token_size;
+    }
+    if (pos != size) {
+        set_error(LZ7_ERROR_FORMAT, "split_tokens", "Truncated token at the end of the run!");
+        return -1;
+    }
+
+    size_t runs_size = run - run_start;
+    memmove(run, length_end - sequence_count, sequence_count + offsets_size);
+    put_u32(block, literal_count);
+    put_u32(block + 4, sequence_count);
+    put_u32(block + 8, runs_size);
+    put_u32(block + 12, offsets_size);
+    return SPLIT_HEADER_SIZE + literal_count + runs_size + sequence_count + offsets_size;
+}
+
+int parse_split_block(const unsigned char* data, size_t size, SplitBlock* block) {
+    if (data == NULL || block == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "parse_split_block", "Required parameters are NULL!");
+        return 0;
+    }
+    if (size < SPLIT_HEADER_SIZE) {
+        set_error(LZ7_ERROR_FORMAT, "parse_split_block", "Truncated block header!");
+        return 0;
+    }
+    block->size = split_block_size(data);
+    if (block->size == SIZE_MAX || block->size > size) {
+        set_error(LZ7_ERROR_FORMAT, "parse_split_block", "Invalid or truncated block!");
+        return 0;
+    }
+    block->literal_count = get_u32(data);
+    block->sequence_count = get_u32(data + 4);
+    block->runs_size = get_u32(data + 8);
+    block->offsets_size = get_u32(data + 12);
+    block->literals = data + SPLIT_HEADER_SIZE;
+    block->runs = block->literals + block->literal_count;
+    block->lengths = block->runs + block->runs_size;
+    block->offsets = block->lengths + block->sequence_count;
+    return 1;
+}
+
+ssize_t join_tokens(const SplitBlock* block, unsigned char* tokens) {
+    if (block == NULL || tokens == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "join_tokens", "Required parameters are NULL!");
+        return -1;
+    }
+    const unsigned char* literal = block->literals;
+    const unsigned char* literal_end = literal + block->literal_count;
+    const unsigned char* run = block->runs;
+    const unsigned char* run_end = run + block->runs_size;
+    const unsigned char* offset = block->offsets;
+    const unsigned char* offset_end = offset + block->offsets_size;
+    unsigned char* token = tokens;
+    for (size_t s = 0; s <= block->sequence_count; s++) {
+        // The literals after the last match end the block
+        size_t count = literal_end - literal;
+        if (s < block->sequence_count && (!read_run(&run, run_end, &count) || count > (size_t) (literal_end - literal))) {
+            set_error(LZ7_ERROR_FORMAT, "join_tokens", "Invalid literal run in sequence %zu!", s);
+            return -1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            token[0] = 0;
+            token[1] = 0;
+            token[2] = *literal++;
+            token += TOKEN_SIZE;
+        }
+        if (s == block->sequence_count) {
+            break;
+        }
+
+        unsigned char length = block->lengths[s];
+        size_t size = length == 0 ? LONG_MATCH_TOKEN_SIZE - TOKEN_SIZE : 2;
+        if ((size_t) (offset_end - offset) < size) {
+            set_error(LZ7_ERROR_FORMAT, "join_tokens", "Truncated offset stream in sequence %zu!", s);
+            return -1;
+        }
+        if (length > 0 && offset[0] == 0 && offset[1] == 0) {
+            set_error(LZ7_ERROR_FORMAT, "join_tokens", "Match offset 0 in sequence %zu!", s);
+            return -1;
+        }
+        if (length == 0) {
+            token[0] = TOKEN_LONG_MATCH;
+            token[1] = LONG_MATCH_TOKEN_SIZE / TOKEN_SIZE - 1;
+            token[2] = 0;
+            memcpy(token + TOKEN_SIZE, offset, size);
+            token += LONG_MATCH_TOKEN_SIZE;
+        } else {
+            token[0] = offset[0];
+            token[1] = offset[1];
+            token[2] = length;
+            token += TOKEN_SIZE;
+        }
+        offset += size;
+    }
+    if (run != run_end || offset != offset_end) {
+        set_error(LZ7_ERROR_FORMAT, "join_tokens", "Unused bytes at the end of the block streams!");
+        return -1;
+    }
+    return token - tokens;
+}
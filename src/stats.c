@@ -0,0 +1,496 @@
+#include "../include/stats.h"
+#include "../include/buffer.h"
+#include "../include/constants.h"
+#include "../include/filter.h"
+#include "../include/frame.h"
+#include "../include/lz77.h"
+#include "../include/split.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STATS_READ_SIZE (64 * KB)
+// Offsets 1..MAX_OFFSET, bucket b holds [2^b, 2^(b + 1))
+#define OFFSET_BUCKETS 16
+#define LENGTH_BUCKETS 9
+
+static const size_t length_bounds[LENGTH_BUCKETS] = { 2, 3, 4, 8, 16, 32, 64, 128, MAX_MATCH_LENGTH };
+
+typedef struct {
+    size_t content;         // Content bytes
+    size_t tokens;
+    size_t size;            // Token stream bytes
+} BlockStats;
+
+typedef struct {
+    size_t tokens;
+    size_t literals;
+    size_t matches;
+    size_t match_bytes;
+    size_t rep_matches;     // Matches at a repeat offset (part of matches)
+    size_t rep_match_bytes;
+    size_t reps[REP_OFFSETS];
+    size_t long_matches;    // Extended tokens, further back than the window
+    size_t long_match_bytes;
+    size_t holes;           // Zeros of a sparse file, not in the stream
+    size_t hole_bytes;
+    size_t content;
+    size_t anomalies;       // Offsets behind the start of the content
+    size_t literal_hist[256];
+    size_t length_hist[MAX_MATCH_LENGTH + 1];
+    size_t offset_hist[OFFSET_BUCKETS];
+    size_t offset_bytes[OFFSET_BUCKETS];
+    BlockStats* blocks;
+    size_t block_count;
+    size_t block_capacity;
+    size_t block_size;
+} TokenStats;
+
+static int offset_bucket(size_t offset) {
+    int bucket = 0;
+    while (offset >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+// Order-0 entropy in bits per symbol
+static double entropy(const size_t* hist, size_t symbols, size_t total) {
+    double bits = 0;
+    for (size_t i = 0; i < symbols && total > 0; i++) {
+        if (hist[i] > 0) {
+            double p = (double) hist[i] / total;
+            bits -= p * log2(p);
+        }
+    }
+    return bits;
+}
+
+static double percent(size_t part, size_t total) {
+    return total > 0 ? 100.0 * part / total : 0;
+}
+
+static BlockStats* current_block(TokenStats* stats) {
+    size_t block = stats->content / stats->block_size;
+    if (block >= stats->block_count) {
+        if (block >= stats->block_capacity) {
+            size_t capacity = stats->block_capacity > 0 ? stats->block_capacity * 2 : STATS_MAX_BLOCKS;
+            while (capacity <= block) {
+                capacity *= 2;
+            }
+            BlockStats* blocks = realloc(stats->blocks, capacity * sizeof(BlockStats));
+            if (blocks == NULL) {
+                return NULL;
+            }
+            stats->blocks = blocks;
+            stats->block_capacity = capacity;
+        }
+        memset(stats->blocks + stats->block_count, 0, (block + 1 - stats->block_count) * sizeof(BlockStats));
+        stats->block_count = block + 1;
+    }
+    return &stats->blocks[block];
+}
+
+// Repeat matches count as matches at their offset, longer ones in the top length bucket
+static int add_token(TokenStats* stats, size_t offset, size_t length, unsigned char literal, int rep) {
+    BlockStats* block = current_block(stats);
+    if (block == NULL) {
+        return 0;
+    }
+    block->tokens++;
+    block->content += length;
+    block->size += TOKEN_SIZE;
+
+    stats->tokens++;
+    if (offset == 0) {
+        stats->literals++;
+        stats->literal_hist[literal]++;
+    } else {
+        if (offset > stats->content || length < MIN_MATCH_LENGTH) {
+            stats->anomalies++;
+        }
+        int bucket = offset_bucket(offset < MAX_OFFSET ? offset : MAX_OFFSET);
+        stats->matches++;
+        stats->match_bytes += length;
+        stats->rep_matches += rep;
+        stats->rep_match_bytes += rep ? length : 0;
+        stats->length_hist[length < MAX_MATCH_LENGTH ? length : MAX_MATCH_LENGTH]++;
+        stats->offset_hist[bucket]++;
+        stats->offset_bytes[bucket] += length;
+    }
+    stats->content += length;
+    return 1;
+}
+
+// Long matches count in the block they start in
+static int add_long_match(TokenStats* stats, size_t offset, size_t length) {
+    BlockStats* block = current_block(stats);
+    if (block == NULL) {
+        return 0;
+    }
+    block->tokens++;
+    block->content += length;
+    block->size += LONG_MATCH_TOKEN_SIZE;
+
+    if (offset == 0 || offset > stats->content) {
+        stats->anomalies++;
+    }
+    stats->tokens++;
+    stats->long_matches++;
+    stats->long_match_bytes += length;
+    stats->content += length;
+    return 1;
+}
+
+// Holes count in the block they start in
+static int add_hole(TokenStats* stats, size_t length) {
+    BlockStats* block = current_block(stats);
+    if (block == NULL) {
+        return 0;
+    }
+    block->tokens++;
+    block->content += length;
+    block->size += HOLE_TOKEN_SIZE;
+
+    stats->tokens++;
+    stats->holes++;
+    stats->hole_bytes += length;
+    stats->content += length;
+    return 1;
+}
+
+static void print_report(FILE* report, const TokenStats* stats, const char* name, size_t file_size,
+                         size_t stream_size, size_t window_size, int framed) {
+    fprintf(report, "\n%s: %zu bytes (%s)\n", name, file_size, framed ? "framed" : "legacy, no header");
+    fprintf(report, "  Content:        %zu bytes, ratio %.2f%%\n", stats->content, percent(file_size, stats->content));
+    fprintf(report, "  Tokens:         %zu (%zu bytes)\n", stats->tokens, stream_size);
+    fprintf(report, "  Literals:       %zu (%.2f%% of tokens, %.2f%% of content)\n", stats->literals,
+            percent(stats->literals, stats->tokens), percent(stats->literals, stats->content));
+    fprintf(report, "  Matches:        %zu (%.2f%% of tokens, %.2f%% of content, %.2f bytes on average)\n",
+            stats->matches, percent(stats->matches, stats->tokens), percent(stats->match_bytes, stats->content),
+            stats->matches > 0 ? (double) stats->match_bytes / stats->matches : 0);
+    if (stats->rep_matches > 0) {
+        fprintf(report, "  Repeat matches: %zu (%.2f%% of matches, %.2f%% of content, %.2f bytes on average)\n",
+                stats->rep_matches, percent(stats->rep_matches, stats->matches),
+                percent(stats->rep_match_bytes, stats->content), (double) stats->rep_match_bytes / stats->rep_matches);
+    }
+    if (stats->long_matches > 0) {
+        fprintf(report, "  Long matches:   %zu (%.2f%% of content, %.2f bytes on average)\n", stats->long_matches,
+                percent(stats->long_match_bytes, stats->content), (double) stats->long_match_bytes / stats->long_matches);
+    }
+    if (stats->holes > 0) {
+        fprintf(report, "  Holes:          %zu (%.2f%% of content, %.2f bytes on average)\n", stats->holes,
+                percent(stats->hole_bytes, stats->content), (double) stats->hole_bytes / stats->holes);
+    }
+    if (stats->anomalies > 0) {
+        fprintf(report, "  Invalid tokens: %zu (the stream is corrupted)\n", stats->anomalies);
+    }
+
+    fprintf(report, "\n  Match lengths       count  %% matches\n");
+    size_t low = MIN_MATCH_LENGTH;
+    for (int b = 0; b < LENGTH_BUCKETS; b++) {
+        size_t count = 0;
+        for (size_t length = low; length <= length_bounds[b]; length++) {
+            count += stats->length_hist[length];
+        }
+        char range[48];
+        if (b == LENGTH_BUCKETS - 1) {
+            snprintf(range, sizeof(range), "%zu+", low);
+        } else {
+            snprintf(range, sizeof(range), low == length_bounds[b] ? "%zu" : "%zu-%zu", low, length_bounds[b]);
+        }
+        fprintf(report, "  %-12s %12zu  %8.2f%%\n", range, count, percent(count, stats->matches));
+        low = length_bounds[b] + 1;
+    }
+
+    fprintf(report, "\n  Match offsets       count  %% matches  %% match bytes\n");
+    int last_bucket = offset_bucket(window_size < MAX_OFFSET ? window_size : MAX_OFFSET);
+    for (int b = 0; b <= last_bucket; b++) {
+        char range[16];
+        snprintf(range, sizeof(range), b == 0 ? "%zu" : "%zu-%zu", (size_t) 1 << b, ((size_t) 2 << b) - 1);
+        fprintf(report, "  %-12s %12zu  %8.2f%%  %12.2f%%\n", range, stats->offset_hist[b],
+                percent(stats->offset_hist[b], stats->matches), percent(stats->offset_bytes[b], stats->match_bytes));
+    }
+
+    fprintf(report, "\n  Block (content)           content       tokens   ratio\n");
+    for (size_t i = 0; i < stats->block_count; i++) {
+        const BlockStats* block = &stats->blocks[i];
+        fprintf(report, "  %-14zu %18zu %12zu %7.2f%%\n", i * stats->block_size, block->content, block->tokens,
+                percent(block->size, block->content));
+    }
+
+    // Entropy stage: literal/match flag, then order-0 codes for literals,
+    // lengths and offset buckets (plus the raw low bits of the offset)
+    double flag_bits = 0;
+    if (stats->tokens > 0) {
+        size_t flags[2] = { stats->literals, stats->matches };
+        flag_bits = stats->tokens * entropy(flags, 2, stats->tokens);
+    }
+    double literal_bits = stats->literals * entropy(stats->literal_hist, 256, stats->literals);
+    double length_bits = stats->matches * entropy(stats->length_hist, MAX_MATCH_LENGTH + 1, stats->matches);
+    double offset_bits = stats->matches * entropy(stats->offset_hist, OFFSET_BUCKETS, stats->matches);
+    for (int b = 0; b < OFFSET_BUCKETS; b++) {
+        offset_bits += (double) stats->offset_hist[b] * b;
+    }
+    double entropy_size = (flag_bits + literal_bits + length_bits + offset_bits) / 8;
+    fprintf(report, "\n  Entropy stage:  ~%.0f bytes (%.2f%% of the token stream, ratio %.2f%%)\n", entropy_size,
+            stream_size > 0 ? 100.0 * entropy_size / stream_size : 0,
+            stats->content > 0 ? 100.0 * entropy_size / stats->content : 0);
+    fprintf(report, "                  literals %.2f, lengths %.2f, offsets %.2f bits per token\n",
+            stats->literals > 0 ? literal_bits / stats->literals : 0,
+            stats->matches > 0 ? length_bits / stats->matches : 0,
+            stats->matches > 0 ? offset_bits / stats->matches : 0);
+
+    // Larger window: extrapolate the match bytes of the last octave of the
+    // window into the next one. Only the part of them that is coded as
+    // literals today gets shorter (many literal tokens become one match).
+    int top = offset_bucket(window_size > 1 ? window_size - 1 : 1);
+    size_t top_bytes = stats->offset_bytes[top];
+    size_t prev_bytes = top > 0 ? stats->offset_bytes[top - 1] : 0;
+    double growth = prev_bytes > 0 ? (double) top_bytes / prev_bytes : 0;
+    growth = growth < 1 ? growth : 1;
+    double extra_bytes = top_bytes * growth;
+    double literal_share = stats->content > 0 ? (double) stats->literals / stats->content : 0;
+    double average = stats->offset_hist[top] > 0 ? (double) top_bytes / stats->offset_hist[top] : 1;
+    double saved = extra_bytes * literal_share * (1 - 1 / average) * TOKEN_SIZE;
+    fprintf(report, "\n  Window:         %zu bytes, %.2f%% of the match bytes come from its last octave\n", window_size,
+            percent(top_bytes, stats->match_bytes));
+    fprintf(report, "  Window x2:      ~%.0f bytes smaller (%.2f%%, extrapolated from the offset histogram)\n",
+            saved, stream_size > 0 ? 100.0 * saved / stream_size : 0);
+    if (window_size * 2 > MAX_OFFSET) {
+        fprintf(report, "                  (the token format limits the window to %d bytes)\n", MAX_OFFSET);
+    }
+}
+
+/*
+* Counts the tokens of the buffer, up to a partial extended token
+*
+* returns: If failed (0), On success (1)
+*/
+static int count_tokens(TokenStats* stats, Buffer* buffer) {
+    int result = 1;
+    while (result && end_of_buffer(buffer) >= TOKEN_SIZE) {
+        const unsigned char* token = buffer->data + buffer->pos;
+        size_t offset = token[0] | (token[1] << 8);
+        if (offset > 0 && token[2] == 0) {
+            // Extended token, completed by the next refill
+            size_t size = TOKEN_SIZE * (1 + token[1]);
+            if ((size_t) end_of_buffer(buffer) < size) {
+                break;
+            }
+            size_t long_offset = 0;
+            size_t length = 0;
+            if (token[0] == TOKEN_HOLE && size == HOLE_TOKEN_SIZE) {
+                for (int i = 5; i >= 0; i--) {
+                    length = (length << 8) | token[3 + i];
+                }
+                result = add_hole(stats, length);
+                buffer->pos += size;
+                continue;
+            }
+            if (token[0] == TOKEN_LONG_MATCH && size == LONG_MATCH_TOKEN_SIZE) {
+                for (int i = 4; i >= 0; i--) {
+                    long_offset = (long_offset << 8) | token[3 + i];
+                }
+                for (int i = 3; i >= 0; i--) {
+                    length = (length << 8) | token[8 + i];
+                }
+            }
+            // Unknown opcodes count as invalid (offset 0)
+            result = add_long_match(stats, long_offset, length);
+            buffer->pos += size;
+            continue;
+        }
+        size_t length = offset > 0 ? token[2] : 1;
+        int rep = offset > 0 && length == REP_MATCH_LENGTH;
+        if (rep) {
+            length = offset >> 2;
+            // A repeat of an unset offset counts as invalid (behind the content)
+            offset = stats->reps[offset & (REP_OFFSETS - 1)];
+            offset = offset > 0 ? offset : SIZE_MAX;
+        }
+        if (offset > 0 && offset != SIZE_MAX) {
+            push_rep_offset(stats->reps, offset);
+        }
+        result = add_token(stats, offset, length, token[2], rep);
+        buffer->pos += TOKEN_SIZE;
+    }
+    return result;
+}
+
+/*
+* Reads a stream of split blocks and counts the tokens they are made of
+*
+* returns: Blocks read. If failed (-1)
+*/
+static ssize_t count_split_blocks(TokenStats* stats, FILE* input_file, size_t stream_size) {
+    unsigned char* data = NULL;
+    Buffer tokens = { .data = NULL, .pos = 0, .size = 0, .max_size = 0 };
+    ssize_t blocks = 0;
+    size_t processed = 0;
+    while (processed < stream_size) {
+        unsigned char header[SPLIT_HEADER_SIZE];
+        size_t size = SIZE_MAX;
+        if (stream_size - processed >= SPLIT_HEADER_SIZE
+            && fread(header, sizeof(unsigned char), SPLIT_HEADER_SIZE, input_file) == SPLIT_HEADER_SIZE) {
+            size = split_block_size(header);
+        }
+        unsigned char* grown = size <= stream_size - processed ? realloc(data, size) : NULL;
+        if (grown == NULL) {
+            set_error(LZ7_ERROR_FORMAT, "print_stats", "Invalid or truncated block!");
+            blocks = -1;
+            break;
+        }
+        data = grown;
+        memcpy(data, header, SPLIT_HEADER_SIZE);
+        SplitBlock block;
+        if (fread(data + SPLIT_HEADER_SIZE, sizeof(unsigned char), size - SPLIT_HEADER_SIZE, input_file)
+                < size - SPLIT_HEADER_SIZE || !parse_split_block(data, size, &block)) {
+            set_error(LZ7_ERROR_FORMAT, "print_stats", "Truncated block!");
+            blocks = -1;
+            break;
+        }
+        size_t tokens_size = TOKEN_SIZE * block.literal_count + LONG_MATCH_TOKEN_SIZE * block.sequence_count;
+        if (tokens_size > tokens.max_size) {
+            unsigned char* larger = realloc(tokens.data, tokens_size);
+            if (larger == NULL) {
+                set_error(LZ7_ERROR_MEMORY, "print_stats", "Unable to allocate memory for the block tokens!");
+                blocks = -1;
+                break;
+            }
+            tokens.data = larger;
+            tokens.max_size = tokens_size;
+        }
+        ssize_t joined = join_tokens(&block, tokens.data);
+        if (joined < 0) {
+            blocks = -1;
+            break;
+        }
+        tokens.pos = 0;
+        tokens.size = joined;
+        if (!count_tokens(stats, &tokens)) {
+            set_error(LZ7_ERROR_MEMORY, "print_stats", "Unable to allocate memory for the block statistics!");
+            blocks = -1;
+            break;
+        }
+        processed += size;
+        blocks++;
+    }
+    free(data);
+    free(tokens.data);
+    return blocks;
+}
+
+/*
+* Reports the frame at the current position of the file, which ends at
+* frame_end (SIZE_MAX: the end of the file)
+*/
+static int print_frame_stats(FILE* input_file, const char* name, FILE* report, size_t frame_end) {
+    FrameHeader header;
+    long frame_start = ftell(input_file);
+    int framed = read_frame_header(input_file, &header);
+    if (framed < 0) {
+        return 0;
+    }
+    if (framed && (header.window_size == 0 || header.window_size > MAX_OFFSET)) {
+        set_error(LZ7_ERROR_FORMAT, "print_stats", "Invalid window size in the frame header!");
+        return 0;
+    }
+    size_t window_size = framed ? header.window_size : WINDOW_SIZE;
+    size_t trailer_size = framed && (header.flags & FRAME_FLAG_CHECKSUM) ? FRAME_TRAILER_SIZE : 0;
+    long start_pos = ftell(input_file);
+    size_t file_size = frame_end != SIZE_MAX ? frame_end : get_file_size(input_file);
+    if (file_size < (size_t) start_pos + trailer_size) {
+        set_error(LZ7_ERROR_FORMAT, "print_stats", "Truncated stream!");
+        return 0;
+    }
+    size_t stream_size = file_size - start_pos - trailer_size;
+
+    TokenStats* stats = calloc(1, sizeof(TokenStats));
+    Buffer buffer = { .data = malloc(STATS_READ_SIZE), .pos = 0, .size = 0, .max_size = STATS_READ_SIZE };
+    if (stats == NULL || buffer.data == NULL) {
+        set_error(LZ7_ERROR_MEMORY, "print_stats", "Unable to allocate memory for the statistics!");
+        free(stats);
+        free_buffer(&buffer);
+        return 0;
+    }
+
+    // Keep the per-block table short for large files
+    stats->block_size = STATS_BLOCK_SIZE;
+    if (framed) {
+        while (header.content_size / stats->block_size >= STATS_MAX_BLOCKS) {
+            stats->block_size *= 2;
+        }
+    }
+
+    // Split blocks are read whole and joined back into tokens
+    int split = framed && (header.flags & FRAME_FLAG_SPLIT);
+    ssize_t split_blocks = split ? count_split_blocks(stats, input_file, stream_size) : 0;
+    int result = 1;
+    size_t stream_left = split ? 0 : stream_size;
+    size_t read_bytes = 0;
+    while (result && (read_bytes = refill_buffer(&buffer, input_file, stream_left)) != 0) {
+        stream_left -= read_bytes;
+        result = count_tokens(stats, &buffer);
+    }
+    if (!result) {
+        set_error(LZ7_ERROR_MEMORY, "print_stats", "Unable to allocate memory for the block statistics!");
+    } else if (split_blocks < 0) {
+        result = 0;
+    } else if (end_of_buffer(&buffer) > 0) {
+        set_error(LZ7_ERROR_FORMAT, "print_stats", "Truncated token at the end of the stream!");
+        result = 0;
+    } else {
+        print_report(report, stats, name, file_size - frame_start, stream_size, window_size, framed);
+        if (framed && stats->content != header.content_size) {
+            fprintf(report, "\n  Warning:        tokens cover %zu of %llu content bytes\n",
+                     stats->content, (unsigned long long) header.content_size);
+        }
+        if (framed && header.filter != FILTER_NONE) {
+            fprintf(report, "\n  Prefilter:      %s (stride %u)\n", filter_name(header.filter), header.filter_stride);
+        }
+        if (split) {
+            fprintf(report, "\n  Layout:         split blocks (%zd, literals, lengths and offsets apart)\n", split_blocks);
+        }
+        if (framed && (header.flags & FRAME_FLAG_PRIMED)) {
+            fprintf(report, "\n  Primed:         the window starts with the content of the frames before\n");
+        }
+    }
+
+    free(stats->blocks);
+    free(stats);
+    free_buffer(&buffer);
+    return result;
+}
+
+int print_stats(FILE* input_file, const char* name, FILE* report) {
+    if (input_file == NULL || name == NULL || report == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "print_stats", "Required parameters are NULL!");
+        return 0;
+    }
+
+    FrameIndex index;
+    int indexed = read_frame_index(input_file, &index);
+    if (indexed <= 0) {
+        return indexed == 0 && print_frame_stats(input_file, name, report, SIZE_MAX);
+    }
+
+    // One report per frame of a multi-frame file
+    fprintf(report, "\n%s: %zu frames, %llu content bytes\n", name, index.count,
+            (unsigned long long) index.content_size);
+    int result = 1;
+    for (size_t i = 0; result && i < index.count; i++) {
+        const FrameEntry* entry = &index.entries[i];
+        char frame_name[256];
+        snprintf(frame_name, sizeof(frame_name), "%s (frame %zu of %zu)", name, i + 1, index.count);
+        result = fseek(input_file, entry->offset, SEEK_SET) == 0
+                 && print_frame_stats(input_file, frame_name, report, entry->offset + entry->size);
+    }
+    free_frame_index(&index);
+    return result;
+}
@@ -1,4 +1,5 @@
 #include "../include/utils.h"
+#include "../include/error.h"
 
 #include <stddef.h>
 #include <stdio.h>
@@ -20,7 +21,7 @@ void err(const char* func_name, const char* message) {
 /*
 * Function open_file
 * ------------------
-*  Returns a file pointer
+*  Returns a file pointer (the error is recorded, not printed)
 *
 *  path: File path
 *  mode: fopen modes
@@ -30,7 +31,7 @@ void err(const char* func_name, const char* message) {
 FILE* open_file(const char* path, const char* mode) {
     FILE* file = fopen(path, mode);
     if (file == NULL) {
-        fprintf(stderr, "\n[ERROR]: open_file() {} -> Unable to open '%s'!\n", path);
+        set_error(LZ7_ERROR_IO, "open_file", "Unable to open '%s'!", path);
         return NULL;
     }
     return file;
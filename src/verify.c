@@ -0,0 +1,100 @@
+#include "../include/verify.h"
+#include "../include/compressor.h"
+#include "../include/frame.h"
+#include "../include/parallel.h"
+#include "../include/utils.h"
+#include "../include/error.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    char** paths;
+    int count;
+    int next;                   // Next file to test (guarded by lock)
+    pthread_mutex_t lock;
+    Lz7TestResult* results;
+    Lz7Options options;
+} VerifyJob;
+
+static int verify_file(VerifyJob* job, int index) {
+    FILE* input_file = open_file(job->paths[index], "rb");
+    if (input_file == NULL) {
+        return 0;
+    }
+
+    FrameHeader header;
+    int framed = read_frame_header(input_file, &header);
+    job->results[index].has_checksum = framed > 0 && (header.flags & FRAME_FLAG_CHECKSUM);
+    fseek(input_file, 0, SEEK_SET);
+
+    int result = framed >= 0 && decompress(input_file, NULL, &job->options, NULL);
+    fclose(input_file);
+    return result;
+}
+
+static void* verify_worker(void* arg) {
+    VerifyJob* job = arg;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->count) {
+            return NULL;
+        }
+        // Every file starts with a clean error, its own one is kept with the result
+        Lz7TestResult* result = &job->results[index];
+        clear_error();
+        result->has_checksum = 0;
+        result->ok = verify_file(job, index);
+        snprintf(result->message, sizeof(result->message), "%s",
+                 result->ok ? "" : (last_error() != LZ7_OK ? last_error_message() : "Failed!"));
+    }
+}
+
+int verify_files(char** paths, int count, const Lz7Options* options, Lz7TestResult* results) {
+    if (paths == NULL || count < 1 || options == NULL || results == NULL) {
+        set_error(LZ7_ERROR_PARAMETER, "verify_files", "No files to test!");
+        return -1;
+    }
+
+    int threads = options->threads;
+    if (threads < 1) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int) cpus : 1;
+    }
+    threads = threads < count ? threads : count;
+    threads = threads < PARALLEL_MAX_THREADS ? threads : PARALLEL_MAX_THREADS;
+
+    VerifyJob job = {
+        .paths = paths,
+        .count = count,
+        .next = 0,
+        .results = results,
+        .options = *options,
+    };
+    // Full validation, whatever the caller asked for
+    job.options.checked = 1;
+    pthread_mutex_init(&job.lock, NULL);
+
+    // The calling thread is a worker too
+    pthread_t workers[PARALLEL_MAX_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, verify_worker, &job) == 0) {
+        started++;
+    }
+    verify_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        failed += !results[i].ok;
+    }
+    return failed;
+}
@@ -1,8 +1,12 @@
 
+#include "../include/lz7.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -11,6 +15,18 @@
 #define TEST_FILES_DIR "./test/test_files"
 #define TEST_RESULTS_DIR "./test/test_results"
 
+// Extra compressor flags, every test file is round-tripped with each of them
+static const char *test_modes[] = {
+    "",
+    "-l 9",
+    "-f paeth",
+    "-f up -l 9",
+    "-m 4",
+    "-T 4",
+    "-L",
+};
+#define TEST_MODES (sizeof(test_modes) / sizeof(test_modes[0]))
+
 // Function to create a directory if it doesn't exist
 int create_directory(const char *path) {
     struct stat st;
@@ -60,6 +76,332 @@ int compare_files(const char *file1, const char *file2) {
     return equal;
 }
 
+// Function to copy a file with one byte in the middle flipped
+int corrupt_file(const char *src, const char *dst) {
+    FILE *in = fopen(src, "rb");
+    if (!in) {
+        return -1;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    unsigned char *data = malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, in) != (size_t) size) {
+        free(data);
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+    data[size / 2] ^= 0x5A;
+
+    FILE *out = fopen(dst, "wb");
+    int result = out && fwrite(data, 1, size, out) == (size_t) size ? 0 : -1;
+    if (out) fclose(out);
+    free(data);
+    return result;
+}
+
+// Function to copy a frame with size bytes of its header at offset replaced (little endian)
+int patch_header(const char *src, const char *dst, long offset, int size, unsigned long long value) {
+    FILE *in = fopen(src, "rb");
+    FILE *out = fopen(dst, "wb");
+    int result = in && out ? 0 : -1;
+    int c;
+    for (long pos = 0; result == 0 && (c = fgetc(in)) != EOF; pos++) {
+        if (pos >= offset && pos < offset + size) {
+            c = (value >> (8 * (pos - offset))) & 0xFF;
+        }
+        result = fputc(c, out) == EOF ? -1 : 0;
+    }
+    if (in) fclose(in);
+    if (out) fclose(out);
+    return result;
+}
+
+// Function to write pseudo-random data whose first block repeats further back than any window
+int write_far_repeats(const char *path) {
+    size_t block = 512 * 1024;
+    unsigned char *data = malloc(block);
+    FILE *out = fopen(path, "wb");
+    if (!data || !out) {
+        free(data);
+        if (out) fclose(out);
+        return -1;
+    }
+    srand(7);
+    for (size_t i = 0; i < block; i++) {
+        data[i] = rand() & 0xFF;
+    }
+    // block, 256 kb of noise, block shifted by 13 bytes
+    int result = fwrite(data, 1, block, out) == block ? 0 : -1;
+    for (size_t i = 0; i < block / 2 && result == 0; i++) {
+        result = fputc(rand() & 0xFF, out) == EOF ? -1 : 0;
+    }
+    if (result == 0 && fwrite(data + 13, 1, block - 13, out) != block - 13) {
+        result = -1;
+    }
+    fclose(out);
+    free(data);
+    return result;
+}
+
+// Function to write fixed-width records that differ in a counter and a few fields
+int write_records(const char *path) {
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        return -1;
+    }
+    int result = 0;
+    for (int i = 0; i < 20000 && result == 0; i++) {
+        result = fprintf(out, "%08d;ACME-%03d;%c;0000000000;PENDING ;%05d\n",
+                         i, i % 7, 'A' + i % 3, i * 37 % 100000) < 0 ? -1 : 0;
+    }
+    fclose(out);
+    return result;
+}
+
+// Function to write runs of one byte around the run thresholds (and the repeat match length), between noise
+int write_runs(const char *path) {
+    static const size_t lengths[] = { 1, 2, 63, 64, 65, 255, 256, 257, 258, 4096, 16383, 16384, 16385, 16386, 100000 };
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        return -1;
+    }
+    srand(11);
+    int result = 0;
+    for (size_t i = 0; i < 3 * sizeof(lengths) / sizeof(lengths[0]) && result == 0; i++) {
+        int value = i % 3 == 0 ? 0 : i % 3 == 1 ? 0xFF : rand() & 0xFF;
+        for (size_t n = 0; n < lengths[i / 3] && result == 0; n++) {
+            result = fputc(value, out) == EOF ? -1 : 0;
+        }
+        for (int n = rand() % 40; n > 0 && result == 0; n--) {
+            result = fputc(rand() & 0xFF, out) == EOF ? -1 : 0;
+        }
+    }
+    fclose(out);
+    return result;
+}
+
+// Function to write a sparse file: records and noise at a few offsets, holes before, between and after them
+int write_sparse(const char *path) {
+    static const long offsets[] = { 1 << 20, (1 << 20) + 300000, 5 << 20, 9 << 20 };
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        return -1;
+    }
+    srand(13);
+    int result = 0;
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]) && result == 0; i++) {
+        result = fseek(out, offsets[i], SEEK_SET) == 0 ? 0 : -1;
+        for (int n = 0; n < 20000 && result == 0; n++) {
+            result = fprintf(out, n % 4 ? "block %zu row %d\n" : "%c", i, rand() & 0xFF) < 0 ? -1 : 0;
+        }
+    }
+    result = result == 0 && fflush(out) == 0 && ftruncate(fileno(out), 16 << 20) == 0 ? 0 : -1;
+    fclose(out);
+    return result;
+}
+
+long allocated_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long) st.st_blocks * 512 : -1;
+}
+
+long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+// Library round trip on one thread: own context, temporary files, progress counted
+typedef struct {
+    const char *path;
+    int level;
+    int progress_calls;
+    int ok;
+} LibraryJob;
+
+int count_progress(void *user_data, uint64_t done, uint64_t total) {
+    (void) done;
+    (void) total;
+    ((LibraryJob *) user_data)->progress_calls++;
+    return 0;
+}
+
+int cancel_progress(void *user_data, uint64_t done, uint64_t total) {
+    (void) user_data;
+    (void) total;
+    return done > 0;
+}
+
+// Records the most blocks the output had while it was decoded
+typedef struct {
+    int fd;
+    long peak;
+} AllocationWatch;
+
+int watch_allocation(void *user_data, uint64_t done, uint64_t total) {
+    AllocationWatch *watch = user_data;
+    struct stat st;
+    (void) done;
+    (void) total;
+    if (fstat(watch->fd, &st) == 0 && (long) st.st_blocks * 512 > watch->peak) {
+        watch->peak = (long) st.st_blocks * 512;
+    }
+    return 0;
+}
+
+void *library_round_trip(void *arg) {
+    LibraryJob *job = arg;
+    Lz7Options options;
+    lz7_default_options(&options);
+    options.level = job->level;
+    Lz7Context context;
+    lz7_init(&context, &options);
+    lz7_set_progress(&context, count_progress, job, 4096);
+
+    FILE *input = fopen(job->path, "rb");
+    FILE *compressed = tmpfile();
+    FILE *output = tmpfile();
+    job->ok = input && compressed && output
+           && lz7_compress_file(&context, input, compressed) == LZ7_OK;
+    rewind(compressed);
+    job->ok = job->ok && lz7_decompress_file(&context, compressed, output) == LZ7_OK;
+    rewind(input);
+    rewind(output);
+    int c1 = 0, c2 = 0;
+    while (job->ok && (c1 = fgetc(input)) != EOF && (c2 = fgetc(output)) != EOF) {
+        job->ok = c1 == c2;
+    }
+    job->ok = job->ok && c1 == EOF && fgetc(output) == EOF;
+    if (input) fclose(input);
+    if (compressed) fclose(compressed);
+    if (output) fclose(output);
+    return NULL;
+}
+
+// Function to read a whole file into a new buffer, placed after margin free bytes
+unsigned char *load_file(const char *path, size_t margin, size_t *size) {
+    long length = file_size(path);
+    FILE *in = fopen(path, "rb");
+    unsigned char *data = length >= 0 ? malloc(margin + length + 1) : NULL;
+    if (!in || !data || fread(data + margin, 1, length, in) != (size_t) length) {
+        free(data);
+        data = NULL;
+    }
+    if (in) fclose(in);
+    *size = length;
+    return data;
+}
+
+// Function to decompress a file from memory, into a second buffer and in place, and compare both
+// (split frames get the largest in-place buffer, their literals are read ahead of the matches)
+int memory_round_trip(const char *original_path, const char *compressed_path, int split) {
+    size_t original_size, compressed_size;
+    unsigned char *original = load_file(original_path, 0, &original_size);
+    unsigned char *compressed = load_file(compressed_path, 0, &compressed_size);
+    Lz7Context context;
+    lz7_init(&context, NULL);
+    uint64_t content_size = 0;
+    int ok = original && compressed
+          && lz7_content_size(&context, compressed, compressed_size, &content_size) == LZ7_OK
+          && content_size == original_size;
+
+    size_t produced = 0;
+    unsigned char *output = ok ? malloc(content_size + 1) : NULL;
+    ok = ok && output && lz7_decompress_buffer(&context, compressed, compressed_size, output, content_size, &produced) == LZ7_OK
+            && produced == original_size && memcmp(output, original, original_size) == 0;
+    free(output);
+
+    size_t buffer_size = split ? content_size + compressed_size : LZ7_IN_PLACE_SIZE(content_size, compressed_size);
+    unsigned char *buffer = ok ? load_file(compressed_path, buffer_size - compressed_size, &compressed_size) : NULL;
+    produced = 0;
+    ok = ok && buffer && lz7_decompress_in_place(&context, buffer, buffer_size, compressed_size, &produced) == LZ7_OK
+            && produced == original_size && memcmp(buffer, original, original_size) == 0;
+    free(buffer);
+
+    // Without any margin the output runs into the unread input (the trailer at least) and must stop
+    if (!ok || content_size <= compressed_size) {
+        free(original);
+        free(compressed);
+        return ok;
+    }
+    buffer = load_file(compressed_path, content_size - compressed_size, &compressed_size);
+    ok = buffer && lz7_decompress_in_place(&context, buffer, content_size, compressed_size, NULL) == LZ7_ERROR_PARAMETER;
+    free(buffer);
+    free(original);
+    free(compressed);
+    return ok;
+}
+
+// Daemon thread of the DAEMON section, stopped by a shutdown request
+typedef struct {
+    const char *socket_path;
+    volatile sig_atomic_t stop;
+    int result;
+} DaemonJob;
+
+// Function to decompress a file through the library after prefix bytes of the output, and check both
+int prefixed_round_trip(const char *compressed_path, const char *original_path, size_t prefix) {
+    Lz7Context context;
+    lz7_init(&context, NULL);
+    FILE *input = fopen(compressed_path, "rb");
+    FILE *output = fopen(TEST_RESULTS_DIR "/prefixed.out", "w+b");
+    int ok = input && output;
+    for (size_t i = 0; ok && i < prefix; i++) {
+        ok = fputc('p', output) != EOF;
+    }
+    ok = ok && lz7_decompress_file(&context, input, output) == LZ7_OK
+            && ftell(output) == (long) prefix + file_size(original_path);
+    if (input) fclose(input);
+    if (output) fclose(output);
+
+    size_t size = 0, original_size = 0;
+    unsigned char *data = ok ? load_file(TEST_RESULTS_DIR "/prefixed.out", 0, &size) : NULL;
+    unsigned char *original = ok ? load_file(original_path, 0, &original_size) : NULL;
+    ok = data && original && size == prefix + original_size && memcmp(data + prefix, original, original_size) == 0;
+    for (size_t i = 0; ok && i < prefix; i++) {
+        ok = data[i] == 'p';
+    }
+    free(data);
+    free(original);
+    return ok;
+}
+
+void *daemon_thread(void *arg) {
+    DaemonJob *job = arg;
+    Lz7Options options;
+    lz7_default_options(&options);
+    options.threads = 2;
+    Lz7Context context;
+    lz7_init(&context, &options);
+    job->result = lz7_serve(&context, job->socket_path, &job->stop);
+    return NULL;
+}
+
+// Function to compress and decompress a file through the daemon, comparing the result
+int remote_round_trip(const char *socket_path, const char *path, int inline_payload) {
+    Lz7Context context;
+    lz7_init(&context, NULL);
+    FILE *input = fopen(path, "rb");
+    FILE *compressed = tmpfile();
+    FILE *output = tmpfile();
+    int ok = input && compressed && output
+          && lz7_remote(&context, socket_path, LZ7_REMOTE_COMPRESS, input, compressed, inline_payload) == LZ7_OK;
+    rewind(compressed);
+    ok = ok && lz7_remote(&context, socket_path, LZ7_REMOTE_DECOMPRESS, compressed, output, inline_payload) == LZ7_OK;
+    rewind(input);
+    rewind(output);
+    int c1 = 0, c2 = 0;
+    while (ok && (c1 = fgetc(input)) != EOF && (c2 = fgetc(output)) != EOF) {
+        ok = c1 == c2;
+    }
+    ok = ok && c1 == EOF && fgetc(output) == EOF;
+    if (input) fclose(input);
+    if (compressed) fclose(compressed);
+    if (output) fclose(output);
+    return ok;
+}
+
 int main() {
     // Compile the main program
     if (run_command("make all") != 0) {
@@ -80,7 +422,9 @@ int main() {
     }
 
     struct dirent *entry;
+    char last_compressed[MAX_PATH] = {0};
     int test_number = 1;
+    int failed = 0;
 
     // Process each file in test_files
     while ((entry = readdir(dir)) != NULL) {
@@ -99,9 +443,7 @@ int main() {
 
         snprintf(input_path, MAX_PATH, "%s/%s", TEST_FILES_DIR, entry->d_name);
         snprintf(test_dir, MAX_PATH, "%s/test_%d", TEST_RESULTS_DIR, test_number);
-        snprintf(compressed_path, MAX_PATH, "%s/%s.lz7", test_dir, entry->d_name);
         snprintf(adv_compressed_path, MAX_PATH, "%s/a_%s.lz7", test_dir, entry->d_name);
-        snprintf(decompressed_path, MAX_PATH, "%s/%s", test_dir, entry->d_name);
         snprintf(adv_decompressed_path, MAX_PATH, "%s/a_%s", test_dir, entry->d_name);
 
         // Create test-specific directory
@@ -110,40 +452,528 @@ int main() {
             return 1;
         }
 
-        printf("\n--------------------------|TEST %02d|--------------------------\n", test_number);
+        for (size_t mode = 0; mode < TEST_MODES; mode++) {
+            snprintf(compressed_path, MAX_PATH, "%s/%zu_%s.lz7", test_dir, mode, entry->d_name);
+            snprintf(decompressed_path, MAX_PATH, "%s/%zu_%s", test_dir, mode, entry->d_name);
+
+            printf("\n--------------------------|TEST %02d|--------------------------\n", test_number);
+            printf("Flags: '%s'\n", test_modes[mode]);
+
+            // Run compression
+            char cmd[MAX_PATH * 2];
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s -o %s %s", input_path, compressed_path, test_modes[mode]);
+            printf("[TEST 1/4]: Compressing %s\n", entry->d_name);
+            if (run_command(cmd) != 0) {
+                fprintf(stderr, "Compression failed for %s\n", entry->d_name);
+                closedir(dir);
+                return 1;
+            }
+
+            // Test the integrity without writing the output
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -t %s", compressed_path);
+            printf("[TEST 2/4]: Testing %s.lz7\n", entry->d_name);
+            if (run_command(cmd) != 0) {
+                printf("--- [FAILED] - Integrity test failed\n");
+                failed++;
+            }
+
+            // Run decompression
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -d %s -o %s", compressed_path, decompressed_path);
+            printf("[TEST 3/4]: Decompressing %s.lz7\n", entry->d_name);
+            if (run_command(cmd) != 0) {
+                fprintf(stderr, "Decompression failed for %s\n", entry->d_name);
+                closedir(dir);
+                return 1;
+            }
+
+            snprintf(last_compressed, MAX_PATH, "%s", compressed_path);
+
+            // Verify decompressed file matches original
+            printf("[TEST 4/4]: Verifying %s\n", entry->d_name);
+            if (compare_files(input_path, decompressed_path) == 1) {
+                printf("--- [PASSED] - Decompressed file matches original\n");
+            } else {
+                printf("--- [FAILED] - Decompressed file differs from original\n");
+                failed++;
+            }
+        }
 
-        // Run compression
+        test_number++;
+    }
+
+    // The token statistics parse every token of the last file
+    printf("\n--------------------------|STATS|--------------------------\n");
+    if (last_compressed[0] != '\0') {
         char cmd[MAX_PATH * 2];
-        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s -o %s", input_path, compressed_path);
-        printf("[TEST 1/3]: Compressing %s\n", entry->d_name);
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 --stats %s > /dev/null", last_compressed);
         if (run_command(cmd) != 0) {
-            fprintf(stderr, "Compression failed for %s\n", entry->d_name);
-            closedir(dir);
-            return 1;
+            printf("--- [FAILED] - Unable to print the token statistics\n");
+            failed++;
+        } else {
+            printf("--- [PASSED] - Token statistics printed\n");
         }
 
-        // Run decompression
-        snprintf(cmd, sizeof(cmd), "./bin/lz7 -d %s -o %s", compressed_path, decompressed_path);
-        printf("[TEST 2/3]: Decompressing %s.lz7\n", entry->d_name);
-        if (run_command(cmd) != 0) {
-            fprintf(stderr, "Decompression failed for %s\n", entry->d_name);
-            closedir(dir);
-            return 1;
+        // A header window larger than any offset is rejected, not used to index the offset buckets
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 --stats %s/window.lz7 > /dev/null 2>&1", TEST_RESULTS_DIR);
+        if (patch_header(last_compressed, TEST_RESULTS_DIR "/window.lz7", 8, 4, 0x1000000) != 0 || system(cmd) == 0) {
+            printf("--- [FAILED] - Statistics of an oversized window\n");
+            failed++;
+        } else {
+            printf("--- [PASSED] - Oversized window rejected by the statistics\n");
+        }
+    }
+
+    // Repeats further back than the window become long matches
+    printf("\n--------------------------|LONG RANGE|--------------------------\n");
+    {
+        char input_path[MAX_PATH];
+        char compressed_path[MAX_PATH];
+        char decompressed_path[MAX_PATH];
+        snprintf(input_path, MAX_PATH, "%s/far_repeats.bin", TEST_RESULTS_DIR);
+        snprintf(compressed_path, MAX_PATH, "%s/far_repeats.bin.lz7", TEST_RESULTS_DIR);
+        snprintf(decompressed_path, MAX_PATH, "%s/far_repeats.out", TEST_RESULTS_DIR);
+        char cmd[MAX_PATH * 3];
+        int ok = write_far_repeats(input_path) == 0;
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s -o %s -L > /dev/null", input_path, compressed_path);
+        ok = ok && run_command(cmd) == 0;
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -t %s > /dev/null", compressed_path);
+        ok = ok && run_command(cmd) == 0;
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -d %s -o %s > /dev/null", compressed_path, decompressed_path);
+        ok = ok && run_command(cmd) == 0 && compare_files(input_path, decompressed_path) == 1;
+        // Random data takes TOKEN_SIZE bytes per literal, the repeated block one token
+        if (ok && file_size(compressed_path) < 3 * file_size(input_path) * 2 / 3) {
+            printf("--- [PASSED] - Far repeats were matched and restored\n");
+        } else {
+            printf("--- [FAILED] - Long range round trip\n");
+            failed++;
         }
+    }
 
-        // Verify decompressed file matches original
-        printf("[TEST 3/3]: Verifying %s\n", entry->d_name);
-        if (compare_files(input_path, decompressed_path)) {
-            printf("--- [PASSED] - Decompressed file matches original\n");
+    // Fixed-width records reuse the same distances, coded as repeat matches
+    printf("\n--------------------------|REPEAT OFFSETS|--------------------------\n");
+    {
+        char cmd[MAX_PATH * 3];
+        int ok = write_records(TEST_RESULTS_DIR "/records.txt") == 0;
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/records.txt -o %s/records.lz7 > /dev/null && "
+                 "./bin/lz7 -d %s/records.lz7 -o %s/records.out > /dev/null && "
+                 "./bin/lz7 --stats %s/records.lz7 | grep -q 'Repeat matches'",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0
+                && compare_files(TEST_RESULTS_DIR "/records.txt", TEST_RESULTS_DIR "/records.out") == 1;
+        if (ok) {
+            printf("--- [PASSED] - Records were coded with repeat matches and restored (%ld -> %ld bytes)\n",
+                   file_size(TEST_RESULTS_DIR "/records.txt"), file_size(TEST_RESULTS_DIR "/records.lz7"));
         } else {
-            printf("--- [FAILED] - Decompressed file differs from original\n");
+            printf("--- [FAILED] - Repeat offset round trip\n");
+            failed++;
         }
+    }
 
-        test_number++;
+    // Long runs of one byte go out as offset 1 matches with every parser, and decode as fills
+    printf("\n--------------------------|RUNS|--------------------------\n");
+    {
+        static const char *run_modes[] = { "", "-l 9", "-T 4", "-m 4", "--split", "--adaptive", "-L" };
+        char cmd[MAX_PATH * 4];
+        int ok = write_runs(TEST_RESULTS_DIR "/runs.bin") == 0;
+        long largest = 0;
+        for (size_t i = 0; i < sizeof(run_modes) / sizeof(run_modes[0]) && ok; i++) {
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/runs.bin -o %s/runs.lz7 %s > /dev/null && "
+                     "./bin/lz7 -t %s/runs.lz7 > /dev/null && "
+                     "./bin/lz7 -d %s/runs.lz7 -o %s/runs.out > /dev/null",
+                     TEST_RESULTS_DIR, TEST_RESULTS_DIR, run_modes[i], TEST_RESULTS_DIR, TEST_RESULTS_DIR,
+                     TEST_RESULTS_DIR);
+            ok = run_command(cmd) == 0 && compare_files(TEST_RESULTS_DIR "/runs.bin", TEST_RESULTS_DIR "/runs.out") == 1
+              && memory_round_trip(TEST_RESULTS_DIR "/runs.bin", TEST_RESULTS_DIR "/runs.lz7", i == 4);
+            long size = file_size(TEST_RESULTS_DIR "/runs.lz7");
+            largest = size > largest ? size : largest;
+        }
+        // The noise between the runs is most of the output
+        if (ok && largest < file_size(TEST_RESULTS_DIR "/runs.bin") / 50) {
+            printf("--- [PASSED] - Runs round-tripped (largest output: %ld bytes)\n", largest);
+        } else {
+            printf("--- [FAILED] - Run round trip\n");
+            failed++;
+        }
+    }
+
+    // The holes of a sparse file are skipped on both sides, the decoded file has them too
+    printf("\n--------------------------|SPARSE|--------------------------\n");
+    {
+        static const char *sparse_modes[] = { "", "-m 4", "-l 9", "-T 4", "--split" };
+        char cmd[MAX_PATH * 4];
+        int ok = write_sparse(TEST_RESULTS_DIR "/sparse.bin") == 0;
+        int holes = 0;
+        for (size_t i = 0; i < sizeof(sparse_modes) / sizeof(sparse_modes[0]) && ok; i++) {
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/sparse.bin -o %s/sparse.lz7 %s > /dev/null && "
+                     "./bin/lz7 -t %s/sparse.lz7 > /dev/null && "
+                     "./bin/lz7 -d %s/sparse.lz7 -o %s/sparse.out > /dev/null",
+                     TEST_RESULTS_DIR, TEST_RESULTS_DIR, sparse_modes[i], TEST_RESULTS_DIR, TEST_RESULTS_DIR,
+                     TEST_RESULTS_DIR);
+            ok = run_command(cmd) == 0 && compare_files(TEST_RESULTS_DIR "/sparse.bin", TEST_RESULTS_DIR "/sparse.out") == 1
+              && memory_round_trip(TEST_RESULTS_DIR "/sparse.bin", TEST_RESULTS_DIR "/sparse.lz7", i == 4);
+            // Only the streaming encoder records holes, on a file system that has them
+            if (ok && i == 0) {
+                holes = allocated_size(TEST_RESULTS_DIR "/sparse.bin") < file_size(TEST_RESULTS_DIR "/sparse.bin") / 4;
+                ok = prefixed_round_trip(TEST_RESULTS_DIR "/sparse.lz7", TEST_RESULTS_DIR "/sparse.bin", 4097);
+                snprintf(cmd, sizeof(cmd), "./bin/lz7 --stats %s/sparse.lz7 | grep -q 'Holes:'", TEST_RESULTS_DIR);
+                ok = ok && (!holes || (run_command(cmd) == 0
+                    && allocated_size(TEST_RESULTS_DIR "/sparse.out") < file_size(TEST_RESULTS_DIR "/sparse.out") / 4));
+            }
+        }
+        if (ok) {
+            printf("--- [PASSED] - Sparse file round-tripped (%s)\n", holes ? "holes kept" : "no holes on this file system");
+        } else {
+            printf("--- [FAILED] - Sparse file round trip\n");
+            failed++;
+        }
+    }
+
+    // Two versions of a file share all but one chunk in an archive
+    printf("\n--------------------------|ARCHIVE|--------------------------\n");
+    {
+        const char *source = TEST_FILES_DIR "/pic-256.bmp";
+        char cmd[MAX_PATH * 3];
+        snprintf(cmd, sizeof(cmd), "mkdir -p %s/archive_in && cp %s %s/archive_in/a.bmp",
+                 TEST_RESULTS_DIR, source, TEST_RESULTS_DIR);
+        int ok = run_command(cmd) == 0
+              && corrupt_file(source, TEST_RESULTS_DIR "/archive_in/b.bmp") == 0;
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -A %s/single.lz7a %s/archive_in/a.bmp > /dev/null",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0;
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -A %s/versions.lz7a %s/archive_in/a.bmp %s/archive_in/b.bmp > /dev/null",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0;
+        snprintf(cmd, sizeof(cmd), "rm -rf %s/archive_out && ./bin/lz7 -X %s/versions.lz7a -o %s/archive_out > /dev/null",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0;
+        // Paths are stored without the leading "./"
+        ok = ok && compare_files(TEST_RESULTS_DIR "/archive_in/a.bmp",
+                                 TEST_RESULTS_DIR "/archive_out/test/test_results/archive_in/a.bmp") == 1
+                && compare_files(TEST_RESULTS_DIR "/archive_in/b.bmp",
+                                 TEST_RESULTS_DIR "/archive_out/test/test_results/archive_in/b.bmp") == 1;
+        // and without anything up to a ".." component, so that they extract
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -A %s/parent.lz7a %s/archive_in/../archive_in/a.bmp > /dev/null && "
+                 "./bin/lz7 -X %s/parent.lz7a -o %s/archive_out > /dev/null",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0
+                && compare_files(TEST_RESULTS_DIR "/archive_in/a.bmp", TEST_RESULTS_DIR "/archive_out/archive_in/a.bmp") == 1;
+        long single = file_size(TEST_RESULTS_DIR "/single.lz7a");
+        long versions = file_size(TEST_RESULTS_DIR "/versions.lz7a");
+        if (ok && versions < single + single / 4) {
+            printf("--- [PASSED] - Archive deduplicated and restored both versions (%ld -> %ld bytes)\n", single, versions);
+        } else {
+            printf("--- [FAILED] - Archive round trip\n");
+            failed++;
+        }
+    }
+
+    // Independent contexts on concurrent threads, progress, cancellation and error codes
+    printf("\n--------------------------|LIBRARY|--------------------------\n");
+    {
+        LibraryJob jobs[4];
+        pthread_t threads[4];
+        int ok = 1;
+        for (int i = 0; i < 4; i++) {
+            jobs[i] = (LibraryJob) { .path = TEST_FILES_DIR "/pic-256.bmp", .level = i % 2 ? LZ7_LEVEL_MAX : LZ7_LEVEL_FAST };
+            ok = ok && pthread_create(&threads[i], NULL, library_round_trip, &jobs[i]) == 0;
+        }
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+            ok = ok && jobs[i].ok && jobs[i].progress_calls > 1;
+        }
+
+        Lz7Context context;
+        lz7_init(&context, NULL);
+        lz7_set_progress(&context, cancel_progress, NULL, 4096);
+        FILE *input = fopen(TEST_FILES_DIR "/pic-256.bmp", "rb");
+        FILE *output = tmpfile();
+        ok = ok && input && output && lz7_compress_file(&context, input, output) == LZ7_ERROR_CANCELLED;
+        if (input) fclose(input);
+        if (output) fclose(output);
+
+        lz7_set_progress(&context, NULL, NULL, 0);
+        if (last_compressed[0] != '\0' && corrupt_file(last_compressed, TEST_RESULTS_DIR "/corrupted.lz7") == 0) {
+            input = fopen(TEST_RESULTS_DIR "/corrupted.lz7", "rb");
+            ok = ok && input && lz7_decompress_file(&context, input, NULL) < LZ7_OK && context.message[0] != '\0';
+            if (input) fclose(input);
+        }
+        if (ok) {
+            printf("--- [PASSED] - Concurrent contexts round-tripped, cancelled and reported errors\n");
+        } else {
+            printf("--- [FAILED] - Library contexts\n");
+            failed++;
+        }
+    }
+
+    // Frames decoded from memory, into a caller buffer and in place
+    printf("\n--------------------------|IN PLACE|--------------------------\n");
+    {
+        char cmd[MAX_PATH * 3];
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/pic-256.bmp -o %s/memory.lz7 -l 9 > /dev/null",
+                 TEST_FILES_DIR, TEST_RESULTS_DIR);
+        int ok = run_command(cmd) == 0
+              && memory_round_trip(TEST_FILES_DIR "/pic-256.bmp", TEST_RESULTS_DIR "/memory.lz7", 0)
+              && memory_round_trip(TEST_RESULTS_DIR "/far_repeats.bin", TEST_RESULTS_DIR "/far_repeats.bin.lz7", 0);
+        if (ok) {
+            printf("--- [PASSED] - Frames decompressed into a buffer and in place\n");
+        } else {
+            printf("--- [FAILED] - Memory decompression\n");
+            failed++;
+        }
+    }
+
+    // Split blocks: every encoder, the statistics and the memory decoder, smaller than tokens on literals
+    printf("\n--------------------------|SPLIT|--------------------------\n");
+    {
+        static const char *split_modes[] = { "", "-l 9", "-T 4", "-f paeth", "-L" };
+        const char *inputs[] = { TEST_FILES_DIR "/pic-256.bmp", TEST_FILES_DIR "/pic-256.bmp", TEST_FILES_DIR "/pic-256.bmp",
+                                 TEST_FILES_DIR "/pic-256.bmp", TEST_RESULTS_DIR "/far_repeats.bin" };
+        char cmd[MAX_PATH * 4];
+        int ok = 1;
+        for (size_t i = 0; i < sizeof(split_modes) / sizeof(split_modes[0]) && ok; i++) {
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s -o %s/split.lz7 --split %s > /dev/null && "
+                     "./bin/lz7 -t %s/split.lz7 > /dev/null && "
+                     "./bin/lz7 -d %s/split.lz7 -o %s/split.out > /dev/null && "
+                     "./bin/lz7 --stats %s/split.lz7 | grep -q 'Layout: *split blocks'",
+                     inputs[i], TEST_RESULTS_DIR, split_modes[i], TEST_RESULTS_DIR, TEST_RESULTS_DIR,
+                     TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+            ok = run_command(cmd) == 0 && compare_files(inputs[i], TEST_RESULTS_DIR "/split.out") == 1
+              && memory_round_trip(inputs[i], TEST_RESULTS_DIR "/split.lz7", 1);
+        }
+        // Random data is all literals: one byte each instead of a token
+        long split_size = file_size(TEST_RESULTS_DIR "/split.lz7");
+        long token_size = file_size(TEST_RESULTS_DIR "/far_repeats.bin.lz7");
+        if (ok && split_size < token_size / 2) {
+            printf("--- [PASSED] - Split blocks round-tripped (far repeats: %ld -> %ld bytes)\n", token_size, split_size);
+        } else {
+            printf("--- [FAILED] - Split block round trip\n");
+            failed++;
+        }
+    }
+
+    // Only the greedy and the optimal level exist; the optimal parse prices split blocks by their bytes
+    printf("\n--------------------------|LEVELS|--------------------------\n");
+    {
+        char cmd[MAX_PATH * 4];
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/pic-256.bmp -o %s/level.lz7 -l 5 > /dev/null 2>&1",
+                 TEST_FILES_DIR, TEST_RESULTS_DIR);
+        int ok = system(cmd) != 0;
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/pic-1024.bmp -o %s/level.lz7 --split > /dev/null && "
+                 "./bin/lz7 -c %s/pic-1024.bmp -o %s/level-max.lz7 --split -l max > /dev/null && "
+                 "./bin/lz7 -d %s/level-max.lz7 -o %s/level.out > /dev/null",
+                 TEST_FILES_DIR, TEST_RESULTS_DIR, TEST_FILES_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0
+                && compare_files(TEST_FILES_DIR "/pic-1024.bmp", TEST_RESULTS_DIR "/level.out") == 1;
+        long greedy_size = file_size(TEST_RESULTS_DIR "/level.lz7");
+        long optimal_size = file_size(TEST_RESULTS_DIR "/level-max.lz7");
+        if (ok && optimal_size < greedy_size * 55 / 100) {
+            printf("--- [PASSED] - Level 5 rejected, split optimal parse round-tripped (%ld -> %ld bytes)\n",
+                   greedy_size, optimal_size);
+        } else {
+            printf("--- [FAILED] - Compression levels\n");
+            failed++;
+        }
+    }
+
+    // Frames appended to a plain frame, primed or not, and a failed append that must leave the file alone
+    printf("\n--------------------------|APPEND|--------------------------\n");
+    {
+        static const char *append_modes[] = { "", "--prime", "--prime -l 9", "--prime --split" };
+        char cmd[MAX_PATH * 6];
+        snprintf(cmd, sizeof(cmd), "head -c 65536 %s/pic-256.bmp > %s/part1 && "
+                 "tail -c +65537 %s/pic-256.bmp | head -c 65536 > %s/part2 && "
+                 "tail -c +131073 %s/pic-256.bmp > %s/part3",
+                 TEST_FILES_DIR, TEST_RESULTS_DIR, TEST_FILES_DIR, TEST_RESULTS_DIR, TEST_FILES_DIR, TEST_RESULTS_DIR);
+        int ok = run_command(cmd) == 0;
+        for (size_t i = 0; i < sizeof(append_modes) / sizeof(append_modes[0]) && ok; i++) {
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/part1 -o %s/append.lz7 > /dev/null && "
+                     "./bin/lz7 --append %s/part2 %s %s/append.lz7 > /dev/null && "
+                     "./bin/lz7 --append %s/part3 %s %s/append.lz7 > /dev/null && "
+                     "./bin/lz7 -t %s/append.lz7 > /dev/null && "
+                     "./bin/lz7 -d %s/append.lz7 -o %s/append.out > /dev/null && "
+                     "./bin/lz7 --stats %s/append.lz7 | grep -q '3 frames'",
+                     TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, append_modes[i], TEST_RESULTS_DIR,
+                     TEST_RESULTS_DIR, append_modes[i], TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR,
+                     TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+            ok = run_command(cmd) == 0 && compare_files(TEST_FILES_DIR "/pic-256.bmp", TEST_RESULTS_DIR "/append.out") == 1
+              && memory_round_trip(TEST_FILES_DIR "/pic-256.bmp", TEST_RESULTS_DIR "/append.lz7", 1);
+        }
+        // Long range matching can't be primed: the append fails before the file is replaced
+        snprintf(cmd, sizeof(cmd), "cp %s/append.lz7 %s/append.keep && "
+                 "! ./bin/lz7 --append %s/part3 --prime -L %s/append.lz7 > /dev/null 2>&1 && "
+                 "cmp -s %s/append.lz7 %s/append.keep && ! ls %s/append.lz7.* > /dev/null 2>&1",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR,
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0;
+        // Concurrent appends wait for each other instead of dropping a frame
+        snprintf(cmd, sizeof(cmd), "cp %s/append.lz7 %s/concurrent.lz7 || exit 1; "
+                 "./bin/lz7 --append %s/part2 %s/concurrent.lz7 > /dev/null & first=$!; "
+                 "./bin/lz7 --append %s/part3 %s/concurrent.lz7 > /dev/null & second=$!; "
+                 "wait $first && wait $second && ./bin/lz7 --stats %s/concurrent.lz7 | grep -q '5 frames'",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR,
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0;
+        if (ok) {
+            printf("--- [PASSED] - Appended frames round-tripped, a failed append left the file untouched\n");
+        } else {
+            printf("--- [FAILED] - Append\n");
+            failed++;
+        }
+    }
+
+    // Adaptive effort: a low target ends at the optimal parse, an unreachable one at the fastest step
+    printf("\n--------------------------|ADAPTIVE|--------------------------\n");
+    {
+        static const char *adaptive_modes[] = { "--target-mbps 100000", "--target-mbps 1", "--adaptive",
+                                                "--adaptive -l 9 --split", "--adaptive -f none" };
+        char cmd[MAX_PATH * 4];
+        int ok = 1;
+        long sizes[2] = { 0, 0 };
+        for (size_t i = 0; i < sizeof(adaptive_modes) / sizeof(adaptive_modes[0]) && ok; i++) {
+            snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/pic-1024.bmp -o %s/adaptive.lz7 %s > /dev/null && "
+                     "./bin/lz7 -t %s/adaptive.lz7 > /dev/null && "
+                     "./bin/lz7 -d %s/adaptive.lz7 -o %s/adaptive.out > /dev/null",
+                     TEST_FILES_DIR, TEST_RESULTS_DIR, adaptive_modes[i], TEST_RESULTS_DIR, TEST_RESULTS_DIR,
+                     TEST_RESULTS_DIR);
+            ok = run_command(cmd) == 0 && compare_files(TEST_FILES_DIR "/pic-1024.bmp", TEST_RESULTS_DIR "/adaptive.out") == 1
+              && memory_round_trip(TEST_FILES_DIR "/pic-1024.bmp", TEST_RESULTS_DIR "/adaptive.lz7", 1);
+            if (i < 2) {
+                sizes[i] = file_size(TEST_RESULTS_DIR "/adaptive.lz7");
+            }
+        }
+        // One thread parses the blocks, long matches need the streaming encoder
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/pic-256.bmp -o %s/adaptive.lz7 --adaptive -L 2>&1 | grep -q 'Compression failed'",
+                 TEST_FILES_DIR, TEST_RESULTS_DIR);
+        ok = ok && run_command(cmd) == 0;
+        if (ok && sizes[1] < sizes[0]) {
+            printf("--- [PASSED] - Adaptive blocks round-tripped (fastest: %ld bytes, hardest: %ld bytes)\n", sizes[0], sizes[1]);
+        } else {
+            printf("--- [FAILED] - Adaptive compression\n");
+            failed++;
+        }
+    }
+
+    // Regular files decode into a mapping of the output: after a prefix, with long matches,
+    // primed frames, a write-only output (streamed), a broken frame (the output is cut back)
+    // and a lying content size (not allocated)
+    printf("\n--------------------------|MAPPED|--------------------------\n");
+    {
+        char cmd[MAX_PATH * 4];
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/pic-1024.bmp -o %s/mapped.lz7 > /dev/null && "
+                 "./bin/lz7 -c %s/far_repeats.bin -o %s/mapped-far.lz7 -L > /dev/null",
+                 TEST_FILES_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR);
+        int ok = run_command(cmd) == 0
+              && prefixed_round_trip(TEST_RESULTS_DIR "/mapped.lz7", TEST_FILES_DIR "/pic-1024.bmp", 0)
+              && prefixed_round_trip(TEST_RESULTS_DIR "/mapped.lz7", TEST_FILES_DIR "/pic-1024.bmp", 5000)
+              && prefixed_round_trip(TEST_RESULTS_DIR "/mapped-far.lz7", TEST_RESULTS_DIR "/far_repeats.bin", 0)
+              && prefixed_round_trip(TEST_RESULTS_DIR "/append.lz7", TEST_FILES_DIR "/pic-256.bmp", 123);
+
+        Lz7Context context;
+        lz7_init(&context, NULL);
+        FILE *input = fopen(TEST_RESULTS_DIR "/mapped.lz7", "rb");
+        FILE *output = fopen(TEST_RESULTS_DIR "/mapped.out", "wb");
+        ok = ok && input && output && lz7_decompress_file(&context, input, output) == LZ7_OK;
+        if (input) fclose(input);
+        if (output) fclose(output);
+        ok = ok && compare_files(TEST_FILES_DIR "/pic-1024.bmp", TEST_RESULTS_DIR "/mapped.out") == 1;
+
+        // A wrong checksum fails after the whole output was written
+        snprintf(cmd, sizeof(cmd), "cp %s/mapped.lz7 %s/mapped-bad.lz7 && "
+                 "printf 'X' | dd of=%s/mapped-bad.lz7 bs=1 seek=%ld conv=notrunc 2> /dev/null",
+                 TEST_RESULTS_DIR, TEST_RESULTS_DIR, TEST_RESULTS_DIR, file_size(TEST_RESULTS_DIR "/mapped.lz7") - 1);
+        input = ok && run_command(cmd) == 0 ? fopen(TEST_RESULTS_DIR "/mapped-bad.lz7", "rb") : NULL;
+        output = fopen(TEST_RESULTS_DIR "/mapped.out", "w+b");
+        ok = ok && input && output && lz7_decompress_file(&context, input, output) < LZ7_OK;
+        if (input) fclose(input);
+        if (output) fclose(output);
+        ok = ok && file_size(TEST_RESULTS_DIR "/mapped.out") == 0;
+
+        // A header claiming 60 GB reserves one chunk ahead of the decoder, not the whole claim
+        input = ok && patch_header(TEST_RESULTS_DIR "/mapped.lz7", TEST_RESULTS_DIR "/mapped-bad.lz7", 20, 8,
+                                   60ULL << 30) == 0 ? fopen(TEST_RESULTS_DIR "/mapped-bad.lz7", "rb") : NULL;
+        output = fopen(TEST_RESULTS_DIR "/mapped.out", "w+b");
+        AllocationWatch watch = { .fd = output ? fileno(output) : -1, .peak = 0 };
+        lz7_set_progress(&context, watch_allocation, &watch, 4096);
+        ok = ok && input && output && lz7_decompress_file(&context, input, output) < LZ7_OK;
+        lz7_set_progress(&context, NULL, NULL, 0);
+        if (input) fclose(input);
+        if (output) fclose(output);
+        ok = ok && watch.peak > 0 && watch.peak <= (64L << 20) + 4096
+                && allocated_size(TEST_RESULTS_DIR "/mapped.out") == 0;
+        if (ok) {
+            printf("--- [PASSED] - Mapped outputs decoded, a failed decode left an empty file\n");
+        } else {
+            printf("--- [FAILED] - Mapped decompression\n");
+            failed++;
+        }
+    }
+
+    // Requests served by a daemon: descriptors, inline payloads, the CLI client, errors and statistics
+    printf("\n--------------------------|DAEMON|--------------------------\n");
+    {
+        DaemonJob job = { .socket_path = TEST_RESULTS_DIR "/lz7d.sock", .stop = 0, .result = -1 };
+        pthread_t thread;
+        int ok = pthread_create(&thread, NULL, daemon_thread, &job) == 0;
+        // Wait for the socket
+        for (int i = 0; ok && i < 100 && access(job.socket_path, F_OK) != 0; i++) {
+            usleep(20000);
+        }
+        ok = ok && remote_round_trip(job.socket_path, TEST_FILES_DIR "/pic-256.bmp", 0)
+                && remote_round_trip(job.socket_path, TEST_FILES_DIR "/pic-256.bmp", 1)
+                && remote_round_trip(job.socket_path, TEST_RESULTS_DIR "/far_repeats.bin", 0);
+
+        char cmd[MAX_PATH * 4];
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -c %s/pic-64.bmp -o %s/remote.lz7 --server %s --inline > /dev/null"
+                 " && ./bin/lz7 -d %s/remote.lz7 -o %s/remote.bmp --server %s > /dev/null",
+                 TEST_FILES_DIR, TEST_RESULTS_DIR, job.socket_path, TEST_RESULTS_DIR, TEST_RESULTS_DIR, job.socket_path);
+        ok = ok && run_command(cmd) == 0 && compare_files(TEST_FILES_DIR "/pic-64.bmp", TEST_RESULTS_DIR "/remote.bmp") == 1;
+
+        // The daemon reports a broken input back to the client
+        Lz7Context context;
+        lz7_init(&context, NULL);
+        FILE *input = ok && last_compressed[0] != '\0' && corrupt_file(last_compressed, TEST_RESULTS_DIR "/corrupted.lz7") == 0
+                    ? fopen(TEST_RESULTS_DIR "/corrupted.lz7", "rb") : NULL;
+        FILE *output = tmpfile();
+        ok = ok && input && output
+                && lz7_remote(&context, job.socket_path, LZ7_REMOTE_DECOMPRESS, input, output, 1) < LZ7_OK
+                && context.message[0] != '\0';
+        if (input) fclose(input);
+        if (output) fclose(output);
+
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 --server-stats %s | grep -q 'Requests: 4 compress, 4 decompress'",
+                 job.socket_path);
+        ok = ok && run_command(cmd) == 0;
+        if (lz7_remote(&context, job.socket_path, LZ7_REMOTE_SHUTDOWN, NULL, NULL, 0) != LZ7_OK) {
+            job.stop = 1;
+            ok = 0;
+        }
+        pthread_join(thread, NULL);
+        ok = ok && job.result == LZ7_OK && access(job.socket_path, F_OK) != 0;
+        if (ok) {
+            printf("--- [PASSED] - Daemon served descriptor and inline requests, then shut down\n");
+        } else {
+            printf("--- [FAILED] - Daemon requests\n");
+            failed++;
+        }
+    }
+
+    // A corrupted file must fail the integrity test
+    printf("\n--------------------------|CORRUPTION|--------------------------\n");
+    if (last_compressed[0] != '\0') {
+        char corrupted_path[MAX_PATH];
+        snprintf(corrupted_path, MAX_PATH, "%s/corrupted.lz7", TEST_RESULTS_DIR);
+        char cmd[MAX_PATH * 2];
+        snprintf(cmd, sizeof(cmd), "./bin/lz7 -t %s", corrupted_path);
+        if (corrupt_file(last_compressed, corrupted_path) != 0 || system(cmd) == 0) {
+            printf("--- [FAILED] - Corrupted file passed the integrity test\n");
+            failed++;
+        } else {
+            printf("--- [PASSED] - Corrupted file was rejected\n");
+        }
     }
     printf("\n-------------------------------------------------------------\n");
 
     closedir(dir);
-    printf("Testing complete.\n");
-    return 0;
+    printf("Testing complete (%d failed).\n", failed);
+    return failed > 0;
 }